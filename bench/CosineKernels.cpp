@@ -0,0 +1,102 @@
+// CosineKernels.cpp
+//
+// Per-call time of CosineSpace's distance kernel against hnswlib's InnerProductSpace
+// kernel for the embedding sizes we ship, on rows that stay in cache, plus the largest
+// difference of either from a double-precision dot product.
+//
+// Usage: CosineKernels [calls per size]
+
+#include "CosineSpace.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace {
+
+constexpr size_t rows = 64; // 64 x 512 floats: comfortably inside L1 + L2
+
+std::vector<float> unitRows(size_t dim, std::mt19937& rng)
+{
+    std::normal_distribution<float> gauss;
+    std::vector<float> data(rows * dim);
+    for (size_t r = 0; r < rows; ++r) {
+        float* row = data.data() + r * dim;
+        double norm = 0.0;
+        for (size_t i = 0; i < dim; ++i) {
+            row[i] = gauss(rng);
+            norm += double(row[i]) * row[i];
+        }
+        const float inv = float(1.0 / std::sqrt(norm));
+        for (size_t i = 0; i < dim; ++i)
+            row[i] *= inv;
+    }
+    return data;
+}
+
+// Nanoseconds per call of kernel over every pair of rows (i, i + 1), round robin
+double nanosecondsPerCall(hnswlib::DISTFUNC<float> kernel, const void* param, const std::vector<float>& data,
+                          size_t dim, size_t calls)
+{
+    volatile float sink = 0.0f;
+    float sum = 0.0f;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t c = 0; c < calls; ++c) {
+        const size_t r = c % rows;
+        sum += kernel(data.data() + r * dim, data.data() + ((r + 1) % rows) * dim, param);
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    sink = sum;
+    (void)sink;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / double(calls);
+}
+
+double maxError(hnswlib::DISTFUNC<float> kernel, const void* param, const std::vector<float>& data, size_t dim)
+{
+    double worst = 0.0;
+    for (size_t a = 0; a < rows; ++a) {
+        for (size_t b = 0; b < rows; ++b) {
+            double dot = 0.0;
+            for (size_t i = 0; i < dim; ++i)
+                dot += double(data[a * dim + i]) * data[b * dim + i];
+            const double distance = kernel(data.data() + a * dim, data.data() + b * dim, param);
+            worst = std::max(worst, std::fabs((1.0 - dot) - distance));
+        }
+    }
+    return worst;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const size_t calls = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000000;
+    if (calls == 0) {
+        std::fprintf(stderr, "Usage: %s [calls per size]\n", argv[0]);
+        return 2;
+    }
+
+    std::mt19937 rng(7);
+    std::printf("%zu calls per size, ns per call\n", calls);
+    for (size_t dim : {128, 256, 512}) {
+        const std::vector<float> data = unitRows(dim, rng);
+        CosineSpace cosine(dim);
+        hnswlib::InnerProductSpace generic(dim);
+
+        // Warm both up once so the first timing does not pay for page faults
+        nanosecondsPerCall(cosine.get_dist_func(), cosine.get_dist_func_param(), data, dim, calls / 10 + 1);
+        nanosecondsPerCall(generic.get_dist_func(), generic.get_dist_func_param(), data, dim, calls / 10 + 1);
+        const double ours = nanosecondsPerCall(cosine.get_dist_func(), cosine.get_dist_func_param(), data, dim, calls);
+        const double theirs =
+            nanosecondsPerCall(generic.get_dist_func(), generic.get_dist_func_param(), data, dim, calls);
+
+        std::printf("  dim %3zu: hnswlib %6.1f, %-12s %6.1f  (max error %.1e vs %.1e)\n", dim, theirs,
+                    cosine.kernelName(), ours,
+                    maxError(cosine.get_dist_func(), cosine.get_dist_func_param(), data, dim),
+                    maxError(generic.get_dist_func(), generic.get_dist_func_param(), data, dim));
+    }
+    return 0;
+}
@@ -0,0 +1,150 @@
+// DetectorAllocations.cpp
+//
+// Counts heap allocations per frame, once warmed up, on three paths over the same model
+// and frame: FaceDetector::detect(), InferenceContext::run() alone (the run plus
+// fetching the dynamic outputs into their slots), and a bare Session::Run() on an
+// IoBinding. Fails if detect() allocates more than its results vector on top of run().
+//
+// Allocations made inside ONNX Runtime are only counted where its operator new is the
+// executable's (Linux, macOS); on Windows the runtime DLL allocates through its own CRT,
+// so the run() and Run() counts cover our side only.
+//
+// Usage: DetectorAllocations <detector.onnx> [image] [frames]
+
+#include "FaceDetector.hpp"
+#include "ImagePreprocess.hpp"
+#include "InferenceContext.hpp"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::atomic<bool> counting{false};
+std::atomic<size_t> allocations{0};
+
+void* countedAlloc(size_t bytes)
+{
+    if (counting.load(std::memory_order_relaxed))
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(bytes ? bytes : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+// Mean allocations per call of frame, after a few uncounted calls to warm up arenas
+double allocationsPerFrame(const std::function<void()>& frame, int frames)
+{
+    for (int i = 0; i < 5; ++i)
+        frame();
+    allocations = 0;
+    counting = true;
+    for (int i = 0; i < frames; ++i)
+        frame();
+    counting = false;
+    return double(allocations.load()) / frames;
+}
+
+// Mid-grey with a lighter oval, in case no image is given; the counts only need a
+// frame the model accepts, not a face
+QImage syntheticFrame()
+{
+    QImage img(640, 480, QImage::Format_RGB32);
+    for (int y = 0; y < img.height(); ++y) {
+        QRgb* row = reinterpret_cast<QRgb*>(img.scanLine(y));
+        for (int x = 0; x < img.width(); ++x) {
+            const int dx = x - 320, dy = y - 220;
+            const int v = dx * dx * 4 + dy * dy * 3 < 160 * 160 ? 200 : 110;
+            row[x] = qRgb(v, v, v);
+        }
+    }
+    return img;
+}
+
+} // namespace
+
+void* operator new(size_t bytes) { return countedAlloc(bytes); }
+void* operator new[](size_t bytes) { return countedAlloc(bytes); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        std::fprintf(stderr, "Usage: %s <detector.onnx> [image] [frames]\n", argv[0]);
+        return 2;
+    }
+    const std::string modelPath = argv[1];
+    const QImage frame = argc > 2 ? QImage(QString::fromLocal8Bit(argv[2])) : syntheticFrame();
+    const int frames = argc > 3 ? std::atoi(argv[3]) : 200;
+    if (frame.isNull() || frames <= 0) {
+        std::fprintf(stderr, "Could not load the image, or no frames to run\n");
+        return 2;
+    }
+
+    // The detector as the app sets it up (maxDetections, confidence and IoU thresholds)
+    FaceDetector detector(modelPath, 32, 0.6f, 0.3f);
+    size_t faces = 0;
+    const double perDetect = allocationsPerFrame([&] { faces = detector.detect(frame).size(); }, frames);
+
+    // The same bindings on a second session, without the detector around them
+    Ort::Env env(ORT_LOGGING_LEVEL_WARNING, "detector_allocations");
+    Ort::SessionOptions options;
+    options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
+    const std::wstring widePath(modelPath.begin(), modelPath.end());
+    Ort::Session session(env, widePath.c_str(), options);
+    InferenceContext context(session);
+    preprocessPlanar(frame, 128, 128, {1.0f / 255.0f, 0.0f}, context.bindInput<float>(0, {1, 3, 128, 128}));
+    *context.bindInput<float>(1, {1}) = 0.6f;
+    *context.bindInput<int64_t>(2, {1}) = 32;
+    *context.bindInput<float>(3, {1}) = 0.3f;
+    for (size_t i = 0; i < context.outputCount(); ++i)
+        context.bindOutputToCpu(i);
+    const double perContextRun = allocationsPerFrame([&] { context.run(); }, frames);
+
+    // Run() alone on tensors of its own: the outputs stay in the binding and are never fetched
+    Ort::MemoryInfo cpu = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
+    std::vector<float> image(3 * 128 * 128);
+    preprocessPlanar(frame, 128, 128, {1.0f / 255.0f, 0.0f}, image.data());
+    float confidence = 0.6f, iou = 0.3f;
+    int64_t maxDetections = 32;
+    const int64_t imageShape[4] = {1, 3, 128, 128}, scalarShape[1] = {1};
+    std::vector<Ort::Value> inputs;
+    inputs.push_back(Ort::Value::CreateTensor<float>(cpu, image.data(), image.size(), imageShape, 4));
+    inputs.push_back(Ort::Value::CreateTensor<float>(cpu, &confidence, 1, scalarShape, 1));
+    inputs.push_back(Ort::Value::CreateTensor<int64_t>(cpu, &maxDetections, 1, scalarShape, 1));
+    inputs.push_back(Ort::Value::CreateTensor<float>(cpu, &iou, 1, scalarShape, 1));
+    Ort::IoBinding binding(session);
+    std::vector<std::string> outputNames;
+    {
+        Ort::AllocatorWithDefaultOptions allocator;
+        for (size_t i = 0; i < inputs.size(); ++i)
+            binding.BindInput(session.GetInputNameAllocated(i, allocator).get(), inputs[i]);
+        for (size_t i = 0; i < session.GetOutputCount(); ++i)
+            outputNames.push_back(session.GetOutputNameAllocated(i, allocator).get());
+    }
+    const double perBareRun = allocationsPerFrame([&] {
+        for (const std::string& name : outputNames)
+            binding.BindOutput(name.c_str(), cpu);
+        session.Run(Ort::RunOptions{nullptr}, binding);
+    }, frames);
+
+    std::printf("%d frames, %zu face(s) per frame\n", frames, faces);
+    std::printf("  Session::Run() on an IoBinding        %8.1f allocations per frame\n", perBareRun);
+    std::printf("  InferenceContext::run()               %8.1f\n", perContextRun);
+    std::printf("  FaceDetector::detect()                %8.1f\n", perDetect);
+
+    // Everything detect() does around run() may allocate the results vector, once
+    const double detectOwn = perDetect - perContextRun;
+    if (detectOwn > 1.0 + 1e-9) {
+        std::fprintf(stderr, "detect() allocates %.1f times per frame on top of run()\n", detectOwn);
+        return 1;
+    }
+    return 0;
+}
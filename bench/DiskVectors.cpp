@@ -0,0 +1,169 @@
+// DiskVectors.cpp
+//
+// Re-rank reads from a disk-resident EmbeddingStore: each query scores 32 random rows
+// of a synthetic 512-d store, once with every row prefetched before the first is
+// scored (what FaceIndex's re-rank does) and once faulting them in one by one. Prints
+// the load time, the memory the store keeps resident, and p50/p99 query latency.
+//
+// The file is written once and kept; make it larger than RAM to measure reads that the
+// page cache cannot serve. On Linux and macOS the file's cached pages are dropped before
+// each pass; elsewhere only the first pass after writing the file starts cold.
+//
+// Usage: DiskVectors <store file> [rows] [queries]
+
+#include "EmbeddingStore.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr size_t dim = 512;
+constexpr size_t rerank = 32;
+
+// Written here rather than with EmbeddingStore::save(), which would need every row in
+// memory first; the layout is the one documented in EmbeddingStore.hpp
+bool writeStore(const std::string& path, size_t rows)
+{
+    std::ofstream out(path, std::ios::binary);
+    char header[64] = {};
+    const uint32_t version = 1, dim32 = dim, stride = 1;
+    const uint64_t rows64 = rows;
+    std::memcpy(header, "FPEV", 4);
+    std::memcpy(header + 4, &version, 4);
+    std::memcpy(header + 8, &dim32, 4);
+    std::memcpy(header + 12, &stride, 4);
+    std::memcpy(header + 16, &rows64, 8);
+    out.write(header, sizeof(header));
+
+    std::mt19937 rng(1);
+    std::normal_distribution<float> gauss(0.0f, 0.044f); // roughly unit length at 512-d
+    std::vector<float> block(4096 * dim);
+    for (size_t r = 0; r < rows; r += 4096) {
+        const size_t count = std::min<size_t>(4096, rows - r);
+        for (size_t i = 0; i < count * dim; ++i)
+            block[i] = gauss(rng);
+        out.write(reinterpret_cast<const char*>(block.data()), std::streamsize(count * dim * sizeof(float)));
+    }
+    const std::vector<char> present(rows, 1);
+    out.write(present.data(), std::streamsize(rows));
+    return bool(out);
+}
+
+void dropCachedPages(const std::string& path)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+#if defined(__APPLE__)
+    fcntl(fd, F_NOCACHE, 1);
+#else
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+    close(fd);
+#else
+    (void)path;
+#endif
+}
+
+// Resident set size in KiB, or -1 where it is not read (only Linux's /proc is)
+long residentKb()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmRSS:") == 0)
+            return std::stol(line.substr(6));
+    }
+    return -1;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        std::fprintf(stderr, "Usage: %s <store file> [rows] [queries]\n", argv[0]);
+        return 2;
+    }
+    const std::string path = argv[1];
+    const size_t rows = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1000000;
+    const size_t queries = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 3000;
+    if (rows == 0 || queries == 0) {
+        std::fprintf(stderr, "Need at least one row and one query\n");
+        return 2;
+    }
+
+    // An existing file is reused (and checked below); writing 10M rows takes a while
+    if (!std::ifstream(path)) {
+        std::printf("Writing %zu rows to %s\n", rows, path.c_str());
+        if (!writeStore(path, rows)) {
+            std::fprintf(stderr, "Could not write %s\n", path.c_str());
+            return 1;
+        }
+    }
+
+    std::printf("%zu rows of %zu floats, %zu queries of %zu rows\n", rows, dim, queries, rerank);
+    const std::vector<float> query(dim, 0.01f);
+    for (bool prefetch : {true, false}) {
+        dropCachedPages(path);
+        const long before = residentKb();
+        EmbeddingStore store(dim);
+        store.setDiskResident(true);
+        const auto loadStart = std::chrono::steady_clock::now();
+        store.load(path);
+        const double loadMs =
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count();
+        if (store.size() != rows) {
+            std::fprintf(stderr, "%s holds %zu rows, not %zu; delete it to write a new one\n", path.c_str(),
+                         store.size(), rows);
+            return 1;
+        }
+        const long afterLoad = residentKb();
+
+        const EmbeddingStore::Snapshot snapshot = store.snapshot();
+        std::mt19937_64 rng(7);
+        std::vector<double> latencies;
+        latencies.reserve(queries);
+        size_t labels[rerank];
+        double sink = 0.0;
+        for (size_t q = 0; q < queries; ++q) {
+            for (size_t& label : labels)
+                label = rng() % rows;
+            const auto start = std::chrono::steady_clock::now();
+            if (prefetch) {
+                for (size_t label : labels)
+                    snapshot.prefetch(label);
+            }
+            for (size_t label : labels) {
+                const float* row = snapshot.find(label);
+                float dot = 0.0f;
+                for (size_t i = 0; i < dim; ++i)
+                    dot += row[i] * query[i];
+                sink += dot;
+            }
+            latencies.push_back(
+                std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+        }
+        std::sort(latencies.begin(), latencies.end());
+
+        std::printf("  %-11s load %6.0f ms, p50 %6.0f us, p99 %6.0f us", prefetch ? "prefetched" : "one by one",
+                    loadMs, latencies[queries / 2], latencies[queries * 99 / 100]);
+        if (before >= 0)
+            std::printf(", store RSS %ld MB, %ld MB with the mapped pages read", (afterLoad - before) / 1024,
+                        (residentKb() - before) / 1024);
+        std::printf(" (checksum %g)\n", sink);
+    }
+    return 0;
+}
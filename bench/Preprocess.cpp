@@ -0,0 +1,115 @@
+// Preprocess.cpp
+//
+// Time per frame of the detector's and the embedder's input preprocessing: the fused
+// ImagePreprocess kernels against the QImage path they replaced (convertToFormat(RGB888)
+// and scaled(), pixelColor() per pixel, then a separate HWC -> CHW transpose for the
+// detector). Also prints the largest difference between the two outputs.
+//
+// Usage: Preprocess [image] [iterations]
+
+#include "ImagePreprocess.hpp"
+#include <QColor>
+#include <QImage>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+namespace {
+
+// FaceDetector::detect() before the fused kernels: 128x128, [0, 1], CHW
+void detectorInputByQImage(const QImage& img, std::vector<float>& chw)
+{
+    QImage rgb = img.convertToFormat(QImage::Format_RGB888).scaled(128, 128);
+    std::vector<float> hwc(128 * 128 * 3);
+    for (int y = 0; y < 128; ++y) {
+        for (int x = 0; x < 128; ++x) {
+            QColor color = rgb.pixelColor(x, y);
+            hwc[(y * 128 + x) * 3 + 0] = color.red() / 255.0f;
+            hwc[(y * 128 + x) * 3 + 1] = color.green() / 255.0f;
+            hwc[(y * 128 + x) * 3 + 2] = color.blue() / 255.0f;
+        }
+    }
+    for (int c = 0; c < 3; ++c)
+        for (int h = 0; h < 128; ++h)
+            for (int w = 0; w < 128; ++w)
+                chw[c * 128 * 128 + h * 128 + w] = hwc[(h * 128 + w) * 3 + c];
+}
+
+// FaceEmbedder::preprocess() before the fused kernels: 112x112, (v - 127.5) / 128, HWC
+void embedderInputByQImage(const QImage& img, std::vector<float>& hwc)
+{
+    QImage rgb = img.convertToFormat(QImage::Format_RGB888).scaled(112, 112);
+    for (int y = 0; y < 112; ++y) {
+        for (int x = 0; x < 112; ++x) {
+            QColor c = rgb.pixelColor(x, y);
+            const int idx = (y * 112 + x) * 3;
+            hwc[idx + 0] = (c.red() - 127.5f) / 128.0f;
+            hwc[idx + 1] = (c.green() - 127.5f) / 128.0f;
+            hwc[idx + 2] = (c.blue() - 127.5f) / 128.0f;
+        }
+    }
+}
+
+// A gradient with some texture, so nearest-neighbour sampling errors would show
+QImage syntheticFrame()
+{
+    QImage img(1280, 720, QImage::Format_RGB32);
+    for (int y = 0; y < img.height(); ++y) {
+        QRgb* row = reinterpret_cast<QRgb*>(img.scanLine(y));
+        for (int x = 0; x < img.width(); ++x)
+            row[x] = qRgb(x * 255 / 1279, y * 255 / 719, (x * 7 + y * 13) & 0xff);
+    }
+    return img;
+}
+
+double microsecondsPerCall(const std::function<void()>& call, int iterations)
+{
+    for (int i = 0; i < 3; ++i)
+        call();
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        call();
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+float maxDifference(const std::vector<float>& a, const std::vector<float>& b)
+{
+    float worst = 0.0f;
+    for (size_t i = 0; i < a.size(); ++i)
+        worst = std::max(worst, std::fabs(a[i] - b[i]));
+    return worst;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const QImage frame = argc > 1 ? QImage(QString::fromLocal8Bit(argv[1])) : syntheticFrame();
+    const int iterations = argc > 2 ? std::atoi(argv[2]) : 500;
+    if (frame.isNull() || iterations <= 0) {
+        std::fprintf(stderr, "Usage: %s [image] [iterations]\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<float> detectorOld(3 * 128 * 128), detectorNew(3 * 128 * 128);
+    std::vector<float> embedderOld(3 * 112 * 112), embedderNew(3 * 112 * 112);
+    const double detectorOldUs = microsecondsPerCall([&] { detectorInputByQImage(frame, detectorOld); }, iterations);
+    const double detectorNewUs = microsecondsPerCall(
+        [&] { preprocessPlanar(frame, 128, 128, {1.0f / 255.0f, 0.0f}, detectorNew.data()); }, iterations);
+    const double embedderOldUs = microsecondsPerCall([&] { embedderInputByQImage(frame, embedderOld); }, iterations);
+    const double embedderNewUs = microsecondsPerCall(
+        [&] { preprocessInterleaved(frame, 112, 112, {1.0f / 128.0f, -127.5f / 128.0f}, embedderNew.data()); },
+        iterations);
+
+    std::printf("%dx%d frame (QImage format %d), %d iterations, us per call\n", frame.width(), frame.height(),
+                int(frame.format()), iterations);
+    std::printf("  detector 128x128 CHW:  QImage %8.1f, fused %8.1f  (max difference %.1e)\n", detectorOldUs,
+                detectorNewUs, maxDifference(detectorOld, detectorNew));
+    std::printf("  embedder 112x112 HWC:  QImage %8.1f, fused %8.1f  (max difference %.1e)\n", embedderOldUs,
+                embedderNewUs, maxDifference(embedderOld, embedderNew));
+    return 0;
+}
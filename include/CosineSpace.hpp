@@ -0,0 +1,40 @@
+// CosineSpace.hpp
+#pragma once
+
+#include <cstddef>
+#include "hnswlib/hnswlib.h"
+#include "hnswlib/space_ip.h"
+
+// hnswlib space for unit-length embeddings: distance = 1 - dot product, so
+// 1 - distance is the cosine similarity. On unit vectors this orders neighbors
+// exactly like L2Space (squared L2 = 2 - 2 cos), so graphs built with either load
+// and search the same.
+//
+// For the embedding sizes we ship (128, 256, 512) the kernel is generated for that
+// exact size, fully unrolled, and uses AVX-512F or AVX2 + FMA as cpuFeatures()
+// allows. Other sizes, and CPUs without AVX2, use hnswlib's InnerProductSpace kernel.
+class CosineSpace : public hnswlib::SpaceInterface<float> {
+public:
+    explicit CosineSpace(size_t dim);
+
+    CosineSpace(const CosineSpace&) = delete; // get_dist_func_param() points into this object
+    CosineSpace& operator=(const CosineSpace&) = delete;
+
+    size_t get_data_size() override { return dataSize; }
+    hnswlib::DISTFUNC<float> get_dist_func() override { return distance; }
+    void* get_dist_func_param() override { return &dim; }
+
+    size_t dimension() const { return dim; }
+    // Which kernel was picked, e.g. "avx512 x512" or "hnswlib"
+    const char* kernelName() const { return kernel; }
+
+    // The kernel for dim on this CPU, or null if hnswlib's generic one would be used
+    static hnswlib::DISTFUNC<float> specializedKernel(size_t dim, const char** name = nullptr);
+
+private:
+    size_t dim;
+    size_t dataSize;
+    hnswlib::InnerProductSpace generic; // fallback kernel
+    hnswlib::DISTFUNC<float> distance;
+    const char* kernel;
+};
@@ -0,0 +1,32 @@
+// CpuFeatures.hpp
+#pragma once
+
+// x86 builds get hand-written SIMD kernels; everything else uses the scalar paths.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define FACEPUNCH_X86 1
+#endif
+
+// Lets GCC/Clang compile a single function for a wider instruction set than the
+// rest of the build (MSVC accepts any intrinsic without this). Callers must check
+// cpuFeatures() before calling such a function.
+#if defined(__GNUC__) || defined(__clang__)
+#define FACEPUNCH_TARGET(features) __attribute__((target(features)))
+#else
+#define FACEPUNCH_TARGET(features)
+#endif
+
+// Instruction set extensions usable on this machine (CPU and OS support both checked)
+struct CpuFeatures {
+    bool sse2 = false;
+    bool sse41 = false;
+    bool avx2 = false;
+    bool fma = false;
+    bool f16c = false;
+    bool avx512f = false;
+    bool avx512bw = false;
+    bool avx512vnni = false;
+    bool avxvnni = false;
+};
+
+// Detected once on first call, then cached
+const CpuFeatures& cpuFeatures();
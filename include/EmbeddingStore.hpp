@@ -0,0 +1,96 @@
+// EmbeddingStore.hpp
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Full-precision embeddings by label, kept beside a quantized FaceIndex graph so the
+// top candidates of a search can be re-scored exactly.
+//
+// One writer (FaceIndex, under its writer mutex) and any number of lock-free readers
+// through snapshot(). Rows live in fixed-size chunks that never move; a snapshot keeps
+// the chunks it saw alive. FaceIndex never reuses a label, so a row is written once,
+// before its label reaches the graph, and only read after that.
+//
+// Disk-resident mode (setDiskResident()) is for galleries whose vectors do not fit in
+// memory: load() maps the file instead of reading it, and a row is paged in from disk
+// when a search re-scores it. prefetch() starts those reads ahead of time, so the
+// handful of rows one query needs are fetched together rather than one fault at a
+// time. Rows put() after the load stay in memory until the next save and load.
+//
+// Label L is kept in row L / labelStride, so a FaceIndex shard that hands out every
+// n-th label (FaceIndex::setShard) stores no empty rows for the other shards' labels.
+//
+// File format (host byte order, as the graph files): "FPEV" magic, u32 version, u32 dim,
+// u32 label stride (0 in older files, meaning 1), u64 rows, padding to 64 bytes, rows x
+// dim floats (label L at offset 64 + L / stride * dim * 4, zero if absent), then one
+// presence byte per row.
+class EmbeddingStore {
+    struct Chunk;
+    struct Mapping;
+    // What a snapshot sees: the chunks, and the mapped file in disk-resident mode
+    struct Table {
+        std::vector<std::shared_ptr<Chunk>> chunks;
+        std::shared_ptr<Mapping> mapping;
+    };
+
+public:
+    class Snapshot {
+    public:
+        // Row of label, or null if it has none
+        const float* find(size_t label) const;
+        // Starts reading the row of label from disk if it is mapped and may not be in
+        // memory yet; returns at once (best effort)
+        void prefetch(size_t label) const;
+
+    private:
+        friend class EmbeddingStore;
+        std::shared_ptr<const Table> table;
+        size_t dim = 0;
+        size_t stride = 1;
+    };
+
+    explicit EmbeddingStore(size_t dim);
+
+    EmbeddingStore(const EmbeddingStore&) = delete;
+    EmbeddingStore& operator=(const EmbeddingStore&) = delete;
+
+    size_t dimension() const { return dim; }
+    size_t size() const { return count; } // labels with a row
+    // Labels are all congruent modulo stride (see above); set it while the store is empty
+    void setLabelStride(size_t stride);
+    // Whether load() maps the file (see above); takes effect at the next load()
+    void setDiskResident(bool enabled) { diskResident = enabled; }
+    bool isDiskResident() const { return diskResident; }
+
+    Snapshot snapshot() const;
+
+    // Writer side
+    void put(size_t label, const float* embedding);
+    void erase(size_t label);
+    void clear();
+
+    // Writes the rows of labels [0, labelLimit); throws std::runtime_error. Returns the file size.
+    uint64_t save(const std::string& path, size_t labelLimit) const;
+    // Replaces the contents with the file's, which must have this label stride; throws
+    // std::runtime_error. In disk-resident mode the file must stay in place (on POSIX it
+    // may be unlinked) while the store or a snapshot uses it.
+    void load(const std::string& path);
+
+private:
+    static constexpr size_t rowsPerChunk = 1024;
+
+    Chunk& chunkForWrite(size_t row);
+    void mapFile(const std::string& path);
+
+    size_t dim;
+    size_t labelStride = 1;
+    bool diskResident = false;
+    size_t count = 0;
+    // Read with std::atomic_load and replaced with std::atomic_store when a chunk is added
+    std::shared_ptr<const Table> table;
+};
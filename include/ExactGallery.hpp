@@ -0,0 +1,86 @@
+// ExactGallery.hpp
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Brute-force face matcher for small galleries. Every template is an fp32 row of one
+// matrix, and a batch of queries is scored against all of them as a cache-blocked
+// matrix multiply (queries x rows^T). The answer is exact, and for a few thousand faces
+// the streaming scan beats walking the HNSW graph (see FaceIndex::setExactSearchLimit).
+//
+// Rows are padded with zeros to a multiple of 16 floats and 64-byte aligned, so the
+// kernels never need a tail. They live in blocks of blockRows rows that are filled in
+// order; only the last block is partly filled. A published block is never modified:
+// the writer copies the blocks it changes and publishes a new block table with
+// std::atomic_store, so searches read a consistent snapshot without locking. Erasing a
+// row moves the gallery's last row into the hole, keeping the matrix dense.
+//
+// The kernel is picked at runtime from cpuFeatures(): AVX-512F (4 queries x 4 rows per
+// step), AVX2 + FMA (4 x 2) or a scalar loop. Queries left over from the groups of
+// four are scored one at a time against 4 rows per step.
+//
+// One writer (FaceIndex, under its writer mutex) and any number of readers.
+class ExactGallery {
+    struct Block;
+    using BlockTable = std::vector<std::shared_ptr<const Block>>;
+
+public:
+    static constexpr size_t blockRows = 64; // 128 KiB of 512-d rows: stays in L2 while every query passes over it
+
+    // Best-scoring template of one user
+    struct Match {
+        size_t user = 0;
+        size_t label = 0;
+        float similarity = 0.0f; // dot product, i.e. cosine similarity of unit vectors
+        bool found = false;
+    };
+
+    class Snapshot {
+    public:
+        size_t rows() const { return count; }
+
+        // Top-k users for count queries (row-major, count x dim floats) into
+        // out[q * k .. q * k + k), most similar first, each user once with their best
+        // template. Rows with fewer than k users are padded with found = false.
+        void search(const float* queries, size_t count, size_t k, Match* out) const;
+
+    private:
+        friend class ExactGallery;
+        std::shared_ptr<const BlockTable> blocks;
+        size_t count = 0;
+        size_t dim = 0;
+        size_t stride = 0;
+    };
+
+    explicit ExactGallery(size_t dim);
+
+    ExactGallery(const ExactGallery&) = delete;
+    ExactGallery& operator=(const ExactGallery&) = delete;
+
+    size_t size() const { return count; } // rows
+    Snapshot snapshot() const;
+
+    // Writer side. Labels are unique; add() with a label already present replaces its row.
+    void add(size_t label, size_t user, const float* embedding);
+    bool erase(size_t label);
+    // Replaces the contents with rows (labels.size() x dim floats) in one pass
+    void assign(const std::vector<size_t>& labels, const std::vector<size_t>& users, const std::vector<float>& rows);
+    void clear();
+
+    // Which kernel was picked, e.g. "avx512 4x4" or "scalar"
+    static const char* kernelName();
+
+private:
+    std::shared_ptr<Block> copyBlock(size_t index) const;
+    void publish(BlockTable table);
+
+    size_t dim;
+    size_t stride;  // dim rounded up to 16 floats
+    size_t count = 0;
+    std::unordered_map<size_t, size_t> rowOf; // label -> row (writer only)
+    // Read with std::atomic_load and replaced with std::atomic_store on every change
+    std::shared_ptr<const BlockTable> blocks;
+};
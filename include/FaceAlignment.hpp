@@ -0,0 +1,22 @@
+// FaceAlignment.hpp
+#pragma once
+
+#include <QImage>
+#include "FaceDetector.hpp"
+#include "ImagePreprocess.hpp"
+
+// Side of the aligned face the embedder expects (ArcFace input)
+constexpr int alignedFaceSize = 112;
+
+// Least-squares similarity transform (rotation, uniform scale, translation) that puts
+// the detected eyes, nose and mouth onto the ArcFace 112x112 landmark template.
+// toSource maps aligned-image pixels back to source pixels, ready for
+// warpNormalizeInterleaved(). Returns false if the landmarks are degenerate.
+bool estimateAlignment(const FaceDetection &detectedFace, AffineTransform &toSource);
+
+// estimateAlignment(), or a plain stretch of the bounding box if the landmarks are degenerate
+AffineTransform alignmentTransform(const FaceDetection &detectedFace);
+
+// Aligned 112x112 face as an image (for display or export). The embedder does not
+// need it: FaceEmbedder samples the same transform straight into its input tensor.
+QImage alignFace(const QImage &sourceImage, const FaceDetection &detectedFace);
@@ -5,6 +5,8 @@
 #include <vector>
 #include <onnxruntime_cxx_api.h>
 #include <memory> // For smart pointers
+#include <mutex>
+#include "InferenceContext.hpp"
 
 // Struct for one detected face, including box and all landmarks
 struct FaceDetection {
@@ -26,12 +28,16 @@ public:
                  float confThresh,
                  float iouThresh);
 
+    // Thread-safe: calls from different threads are serialized (they share the bound tensors)
     std::vector<FaceDetection> detect(const QImage& img);
 
 private:
     Ort::Env env;
     std::unique_ptr<Ort::Session> session;
     Ort::SessionOptions session_options;
+    std::unique_ptr<InferenceContext> inference; // Persistent bindings for session
+    float* inputTensor = nullptr;                // Bound [1, 3, 128, 128] input buffer
+    std::mutex runMutex;                         // Guards inputTensor/inference during detect()
 
     int maxDetections;
     float confThresh;
@@ -5,6 +5,11 @@
 #include <string>
 #include <onnxruntime_cxx_api.h>
 #include <QImage>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include "FaceDetector.hpp"
+#include "InferenceContext.hpp"
 
 // This class handles extracting face embeddings from a face image using ArcFace ONNX
 class FaceEmbedder {
@@ -12,14 +17,37 @@ public:
     // Constructor: loads the ONNX model from given path
     FaceEmbedder(const std::string& modelPath);
     
+    // Both embedding calls are thread-safe; concurrent calls are serialized.
     // Given a QImage (face, RGB), returns a 512-dim normalized embedding vector
     std::vector<float> getEmbedding(const QImage& face);
 
+    // Embeds N aligned 112x112 faces with batched inference and returns a contiguous,
+    // row-major N x embeddingSize() matrix of normalized embeddings (row i = faces[i])
+    std::vector<float> getEmbeddings(const std::vector<QImage>& faces);
+
+    // Aligns each detected face with its landmarks (see FaceAlignment) and samples it
+    // from frame straight into the model input: no aligned or resized copies are made.
+    // Returns faces.size() x embeddingSize() normalized embeddings (row i = faces[i]).
+    std::vector<float> getEmbeddings(const QImage& frame, const std::vector<FaceDetection>& faces);
+    std::vector<float> getEmbedding(const QImage& frame, const FaceDetection& face);
+
+    int embeddingSize() const { return static_cast<int>(embeddingDim); }
+
 private:
     Ort::Env env;                    // ONNX environment
     Ort::SessionOptions sessionOpts; // Session options (optimizations)
     std::unique_ptr<Ort::Session> session; // The loaded ArcFace model
+    std::unique_ptr<InferenceContext> inference; // Persistent bindings for session
+
+    float* inputTensor = nullptr;  // Bound NHWC [boundBatch, 112, 112, 3] input buffer
+    float* outputTensor = nullptr; // Bound [boundBatch, embeddingDim] output buffer
+    int64_t embeddingDim = 512;    // Taken from the model's output shape when it is static
+    int64_t maxBatch = 16;         // Faces per session run (the model's own value if fixedBatch)
+    int64_t boundBatch = 0;        // Batch size the tensors are currently bound with
+    bool fixedBatch = false;       // Model declares a fixed batch dimension
+    std::mutex runMutex;           // Guards the bound tensors during embedBatch()
 
-    // Helper: preprocess QImage to model input (1, 3, 112, 112) float32
-    std::vector<float> preprocess(const QImage& img);
+    void bindBatch(int64_t n);
+    // Runs count faces through the model; fill(i, input) writes face i's 112x112x3 NHWC input
+    void embedBatch(size_t count, const std::function<void(size_t, float*)>& fill, float* out);
 };
@@ -3,10 +3,28 @@
 
 #include <vector>
 #include <string>
+#include <chrono>
 #include <unordered_map>
+#include <unordered_set>
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <thread>
 #include "hnswlib/hnswlib.h"
-#include "hnswlib/space_l2.h"
+#include "CosineSpace.hpp"
+#include "EmbeddingStore.hpp"
+#include "ExactGallery.hpp"
+#include "FaceSearchStopCondition.hpp"
+#include "FaceIndexJournal.hpp"
+#include "LabelMap.hpp"
+#include "LabelSet.hpp"
+#include "QuantizedSpace.hpp"
+#include "TemplateSpace.hpp"
+
+class FaceIndexStorage;
+class ThreadPool;
 
 // Structure for search results
 struct SearchResult {
@@ -14,42 +32,361 @@ struct SearchResult {
     float similarity = 0.0f;
     size_t id = 0; // 0 or other invalid marker if no match
     bool found = false;
+    bool exhaustive = true; // false if the search was cut short (see FaceIndex::setSearchBudget)
+};
+
+// One neighbor from FaceIndex::searchBatch(); the name is looked up only when needed
+struct SearchMatch {
+    size_t id = 0;         // the user (identity)
+    size_t templateId = 0; // label of the user's template that matched best
+    float similarity = 0.0f;
+    bool found = false; // false pads rows with fewer than k neighbors
+    bool exhaustive = true; // false if the query stopped early; closer users may exist
+};
+
+// One ef value tried by FaceIndex::tuneSearch()
+struct SearchTuningPoint {
+    size_t ef = 0;
+    double recall = 0.0; // recall@1 against the exact answer
+    double p50Us = 0.0, p95Us = 0.0, p99Us = 0.0; // search latency percentiles
 };
 
-// FaceIndex: Stores embeddings and lets you do fast nearest-neighbor face search using hnswlib
+// Outcome of FaceIndex::tuneSearch()
+struct SearchTuning {
+    size_t samples = 0;       // queries measured; 0 if the gallery has fewer than two users
+    double targetRecall = 0.0;
+    size_t ef = 0;            // now in use: the smallest tried that met the target, else the largest
+    bool targetMet = false;
+    size_t graphM = 0;        // M of the current graph
+    size_t recommendedM = 0;  // M for graphs built from now on
+    std::vector<SearchTuningPoint> points; // in increasing ef, up to the chosen one
+};
+
+// How many FaceIndex queries ended early, and why (see FaceIndex::setSearchBudget)
+struct SearchStopStats {
+    uint64_t queries = 0;
+    uint64_t confident = 0; // stopped on a confident hit
+    uint64_t budget = 0;    // ran out of time or hops
+};
+
+// FaceIndex: Stores embeddings and lets you do fast nearest-neighbor face search using hnswlib.
+// All public methods are thread-safe, and searches never wait for a writer: changes are
+// serialized by a writer mutex, and the graph and the name and group tables are
+// published to the searches as atomic shared_ptr snapshots. A user can have several
+// templates, can belong to groups, and is journaled to disk as they change. See
+// docs/FaceIndex.md for how the pieces fit together.
 class FaceIndex {
 public:
-    // Constructor: sets up hnswlib index for L2 distance with fixed dimension
-    FaceIndex(int dim, int max_elements);
+    // Constructor: sets up hnswlib index for cosine distance with fixed dimension and
+    // room for initialCapacity faces before it first has to grow
+    FaceIndex(int dim, int initialCapacity, bool readOnly = false,
+              VectorStorage storage = VectorStorage::Float32);
+    ~FaceIndex(); // stops compaction and flushes the journal
+
+    FaceIndex(const FaceIndex&) = delete;
+    FaceIndex& operator=(const FaceIndex&) = delete;
 
-    // Add a (name, embedding) pair to the index
+    bool isReadOnly() const { return readOnly; }
+    VectorStorage vectorStorage() const { return storageMode; }
+
+    // Progress of a long load (the one-time CSV import): parsing counts file chunks,
+    // indexing counts rows added to the graph. Called on the thread that called
+    // loadFromDisk(), a few times per second.
+    enum class LoadPhase { Parsing, Indexing };
+    using LoadProgress = std::function<void(LoadPhase phase, size_t done, size_t total)>;
+
+    // Add a (name, embedding) pair to the index as a new user. Returns once the change is
+    // on disk. Throws std::runtime_error when read-only or when it cannot be saved (the
+    // user is then not added).
     void add(const std::string& name, const std::vector<float>& embedding);
+    // Add another template to an existing user; false (and logs) if there is no such
+    // user. Throws std::runtime_error as add() does.
+    bool addTemplate(size_t userId, const std::vector<float>& embedding);
+    // Templates of a user (0 if there is no such user)
+    size_t templateCount(size_t userId);
 
     // Search for the most similar face. Returns a SearchResult struct.
-    SearchResult search(const std::vector<float>& embedding, float threshold = 0.7);
+    // With allowed, only the templates in it are candidates (see groupLabels()).
+    SearchResult search(const std::vector<float>& embedding, float threshold = 0.7,
+                        const LabelSet* allowed = nullptr);
+
+    // Top-k users for count queries (row-major, count x dim floats) into
+    // out[q * k .. q * k + k), most similar first, each scored by their best template. Batches of parallelSearchMin or
+    // more are spread over a small thread pool. Names are not copied; resolve the
+    // matches you need against one getIdToNameMap() snapshot taken afterwards.
+    // With allowed, only the templates in it are candidates; an empty set finds nothing.
+    void searchBatch(const float* queries, size_t count, size_t k, SearchMatch* out,
+                     const LabelSet* allowed = nullptr);
+    static constexpr size_t parallelSearchMin = 8;
+
+    using NameTable = LabelMap<std::string>;
+
+    // Applies search()'s rules to a match: found only at or above threshold and with a name
+    static SearchResult resolve(const SearchMatch& match, const NameTable& names, float threshold);
+
+    // Cosine similarity for a graph distance (CosineSpace), so callers that score
+    // embeddings themselves use the same scale as the thresholds
+    static float similarityFromDistance(float distance);
+
+    // Stored embedding of a template (a user id names the user's first one); false if
+    // there is none (e.g. deleted)
+    bool getEmbedding(size_t label, std::vector<float>& out);
+
+    // Save the graph and names to disk in the binary format (see FaceIndexStorage).
+    // Saving to the loaded database also starts a new, empty journal.
+    // Returns false (and logs) if the files could not be written.
+    bool saveToDisk(const std::string& path);
+    // Load from the binary files next to path and replay the journals written since.
+    // A legacy CSV database at path is loaded once, converted to the binary format and
+    // renamed to .csv.migrated. A writable index then journals its changes to path.
+    bool loadFromDisk(const std::string& path, const LoadProgress& progress = LoadProgress());
+
+    // Makes this index shard `shard` of shardCount (see ShardedFaceIndex): the labels it
+    // hands out are shard, shard + shardCount, shard + 2 * shardCount... so they are
+    // unique across the shards and label % shardCount names the shard. Call it on an
+    // empty index, before loadFromDisk(); a saved shard only loads into the same slot.
+    // Throws std::runtime_error otherwise.
+    void setShard(size_t shard, size_t shardCount);
+
+    // Journal size (bytes) above which the background thread writes a new snapshot
+    void setCompactionThreshold(uint64_t bytes);
+    // Share of deleted graph entries (0..1) above which the background thread rebuilds the graph
+    void setRebuildThreshold(double deletedFraction);
+    // With fp16/int8 storage: how many candidate users each search re-scores in full
+    // precision (0 = none, and no full-precision copies are kept). Set it before
+    // loadFromDisk(); faces added while it is 0 are never re-scored.
+    void setRerankCandidates(size_t count);
+    // Keeps those full-precision copies on disk: the saved embedding file is memory-mapped
+    // instead of read, so only the graph with its fp16/int8 codes stays in memory and a
+    // search pages in just its re-scored candidates (read ahead together). Faces added
+    // since the last save stay in memory until the next one (e.g. the next compaction).
+    // Set it before loadFromDisk(); the vectors should be on an SSD.
+    void setDiskResidentVectors(bool enabled);
 
-    // Save all embeddings and names to disk (CSV format)
-    void saveToDisk(const std::string& path);
-    // Load all embeddings and names from disk (CSV format)
-    void loadFromDisk(const std::string& path);
+    // Lets searches stop before the usual ef exploration: on a confident hit, or when a
+    // query has used up its time or hop budget. Trades a little recall on the affected
+    // queries for a bounded tail latency; their results report exhaustive = false.
+    // The default budget never stops a search early.
+    void setSearchBudget(const SearchBudget& budget);
+    SearchStopStats searchStopStats() const;
 
-    // Get a const reference to the ID-to-Name map
-    const std::unordered_map<size_t, std::string>& getIdToNameMap() const;
+    // Measures recall@1 and latency of graph searches for increasing ef and keeps the
+    // smallest ef that reaches targetRecall. The queries are `samples` random templates,
+    // each held out with its whole user: the right answer is the nearest other user,
+    // found by an exact scan of the gallery. If no ef reaches the target, or only one
+    // far above M, the graph is too sparse and a larger M is recommended; the graphs
+    // built from then on (rebuilds, imports) use it. Both values are saved with the
+    // index at once. It measures a snapshot of the graph, so searches and changes go on
+    // meanwhile; only storing the result waits for the writer lock. Throws
+    // std::runtime_error when read-only or if the index cannot be saved.
+    using TuneProgress = std::function<void(size_t done, size_t total)>;
+    SearchTuning tuneSearch(double targetRecall, size_t samples = 200, const TuneProgress& progress = TuneProgress());
+    static constexpr size_t defaultSearchEf = 10; // hnswlib's default
+    static constexpr size_t defaultGraphM = 16;
 
-    // Delete a user by their label (ID)
+    // Templates up to which searches scan every template instead of the graph (0 = never).
+    // Batches of 4 or more queries share each pass over the rows, so for them the
+    // limit is doubled. The default is the crossover measured with 512-d embeddings on
+    // an AVX-512 core: single queries at about 500 templates, batches at about 1000.
+    void setExactSearchLimit(size_t templates);
+    static constexpr size_t defaultExactSearchLimit = 512;
+
+    // Read-only mode: maps the newest snapshot if a writer has saved one since the
+    // last load. Returns true if the index changed.
+    bool refreshSnapshot(const std::string& path);
+
+    // Snapshot of the ID-to-Name map; later changes publish a new table and leave this one as is
+    std::shared_ptr<const NameTable> getIdToNameMap() const;
+
+    // Delete a user by their label (ID), with all of their templates
     bool deleteUser(size_t label);
 
     // Update the name of a user by their label (ID)
     bool updateUserName(size_t label, const std::string& newName);
 
+    using GroupList = std::vector<std::string>; // sorted, without duplicates
+    struct GroupTable {
+        LabelMap<GroupList> userGroups; // users in at least one group
+        std::unordered_map<std::string, std::shared_ptr<const LabelSet>> members; // group -> its users' templates
+    };
+    // Replaces the groups of a user. Names are trimmed, and empty ones and duplicates
+    // dropped. Returns false (and logs) if there is no such user or the index is read-only.
+    bool setUserGroups(size_t userId, GroupList groups);
+    // Groups from a comma-separated list ("staff, floor-2"), normalized as above
+    static GroupList parseGroupList(const std::string& commaSeparated);
+    // Snapshot of the groups; later changes publish a new table and leave this one as is
+    std::shared_ptr<const GroupTable> getGroups() const;
+    // Templates of the users in any of groups, for a restricted search
+    std::shared_ptr<const LabelSet> groupLabels(const GroupList& groups) const;
+    // Restricted searches score the allowed templates one by one up to this many, and
+    // walk the graph with a filter above it. Measured on 20k 512-d faces: with 200
+    // allowed the filtered walk took 4 ms (fp32) or 0.8 ms (int8) against 25 us for the
+    // scan, and missed 2% of the matches; the two break even at about 1000 templates
+    // with int8 storage and 2000 with fp32.
+    static constexpr size_t filteredExactLimit = 1024;
+
 private:
     int dim; // dimension of each embedding
-    int max_elements_; // maximum number of elements for the index
-    size_t nextId = 0; // unique integer label for hnswlib
-    std::unordered_map<size_t, std::string> idToName; // map hnswlib labels to user names
+    size_t initialCapacity; // slots allocated up front; the graph grows past it on demand
+    bool readOnly; // graph is memory-mapped; add/delete/update/save are refused
+    size_t nextId = 0; // unique integer label for hnswlib; users and templates share the sequence
+    size_t firstLabel = 0, labelStride = 1; // the sequence is firstLabel + n * labelStride (see setShard)
+    uint64_t storageGeneration = 0; // generation of the snapshot last saved or loaded
+    NameTable idToName; // map user ids to user names; the writer's working copy
+    // User id -> labels of the user's templates besides the first; writer only
+    std::unordered_map<size_t, std::vector<size_t>> extraTemplates;
+    // Groups of users and templates of groups; the writer's working copies of the GroupTable
+    LabelMap<GroupList> userGroups;
+    std::unordered_map<std::string, std::shared_ptr<const LabelSet>> groupMembers;
+
+    // Exact cosine kernel: the graph's space with fp32 storage, and used for re-ranking
+    std::unique_ptr<CosineSpace> space;
+    VectorStorage storageMode;
+    std::unique_ptr<QuantizedSpace> quantizedSpace; // the graph's space with fp16/int8 storage
+    EmbeddingStore exactVectors; // full-precision copies for re-ranking; see keepsExactLocked()
+    std::atomic<size_t> rerankCandidates{0};
+    // The graph's space: the vector as one of the above stores it, then its user id
+    std::unique_ptr<TemplateSpace> templateSpace;
+
+    // Every live template in fp32 for exact searches. It follows the graph while there
+    // are at most 4 x exactSearchLimit templates, is emptied above that and rebuilt once
+    // the count is back under 2 x the limit, so a gallery near the limit doesn't
+    // rebuild it over and over. Searches use it only while it holds rows within their limit.
+    ExactGallery gallery;
+    bool galleryActive = false; // writer only
+    std::atomic<size_t> exactSearchLimit{defaultExactSearchLimit};
+    // Full-precision vector of a template whose graph element is data: the kept copy, or
+    // the element decoded
+    void templateVector(const EmbeddingStore::Snapshot& exact, size_t label, const char* data, float* out) const;
+    void galleryAddLocked(size_t label, size_t userId, const float* embedding);
+    void galleryEraseLocked(size_t label);
+    void syncGalleryLocked(); // rebuilds or empties the gallery for the live template count
+
+    hnswlib::SpaceInterface<float>* graphSpace() const;
+    // A query as the graph's distance reads it: itself for fp32, else encoded into scratch
+    const void* graphVector(const float* embedding, std::vector<char>& scratch) const;
+    // A graph element: the embedding as the graph stores it followed by userId, in scratch
+    const void* graphElement(const float* embedding, size_t userId, std::vector<char>& scratch) const;
+    bool keepsExactLocked() const; // quantized storage with re-ranking on
+
+    // Read by searches with std::atomic_load and replaced only with std::atomic_store
+    // (under writeMutex); the writer may use them directly.
+    std::shared_ptr<hnswlib::HierarchicalNSW<float>> index;
+    std::shared_ptr<const NameTable> publishedNames;
+    std::shared_ptr<const GroupTable> publishedGroups;
+    std::shared_ptr<const SearchBudget> searchBudget;
+
+    std::atomic<uint64_t> searchQueries{0}, confidentStops{0}, budgetStops{0};
+
+    // Graph search parameters; chosen by tuneSearch() and saved with the index
+    std::atomic<size_t> searchEf{defaultSearchEf};
+    size_t graphM = defaultGraphM; // for new graphs; writer only
+
+    // Reused between the queries of one searchBatch() slice
+    struct SearchScratch {
+        std::vector<char> code;
+        std::vector<SearchMatch> candidates;
+        std::unordered_set<size_t> seen;
+    };
+    // One query against graph: its nearest k users (at least ef explored) into row,
+    // padded with found = false. Returns why the search stopped.
+    FaceSearchStopCondition::Stop searchGraph(const hnswlib::HierarchicalNSW<float>& graph, const float* query,
+                                              size_t k, size_t ef, const SearchBudget& budget,
+                                              const EmbeddingStore::Snapshot& exact, SearchScratch& scratch,
+                                              SearchMatch* row, const LabelSet* allowed);
+    // searchBatch() restricted to the templates in allowed, scoring each of them
+    void searchAllowed(const float* queries, size_t count, size_t k, SearchMatch* out, const LabelSet& allowed);
+
+    // Serializes changes, loads, saves and background maintenance; everything not
+    // published above is guarded by it
+    std::mutex writeMutex;
+
+    void publishIndexLocked(std::shared_ptr<hnswlib::HierarchicalNSW<float>> graph);
+    // Publish idToName, or userGroups and groupMembers, for the searches. The copies
+    // share all but what the writer changes afterwards (see LabelMap, LabelSet).
+    void publishNamesLocked();
+    void publishGroupsLocked();
+    // Moves a user's templates between the group sets for their new groups
+    void regroupLocked(size_t userId, const GroupList& groups);
+    // Adds a new template to its user's group sets; false if the user has no groups
+    bool groupTemplateLocked(size_t userId, size_t label);
+    void rebuildGroupsLocked(); // groupMembers from userGroups and the templates, after a load
+
+    // Workers for searchBatch(), started by the first large batch
+    std::once_flag searchPoolStarted;
+    std::unique_ptr<ThreadPool> searchPool;
+    // Runs searchRows over slices of [0, count) on the pool and this thread
+    void runSliced(size_t count, const std::function<void(size_t begin, size_t end)>& searchRows);
+
+    // Change journal of the database at databasePath; null until loaded (and when read-only)
+    std::unique_ptr<FaceIndexJournal> journal;
+    std::string databasePath;
+
+    // Background compaction, growth and rebuild
+    static constexpr std::chrono::seconds compactionInterval{60};
+    static constexpr size_t rebuildMinDeleted = 64; // not worth a rebuild below this many tombstones
+    uint64_t compactionThreshold = 4u << 20;
+    double rebuildThreshold = 0.2;
+    bool compactionRequested = false;
+    bool growthRequested = false;
+    bool rebuildRequested = false;
+    std::atomic<bool> stopCompactor{false}; // also read by a rebuild running without the lock
+    std::condition_variable compactorWake;
+    std::thread compactor;
+    void compactorLoop();
+
+    // add() and addTemplate() with writeMutex held; return the new label
+    size_t addLocked(const std::string& name, const std::vector<float>& embedding);
+    size_t addTemplateLocked(size_t userId, const std::vector<float>& embedding);
+    // Marks every template of a user deleted and forgets them; returns their labels
+    std::vector<size_t> deleteTemplatesLocked(size_t userId);
+    void indexTemplatesLocked(); // fills extraTemplates from the graph's user ids
+
+    // Growth; the caller holds writeMutex. freeSlotsLocked() counts the never used slots
+    // (a rebuild frees the deleted ones), grownCapacityLocked() is the next geometric step.
+    size_t freeSlotsLocked() const;
+    bool lowOnSlotsLocked() const; // below 1/8 free
+    size_t grownCapacityLocked() const;
+    void requestGrowthIfLowLocked(); // wakes the background thread below 1/8 free
+    void growLocked(); // copies the graph while searches continue, then swaps it in
+
+    // Rebuild; the caller holds writeMutex. While a rebuild runs, graph changes are also
+    // queued in rebuildBacklog; graphEpoch changes whenever a load replaces the graph.
+    bool rebuilding = false;
+    std::vector<FaceIndexJournal::Record> rebuildBacklog;
+    uint64_t graphEpoch = 0;
+    bool rebuildDueLocked() const;
+    void requestRebuildIfSparseLocked();
+    void rebuildLocked(std::unique_lock<std::mutex>& lock); // releases the lock while building
+
+    // Appends a change to the journal and wakes the compactor past the threshold. Returns
+    // the journal ticket, or 0 if no journal is open; throws if the journal rejects it.
+    uint64_t journalLocked(const FaceIndexJournal::Record& record);
+    // journalLocked() for changes that are not undone when they cannot be journaled: logs instead
+    void journalOrWarnLocked(const FaceIndexJournal::Record& record);
+    bool journalFailedLocked() const { return journal && journal->failed(); }
+    // Waits (without writeMutex) for a registration's record. If the journal failed first
+    // and no snapshot has been saved since (generation = storageGeneration when it was
+    // journaled), runs undoLocked under writeMutex and throws std::runtime_error.
+    void awaitJournaled(uint64_t ticket, uint64_t generation, const std::function<void()>& undoLocked);
+    // Drops a user or one extra template from memory, without journaling it
+    void eraseUserLocked(size_t label);
+    void eraseTemplateLocked(size_t userId, size_t label);
 
-    std::unique_ptr<hnswlib::L2Space> space;
-    std::unique_ptr<hnswlib::HierarchicalNSW<float>> index;
+    // Persistence helpers; the caller holds writeMutex. The binary ones throw std::runtime_error.
+    void resetLocked(size_t capacity = 0); // empty graph with room for max(capacity, initialCapacity)
+    void saveBinaryLocked(const FaceIndexStorage& storage);
+    // True if the saved graph had another vector storage and was converted to this one
+    bool loadBinaryLocked(const FaceIndexStorage& storage);
+    // Graph in this index's storage with source's live entries; sourceCodec is null for
+    // fp32, sourceIds null for a graph without user ids (each label is its own user)
+    std::unique_ptr<hnswlib::HierarchicalNSW<float>> convertGraphLocked(hnswlib::HierarchicalNSW<float>& source,
+                                                                        const QuantizedSpace* sourceCodec,
+                                                                        TemplateSpace* sourceIds);
+    void replayJournalsLocked(const FaceIndexStorage& storage); // opens the last one for appending
+    // Bulk CSV import: parses newline-aligned chunks and inserts the rows on a thread pool.
+    // False if the file could not be read or parsed.
+    bool loadLegacyCsvLocked(const std::string& path, const LoadProgress& progress);
 
     // Helper to normalize a vector to length 1
     std::vector<float> normalize(const std::vector<float>& v);
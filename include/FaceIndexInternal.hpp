@@ -0,0 +1,31 @@
+// FaceIndexInternal.hpp
+#pragma once
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <vector>
+#include "FaceIndex.hpp"
+
+// Helpers shared by FaceIndex's source files (FaceIndex.cpp, FaceIndexPersistence.cpp,
+// FaceIndexTuning.cpp); not part of its interface
+namespace FaceIndexInternal {
+
+inline bool isBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+// Waits for every task, calling progress(done) meanwhile, then rethrows the first failure
+void waitForTasks(std::vector<std::future<void>>& tasks, const std::function<void()>& progress);
+
+// Writable graph with M links per element. Deleted slots are never refilled in place
+// (addPoint's replace_deleted), since a search may be reading one.
+std::unique_ptr<hnswlib::HierarchicalNSW<float>> makeGraph(hnswlib::SpaceInterface<float>* space, size_t capacity, size_t m);
+
+// Copies the stored vector of label (as the graph's space encodes it, data_size_ bytes)
+// to out; false if it is missing or deleted. Locks like getDataByLabel().
+bool copyElementData(const hnswlib::HierarchicalNSW<float>& graph, size_t label, char* out);
+bool copyElementData(const hnswlib::HierarchicalNSW<float>& graph, size_t label, std::vector<char>& out);
+
+// Group names trimmed, without empty ones, sorted and deduplicated
+FaceIndex::GroupList normalizedGroups(FaceIndex::GroupList groups);
+
+} // namespace FaceIndexInternal
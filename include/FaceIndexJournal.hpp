@@ -0,0 +1,105 @@
+// FaceIndexJournal.hpp
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Write-ahead log of FaceIndex mutations, so a registration, deletion or rename costs
+// one small append instead of rewriting the whole database.
+//
+// A journal belongs to a snapshot generation ("face_db.journal.<gen>"): it holds every
+// change made after snapshot <gen> was taken. Loading maps/reads the snapshot and
+// replays the journals of that generation and later ones; compaction writes a new
+// snapshot and starts the next journal.
+//
+// File layout: "FPJL" magic, u32 version, u64 generation, then records framed as
+//   u32 payload length, u32 CRC32 of payload, payload
+// where payload = u8 type, u64 id, and for Add: u32 name length + name + dim floats,
+// for Rename: u32 name length + name, for AddTemplate: u64 identity + dim floats,
+// for SetGroups: u32 count + count x (u32 length + group name).
+// Replay stops at the first torn or corrupt record.
+//
+// Appends are group-committed: append() only buffers the record, and a flusher thread
+// writes and fsyncs whatever has accumulated, so concurrent appends share one fsync.
+//
+// A batch that fails to write or fsync is not reported durable. The file is cut back
+// to the last durable record, and the journal is failed: waitDurable() and flush()
+// throw for the records that did not make it, and append() throws until the next
+// open(). The caller should not trust a failed journal again; FaceIndex compacts
+// into a new snapshot and journal.
+class FaceIndexJournal {
+public:
+    enum class RecordType : uint8_t { Add = 1, Delete = 2, Rename = 3, AddTemplate = 4, SetGroups = 5 };
+
+    struct Record {
+        RecordType type = RecordType::Add;
+        uint64_t id = 0;              // Add, AddTemplate: the new label; Delete, Rename, SetGroups: the user
+        uint64_t identity = 0;        // AddTemplate: the identity the new template joins
+        std::string name;             // Add, Rename
+        std::vector<float> embedding; // Add, AddTemplate
+        std::vector<std::string> groups; // SetGroups: all of the user's groups
+    };
+
+    static constexpr uint32_t formatVersion = 1;
+
+    FaceIndexJournal();
+    ~FaceIndexJournal(); // flushes and closes
+
+    FaceIndexJournal(const FaceIndexJournal&) = delete;
+    FaceIndexJournal& operator=(const FaceIndexJournal&) = delete;
+
+    // Reads every intact record of a journal file. validBytes receives the length of
+    // the intact prefix (the header alone if there are no records). Throws
+    // std::runtime_error if the header is missing or names another generation.
+    static std::vector<Record> read(const std::string& path, uint64_t generation, size_t dim, uint64_t& validBytes);
+
+    // Opens (or creates) the journal for appending; a torn tail beyond validBytes is cut off.
+    // Pass validBytes = 0 for a new file. Flushes and closes a previously open journal.
+    void open(const std::string& path, uint64_t generation, uint64_t validBytes);
+    void close();
+    bool isOpen() const;
+
+    // Buffers a record; it is on disk after the next group commit (or flush()). Returns
+    // a ticket for waitDurable(). Throws std::runtime_error if the journal is not open
+    // or has failed.
+    uint64_t append(const Record& record);
+
+    // Blocks until the record with this ticket, and every one before it, is written and
+    // fsynced, or was made durable by the snapshot of a later open(). Throws
+    // std::runtime_error if the journal failed first.
+    void waitDurable(uint64_t ticket);
+    // Blocks until everything appended so far is written and fsynced; throws as above
+    void flush();
+
+    uint64_t generation() const;
+    uint64_t sizeBytes() const;   // file size including records not yet flushed
+    bool hasRecords() const;      // anything appended since the header
+    bool failed() const;          // a write or fsync failed since open()
+
+private:
+    struct File; // platform file handle with write/fsync/truncate
+
+    void flusherLoop();
+    static std::string encode(const Record& record);
+
+    mutable std::mutex mutex;
+    std::condition_variable pendingReady;  // flusher: something to write, or stopping
+    std::condition_variable flushed;       // writers waiting in waitDurable(), close()
+    std::string pending;                   // framed records not yet handed to the flusher
+    uint64_t pendingRecords = 0;
+    uint64_t appendedBytes = 0;            // file offset after every appended record
+    uint64_t durableBytes = 0;             // file offset known to be on disk
+    uint64_t appendedRecords = 0;          // tickets: counted across open()s, never reset
+    uint64_t durableRecords = 0;
+    std::string failure;                   // why the journal failed, or empty
+    uint64_t headerBytes = 0;
+    uint64_t generation_ = 0;
+    bool writing = false;                  // flusher is writing a batch
+    bool stopping = false;
+    File* file = nullptr;                  // owned; only the flusher writes while open
+    std::thread flusher;
+};
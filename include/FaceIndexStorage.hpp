@@ -0,0 +1,103 @@
+// FaceIndexStorage.hpp
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "LabelMap.hpp"
+
+// Contents of the index sidecar: everything FaceIndex needs besides the HNSW graph
+struct FaceIndexMeta {
+    uint32_t dim = 0;
+    uint64_t nextId = 0;
+    uint64_t generation = 0;         // bumped on every save; names the graph file
+    std::string graphFile;           // file name (no directory) of the graph written by saveIndex
+    uint64_t graphSize = 0;          // expected size of that file in bytes
+    uint32_t vectorStorage = 0;      // VectorStorage of the graph's vectors (0 = fp32)
+    std::string vectorsFile;         // full-precision embeddings (EmbeddingStore), or empty
+    uint64_t vectorsSize = 0;        // expected size of that file in bytes
+    bool identityIds = true;         // graph elements end with their identity id (TemplateSpace)
+    uint32_t searchEf = 0;           // search ef chosen by FaceIndex::tuneSearch (0 = never tuned)
+    uint32_t graphM = 0;             // M for newly built graphs (0 = the default)
+    LabelMap<std::string> idToName;
+    LabelMap<std::vector<std::string>> userGroups; // users in at least one group
+};
+
+// On-disk layout of a face database. For a database path "dir/face_db.csv" (or
+// "dir/face_db") the files are:
+//
+//   dir/face_db.meta          sidecar: versioned, CRC32-checked FaceIndexMeta
+//   dir/face_db.graph.<gen>   HNSW graph as written by HierarchicalNSW::saveIndex
+//   dir/face_db.vectors.<gen> full-precision embeddings beside a quantized graph (optional)
+//   dir/face_db.journal.<gen> changes made after snapshot <gen> (see FaceIndexJournal)
+//   dir/face_db.csv           legacy CSV; migrated once, then renamed to .csv.migrated
+//
+// A save writes a new graph generation first and then atomically replaces the
+// sidecar, so a crash at any point leaves either the old or the new database. The
+// sidecar is fsynced before the rename and its directory after it, which makes that
+// hold for an OS crash or power loss too, provided the files the new sidecar names
+// were fsynced before writeMeta() (see syncFile()).
+//
+// Sidecar format (little-endian):
+//   "FPIX" magic, u32 version, u32 dim, u64 nextId, u64 generation, u64 graphSize,
+//   u32 length + graph file name, u64 count, count x (u64 id, u32 length + name),
+//   [version 2: u32 vector storage, u64 vectors size, u32 length + vectors file name],
+//   u32 CRC32 of all preceding bytes. Version 1 sidecars (fp32, no vectors file) still load.
+// Version 3 has the same fields; it marks graphs whose elements carry their identity id.
+// Earlier graphs hold one template per identity, with the identity id as label.
+// Version 4 adds u32 search ef and u32 graph M before the CRC.
+// Version 5 adds u64 count, count x (u64 user id, u32 n, n x (u32 length + group name)) before the CRC.
+class FaceIndexStorage {
+public:
+    static constexpr uint32_t formatVersion = 5;
+
+    explicit FaceIndexStorage(const std::string& databasePath);
+
+    const std::string& metaPath() const { return metaPath_; }
+    const std::string& legacyCsvPath() const { return legacyCsvPath_; }
+    std::string graphFileName(uint64_t generation) const;
+    std::string vectorsFileName(uint64_t generation) const;
+    std::string pathInDirectory(const std::string& fileName) const;
+
+    bool hasMeta() const;
+    bool hasLegacyCsv() const;
+
+    // Throws std::runtime_error if the sidecar is missing, truncated, of an unknown
+    // version or fails its checksum
+    FaceIndexMeta readMeta() const;
+
+    // Writes the sidecar to a temporary file, fsyncs it, renames it over the old one and
+    // fsyncs the directory; throws std::runtime_error
+    void writeMeta(const FaceIndexMeta& meta) const;
+
+    // Flushes a written (and closed) file to the disk; throws std::runtime_error
+    static void syncFile(const std::string& path);
+    // Makes files created in or renamed into the database directory durable (no-op on
+    // Windows, where NTFS journals them); throws std::runtime_error
+    void syncDirectory() const;
+
+    // Removes graph files of every generation except `keep`
+    void removeStaleGraphs(uint64_t keep) const;
+    // Removes embedding files of every generation except `keep`
+    void removeStaleVectors(uint64_t keep) const;
+
+    std::string journalPath(uint64_t generation) const;
+    // Generations >= `from` that have a journal file, ascending
+    std::vector<uint64_t> journalGenerations(uint64_t from) const;
+    // Removes journals older than `keepFrom` (their changes are in that snapshot)
+    void removeStaleJournals(uint64_t keepFrom) const;
+
+    // Renames the legacy CSV out of the way once its contents live in the binary files
+    bool retireLegacyCsv() const;
+
+private:
+    // Generations of the files named <baseName_><infix><generation> in the directory
+    std::vector<uint64_t> generationsOf(const std::string& infix) const;
+
+    std::string directory_; // with trailing separator, or empty
+    std::string baseName_;  // file name without the .csv extension
+    std::string metaPath_;
+    std::string legacyCsvPath_;
+};
+
+uint32_t crc32(const void* data, size_t size, uint32_t crc = 0);
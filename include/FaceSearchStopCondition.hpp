@@ -0,0 +1,50 @@
+// FaceSearchStopCondition.hpp
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include "hnswlib/hnswlib.h"
+#include "TemplateSpace.hpp"
+
+// Limits on one FaceIndex query, past which it returns the best it has found so far
+struct SearchBudget {
+    float confidentSimilarity = 0.0f;  // stop once a template is at least this similar; 0 = never
+    std::chrono::microseconds time{0}; // wall time per query; 0 = unlimited
+    size_t hops = 0;                   // graph nodes expanded per query; 0 = unlimited
+};
+
+// Stop condition for FaceIndex searches. It collects the nearest users exactly like
+// MultiVectorSearchStopCondition and ends the search early
+//  - on a confident hit: the best template so far is at least budget.confidentSimilarity
+//    similar, so far above the match threshold that exploring on would not change who
+//    is recognized, or
+//  - when the query has expanded budget.hops graph nodes or run for budget.time.
+// The results are then the best found so far, and reason() says why the search ended.
+// A budget never cuts a search off before it has found anything.
+//
+// Holds the state of one query; use a new one per search.
+class FaceSearchStopCondition : public hnswlib::MultiVectorSearchStopCondition<uint64_t, float> {
+public:
+    enum class Stop { Exhaustive, Confident, Budget };
+
+    FaceSearchStopCondition(TemplateSpace& space, size_t users, size_t ef, const SearchBudget& budget);
+
+    void add_point_to_result(hnswlib::labeltype label, const void* datapoint, float dist) override;
+    bool should_stop_search(float candidateDist, float lowerBound) override;
+
+    Stop reason() const { return stop; }
+
+private:
+    using Base = hnswlib::MultiVectorSearchStopCondition<uint64_t, float>;
+
+    static constexpr size_t clockInterval = 16; // hops between two reads of the clock
+
+    float confidentDistance; // CosineSpace distance of budget.confidentSimilarity; below 0 if off
+    size_t maxHops;
+    bool timed;
+    std::chrono::steady_clock::time_point deadline;
+    size_t hops = 0;
+    float best; // distance of the nearest template collected so far
+    Stop stop = Stop::Exhaustive;
+};
@@ -0,0 +1,96 @@
+// FaceTracker.hpp
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include "FaceDetector.hpp"
+
+// Tuning knobs; the defaults suit a webcam at 15-30 fps
+struct TrackerOptions {
+    float minIou = 0.3f;              // detections below this overlap start a new track
+    double maxCoastSecs = 0.5;        // tracks without a detection are dropped after this long
+    double identityHalfLifeSecs = 2.0;  // confidence in a known identity halves this often
+    double unknownHalfLifeSecs = 0.5;   // same for "Unknown", so newly registered users are picked up soon
+    float reidentifyBelow = 0.25f;    // re-run embedding + search once confidence drops below this
+    float measurementNoise = 0.05f;   // detector box jitter, as a fraction of the face height
+    float motionNoise = 1.0f;         // acceleration noise, in face heights per second^2
+};
+
+// A track as seen by the rest of the pipeline
+struct TrackedFace {
+    int trackId = 0;
+    FaceDetection detection{};        // filtered box; landmarks from the latest detection, moved with it
+    FaceDetection measured{};         // the raw detection associated this frame (valid if detectedThisFrame)
+    bool detectedThisFrame = false;   // false while coasting on the motion model
+    bool needsIdentity = false;       // caller should embed + search this face and report back
+    bool hasIdentity = false;
+    bool known = false;               // the identity matched a user; 0 is a valid userId
+    size_t userId = 0;                // 0 when unknown
+    std::string name;                 // "Unknown" when no match cleared the threshold
+    float similarity = 0.0f;
+    float identityConfidence = 0.0f;  // 1 right after identification, decays over time
+};
+
+// Multi-object face tracker: greedy IoU association of detections to tracks, and a
+// constant-velocity Kalman filter per box coordinate (centre x/y, width, height).
+//
+// Identities stick to tracks. A track asks for an identity once when it is created
+// and again whenever its identity confidence has decayed below reidentifyBelow, so
+// a steady crowd is embedded and searched a few times, not on every frame.
+//
+// Thread-safe: update() runs on one pipeline stage and setIdentity() on another.
+class FaceTracker {
+public:
+    explicit FaceTracker(const TrackerOptions& options = TrackerOptions());
+
+    // Advances all tracks to `timestamp` (seconds, monotonic), associates the frame's
+    // detections and returns every live track. Tracks flagged needsIdentity are marked
+    // pending until setIdentity() is called for them, so they are only requested once.
+    std::vector<TrackedFace> update(const std::vector<FaceDetection>& detections, double timestamp);
+
+    // Reports the search result for a track; ignored if the track has since been dropped
+    void setIdentity(int trackId, size_t userId, const std::string& name, float similarity, bool found);
+
+    // Clears the pending flag without an identity (e.g. alignment failed); the track asks again next frame
+    void cancelIdentity(int trackId);
+
+    void clear();
+
+private:
+    // Constant-velocity Kalman filter for one scalar: state (position, velocity)
+    struct Axis {
+        float pos = 0.0f, vel = 0.0f;
+        float p00 = 0.0f, p01 = 0.0f, p11 = 0.0f; // symmetric covariance
+        void init(float value, float posVar, float velVar);
+        void predict(float dt, float accelVar);
+        void correct(float measured, float measVar);
+    };
+
+    struct Track {
+        int id = 0;
+        Axis cx, cy, w, h;
+        FaceDetection last{};         // latest associated detection
+        double lastSeen = 0.0;
+        bool detectedThisFrame = false;
+        bool pending = false;         // identity requested, result not back yet
+        bool hasIdentity = false;
+        bool known = false;
+        size_t userId = 0;
+        std::string name;
+        float similarity = 0.0f;
+        float identityConfidence = 0.0f;
+        double identityTime = 0.0;
+    };
+
+    static float iou(const Track& t, const FaceDetection& d);
+    static void boxOf(const Track& t, float& x1, float& y1, float& x2, float& y2);
+    void startTrack(const FaceDetection& d, double timestamp);
+    TrackedFace snapshot(Track& t, double timestamp);
+
+    TrackerOptions options;
+    std::mutex mutex;
+    std::vector<Track> tracks;
+    int nextTrackId = 1;
+    double lastTimestamp = -1.0;
+};
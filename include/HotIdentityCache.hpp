@@ -0,0 +1,53 @@
+// HotIdentityCache.hpp
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "CosineSpace.hpp"
+
+// Embeddings of the identities matched most recently, scored exactly against each
+// query before the HNSW graph is searched. In attendance use the same few hundred
+// people pass the camera again and again, so a brute-force scan of a few hundred
+// contiguous rows (with FaceIndex's cosine kernel) answers most queries.
+//
+// Rows are row-major in one array; erasing moves the last row into the hole.
+// When full, inserting evicts the least recently matched identity.
+//
+// Not thread-safe; the recognition pipeline's match stage owns it.
+class HotIdentityCache {
+public:
+    // capacity = 0 disables the cache (best() never finds anything)
+    HotIdentityCache(size_t dim, size_t capacity);
+
+    HotIdentityCache(const HotIdentityCache&) = delete; // distanceParam points into space
+    HotIdentityCache& operator=(const HotIdentityCache&) = delete;
+
+    size_t size() const { return ids.size(); }
+    size_t capacity() const { return maxEntries; }
+
+    // Most similar cached identity, with FaceIndex's similarity scale. False if empty.
+    bool best(const float* query, size_t& id, float& similarity) const;
+
+    // Marks id as just matched, so it is evicted last
+    void touch(size_t id);
+
+    // Adds id (or refreshes its embedding) as the most recently matched entry
+    void insert(size_t id, const float* embedding);
+
+    void erase(size_t id);
+    void clear();
+
+private:
+    size_t dim;
+    size_t maxEntries;
+    CosineSpace space;               // distance kernel picked for this CPU
+    hnswlib::DISTFUNC<float> distance;
+    void* distanceParam;
+    std::vector<float> vectors;      // size() x dim, row-major
+    std::vector<size_t> ids;         // id of each row
+    std::vector<uint64_t> lastUsed;  // tick of each row's last match
+    std::unordered_map<size_t, size_t> rowOf;
+    uint64_t tick = 0;
+};
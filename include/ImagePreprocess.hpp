@@ -0,0 +1,55 @@
+// ImagePreprocess.hpp
+#pragma once
+
+#include <QImage>
+
+// Packed 8-bit pixel layouts the kernels read straight from scanlines
+enum class PixelLayout {
+    RGB888,   // R, G, B bytes
+    BGR888,   // B, G, R bytes
+    RGBX8888, // R, G, B, X/A bytes
+    BGRX8888  // B, G, R, X/A bytes (QImage RGB32/ARGB32 on little-endian hosts)
+};
+
+// Non-owning view of an image's pixel rows
+struct ImageView {
+    const unsigned char* data = nullptr;
+    int width = 0;
+    int height = 0;
+    int bytesPerLine = 0;
+    PixelLayout layout = PixelLayout::BGRX8888;
+};
+
+// Applied to every 8-bit sample: out = value * scale + bias
+struct Normalization {
+    float scale = 1.0f;
+    float bias = 0.0f;
+};
+
+// 2x3 affine map: (x, y) -> (m00 * x + m01 * y + m02, m10 * x + m11 * y + m12)
+struct AffineTransform {
+    float m00 = 1.0f, m01 = 0.0f, m02 = 0.0f;
+    float m10 = 0.0f, m11 = 1.0f, m12 = 0.0f;
+};
+
+// Fills view if img's format can be read directly; returns false otherwise
+bool imageViewFor(const QImage& img, ImageView& view);
+
+// One pass over the source: nearest-neighbour resize to dstW x dstH (same sampling
+// as QImage::scaled), normalize, and write planar RGB floats (CHW).
+// dst must hold 3 * dstW * dstH floats.
+void resizeNormalizePlanar(const ImageView& src, int dstW, int dstH, Normalization norm, float* dst);
+
+// Same as above but writes interleaved RGB floats (HWC)
+void resizeNormalizeInterleaved(const ImageView& src, int dstW, int dstH, Normalization norm, float* dst);
+
+// One pass over the source for an arbitrary affine warp: output pixel (x, y) is sampled
+// bilinearly at toSource(x, y), normalized and written as interleaved RGB floats (HWC).
+// Samples outside the source read as black, like cv::warpAffine's constant border.
+// dst must hold 3 * dstW * dstH floats.
+void warpNormalizeInterleaved(const ImageView& src, const AffineTransform& toSource, int dstW, int dstH,
+                              Normalization norm, float* dst);
+
+// QImage front-ends; formats without a direct view are converted to RGBX8888 first
+void preprocessPlanar(const QImage& img, int dstW, int dstH, Normalization norm, float* dst);
+void preprocessInterleaved(const QImage& img, int dstW, int dstH, Normalization norm, float* dst);
@@ -0,0 +1,105 @@
+// InferenceContext.hpp
+#pragma once
+
+#include <onnxruntime_cxx_api.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Everything a session needs per Run(), resolved once and then reused:
+// input/output names and declared shapes, persistent tensor buffers, and an
+// Ort::IoBinding that keeps those buffers bound between runs. After setup a
+// run() with preallocated outputs does no heap allocation on our side.
+// Not thread-safe: one context drives one session from one thread at a time.
+class InferenceContext {
+public:
+    explicit InferenceContext(Ort::Session& session);
+
+    size_t inputCount() const { return inputs.size(); }
+    size_t outputCount() const { return outputs.size(); }
+
+    // Shapes as declared by the model (dynamic dimensions are -1)
+    const std::vector<int64_t>& inputShape(size_t index) const { return inputs.at(index).declaredShape; }
+    const std::vector<int64_t>& outputShape(size_t index) const { return outputs.at(index).declaredShape; }
+
+    // Binds a persistent buffer of the given shape to input `index` and returns it.
+    // Memory is only reallocated when it has to grow, so rebinding with an equal or
+    // smaller shape (e.g. a smaller batch) reuses the same buffer.
+    template <typename T>
+    T* bindInput(size_t index, const std::vector<int64_t>& shape);
+
+    // Same, for an output whose shape is known before the run
+    template <typename T>
+    T* bindOutput(size_t index, const std::vector<int64_t>& shape);
+
+    // For outputs whose shape is only known after the run (e.g. detection count);
+    // ONNX Runtime allocates them from its CPU arena on every run. They cannot be
+    // preallocated at a maximum size: ONNX Runtime rejects a bound tensor whose shape
+    // differs from the computed one.
+    void bindOutputToCpu(size_t index);
+
+    // Runs the session on the current bindings. Outputs bound with bindOutputToCpu() are
+    // rebound first: IoBinding keeps the last run's value bound as if preallocated, so
+    // a run that produces another shape (e.g. another face count) would fail.
+    void run();
+
+    // Output `index` of the last run. For a bindOutputToCpu() output this is the tensor
+    // ONNX Runtime allocated during that run; it stays valid until the next run().
+    const Ort::Value& output(size_t index) const { return outputs.at(index).value; }
+
+private:
+    struct Slot {
+        std::string name;
+        std::vector<int64_t> declaredShape;
+        std::unique_ptr<unsigned char[]> buffer;
+        size_t capacityBytes = 0;
+        Ort::Value value{nullptr};
+        bool bound = false;
+        bool allocatedByRun = false; // bound with bindOutputToCpu()
+    };
+
+    // Hands GetBoundOutputValues() the preallocated fetched array instead of heap memory
+    struct FetchAllocator : OrtAllocator {
+        InferenceContext* owner = nullptr;
+    };
+    static void* ORT_API_CALL allocFetched(OrtAllocator* allocator, size_t bytes);
+    static void ORT_API_CALL freeFetched(OrtAllocator* allocator, void* p);
+    static const OrtMemoryInfo* ORT_API_CALL fetchedInfo(const OrtAllocator* allocator);
+
+    void* reserve(Slot& slot, size_t bytes);
+    void markBound(size_t outputIndex);
+    void fetchRunOutputs();
+    static size_t elementCount(const std::vector<int64_t>& shape);
+
+    Ort::Session& session;
+    Ort::MemoryInfo memoryInfo;
+    Ort::IoBinding binding;
+    std::vector<Slot> inputs;
+    std::vector<Slot> outputs;
+    std::vector<size_t> boundOutputs; // output indices in the order they were first bound, as IoBinding lists them
+    std::vector<OrtValue*> fetched;   // one entry per output, filled by fetchRunOutputs()
+    FetchAllocator fetchAllocator{};
+};
+
+template <typename T>
+T* InferenceContext::bindInput(size_t index, const std::vector<int64_t>& shape) {
+    Slot& slot = inputs.at(index);
+    const size_t count = elementCount(shape);
+    T* data = static_cast<T*>(reserve(slot, count * sizeof(T)));
+    slot.value = Ort::Value::CreateTensor<T>(memoryInfo, data, count, shape.data(), shape.size());
+    binding.BindInput(slot.name.c_str(), slot.value);
+    return data;
+}
+
+template <typename T>
+T* InferenceContext::bindOutput(size_t index, const std::vector<int64_t>& shape) {
+    Slot& slot = outputs.at(index);
+    const size_t count = elementCount(shape);
+    T* data = static_cast<T*>(reserve(slot, count * sizeof(T)));
+    slot.value = Ort::Value::CreateTensor<T>(memoryInfo, data, count, shape.data(), shape.size());
+    slot.allocatedByRun = false;
+    binding.BindOutput(slot.name.c_str(), slot.value);
+    markBound(index);
+    return data;
+}
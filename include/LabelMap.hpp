@@ -0,0 +1,233 @@
+// LabelMap.hpp
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Map from graph labels to values that copies in constant time: a 64-way trie whose
+// nodes are shared between copies and copied on write. FaceIndex keeps its name and
+// group tables in LabelMaps, so publishing a table for the searches after a change
+// costs the few nodes on the changed label's path instead of a copy of the table.
+//
+// A node is modified in place only while no other copy refers to it, so a published
+// copy never changes. Copies can be read from any number of threads; modifying one
+// needs the usual external locking, but not against readers of the other copies.
+template <typename T>
+class LabelMap {
+public:
+    // Null if label is not in the map. Valid until this copy is next modified.
+    const T* find(size_t label) const
+    {
+        if (!root || !fits(label, height))
+            return nullptr;
+        const Node* node = root.get();
+        for (unsigned level = height; level > 0; --level) {
+            const unsigned slot = slotOf(label, level);
+            if (!(node->present >> slot & 1))
+                return nullptr;
+            node = node->children[rank(node->present, slot)].get();
+        }
+        const unsigned slot = slotOf(label, 0);
+        return node->present >> slot & 1 ? &node->values[rank(node->present, slot)] : nullptr;
+    }
+    bool contains(size_t label) const { return find(label) != nullptr; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    void set(size_t label, T value)
+    {
+        while (!fits(label, height)) {
+            if (root) {
+                auto parent = std::make_shared<Node>();
+                parent->present = 1;
+                parent->children.push_back(std::move(root));
+                root = std::move(parent);
+            }
+            ++height;
+        }
+        if (!root)
+            root = std::make_shared<Node>();
+        Node* node = writable(root);
+        for (unsigned level = height; level > 0; --level) {
+            const unsigned slot = slotOf(label, level);
+            const size_t index = rank(node->present, slot);
+            if (!(node->present >> slot & 1)) {
+                node->children.insert(node->children.begin() + index, std::make_shared<Node>());
+                node->present |= uint64_t(1) << slot;
+            }
+            node = writable(node->children[index]);
+        }
+        const unsigned slot = slotOf(label, 0);
+        const size_t index = rank(node->present, slot);
+        if (node->present >> slot & 1) {
+            node->values[index] = std::move(value);
+        } else {
+            node->values.insert(node->values.begin() + index, std::move(value));
+            node->present |= uint64_t(1) << slot;
+            ++count;
+        }
+    }
+
+    // False if label was not in the map
+    bool erase(size_t label)
+    {
+        if (!contains(label))
+            return false;
+        // The nodes on the way down, so emptied ones can be unlinked on the way up
+        Node* path[maxHeight + 1];
+        Node* node = writable(root);
+        for (unsigned level = height; level > 0; --level) {
+            path[level] = node;
+            node = writable(node->children[rank(node->present, slotOf(label, level))]);
+        }
+        const unsigned slot = slotOf(label, 0);
+        node->values.erase(node->values.begin() + rank(node->present, slot));
+        node->present &= ~(uint64_t(1) << slot);
+        --count;
+        for (unsigned level = 1; level <= height && !node->present; ++level) {
+            node = path[level];
+            const unsigned parentSlot = slotOf(label, level);
+            node->children.erase(node->children.begin() + rank(node->present, parentSlot));
+            node->present &= ~(uint64_t(1) << parentSlot);
+        }
+        if (!root->present)
+            clear();
+        return true;
+    }
+
+    void clear()
+    {
+        root.reset();
+        height = 0;
+        count = 0;
+    }
+
+    // Calls f(label, value) for every entry, in increasing label order
+    template <typename F>
+    void forEach(F f) const
+    {
+        if (root)
+            visit(root.get(), height, 0, f);
+    }
+
+    // Calls onSet(label, value) for every entry of to that from lacks or holds another
+    // value for, and onErase(label) for every label of from that to lacks. Subtrees the
+    // two copies still share are skipped, so comparing a table with a copy of itself
+    // made a few changes ago costs about those changes.
+    template <typename OnSet, typename OnErase>
+    static void diff(const LabelMap& from, const LabelMap& to, OnSet onSet, OnErase onErase)
+    {
+        // Bring both roots to the same height; a taller trie's slot 0 holds the shorter one's labels
+        std::shared_ptr<const Node> a = from.root, b = to.root;
+        for (unsigned h = from.height; h < to.height; ++h)
+            a = lifted(std::move(a));
+        for (unsigned h = to.height; h < from.height; ++h)
+            b = lifted(std::move(b));
+        diffNodes(a.get(), b.get(), std::max(from.height, to.height), 0, onSet, onErase);
+    }
+
+private:
+    static constexpr unsigned bits = 6;       // 64 slots per node
+    static constexpr unsigned maxHeight = 10; // 11 levels of 6 bits cover 64-bit labels
+
+    // present has a bit per filled slot; the filled slots' children (inner nodes) or
+    // values (leaves) are stored in slot order without gaps
+    struct Node {
+        uint64_t present = 0;
+        std::vector<std::shared_ptr<Node>> children;
+        std::vector<T> values;
+    };
+
+    static bool fits(size_t label, unsigned height)
+    {
+        return height >= maxHeight || (static_cast<uint64_t>(label) >> (bits * (height + 1))) == 0;
+    }
+    static unsigned slotOf(size_t label, unsigned level)
+    {
+        return static_cast<unsigned>(static_cast<uint64_t>(label) >> (bits * level) & 63);
+    }
+    // Index of slot among the filled ones
+    static size_t rank(uint64_t present, unsigned slot)
+    {
+        return std::bitset<64>(present & ((uint64_t(1) << slot) - 1)).count();
+    }
+
+    // The node, copied first if another copy of the map shares it
+    static Node* writable(std::shared_ptr<Node>& node)
+    {
+        if (node.use_count() != 1)
+            node = std::make_shared<Node>(*node);
+        else
+            std::atomic_thread_fence(std::memory_order_acquire); // pairs with the release of the last other owner
+        return node.get();
+    }
+
+    static std::shared_ptr<const Node> lifted(std::shared_ptr<const Node> node)
+    {
+        if (!node)
+            return node;
+        auto parent = std::make_shared<Node>();
+        parent->present = 1;
+        parent->children.push_back(std::const_pointer_cast<Node>(std::move(node)));
+        return parent;
+    }
+
+    template <typename F>
+    static void visit(const Node* node, unsigned level, size_t base, F& f)
+    {
+        size_t index = 0;
+        for (uint64_t rest = node->present; rest; rest &= rest - 1, ++index) {
+            const size_t label = base | static_cast<size_t>(slotOfLowest(rest)) << (bits * level);
+            if (level == 0)
+                f(label, node->values[index]);
+            else
+                visit(node->children[index].get(), level - 1, label, f);
+        }
+    }
+
+    template <typename OnSet, typename OnErase>
+    static void diffNodes(const Node* a, const Node* b, unsigned level, size_t base, OnSet& onSet, OnErase& onErase)
+    {
+        if (a == b)
+            return;
+        if (!a) {
+            visit(b, level, base, onSet);
+            return;
+        }
+        if (!b) {
+            const auto erased = [&](size_t label, const T&) { onErase(label); };
+            visit(a, level, base, erased);
+            return;
+        }
+        for (uint64_t rest = a->present | b->present; rest; rest &= rest - 1) {
+            const unsigned slot = slotOfLowest(rest);
+            const size_t label = base | static_cast<size_t>(slot) << (bits * level);
+            const bool inA = a->present >> slot & 1, inB = b->present >> slot & 1;
+            if (level == 0) {
+                if (!inB)
+                    onErase(label);
+                else if (!inA || !(a->values[rank(a->present, slot)] == b->values[rank(b->present, slot)]))
+                    onSet(label, b->values[rank(b->present, slot)]);
+            } else {
+                diffNodes(inA ? a->children[rank(a->present, slot)].get() : nullptr,
+                          inB ? b->children[rank(b->present, slot)].get() : nullptr,
+                          level - 1, label, onSet, onErase);
+            }
+        }
+    }
+
+    static unsigned slotOfLowest(uint64_t present)
+    {
+        return static_cast<unsigned>(std::bitset<64>((present & (0 - present)) - 1).count());
+    }
+
+    std::shared_ptr<Node> root;
+    unsigned height = 0; // levels above the leaves
+    size_t count = 0;
+};
@@ -0,0 +1,74 @@
+// LabelSet.hpp
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "hnswlib/hnswlib.h"
+
+// Set of graph labels as a bitset: one bit per label up to the largest one in the set.
+// FaceIndex labels are dense (handed out in sequence), so a million templates cost
+// 128 KiB and membership is two loads and a shift, cheap enough to test for every
+// node a graph search visits.
+//
+// The bits are kept in chunks of 32768 labels that copies share until one of them
+// writes to a chunk, so the copy FaceIndex makes to add a template to a published
+// group copies one 4 KiB chunk rather than the whole set.
+class LabelSet {
+public:
+    bool contains(size_t label) const
+    {
+        const size_t chunk = label / chunkLabels;
+        if (chunk >= chunks.size() || !chunks[chunk])
+            return false;
+        const size_t bit = label % chunkLabels;
+        return (*chunks[chunk])[bit / 64] >> (bit % 64) & 1;
+    }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    void insert(size_t label);
+    void erase(size_t label);
+    void unite(const LabelSet& other);
+
+    // Calls f(label) for every label in the set, in increasing order
+    template <typename F>
+    void forEach(F f) const
+    {
+        for (size_t c = 0; c < chunks.size(); ++c) {
+            if (!chunks[c])
+                continue;
+            const Chunk& words = *chunks[c];
+            for (size_t w = 0; w < chunkWords; ++w) {
+                if (!words[w])
+                    continue;
+                for (size_t b = 0; b < 64; ++b) {
+                    if (words[w] >> b & 1)
+                        f(c * chunkLabels + w * 64 + b);
+                }
+            }
+        }
+    }
+
+private:
+    static constexpr size_t chunkWords = 512;
+    static constexpr size_t chunkLabels = chunkWords * 64;
+    using Chunk = std::array<uint64_t, chunkWords>;
+
+    Chunk& writableChunk(size_t chunk); // copied first if another set shares it
+
+    std::vector<std::shared_ptr<Chunk>> chunks; // null while none of its labels is in the set
+    size_t count = 0;
+};
+
+// hnswlib search filter that lets through the labels of a LabelSet
+class LabelSetFilter : public hnswlib::BaseFilterFunctor {
+public:
+    explicit LabelSetFilter(const LabelSet& labels) : labels(labels) {}
+    bool operator()(hnswlib::labeltype label) override { return labels.contains(label); }
+
+private:
+    const LabelSet& labels;
+};
@@ -13,7 +13,8 @@
 #include "FaceDetector.hpp"
 #include "config.h"
 #include "FaceEmbedder.hpp"
-#include "FaceIndex.hpp"
+#include "ShardedFaceIndex.hpp"
+#include "RecognitionPipeline.hpp"
 #include <memory>
 #include <QAction> // Added for QAction
 #include <QMenuBar> // Added for menuBar()
@@ -47,7 +48,7 @@ public:
     explicit MainWindow(const AppConfig &config, QWidget *parent = nullptr);
     ~MainWindow();
     std::unique_ptr<FaceEmbedder> embedder = nullptr;       // For embedding
-    std::unique_ptr<FaceIndex> faceIndex = nullptr;         // For storing/searching
+    std::unique_ptr<ShardedFaceIndex> faceIndex = nullptr;         // For storing/searching
     std::vector<std::string> recentResults; // To track per-frame results
     
 
@@ -56,28 +57,31 @@ public:
 private slots:
     void onVideoFrame(const QVideoFrame &frame); // <-- For Qt 6 video frame callback
     void onRegisterUser();     
-    QImage cropFace(const QImage &img, const FaceDetection &fd);
-    QImage alignFace(const QImage &sourceImage, const FaceDetection &detectedFace); // Added for face alignment
     void openSettingsDialog(); // Slot to open settings dialog
     void populateUserTable(); // Slot to populate the user table
     void onDeleteUserClicked(); // Slot for delete user button
     void onEditUserNameClicked(); // Slot for edit user name button
+    void onEditUserGroupsClicked(); // Slot for edit user groups button
     void populateAttendanceTable(); // Slot to populate the attendance table
+    void updatePipelineStatus(); // Slot to show pipeline queue occupancy in the status bar
+    void refreshFaceIndexSnapshot(); // Slot to follow the writer's snapshots in read-only mode
+    void onTuneFaceSearch(); // Slot to tune the face index's search ef for a target recall
 
 
 private:
+    void loadFaceIndex(); // (Re)creates faceIndex from the configured database, with a progress dialog
+
     Ui::MainWindow *ui;
     QMenu *fileMenu; // Added for File menu
     QAction *settingsAction; // Added for Settings action
+    QAction *tuneSearchAction;
     QTimer *timer;
+    QTimer *pipelineStatusTimer;
+    QTimer *snapshotTimer;
     std::unique_ptr<FaceDetector> detector; // Changed to unique_ptr
     QImage lastFrame;
     AppConfig m_appConfig; // Added AppConfig member
 
-    // For attendance log debouncing
-    std::unordered_map<size_t, QDateTime> m_lastLogTimestamps;
-    int m_attendanceLogDebounceSecs = 10; // Default, consider making this part of AppConfig later
-
     // UI elements for User Management Tab
     QTabWidget *mainTabWidget;
     QWidget *liveViewTab; // To hold the camera feed
@@ -87,6 +91,7 @@ private:
     QPushButton *refreshUserListButton;
     QPushButton *deleteUserButton; // Button to delete selected user
     QPushButton *editUserNameButton; // Button to edit selected user's name
+    QPushButton *editUserGroupsButton; // Button to edit selected user's groups
 
     // UI elements for Attendance Log Tab
     QWidget *attendanceLogTab;
@@ -99,25 +104,6 @@ private:
     QMediaCaptureSession *captureSession;
     QVideoSink *videoSink;
 
- struct CachedFace {
-    QRect box;
-    std::string name;
-    float conf;
-    // You can add landmark points here if you want landmark overlay cached too
-    float left_eye_x, left_eye_y;
-    float right_eye_x, right_eye_y;
-    float nose_x, nose_y;
-    float mouth_x, mouth_y;
-    float left_cheek_x, left_cheek_y;
-    float right_cheek_x, right_cheek_y;
-    int ttl; // frames left
-    float similarity;
-     size_t userId = 0; // Added for attendance logging
-};
-
-int frameCount = 0;
-const int frameSkip = 3;  // ONNX every 3rd frame
-const int cacheTTL  = 3;  // how many frames to keep a detection
-std::vector<CachedFace> faceCache;
-
+    // Staged detection/recognition pipeline; declared last so it is destroyed before the components it uses
+    std::unique_ptr<RecognitionPipeline> recognitionPipeline;
 };
@@ -0,0 +1,41 @@
+// MappedFile.hpp
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file (POSIX mmap / Win32 file mapping).
+// Pages come from the OS page cache, so every process mapping the same file
+// shares one physical copy. Throws std::runtime_error if the file cannot be mapped.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    const std::string& path() const { return path_; }
+
+    // Hint that the whole file will be read soon (best effort)
+    void prefetch() const;
+    // Starts reading [offset, offset + length) in the background and returns at once;
+    // clipped to the file (best effort)
+    void prefetch(size_t offset, size_t length) const;
+    // Hint that reads will be scattered, so a page fault should not read ahead of the
+    // page (best effort; no-op on Windows)
+    void adviseRandom() const;
+
+private:
+    std::string path_;
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    void* fileHandle_ = nullptr;
+    void* mappingHandle_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+};
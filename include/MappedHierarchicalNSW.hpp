@@ -0,0 +1,31 @@
+// MappedHierarchicalNSW.hpp
+#pragma once
+
+#include <memory>
+#include <string>
+#include "hnswlib/hnswlib.h"
+#include "MappedFile.hpp"
+
+// Read-only HierarchicalNSW whose level-0 block (links, vectors, labels) and upper
+// link lists point straight into a memory-mapped file written by saveIndex(),
+// instead of being copied into malloc'd buffers. Every process that maps the same
+// graph file shares one page-cache copy, and opening it only walks the link-list
+// table and builds label_lookup_.
+//
+// Only searches are supported. The mapping is read-only, so anything that writes
+// to the graph (addPoint, markDelete, resizeIndex, ...) would fault; FaceIndex
+// refuses those calls in read-only mode.
+class MappedHierarchicalNSW : public hnswlib::HierarchicalNSW<float> {
+public:
+    // Throws std::runtime_error if the file is not a complete saveIndex() image
+    MappedHierarchicalNSW(hnswlib::SpaceInterface<float>* space, const std::string& path);
+    ~MappedHierarchicalNSW();
+
+    const std::string& path() const { return file->path(); }
+
+private:
+    void mapImage(hnswlib::SpaceInterface<float>* space, const std::string& path);
+    void detach();
+
+    std::unique_ptr<MappedFile> file;
+};
@@ -0,0 +1,59 @@
+// QuantizedSpace.hpp
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "hnswlib/hnswlib.h"
+
+// How FaceIndex stores embeddings inside its graph
+enum class VectorStorage : uint32_t {
+    Float32 = 0, // full precision (CosineSpace)
+    Float16 = 1, // IEEE half per component
+    Int8 = 2     // signed byte per component plus a per-vector scale
+};
+
+// Parses "fp32" / "float32", "fp16" / "float16", "int8"; returns fallback otherwise
+VectorStorage vectorStorageFromString(const std::string& name, VectorStorage fallback);
+const char* vectorStorageName(VectorStorage storage);
+
+// hnswlib space over compressed unit embeddings: distance = 1 - approximate dot product,
+// on the same scale as CosineSpace. Graph elements and queries are both codes, so a
+// query has to be encode()d before it is passed to searchKnn.
+//
+// Code layouts (host byte order):
+//   Float16  dim halves
+//   Int8     float scale, int32 sum of the codes, dim int8 codes; component i is
+//            about scale * code[i], with scale = max |v| / 127. The sum lets the VNNI
+//            kernels (unsigned x signed byte products) score two signed vectors.
+//
+// The kernel is picked at runtime from cpuFeatures(): AVX-512 VNNI, AVX-VNNI or AVX2
+// for Int8, F16C + FMA for Float16, and a scalar loop otherwise.
+class QuantizedSpace : public hnswlib::SpaceInterface<float> {
+public:
+    // storage must be Float16 or Int8; throws std::runtime_error otherwise
+    QuantizedSpace(size_t dim, VectorStorage storage);
+
+    QuantizedSpace(const QuantizedSpace&) = delete; // get_dist_func_param() points into this object
+    QuantizedSpace& operator=(const QuantizedSpace&) = delete;
+
+    size_t get_data_size() override { return codeSize; }
+    hnswlib::DISTFUNC<float> get_dist_func() override { return distance; }
+    void* get_dist_func_param() override { return &dim; }
+
+    VectorStorage storage() const { return mode; }
+    size_t dimension() const { return dim; }
+    // Which kernel was picked, e.g. "avx512-vnni" or "scalar"
+    const char* kernelName() const { return kernel; }
+
+    // v (dim floats) to a get_data_size() byte code, and back (approximately)
+    void encode(const float* v, void* code) const;
+    void decode(const void* code, float* v) const;
+
+private:
+    size_t dim;
+    VectorStorage mode;
+    size_t codeSize;
+    hnswlib::DISTFUNC<float> distance;
+    const char* kernel;
+};
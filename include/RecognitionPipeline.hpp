@@ -0,0 +1,168 @@
+// RecognitionPipeline.hpp
+#pragma once
+
+#include <QImage>
+#include <QRect>
+#include <QDateTime>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "config.h"
+#include "FaceDetector.hpp"
+#include "FaceTracker.hpp"
+#include "HotIdentityCache.hpp"
+#include "SpscQueue.hpp"
+
+class FaceEmbedder;
+class ShardedFaceIndex;
+struct SearchResult;
+
+// One recognized (or unknown) face, ready to be drawn
+struct OverlayFace {
+    int trackId = 0;         // stable across frames while the face is tracked
+    QRect box;
+    std::string name;        // "Unknown" when no match cleared the threshold
+    float conf = 0.0f;       // detector confidence
+    float similarity = 0.0f; // best match similarity
+    size_t userId = 0;       // matched user, for attendance logging
+    FaceDetection detection; // tracked box + landmarks
+};
+
+// Everything the pipeline found in one frame. Published as an immutable snapshot.
+struct RecognitionResult {
+    std::vector<OverlayFace> faces;
+    unsigned long long frameNumber = 0; // number of the frame (as submitted) this result belongs to
+};
+
+// Queue depths and drop policies; see AppConfig::pipeline* for the configurable values
+struct PipelineOptions {
+    size_t frameQueueDepth = 1;                        // GUI -> convert
+    DropPolicy frameDropPolicy = DropPolicy::DropOldest;
+    size_t stageQueueDepth = 2;                        // between the worker stages
+    DropPolicy stageDropPolicy = DropPolicy::Block;
+
+    static PipelineOptions fromConfig(const AppConfig& config);
+};
+
+// Counters for one stage and the queue feeding it
+struct PipelineStageStats {
+    const char* name = "";
+    QueueStats input;
+    uint64_t processed = 0;  // items this stage finished
+    double avgBusyMs = 0.0;  // mean time spent per item
+};
+
+// How often the hot identity cache answered a query without a graph search
+struct HotIdentityStats {
+    uint64_t lookups = 0;
+    uint64_t hits = 0;
+    double hitRate() const { return lookups ? double(hits) / lookups : 0.0; }
+};
+
+// Detection, alignment, embedding, index search and attendance logging split into
+// four stages, each on its own thread:
+//
+//   submitFrame -> [convert] -> [detect] -> [track, align + embed] -> [search + attendance] -> latestResult
+//
+// Detections are fed through a FaceTracker first; only tracks that are new or whose
+// identity confidence has decayed are aligned, embedded and searched. The search
+// stage reports identities back to the tracker, and every other track keeps its name.
+// It scores each embedding against the recently matched identities first (see
+// HotIdentityCache) and searches the index only for the faces no cached identity
+// matches with hotIdentityMargin to spare. With cameraAllowedGroups set, both only
+// consider the users in those groups (see FaceIndex::groupLabels); anyone else stays
+// Unknown. The index may be split into shards; a search covers all of them.
+//
+// Stages are connected by bounded SPSC queues, so while frame N is being embedded
+// frame N+1 is already in the detector. By default the frame queue holds just the
+// newest frame (DropOldest) and the inner queues block, which pushes backpressure
+// to the front of the pipeline, where stale frames are cheapest to drop.
+class RecognitionPipeline {
+public:
+    // The components must outlive the pipeline (destroy the pipeline first)
+    RecognitionPipeline(FaceDetector* detector, FaceEmbedder* embedder, ShardedFaceIndex* faceIndex,
+                        const AppConfig& config);
+    ~RecognitionPipeline(); // Stops and joins all stage threads
+
+    RecognitionPipeline(const RecognitionPipeline&) = delete;
+    RecognitionPipeline& operator=(const RecognitionPipeline&) = delete;
+
+    // Called from the GUI thread for every camera frame (the single producer).
+    // Never blocks unless the frame drop policy is Block.
+    void submitFrame(const QImage& frame);
+
+    // Most recent published result; never null
+    std::shared_ptr<const RecognitionResult> latestResult() const;
+
+    // Occupancy and throughput of every stage, in pipeline order
+    std::vector<PipelineStageStats> stats() const;
+    HotIdentityStats hotIdentityStats() const;
+
+private:
+    struct FrameJob {
+        QImage frame;
+        unsigned long long frameNumber = 0;
+        double timestamp = 0.0;           // seconds on a monotonic clock, taken at submit
+    };
+    struct DetectedFrame {
+        QImage frame;
+        unsigned long long frameNumber = 0;
+        double timestamp = 0.0;
+        std::vector<FaceDetection> faces;
+    };
+    struct EmbeddedFrame {
+        unsigned long long frameNumber = 0;
+        std::vector<TrackedFace> tracks;  // every live track
+        std::vector<size_t> embedded;     // indices into tracks that have an embedding row
+        std::vector<float> embeddings;    // embedded.size() x dim, row-major
+        int dim = 0;
+    };
+
+    struct StageCounters {
+        std::atomic<uint64_t> processed{0};
+        std::atomic<uint64_t> busyMicros{0};
+    };
+
+    enum Stage { Convert, Detect, Embed, Match, StageCount };
+
+    template <typename In, typename Fn>
+    void runStage(SpscQueue<In>& input, Stage stage, Fn work);
+
+    void convert(FrameJob& job);
+    void detect(FrameJob& job);
+    void embed(DetectedFrame& job);
+    void match(EmbeddedFrame& job);
+    void logAttendance(const SearchResult& match);
+    void cancelIdentities(const EmbeddedFrame& job);
+
+    FaceDetector* detector;
+    FaceEmbedder* embedder;
+    ShardedFaceIndex* faceIndex;
+    AppConfig config;
+    PipelineOptions options;
+    std::vector<std::string> allowedGroups;  // parsed cameraAllowedGroups; empty = everyone
+
+    SpscQueue<FrameJob> frameQueue;          // GUI -> convert
+    SpscQueue<FrameJob> convertedQueue;      // convert -> detect
+    SpscQueue<DetectedFrame> detectedQueue;  // detect -> embed
+    SpscQueue<EmbeddedFrame> embeddedQueue;  // embed -> match
+    FaceTracker tracker;                     // updated by the embed stage, identities set by the match stage
+    HotIdentityCache hotIdentities;          // match stage only
+    std::atomic<uint64_t> hotLookups{0};
+    std::atomic<uint64_t> hotHits{0};
+    StageCounters counters[StageCount];
+    std::atomic<bool> stopping{false};
+    unsigned long long submittedFrames = 0;  // GUI thread only
+
+    // Accessed only through std::atomic_load / std::atomic_store
+    std::shared_ptr<const RecognitionResult> published;
+
+    // For attendance log debouncing (match stage only); attendance is logged when a track is identified
+    std::unordered_map<size_t, QDateTime> lastLogTimestamps;
+    int attendanceLogDebounceSecs = 10; // Default, consider making this part of AppConfig later
+
+    std::vector<std::thread> threads; // Started last, after every member above is initialized
+};
@@ -30,6 +30,9 @@ private:
     QDoubleSpinBox* iouThreshDoubleSpinBox;
     QDoubleSpinBox* similarityThresholdDoubleSpinBox;
     QSpinBox* maxFaceIndexSizeSpinBox;
+    QDoubleSpinBox* searchConfidenceMarginDoubleSpinBox;
+    QSpinBox* searchTimeBudgetSpinBox;
+    QSpinBox* searchHopBudgetSpinBox;
 
     QDialogButtonBox* buttonBox;
 
@@ -0,0 +1,117 @@
+// ShardedFaceIndex.hpp
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "FaceIndex.hpp"
+
+class ThreadPool;
+
+// FaceIndex split into shardCount independent shards, each a complete FaceIndex with a
+// graph, writer mutex, journal and background compaction and rebuild of its own. Users
+// are spread over the shards; registrations on different shards do not wait for each
+// other, and no graph (nor its entry point and level-promotion lock) has to hold the
+// whole gallery.
+//
+// Shard s hands out the labels s, s + shardCount, s + 2 * shardCount... (see
+// FaceIndex::setShard), so ids are unique across shards and an id's shard is
+// id % shardCount. A new user goes to the shard with the fewest users.
+//
+// Searches fan out: every shard answers the batch on a small thread pool (the calling
+// thread takes one shard itself) and the per-shard top-k lists are merged into one.
+// A user lives in one shard, so the merged users are distinct without further work.
+//
+// Each shard persists to files of its own (shardPath(): "face_db-shard2of4.meta", its
+// graph, vectors and journals), so one shard can be rebuilt, reloaded or restored
+// without touching the others. The shard count is part of the database layout; a
+// database saved with another count (or unsharded) is refused by loadFromDisk().
+// With one shard the index is an ordinary FaceIndex at the database path itself.
+//
+// Thread safety is that of FaceIndex.
+class ShardedFaceIndex {
+public:
+    ShardedFaceIndex(int dim, int initialCapacity, size_t shardCount, bool readOnly = false,
+                     VectorStorage storage = VectorStorage::Float32);
+    ~ShardedFaceIndex();
+
+    ShardedFaceIndex(const ShardedFaceIndex&) = delete;
+    ShardedFaceIndex& operator=(const ShardedFaceIndex&) = delete;
+
+    size_t shardCount() const { return shards.size(); }
+    size_t shardOf(size_t label) const { return label % shards.size(); }
+    FaceIndex& shard(size_t index) { return *shards[index]; }
+    // Database path of one shard of the database at path
+    static std::string shardPath(const std::string& path, size_t shard, size_t shardCount);
+
+    bool isReadOnly() const { return shards.front()->isReadOnly(); }
+    VectorStorage vectorStorage() const { return shards.front()->vectorStorage(); }
+
+    // As FaceIndex::add(), on the shard with the fewest users
+    void add(const std::string& name, const std::vector<float>& embedding);
+    // Registers names.size() users (embeddings row-major, one row each), spread evenly
+    // over the shards, which insert their share in parallel. Throws std::runtime_error
+    // when read-only.
+    void addBatch(const std::vector<std::string>& names, const float* embeddings);
+    bool addTemplate(size_t userId, const std::vector<float>& embedding);
+    size_t templateCount(size_t userId);
+
+    SearchResult search(const std::vector<float>& embedding, float threshold = 0.7,
+                        const LabelSet* allowed = nullptr);
+    // As FaceIndex::searchBatch(), merged over the shards. A match is exhaustive only if
+    // every shard searched that query exhaustively.
+    void searchBatch(const float* queries, size_t count, size_t k, SearchMatch* out,
+                     const LabelSet* allowed = nullptr);
+
+    bool getEmbedding(size_t label, std::vector<float>& out);
+
+    // Every shard to its own files next to path; false (and logs) if any shard failed
+    bool saveToDisk(const std::string& path);
+    // Loads the shards in parallel (progress is reported only with one shard, which is
+    // the only layout that imports a legacy CSV). True if every shard loaded; like
+    // FaceIndex::loadFromDisk(), false also for a database not saved yet.
+    bool loadFromDisk(const std::string& path, const FaceIndex::LoadProgress& progress = FaceIndex::LoadProgress());
+    bool refreshSnapshot(const std::string& path); // true if any shard changed
+
+    // Applied to every shard
+    void setCompactionThreshold(uint64_t bytes);
+    void setRebuildThreshold(double deletedFraction);
+    void setRerankCandidates(size_t count);
+    void setDiskResidentVectors(bool enabled);
+    void setSearchBudget(const SearchBudget& budget);
+    void setExactSearchLimit(size_t templates); // per shard: the templates one shard scans
+    SearchStopStats searchStopStats() const;    // per query, averaged over the shards
+
+    // Tunes every shard in turn (progress covers all of them) and returns the report of
+    // the shard that needed the largest ef, which bounds the recall of merged searches
+    SearchTuning tuneSearch(double targetRecall, size_t samples = 200,
+                            const FaceIndex::TuneProgress& progress = FaceIndex::TuneProgress());
+
+    // Merged snapshots of the shards' tables; rebuilt only after a shard has changed its own
+    std::shared_ptr<const FaceIndex::NameTable> getIdToNameMap() const;
+    std::shared_ptr<const FaceIndex::GroupTable> getGroups() const;
+    // Union of the shards' group templates; usable as the filter of any shard
+    std::shared_ptr<const LabelSet> groupLabels(const FaceIndex::GroupList& groups) const;
+
+    bool deleteUser(size_t label);
+    bool updateUserName(size_t label, const std::string& newName);
+    bool setUserGroups(size_t userId, FaceIndex::GroupList groups);
+
+private:
+    // Runs work(shard) for every shard, on the pool and this thread; rethrows the first
+    // failure once all have finished
+    void forEachShard(const std::function<void(size_t shard)>& work);
+
+    size_t dim;
+    std::vector<std::unique_ptr<FaceIndex>> shards;
+    std::unique_ptr<ThreadPool> pool; // shardCount - 1 workers; null with one shard
+
+    // The merged tables and the shard tables they were built from
+    mutable std::mutex mergeMutex;
+    mutable std::vector<std::shared_ptr<const FaceIndex::NameTable>> namesFrom;
+    mutable std::shared_ptr<const FaceIndex::NameTable> mergedNames;
+    mutable std::vector<std::shared_ptr<const FaceIndex::GroupTable>> groupsFrom;
+    mutable std::shared_ptr<const FaceIndex::GroupTable> mergedGroups;
+};
@@ -0,0 +1,215 @@
+// SpscQueue.hpp
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// What a full queue does with a new item
+enum class DropPolicy {
+    Block,      // producer waits for room (backpressure)
+    DropNewest, // producer discards the incoming item
+    DropOldest  // producer evicts the oldest queued item to make room
+};
+
+// Parses "block", "drop-newest" / "newest", "drop-oldest" / "oldest"; returns fallback otherwise
+inline DropPolicy dropPolicyFromString(const std::string& name, DropPolicy fallback) {
+    if (name == "block") return DropPolicy::Block;
+    if (name == "drop-newest" || name == "newest") return DropPolicy::DropNewest;
+    if (name == "drop-oldest" || name == "oldest") return DropPolicy::DropOldest;
+    return fallback;
+}
+
+inline const char* dropPolicyName(DropPolicy policy) {
+    switch (policy) {
+    case DropPolicy::Block: return "block";
+    case DropPolicy::DropNewest: return "drop-newest";
+    case DropPolicy::DropOldest: return "drop-oldest";
+    }
+    return "block";
+}
+
+// Occupancy counters of one queue, readable from any thread
+struct QueueStats {
+    size_t size = 0;            // items queued right now
+    size_t capacity = 0;
+    size_t highWater = 0;       // largest size seen since construction
+    uint64_t pushed = 0;        // items accepted
+    uint64_t dropped = 0;       // items discarded by the drop policy
+};
+
+// Bounded single-producer/single-consumer ring buffer.
+//
+// The fast path is lock-free: head and tail are only written by the consumer and
+// producer respectively and live on separate cache lines. The blocking calls fall
+// back to a mutex + condition variable only while a side is actually idle, and
+// notifications are skipped when nobody is waiting.
+//
+// DropOldest is the exception: eviction makes the producer a second reader, so in
+// that mode reads from the head take a small lock (held for one move).
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity, DropPolicy policy = DropPolicy::Block)
+        : ring(capacity < 1 ? 2 : capacity + 1), // one slot stays empty to tell full from empty
+          dropPolicy(policy) {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    size_t capacity() const { return ring.size() - 1; }
+    DropPolicy policy() const { return dropPolicy; }
+
+    // Producer side. Applies the drop policy when the queue is full; Block waits until
+    // there is room or close() is called. Returns true if the item was queued.
+    bool push(T item) {
+        bool queued = enqueue(item);
+        if (!queued && dropPolicy == DropPolicy::DropOldest) {
+            T evicted;
+            if (dequeue(evicted))
+                dropped.fetch_add(1, std::memory_order_relaxed);
+            queued = enqueue(item); // only this thread adds items, so there is room now
+        }
+        if (!queued && dropPolicy == DropPolicy::DropNewest) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (!queued)
+            waitFor([&] { return (queued = enqueue(item)) || isClosed(); });
+        if (queued)
+            notifyWaiters();
+        return queued;
+    }
+
+    // Consumer side. Waits for an item; returns false once the queue is closed and empty.
+    bool pop(T& out) {
+        bool got = dequeue(out);
+        if (!got)
+            waitFor([&] { return (got = dequeue(out)) || isClosed(); });
+        if (got)
+            notifyWaiters();
+        return got;
+    }
+
+    // Non-blocking variants; no drop accounting
+    bool tryPush(T& item) {
+        if (!enqueue(item))
+            return false;
+        notifyWaiters();
+        return true;
+    }
+
+    bool tryPop(T& out) {
+        if (!dequeue(out))
+            return false;
+        notifyWaiters();
+        return true;
+    }
+
+    // Wakes both sides for shutdown; pending and later push/pop calls return false
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(waitMutex);
+            closed.store(true, std::memory_order_seq_cst);
+        }
+        waitCondition.notify_all();
+    }
+
+    bool isClosed() const { return closed.load(std::memory_order_acquire); }
+
+    size_t size() const {
+        const size_t h = head.load(std::memory_order_acquire);
+        const size_t t = tail.load(std::memory_order_acquire);
+        return t >= h ? t - h : t + ring.size() - h;
+    }
+
+    QueueStats stats() const {
+        QueueStats s;
+        s.size = size();
+        s.capacity = capacity();
+        s.highWater = highWater.load(std::memory_order_relaxed);
+        s.pushed = pushed.load(std::memory_order_relaxed);
+        s.dropped = dropped.load(std::memory_order_relaxed);
+        return s;
+    }
+
+private:
+    size_t increment(size_t i) const { return i + 1 == ring.size() ? 0 : i + 1; }
+
+    bool enqueue(T& item) {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        const size_t next = increment(t);
+        if (next == head.load(std::memory_order_acquire))
+            return false; // full
+        ring[t] = std::move(item);
+        tail.store(next, std::memory_order_seq_cst);
+        pushed.fetch_add(1, std::memory_order_relaxed);
+        updateHighWater();
+        return true;
+    }
+
+    bool dequeue(T& out) {
+        if (dropPolicy != DropPolicy::DropOldest)
+            return dequeueUnlocked(out);
+        std::lock_guard<std::mutex> lock(evictMutex);
+        return dequeueUnlocked(out);
+    }
+
+    bool dequeueUnlocked(T& out) {
+        const size_t h = head.load(std::memory_order_acquire);
+        if (h == tail.load(std::memory_order_acquire))
+            return false; // empty
+        out = std::move(ring[h]);
+        ring[h] = T(); // release whatever the slot held (e.g. image data) right away
+        head.store(increment(h), std::memory_order_seq_cst);
+        return true;
+    }
+
+    void updateHighWater() {
+        const size_t now = size();
+        size_t seen = highWater.load(std::memory_order_relaxed);
+        while (now > seen && !highWater.compare_exchange_weak(seen, now, std::memory_order_relaxed)) {}
+    }
+
+    // The waiter announces itself before re-checking under the mutex, and the other
+    // side publishes head/tail before reading `waiters`, so either the waiter sees the
+    // new state or the other side sees the waiter and notifies. `ready` runs under
+    // waitMutex, so it must not notify.
+    template <typename Ready>
+    void waitFor(Ready ready) {
+        std::unique_lock<std::mutex> lock(waitMutex);
+        waiters.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        waitCondition.wait(lock, ready);
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void notifyWaiters() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_seq_cst) == 0)
+            return;
+        { std::lock_guard<std::mutex> lock(waitMutex); }
+        waitCondition.notify_all();
+    }
+
+    std::vector<T> ring; // not "slots": Qt defines that as a macro
+    const DropPolicy dropPolicy;
+
+    alignas(64) std::atomic<size_t> head{0}; // next slot to read (consumer)
+    alignas(64) std::atomic<size_t> tail{0}; // next slot to write (producer)
+
+    alignas(64) std::atomic<size_t> highWater{0};
+    std::atomic<uint64_t> pushed{0};
+    std::atomic<uint64_t> dropped{0};
+
+    std::mutex evictMutex; // DropOldest only
+    std::atomic<int> waiters{0};
+    std::atomic<bool> closed{false};
+    std::mutex waitMutex;
+    std::condition_variable waitCondition;
+};
@@ -0,0 +1,39 @@
+// TemplateSpace.hpp
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "hnswlib/hnswlib.h"
+
+// hnswlib space for face templates grouped into identities: a graph element is an
+// embedding as the inner space stores it (CosineSpace or QuantizedSpace) followed by
+// the u64 id of the identity it belongs to. This is hnswlib's multi-vector layout
+// (BaseMultiVectorSpace, doc id = identity), so MultiVectorSearchStopCondition can
+// collect the nearest identities instead of the nearest templates.
+//
+// Distances only read the leading embedding, so the inner space's kernel is used as
+// is and queries are passed without an identity id.
+class TemplateSpace : public hnswlib::BaseMultiVectorSpace<uint64_t> {
+public:
+    // inner must outlive this space
+    explicit TemplateSpace(hnswlib::SpaceInterface<float>& inner);
+
+    TemplateSpace(const TemplateSpace&) = delete;
+    TemplateSpace& operator=(const TemplateSpace&) = delete;
+
+    size_t get_data_size() override { return dataSize; }
+    hnswlib::DISTFUNC<float> get_dist_func() override { return distance; }
+    void* get_dist_func_param() override { return param; }
+
+    uint64_t get_doc_id(const void* datapoint) override;
+    void set_doc_id(void* datapoint, uint64_t identity) override;
+
+    // Bytes of the embedding before the identity id (the inner space's data size)
+    size_t codeSize() const { return innerSize; }
+
+private:
+    size_t innerSize;
+    size_t dataSize;
+    hnswlib::DISTFUNC<float> distance;
+    void* param;
+};
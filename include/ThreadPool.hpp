@@ -0,0 +1,37 @@
+// ThreadPool.hpp
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running queued tasks in FIFO order.
+// submit() returns a future that becomes ready when the task has run; an exception
+// thrown by the task is stored in it. The destructor finishes the queued tasks first.
+class ThreadPool {
+public:
+    // threads = 0 uses one thread per hardware thread
+    explicit ThreadPool(size_t threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return workers.size(); }
+
+    std::future<void> submit(std::function<void()> task);
+
+private:
+    void workerLoop();
+
+    std::mutex mutex;
+    std::condition_variable taskReady;
+    std::deque<std::packaged_task<void()>> tasks;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+};
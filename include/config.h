@@ -9,10 +9,35 @@ struct AppConfig {
     std::string modelPath = "assets/models/blaze.onnx";
     std::string arcfaceModelPath = "assets/models/arc.onnx";
     std::string faceDatabasePath = "face_db.csv";
-    float similarityThreshold = 0.85f;
-    int maxFaceIndexSize = 10000;
+    float similarityThreshold = 0.73f; // cosine similarity of the embeddings
+    int maxFaceIndexSize = 10000; // initial face index capacity; the index grows past it as needed
+    int faceIndexShards = 1;      // independent graphs the gallery is split over (see ShardedFaceIndex)
+    bool faceIndexReadOnly = false; // map the saved database read-only and follow a writer's snapshots
+    int faceIndexCompactionMB = 4;  // fold the change journal into a new snapshot past this size
+    int faceIndexRebuildDeletedPercent = 20; // rebuild the graph once this share of its entries are deleted
+    std::string faceIndexVectorStorage = "fp32"; // fp32, fp16 or int8 vectors in the graph
+    int faceIndexRerankCandidates = 32;  // with fp16/int8, re-score this many candidates in fp32 (0 = off)
+    bool faceIndexDiskVectors = false;   // keep those fp32 copies in a memory-mapped file, not in RAM
+    // Early end of a face search (see FaceSearchStopCondition); cut-short results report it.
+    // Off by default: searches then explore fully and give the same answer every run.
+    float searchConfidenceMargin = 0.0f;  // stop once a match clears similarityThreshold by this much (0 = off)
+    int searchTimeBudgetUs = 0;           // wall time per query (0 = unlimited)
+    int searchHopBudget = 0;              // graph nodes expanded per query (0 = unlimited)
+    int exactSearchMaxFaces = 512;        // scan every template instead of the graph up to this many (0 = never)
+    float searchTargetRecall = 0.95f;     // proposed by File > Tune Face Search (see FaceIndex::tuneSearch)
+    std::string cameraAllowedGroups;      // comma-separated user groups the camera recognizes (empty = everyone)
     std::string attendanceLogPath = "attendance_log.csv";
 
+    // Recently matched identities scored exactly before the graph search (see HotIdentityCache)
+    int hotIdentityCacheSize = 256;     // entries; 0 disables the cache
+    float hotIdentityMargin = 0.05f;    // a cached match must clear similarityThreshold by this much
+
+    // Recognition pipeline queues (see RecognitionPipeline)
+    int pipelineFrameQueueDepth = 1;                       // camera frames waiting for the pipeline
+    std::string pipelineFrameDropPolicy = "drop-oldest";   // block, drop-newest or drop-oldest
+    int pipelineStageQueueDepth = 2;                       // items between two worker stages
+    std::string pipelineStageDropPolicy = "block";
+
     // Loads config from QSettings, then environment, with defaults and validation
     void loadInitialConfig();
 };
@@ -0,0 +1,93 @@
+// CosineSpace.cpp
+
+#include "CosineSpace.hpp"
+#include "CpuFeatures.hpp"
+#include <utility>
+
+#ifdef FACEPUNCH_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+#ifdef FACEPUNCH_X86
+
+// Four independent accumulators hide the FMA latency. The index_sequence expands into
+// one load/load/FMA per block, so the loop is unrolled for the given size by the
+// front end instead of being left to the optimizer.
+
+template <size_t... Block>
+FACEPUNCH_TARGET("avx2,fma")
+inline void dotBlocksAvx2(const float* a, const float* b, __m256* acc, std::index_sequence<Block...>) {
+    ((acc[Block % 4] = _mm256_fmadd_ps(_mm256_loadu_ps(a + 8 * Block), _mm256_loadu_ps(b + 8 * Block), acc[Block % 4])), ...);
+}
+
+template <size_t Dim>
+FACEPUNCH_TARGET("avx2,fma")
+float cosineDistanceAvx2(const void* a, const void* b, const void*) {
+    static_assert(Dim % 32 == 0, "four 8-float accumulators per step");
+    __m256 acc[4] = {_mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps()};
+    dotBlocksAvx2(static_cast<const float*>(a), static_cast<const float*>(b), acc, std::make_index_sequence<Dim / 8>());
+    const __m256 sum8 = _mm256_add_ps(_mm256_add_ps(acc[0], acc[1]), _mm256_add_ps(acc[2], acc[3]));
+    __m128 sum4 = _mm_add_ps(_mm256_castps256_ps128(sum8), _mm256_extractf128_ps(sum8, 1));
+    sum4 = _mm_add_ps(sum4, _mm_movehl_ps(sum4, sum4));
+    sum4 = _mm_add_ss(sum4, _mm_movehdup_ps(sum4));
+    return 1.0f - _mm_cvtss_f32(sum4);
+}
+
+template <size_t... Block>
+FACEPUNCH_TARGET("avx512f")
+inline void dotBlocksAvx512(const float* a, const float* b, __m512* acc, std::index_sequence<Block...>) {
+    ((acc[Block % 4] = _mm512_fmadd_ps(_mm512_loadu_ps(a + 16 * Block), _mm512_loadu_ps(b + 16 * Block), acc[Block % 4])), ...);
+}
+
+template <size_t Dim>
+FACEPUNCH_TARGET("avx512f")
+float cosineDistanceAvx512(const void* a, const void* b, const void*) {
+    static_assert(Dim % 64 == 0, "four 16-float accumulators per step");
+    __m512 acc[4] = {_mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps()};
+    dotBlocksAvx512(static_cast<const float*>(a), static_cast<const float*>(b), acc, std::make_index_sequence<Dim / 16>());
+    return 1.0f - _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(acc[0], acc[1]), _mm512_add_ps(acc[2], acc[3])));
+}
+
+template <size_t Dim>
+hnswlib::DISTFUNC<float> kernelFor(const CpuFeatures& cpu, const char** name) {
+    if (cpu.avx512f) {
+        if (name) *name = Dim == 128 ? "avx512 x128" : Dim == 256 ? "avx512 x256" : "avx512 x512";
+        return cosineDistanceAvx512<Dim>;
+    }
+    if (cpu.avx2 && cpu.fma) {
+        if (name) *name = Dim == 128 ? "avx2 x128" : Dim == 256 ? "avx2 x256" : "avx2 x512";
+        return cosineDistanceAvx2<Dim>;
+    }
+    return nullptr;
+}
+
+#endif // FACEPUNCH_X86
+
+} // namespace
+
+hnswlib::DISTFUNC<float> CosineSpace::specializedKernel(size_t dim, const char** name)
+{
+#ifdef FACEPUNCH_X86
+    const CpuFeatures& cpu = cpuFeatures();
+    switch (dim) {
+    case 128: return kernelFor<128>(cpu, name);
+    case 256: return kernelFor<256>(cpu, name);
+    case 512: return kernelFor<512>(cpu, name);
+    default: break;
+    }
+#else
+    (void)dim;
+    (void)name;
+#endif
+    return nullptr;
+}
+
+CosineSpace::CosineSpace(size_t dim_)
+    : dim(dim_), dataSize(dim_ * sizeof(float)), generic(dim_), distance(nullptr), kernel("hnswlib")
+{
+    distance = specializedKernel(dim, &kernel);
+    if (!distance)
+        distance = generic.get_dist_func();
+}
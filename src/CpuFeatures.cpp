@@ -0,0 +1,82 @@
+// CpuFeatures.cpp
+
+#include "CpuFeatures.hpp"
+#include <cstdint>
+
+#ifdef FACEPUNCH_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#ifdef FACEPUNCH_X86
+static void cpuid(int out[4], int leaf, int subleaf) {
+#ifdef _MSC_VER
+    __cpuidex(out, leaf, subleaf);
+#else
+    unsigned int a, b, c, d;
+    __cpuid_count(leaf, subleaf, a, b, c, d);
+    out[0] = int(a); out[1] = int(b); out[2] = int(c); out[3] = int(d);
+#endif
+}
+
+// Reads XCR0, which tells which register states the OS saves on context switch
+static uint64_t readXcr0() {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    uint32_t eax, edx;
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (uint64_t(edx) << 32) | eax;
+#endif
+}
+
+static CpuFeatures detectCpuFeatures() {
+    CpuFeatures f;
+    int info[4];
+
+    cpuid(info, 0, 0);
+    int maxLeaf = info[0];
+    if (maxLeaf < 1) return f;
+
+    cpuid(info, 1, 0);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    f.sse2 = (info[3] & (1 << 26)) != 0;
+    f.sse41 = (info[2] & (1 << 19)) != 0;
+
+    // AVX state (XMM + YMM) must be enabled by the OS before any VEX code may run
+    uint64_t xcr0 = osxsave ? readXcr0() : 0;
+    const bool osAvx = avx && (xcr0 & 0x6) == 0x6;
+    const bool osAvx512 = osAvx && (xcr0 & 0xe6) == 0xe6;
+    if (!osAvx) return f;
+
+    f.fma = (info[2] & (1 << 12)) != 0;
+    f.f16c = (info[2] & (1 << 29)) != 0;
+
+    if (maxLeaf >= 7) {
+        cpuid(info, 7, 0);
+        f.avx2 = (info[1] & (1 << 5)) != 0;
+        if (osAvx512) {
+            f.avx512f = (info[1] & (1 << 16)) != 0;
+            f.avx512bw = (info[1] & (1 << 30)) != 0;
+            f.avx512vnni = (info[2] & (1 << 11)) != 0;
+        }
+        cpuid(info, 7, 1);
+        f.avxvnni = (info[0] & (1 << 4)) != 0;
+    }
+    return f;
+}
+#else
+static CpuFeatures detectCpuFeatures() {
+    return CpuFeatures{};
+}
+#endif
+
+const CpuFeatures& cpuFeatures() {
+    static const CpuFeatures features = detectCpuFeatures();
+    return features;
+}
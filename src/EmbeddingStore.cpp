@@ -0,0 +1,275 @@
+// EmbeddingStore.cpp
+
+#include "EmbeddingStore.hpp"
+#include "MappedFile.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+
+const char storeMagic[4] = {'F', 'P', 'E', 'V'};
+constexpr uint32_t storeVersion = 1;
+constexpr size_t headerSize = 64;
+
+struct StoreHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t dim;
+    uint32_t labelStride; // 0 = 1
+    uint64_t rows;
+};
+static_assert(sizeof(StoreHeader) <= headerSize, "header fits its padding");
+
+} // namespace
+
+struct EmbeddingStore::Chunk {
+    explicit Chunk(size_t dim)
+        : rows(new float[rowsPerChunk * dim]()), present(new std::atomic<bool>[rowsPerChunk]) {
+        for (size_t i = 0; i < rowsPerChunk; ++i)
+            present[i].store(false, std::memory_order_relaxed);
+    }
+    std::unique_ptr<float[]> rows;
+    std::unique_ptr<std::atomic<bool>[]> present; // set after the row is written
+    size_t live = 0; // writer only
+};
+
+// The rows of a file loaded in disk-resident mode, read in place
+struct EmbeddingStore::Mapping {
+    Mapping(std::unique_ptr<MappedFile> file, size_t rows, size_t dim)
+        : file(std::move(file)), present(new std::atomic<bool>[rows]), rows(rows), rowBytes(dim * sizeof(float)) {}
+    const float* row(size_t r) const
+    {
+        return reinterpret_cast<const float*>(file->data() + headerSize + r * rowBytes);
+    }
+    std::unique_ptr<MappedFile> file;
+    std::unique_ptr<std::atomic<bool>[]> present; // from the file; cleared by erase()
+    size_t rows, rowBytes;
+};
+
+const float* EmbeddingStore::Snapshot::find(size_t label) const
+{
+    if (!table)
+        return nullptr;
+    const size_t r = label / stride;
+    const size_t c = r / rowsPerChunk, row = r % rowsPerChunk;
+    if (c < table->chunks.size() && table->chunks[c]) {
+        const Chunk& chunk = *table->chunks[c];
+        if (chunk.present[row].load(std::memory_order_acquire))
+            return chunk.rows.get() + row * dim;
+    }
+    const Mapping* mapping = table->mapping.get();
+    if (mapping && r < mapping->rows && mapping->present[r].load(std::memory_order_acquire))
+        return mapping->row(r);
+    return nullptr;
+}
+
+void EmbeddingStore::Snapshot::prefetch(size_t label) const
+{
+    const Mapping* mapping = table ? table->mapping.get() : nullptr;
+    const size_t r = label / stride;
+    if (mapping && r < mapping->rows)
+        mapping->file->prefetch(headerSize + r * mapping->rowBytes, mapping->rowBytes);
+}
+
+EmbeddingStore::EmbeddingStore(size_t dim_)
+    : dim(dim_), table(std::make_shared<const Table>())
+{
+}
+
+EmbeddingStore::Snapshot EmbeddingStore::snapshot() const
+{
+    Snapshot s;
+    s.table = std::atomic_load(&table);
+    s.dim = dim;
+    s.stride = labelStride;
+    return s;
+}
+
+void EmbeddingStore::setLabelStride(size_t stride)
+{
+    labelStride = std::max<size_t>(stride, 1);
+}
+
+EmbeddingStore::Chunk& EmbeddingStore::chunkForWrite(size_t row)
+{
+    const size_t c = row / rowsPerChunk;
+    if (c < table->chunks.size() && table->chunks[c])
+        return *table->chunks[c];
+    // Readers may hold the current table, so add the chunk to a copy
+    auto grown = std::make_shared<Table>(*table);
+    if (grown->chunks.size() <= c)
+        grown->chunks.resize(c + 1);
+    grown->chunks[c] = std::make_shared<Chunk>(dim);
+    Chunk& chunk = *grown->chunks[c];
+    std::atomic_store(&table, std::shared_ptr<const Table>(std::move(grown)));
+    return chunk;
+}
+
+void EmbeddingStore::put(size_t label, const float* embedding)
+{
+    // A mapped row is read-only; the new one in memory replaces it
+    const size_t r = label / labelStride;
+    Mapping* mapping = table->mapping.get();
+    if (mapping && r < mapping->rows && mapping->present[r].exchange(false, std::memory_order_relaxed))
+        --count;
+    Chunk& chunk = chunkForWrite(r);
+    const size_t row = r % rowsPerChunk;
+    std::memcpy(chunk.rows.get() + row * dim, embedding, dim * sizeof(float));
+    if (!chunk.present[row].exchange(true, std::memory_order_release)) {
+        ++chunk.live;
+        ++count;
+    }
+}
+
+void EmbeddingStore::erase(size_t label)
+{
+    const size_t r = label / labelStride;
+    Mapping* mapping = table->mapping.get();
+    if (mapping && r < mapping->rows && mapping->present[r].exchange(false, std::memory_order_relaxed))
+        --count;
+    const size_t c = r / rowsPerChunk, row = r % rowsPerChunk;
+    if (c >= table->chunks.size() || !table->chunks[c])
+        return;
+    Chunk& chunk = *table->chunks[c];
+    if (!chunk.present[row].exchange(false, std::memory_order_relaxed))
+        return;
+    --count;
+    if (--chunk.live == 0) {
+        // Labels are not reused, so an emptied chunk is never written again; drop it
+        auto shrunk = std::make_shared<Table>(*table);
+        shrunk->chunks[c].reset();
+        std::atomic_store(&table, std::shared_ptr<const Table>(std::move(shrunk)));
+    }
+}
+
+void EmbeddingStore::clear()
+{
+    std::atomic_store(&table, std::make_shared<const Table>());
+    count = 0;
+}
+
+uint64_t EmbeddingStore::save(const std::string& path, size_t labelLimit) const
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out)
+        throw std::runtime_error("Cannot create embedding file " + path);
+
+    char header[headerSize] = {};
+    StoreHeader h;
+    std::memcpy(h.magic, storeMagic, sizeof(storeMagic));
+    h.version = storeVersion;
+    h.dim = static_cast<uint32_t>(dim);
+    h.labelStride = static_cast<uint32_t>(labelStride);
+    const size_t rows = (labelLimit + labelStride - 1) / labelStride;
+    h.rows = rows;
+    std::memcpy(header, &h, sizeof(h));
+    out.write(header, sizeof(header));
+
+    const Snapshot s = snapshot();
+    const Mapping* mapping = s.table->mapping.get();
+    const std::vector<float> zeros(dim, 0.0f);
+    std::vector<char> present(rows, 0);
+    for (size_t r = 0; r < rows; ++r) {
+        // Mapped rows are read in order (and the mapping does not read ahead): keep the
+        // next chunk's worth on the way
+        if (mapping && r % rowsPerChunk == 0)
+            mapping->file->prefetch(headerSize + r * mapping->rowBytes, 2 * rowsPerChunk * mapping->rowBytes);
+        const float* row = s.find(r * labelStride);
+        present[r] = row ? 1 : 0;
+        out.write(reinterpret_cast<const char*>(row ? row : zeros.data()), static_cast<std::streamsize>(dim * sizeof(float)));
+    }
+    out.write(present.data(), static_cast<std::streamsize>(present.size()));
+    if (!out.flush())
+        throw std::runtime_error("Cannot write embedding file " + path);
+    return headerSize + uint64_t(rows) * dim * sizeof(float) + rows;
+}
+
+void EmbeddingStore::load(const std::string& path)
+{
+    if (diskResident) {
+        mapFile(path);
+        return;
+    }
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("Cannot open embedding file " + path);
+    char header[headerSize];
+    StoreHeader h;
+    if (!in.read(header, sizeof(header)))
+        throw std::runtime_error("Embedding file " + path + " is truncated");
+    std::memcpy(&h, header, sizeof(h));
+    if (std::memcmp(h.magic, storeMagic, sizeof(storeMagic)) != 0 || h.version != storeVersion)
+        throw std::runtime_error("Not a supported embedding file: " + path);
+    if (h.dim != dim)
+        throw std::runtime_error("Embedding file " + path + " has dimension " + std::to_string(h.dim));
+    if (std::max<uint32_t>(h.labelStride, 1) != labelStride)
+        throw std::runtime_error("Embedding file " + path + " has label stride " + std::to_string(h.labelStride));
+
+    const uint64_t rowBytes = uint64_t(dim) * sizeof(float);
+    std::vector<char> present(static_cast<size_t>(h.rows));
+    in.seekg(static_cast<std::streamoff>(headerSize + h.rows * rowBytes));
+    if (!in.read(present.data(), static_cast<std::streamsize>(present.size())))
+        throw std::runtime_error("Embedding file " + path + " is truncated");
+
+    auto loadedTable = std::make_shared<Table>();
+    loadedTable->chunks.resize((static_cast<size_t>(h.rows) + rowsPerChunk - 1) / rowsPerChunk);
+    size_t loaded = 0;
+    in.seekg(static_cast<std::streamoff>(headerSize));
+    for (size_t c = 0; c < loadedTable->chunks.size(); ++c) {
+        const size_t first = c * rowsPerChunk;
+        const size_t rows = std::min<size_t>(rowsPerChunk, static_cast<size_t>(h.rows) - first);
+        const auto begin = present.begin() + static_cast<std::ptrdiff_t>(first);
+        if (std::none_of(begin, begin + static_cast<std::ptrdiff_t>(rows), [](char p) { return p != 0; })) {
+            in.seekg(static_cast<std::streamoff>(rows * rowBytes), std::ios::cur);
+            continue;
+        }
+        auto chunk = std::make_shared<Chunk>(dim);
+        if (!in.read(reinterpret_cast<char*>(chunk->rows.get()), static_cast<std::streamsize>(rows * rowBytes)))
+            throw std::runtime_error("Embedding file " + path + " is truncated");
+        for (size_t r = 0; r < rows; ++r) {
+            if (present[first + r]) {
+                chunk->present[r].store(true, std::memory_order_relaxed);
+                ++chunk->live;
+            }
+        }
+        loaded += chunk->live;
+        loadedTable->chunks[c] = std::move(chunk);
+    }
+    std::atomic_store(&table, std::shared_ptr<const Table>(std::move(loadedTable)));
+    count = loaded;
+}
+
+void EmbeddingStore::mapFile(const std::string& path)
+{
+    auto file = std::make_unique<MappedFile>(path);
+    if (file->size() < headerSize)
+        throw std::runtime_error("Embedding file " + path + " is truncated");
+    StoreHeader h;
+    std::memcpy(&h, file->data(), sizeof(h));
+    if (std::memcmp(h.magic, storeMagic, sizeof(storeMagic)) != 0 || h.version != storeVersion)
+        throw std::runtime_error("Not a supported embedding file: " + path);
+    if (h.dim != dim)
+        throw std::runtime_error("Embedding file " + path + " has dimension " + std::to_string(h.dim));
+    if (std::max<uint32_t>(h.labelStride, 1) != labelStride)
+        throw std::runtime_error("Embedding file " + path + " has label stride " + std::to_string(h.labelStride));
+
+    const size_t rows = static_cast<size_t>(h.rows);
+    if (file->size() != headerSize + rows * dim * sizeof(float) + rows)
+        throw std::runtime_error("Embedding file " + path + " is truncated");
+    auto mapping = std::make_shared<Mapping>(std::move(file), rows, dim);
+    // Searches touch a few scattered rows each; reading ahead of them would only crowd
+    // the page cache
+    mapping->file->adviseRandom();
+    const char* present = mapping->file->data() + headerSize + rows * mapping->rowBytes;
+    size_t loaded = 0;
+    for (size_t r = 0; r < rows; ++r) {
+        mapping->present[r].store(present[r] != 0, std::memory_order_relaxed);
+        loaded += present[r] != 0;
+    }
+    auto mappedTable = std::make_shared<Table>();
+    mappedTable->mapping = std::move(mapping);
+    std::atomic_store(&table, std::shared_ptr<const Table>(std::move(mappedTable)));
+    count = loaded;
+}
@@ -0,0 +1,373 @@
+// ExactGallery.cpp
+
+#include "ExactGallery.hpp"
+#include "CpuFeatures.hpp"
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#ifdef FACEPUNCH_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+constexpr size_t rowAlignment = 64; // bytes; also the padding unit of a row (16 floats)
+constexpr size_t queryGroup = 4;    // queries scored together by one kernel call
+
+struct AlignedDelete {
+    void operator()(float* p) const { ::operator delete[](p, std::align_val_t(rowAlignment)); }
+};
+using AlignedFloats = std::unique_ptr<float[], AlignedDelete>;
+
+AlignedFloats allocateRows(size_t floats)
+{
+    float* p = static_cast<float*>(::operator new[](floats * sizeof(float), std::align_val_t(rowAlignment)));
+    std::memset(p, 0, floats * sizeof(float));
+    return AlignedFloats(p);
+}
+
+// Scores queryGroup queries (each `stride` floats apart) against rowCount rows (a
+// multiple of 4) into scores[i * ExactGallery::blockRows + r]. The row kernels score
+// a single query into scores[r]: a lone query would waste three quarters of a tile.
+using TileKernel = void (*)(const float* queries, size_t stride, const float* rows, size_t rowCount, float* scores);
+
+template <size_t queryCount>
+void scoreScalar(const float* queries, size_t stride, const float* rows, size_t rowCount, float* scores)
+{
+    for (size_t i = 0; i < queryCount; ++i) {
+        const float* q = queries + i * stride;
+        for (size_t r = 0; r < rowCount; ++r) {
+            const float* g = rows + r * stride;
+            float dot = 0.0f;
+            for (size_t d = 0; d < stride; ++d)
+                dot += q[d] * g[d];
+            scores[i * ExactGallery::blockRows + r] = dot;
+        }
+    }
+}
+
+#ifdef FACEPUNCH_X86
+
+FACEPUNCH_TARGET("avx2,fma")
+float horizontalSum(__m256 v)
+{
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    return _mm_cvtss_f32(sum);
+}
+
+// 4 queries x 2 rows per step: eight accumulators plus three live loads fit the 16 ymm registers
+FACEPUNCH_TARGET("avx2,fma")
+void scoreTileAvx2(const float* queries, size_t stride, const float* rows, size_t rowCount, float* scores)
+{
+    for (size_t r = 0; r < rowCount; r += 2) {
+        const float* g0 = rows + r * stride;
+        const float* g1 = g0 + stride;
+        __m256 acc[queryGroup][2];
+        for (size_t i = 0; i < queryGroup; ++i)
+            acc[i][0] = acc[i][1] = _mm256_setzero_ps();
+        for (size_t d = 0; d < stride; d += 8) {
+            const __m256 a = _mm256_load_ps(g0 + d);
+            const __m256 b = _mm256_load_ps(g1 + d);
+            for (size_t i = 0; i < queryGroup; ++i) {
+                const __m256 q = _mm256_loadu_ps(queries + i * stride + d);
+                acc[i][0] = _mm256_fmadd_ps(q, a, acc[i][0]);
+                acc[i][1] = _mm256_fmadd_ps(q, b, acc[i][1]);
+            }
+        }
+        for (size_t i = 0; i < queryGroup; ++i) {
+            scores[i * ExactGallery::blockRows + r] = horizontalSum(acc[i][0]);
+            scores[i * ExactGallery::blockRows + r + 1] = horizontalSum(acc[i][1]);
+        }
+    }
+}
+
+// 1 query x 4 rows per step, so four FMA chains hide the latency
+FACEPUNCH_TARGET("avx2,fma")
+void scoreRowsAvx2(const float* query, size_t stride, const float* rows, size_t rowCount, float* scores)
+{
+    for (size_t r = 0; r < rowCount; r += 4) {
+        const float* g = rows + r * stride;
+        __m256 acc[4] = {_mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps()};
+        for (size_t d = 0; d < stride; d += 8) {
+            const __m256 q = _mm256_loadu_ps(query + d);
+            for (size_t j = 0; j < 4; ++j)
+                acc[j] = _mm256_fmadd_ps(q, _mm256_load_ps(g + j * stride + d), acc[j]);
+        }
+        for (size_t j = 0; j < 4; ++j)
+            scores[r + j] = horizontalSum(acc[j]);
+    }
+}
+
+// 4 queries x 4 rows per step: sixteen accumulators, and each loaded row feeds four FMAs
+FACEPUNCH_TARGET("avx512f")
+void scoreTileAvx512(const float* queries, size_t stride, const float* rows, size_t rowCount, float* scores)
+{
+    for (size_t r = 0; r < rowCount; r += 4) {
+        const float* g = rows + r * stride;
+        __m512 acc[queryGroup][4];
+        for (size_t i = 0; i < queryGroup; ++i)
+            acc[i][0] = acc[i][1] = acc[i][2] = acc[i][3] = _mm512_setzero_ps();
+        for (size_t d = 0; d < stride; d += 16) {
+            const __m512 g0 = _mm512_load_ps(g + d);
+            const __m512 g1 = _mm512_load_ps(g + stride + d);
+            const __m512 g2 = _mm512_load_ps(g + 2 * stride + d);
+            const __m512 g3 = _mm512_load_ps(g + 3 * stride + d);
+            for (size_t i = 0; i < queryGroup; ++i) {
+                const __m512 q = _mm512_loadu_ps(queries + i * stride + d);
+                acc[i][0] = _mm512_fmadd_ps(q, g0, acc[i][0]);
+                acc[i][1] = _mm512_fmadd_ps(q, g1, acc[i][1]);
+                acc[i][2] = _mm512_fmadd_ps(q, g2, acc[i][2]);
+                acc[i][3] = _mm512_fmadd_ps(q, g3, acc[i][3]);
+            }
+        }
+        for (size_t i = 0; i < queryGroup; ++i) {
+            for (size_t j = 0; j < 4; ++j)
+                scores[i * ExactGallery::blockRows + r + j] = _mm512_reduce_add_ps(acc[i][j]);
+        }
+    }
+}
+
+// 1 query x 4 rows per step, so four FMA chains hide the latency
+FACEPUNCH_TARGET("avx512f")
+void scoreRowsAvx512(const float* query, size_t stride, const float* rows, size_t rowCount, float* scores)
+{
+    for (size_t r = 0; r < rowCount; r += 4) {
+        const float* g = rows + r * stride;
+        __m512 acc[4] = {_mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps()};
+        for (size_t d = 0; d < stride; d += 16) {
+            const __m512 q = _mm512_loadu_ps(query + d);
+            for (size_t j = 0; j < 4; ++j)
+                acc[j] = _mm512_fmadd_ps(q, _mm512_load_ps(g + j * stride + d), acc[j]);
+        }
+        for (size_t j = 0; j < 4; ++j)
+            scores[r + j] = _mm512_reduce_add_ps(acc[j]);
+    }
+}
+
+#endif // FACEPUNCH_X86
+
+struct Kernel {
+    const char* name;
+    TileKernel tile; // queryGroup queries
+    TileKernel row;  // one query
+};
+
+Kernel pickKernel()
+{
+#ifdef FACEPUNCH_X86
+    const CpuFeatures& cpu = cpuFeatures();
+    if (cpu.avx512f)
+        return {"avx512 4x4", scoreTileAvx512, scoreRowsAvx512};
+    if (cpu.avx2 && cpu.fma)
+        return {"avx2 4x2", scoreTileAvx2, scoreRowsAvx2};
+#endif
+    return {"scalar", scoreScalar<queryGroup>, scoreScalar<1>};
+}
+
+const Kernel& kernel()
+{
+    static const Kernel picked = pickKernel();
+    return picked;
+}
+
+// Keeps the k best users of one query, most similar first
+void offer(ExactGallery::Match* top, size_t k, float similarity, size_t user, size_t label)
+{
+    if (top[k - 1].found && similarity <= top[k - 1].similarity)
+        return; // the common case: not among the best
+    size_t at = 0;
+    while (at < k && top[at].found && top[at].user != user)
+        ++at;
+    if (at < k && top[at].found) {
+        // A better template of a user already listed
+        if (similarity <= top[at].similarity)
+            return;
+    } else if (at == k) {
+        at = k - 1; // drop the last user
+    }
+    top[at] = {user, label, similarity, true};
+    for (; at > 0 && (!top[at - 1].found || top[at - 1].similarity < top[at].similarity); --at)
+        std::swap(top[at - 1], top[at]);
+}
+
+} // namespace
+
+struct ExactGallery::Block {
+    explicit Block(size_t stride_) : stride(stride_), data(allocateRows(blockRows * stride_)) {}
+    Block(const Block& other) : Block(other.stride)
+    {
+        std::memcpy(data.get(), other.data.get(), blockRows * stride * sizeof(float));
+        std::copy_n(other.labels, blockRows, labels);
+        std::copy_n(other.users, blockRows, users);
+        rows = other.rows;
+    }
+    Block& operator=(const Block&) = delete;
+
+    float* row(size_t r) { return data.get() + r * stride; }
+
+    size_t stride;
+    AlignedFloats data; // blockRows x stride floats; rows past `rows` stay zero
+    size_t labels[blockRows] = {};
+    size_t users[blockRows] = {};
+    size_t rows = 0;
+};
+
+void ExactGallery::Snapshot::search(const float* queries, size_t queryCount, size_t k, Match* out) const
+{
+    if (queryCount == 0 || k == 0)
+        return;
+    std::fill(out, out + queryCount * k, Match());
+    if (!blocks || count == 0)
+        return;
+    const Kernel& score = kernel();
+
+    // Queries padded like the rows. Whole groups go through the tile kernel and the
+    // remaining one to three queries through the row kernel.
+    const size_t groups = queryCount / queryGroup;
+    std::vector<float> padded(queryCount * stride, 0.0f);
+    for (size_t q = 0; q < queryCount; ++q)
+        std::copy_n(queries + q * dim, dim, padded.data() + q * stride);
+
+    // Block by block, so each block is read from memory once and then served from
+    // cache to every query group
+    std::vector<float> scores(queryGroup * blockRows);
+    for (const std::shared_ptr<const Block>& block : *blocks) {
+        const size_t rows = block->rows;
+        const size_t scored = (rows + 3) & ~size_t(3); // whole steps; the padding rows are zero
+        for (size_t g = 0; g < groups; ++g) {
+            score.tile(padded.data() + g * queryGroup * stride, stride, block->data.get(), scored, scores.data());
+            for (size_t i = 0; i < queryGroup; ++i) {
+                Match* top = out + (g * queryGroup + i) * k;
+                const float* s = scores.data() + i * blockRows;
+                for (size_t r = 0; r < rows; ++r)
+                    offer(top, k, s[r], block->users[r], block->labels[r]);
+            }
+        }
+        for (size_t q = groups * queryGroup; q < queryCount; ++q) {
+            score.row(padded.data() + q * stride, stride, block->data.get(), scored, scores.data());
+            Match* top = out + q * k;
+            for (size_t r = 0; r < rows; ++r)
+                offer(top, k, scores[r], block->users[r], block->labels[r]);
+        }
+    }
+}
+
+ExactGallery::ExactGallery(size_t dim_)
+    : dim(dim_), stride((dim_ + 15) & ~size_t(15)), blocks(std::make_shared<const BlockTable>())
+{
+}
+
+const char* ExactGallery::kernelName()
+{
+    return kernel().name;
+}
+
+ExactGallery::Snapshot ExactGallery::snapshot() const
+{
+    Snapshot s;
+    s.blocks = std::atomic_load(&blocks);
+    s.count = s.blocks->empty() ? 0 : (s.blocks->size() - 1) * blockRows + s.blocks->back()->rows;
+    s.dim = dim;
+    s.stride = stride;
+    return s;
+}
+
+std::shared_ptr<ExactGallery::Block> ExactGallery::copyBlock(size_t index) const
+{
+    return std::make_shared<Block>(*(*blocks)[index]);
+}
+
+void ExactGallery::publish(BlockTable table)
+{
+    std::atomic_store(&blocks, std::shared_ptr<const BlockTable>(std::make_shared<BlockTable>(std::move(table))));
+}
+
+void ExactGallery::add(size_t label, size_t user, const float* embedding)
+{
+    BlockTable table = *blocks;
+    size_t position = count;
+    const auto existing = rowOf.find(label);
+    if (existing != rowOf.end())
+        position = existing->second;
+
+    const size_t b = position / blockRows, r = position % blockRows;
+    std::shared_ptr<Block> block = b < table.size() ? copyBlock(b) : std::make_shared<Block>(stride);
+    std::copy_n(embedding, dim, block->row(r));
+    block->labels[r] = label;
+    block->users[r] = user;
+    if (position == count) {
+        ++block->rows;
+        ++count;
+        rowOf[label] = position;
+    }
+    if (b < table.size())
+        table[b] = std::move(block);
+    else
+        table.push_back(std::move(block));
+    publish(std::move(table));
+}
+
+bool ExactGallery::erase(size_t label)
+{
+    const auto it = rowOf.find(label);
+    if (it == rowOf.end())
+        return false;
+    const size_t position = it->second, last = count - 1;
+    rowOf.erase(it);
+
+    BlockTable table = *blocks;
+    const size_t lastBlock = last / blockRows;
+    std::shared_ptr<Block> tail = copyBlock(lastBlock);
+    const size_t lastRow = last % blockRows;
+    if (position != last) {
+        // The last row fills the hole
+        const size_t b = position / blockRows, r = position % blockRows;
+        std::shared_ptr<Block> block = b == lastBlock ? tail : copyBlock(b);
+        std::copy_n(tail->row(lastRow), stride, block->row(r));
+        block->labels[r] = tail->labels[lastRow];
+        block->users[r] = tail->users[lastRow];
+        rowOf[block->labels[r]] = position;
+        if (b != lastBlock)
+            table[b] = std::move(block);
+    }
+    std::fill_n(tail->row(lastRow), stride, 0.0f); // padding rows must score zero
+    --tail->rows;
+    --count;
+    if (tail->rows == 0)
+        table.pop_back();
+    else
+        table[lastBlock] = std::move(tail);
+    publish(std::move(table));
+    return true;
+}
+
+void ExactGallery::assign(const std::vector<size_t>& labels, const std::vector<size_t>& users, const std::vector<float>& rows)
+{
+    BlockTable table;
+    table.reserve((labels.size() + blockRows - 1) / blockRows);
+    rowOf.clear();
+    rowOf.reserve(labels.size());
+    for (size_t position = 0; position < labels.size(); ++position) {
+        const size_t r = position % blockRows;
+        if (r == 0)
+            table.push_back(std::make_shared<Block>(stride));
+        Block& block = const_cast<Block&>(*table.back()); // not published yet
+        std::copy_n(rows.data() + position * dim, dim, block.row(r));
+        block.labels[r] = labels[position];
+        block.users[r] = users[position];
+        ++block.rows;
+        rowOf[labels[position]] = position;
+    }
+    count = labels.size();
+    publish(std::move(table));
+}
+
+void ExactGallery::clear()
+{
+    rowOf.clear();
+    count = 0;
+    publish(BlockTable());
+}
@@ -0,0 +1,108 @@
+// FaceAlignment.cpp
+
+#include "FaceAlignment.hpp"
+#include <QPainter>
+#include <QTransform>
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+struct Point {
+    double x, y;
+};
+
+// insightface's 112x112 ArcFace template. The detector gives a single mouth point,
+// so it is matched with the midpoint of the template's two mouth corners. Its ear
+// points have no template counterpart and stay out of the fit.
+const Point templateLeftEye  = {38.2946, 51.6963};
+const Point templateRightEye = {73.5318, 51.5014};
+const Point templateNose     = {56.0252, 71.7366};
+const Point templateMouth    = {56.1396, 92.2848};
+
+} // namespace
+
+bool estimateAlignment(const FaceDetection &detectedFace, AffineTransform &toSource)
+{
+    Point leftEye = {detectedFace.left_eye_x, detectedFace.left_eye_y};
+    Point rightEye = {detectedFace.right_eye_x, detectedFace.right_eye_y};
+    const Point nose = {detectedFace.nose_x, detectedFace.nose_y};
+    const Point mouth = {detectedFace.mouth_x, detectedFace.mouth_y};
+
+    // The template's image-left eye comes first. Decide which detected eye that is from
+    // the side the mouth is on, so neither the detector's naming nor head roll matters.
+    const double eyeMidX = (leftEye.x + rightEye.x) / 2, eyeMidY = (leftEye.y + rightEye.y) / 2;
+    const double cross = (rightEye.x - leftEye.x) * (mouth.y - eyeMidY) - (rightEye.y - leftEye.y) * (mouth.x - eyeMidX);
+    if (cross < 0)
+        std::swap(leftEye, rightEye);
+
+    const Point src[4] = {leftEye, rightEye, nose, mouth};
+    const Point dst[4] = {templateLeftEye, templateRightEye, templateNose, templateMouth};
+    const int n = 4;
+
+    // Closed-form least squares for dst = [a -b; b a] * src + t
+    Point srcMean = {0, 0}, dstMean = {0, 0};
+    for (int i = 0; i < n; ++i) {
+        srcMean.x += src[i].x / n; srcMean.y += src[i].y / n;
+        dstMean.x += dst[i].x / n; dstMean.y += dst[i].y / n;
+    }
+    double srcVar = 0, dotSum = 0, crossSum = 0;
+    for (int i = 0; i < n; ++i) {
+        const double sx = src[i].x - srcMean.x, sy = src[i].y - srcMean.y;
+        const double dx = dst[i].x - dstMean.x, dy = dst[i].y - dstMean.y;
+        srcVar += sx * sx + sy * sy;
+        dotSum += sx * dx + sy * dy;
+        crossSum += sx * dy - sy * dx;
+    }
+    if (!(srcVar > 1e-6))
+        return false;
+    const double a = dotSum / srcVar;
+    const double b = crossSum / srcVar;
+    const double scale2 = a * a + b * b;
+    if (!(scale2 > 1e-12) || !std::isfinite(scale2))
+        return false;
+
+    // Invert: src = [a b; -b a] / scale2 * (dst - dstMean) + srcMean
+    toSource.m00 = float(a / scale2);
+    toSource.m01 = float(b / scale2);
+    toSource.m10 = float(-b / scale2);
+    toSource.m11 = float(a / scale2);
+    toSource.m02 = float(srcMean.x - (a * dstMean.x + b * dstMean.y) / scale2);
+    toSource.m12 = float(srcMean.y - (-b * dstMean.x + a * dstMean.y) / scale2);
+    return true;
+}
+
+AffineTransform alignmentTransform(const FaceDetection &detectedFace)
+{
+    AffineTransform toSource;
+    if (estimateAlignment(detectedFace, toSource))
+        return toSource;
+
+    qWarning() << "Face landmarks are degenerate, falling back to the bounding box";
+    const float w = std::max(detectedFace.x2 - detectedFace.x1, 1.0f);
+    const float h = std::max(detectedFace.y2 - detectedFace.y1, 1.0f);
+    toSource = AffineTransform();
+    toSource.m00 = w / alignedFaceSize;
+    toSource.m11 = h / alignedFaceSize;
+    toSource.m02 = detectedFace.x1;
+    toSource.m12 = detectedFace.y1;
+    return toSource;
+}
+
+QImage alignFace(const QImage &sourceImage, const FaceDetection &detectedFace)
+{
+    if (sourceImage.isNull())
+        return QImage();
+    const AffineTransform t = alignmentTransform(detectedFace);
+    const QTransform toSource(t.m00, t.m10, t.m01, t.m11, t.m02, t.m12);
+
+    QImage aligned_image(alignedFaceSize, alignedFaceSize, QImage::Format_RGB32);
+    aligned_image.fill(Qt::black);
+    QPainter painter(&aligned_image);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    painter.setTransform(toSource.inverted());
+    painter.drawImage(0, 0, sourceImage);
+    painter.end();
+    return aligned_image;
+}
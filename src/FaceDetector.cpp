@@ -1,5 +1,6 @@
 //src/FaceDetector.cpp
 #include "FaceDetector.hpp"
+#include "ImagePreprocess.hpp"
 #include <QImage>
 #include <vector>
 #include <onnxruntime_cxx_api.h>
@@ -7,7 +8,6 @@
 #include <stdexcept>  // For std::runtime_error
 #include <filesystem> // For checking if model file exists
 #include <cwchar>     // For wide character string conversion
-#include <QDebug>     // For debug output
 
 // Constructor: initializes ONNX session and stores config
 FaceDetector::FaceDetector(const std::string& model_path,
@@ -32,94 +32,49 @@ FaceDetector::FaceDetector(const std::string& model_path,
 
     // Create the ONNX session for inference (loads the model into memory)
     session = std::make_unique<Ort::Session>(env, wide_model_path.c_str(), session_options);
+
+    // Resolve names/shapes once and keep all four inputs bound between frames.
+    // The three scalar inputs never change, so they are written here and never again.
+    inference = std::make_unique<InferenceContext>(*session);
+    inputTensor = inference->bindInput<float>(0, {1, 3, 128, 128});
+    *inference->bindInput<float>(1, {1}) = confThresh;
+    *inference->bindInput<int64_t>(2, {1}) = maxDetections;
+    *inference->bindInput<float>(3, {1}) = iouThresh;
+    for (size_t i = 0; i < inference->outputCount(); ++i)
+        inference->bindOutputToCpu(i);
 }
 
 std::vector<FaceDetection> FaceDetector::detect(const QImage& img) {
     std::vector<FaceDetection> results; // Output: List of detected faces
 
-    // 1. Convert input image to RGB888, resize to 128x128, normalize to [0, 1]
-    QImage rgb = img.convertToFormat(QImage::Format_RGB888).scaled(128, 128);
-
-    // 2. Copy image data to a float vector (HWC format)
-    std::vector<float> input_tensor_values(128 * 128 * 3);
-    for (int y = 0; y < 128; ++y) {
-        for (int x = 0; x < 128; ++x) {
-            QColor color = rgb.pixelColor(x, y);
-            input_tensor_values[(y * 128 + x) * 3 + 0] = color.red() / 255.0f;
-            input_tensor_values[(y * 128 + x) * 3 + 1] = color.green() / 255.0f;
-            input_tensor_values[(y * 128 + x) * 3 + 2] = color.blue() / 255.0f;
-        }
-    }
+    if (img.isNull())
+        return results;
 
-    // 3. Convert to NCHW format (C, H, W)
-    std::vector<float> chw(1 * 3 * 128 * 128);
-    for (int c = 0; c < 3; ++c) {
-        for (int h = 0; h < 128; ++h) {
-            for (int w = 0; w < 128; ++w) {
-                chw[c * 128 * 128 + h * 128 + w] = input_tensor_values[(h * 128 + w) * 3 + c];
-            }
-        }
-    }
+    std::lock_guard<std::mutex> lock(runMutex);
+
+    // 1. Resize to 128x128, normalize to [0, 1] and write NCHW (C, H, W) in a single pass
+    //    straight from the frame's scanlines into the bound input tensor
+    preprocessPlanar(img, 128, 128, {1.0f / 255.0f, 0.0f}, inputTensor);
 
-    // 4. Prepare ONNX inputs (4 total)
-    Ort::AllocatorWithDefaultOptions allocator;
-    auto input_name_ptr    = session->GetInputNameAllocated(0, allocator);
-    auto conf_name_ptr     = session->GetInputNameAllocated(1, allocator);
-    auto maxdets_name_ptr  = session->GetInputNameAllocated(2, allocator);
-    auto iou_name_ptr      = session->GetInputNameAllocated(3, allocator);
-
-    const char* input_name     = input_name_ptr.get();
-    const char* conf_name      = conf_name_ptr.get();
-    const char* maxdets_name   = maxdets_name_ptr.get();
-    const char* iou_name       = iou_name_ptr.get();
-
-    std::array<int64_t, 4> input_shape = {1, 3, 128, 128};
-    Ort::MemoryInfo memory_info = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
-
-    auto input_tensor = Ort::Value::CreateTensor<float>(
-        memory_info, chw.data(), chw.size(), input_shape.data(), input_shape.size());
-
-    // Use instance variables for config!
-    float conf_thresh = confThresh;
-    int64_t max_detections = maxDetections;
-    float iou_thresh = iouThresh;
-
-    std::array<int64_t, 1> single_dim = {1};
-    Ort::Value conf_tensor     = Ort::Value::CreateTensor<float>(memory_info, &conf_thresh, 1, single_dim.data(), 1);
-    Ort::Value maxdets_tensor  = Ort::Value::CreateTensor<int64_t>(memory_info, &max_detections, 1, single_dim.data(), 1);
-    Ort::Value iou_tensor      = Ort::Value::CreateTensor<float>(memory_info, &iou_thresh, 1, single_dim.data(), 1);
-
-    std::array<const char*, 4> input_names = {input_name, conf_name, maxdets_name, iou_name};
-    std::array<Ort::Value, 4>  input_tensors = {
-        std::move(input_tensor),
-        std::move(conf_tensor),
-        std::move(maxdets_tensor),
-        std::move(iou_tensor)
-    };
-
-    std::vector<std::string> output_names_str = session->GetOutputNames();
-    std::vector<const char*> output_names;
-    for (const auto& name : output_names_str)
-        output_names.push_back(name.c_str());
-
-    // 5. Run the model!
-    auto output_tensors = session->Run(
-        Ort::RunOptions{nullptr},
-        input_names.data(),
-        input_tensors.data(),
-        input_tensors.size(),
-        output_names.data(),
-        output_names.size()
-    );
-
-    // 6. Parse model output
-    const float* boxes_data = output_tensors[0].GetTensorData<float>();
-    const float* scores_data = (output_tensors.size() > 1) ? output_tensors[1].GetTensorData<float>() : nullptr;
-
-    auto boxes_shape = output_tensors[0].GetTensorTypeAndShapeInfo().GetShape();
-    size_t num_boxes = (boxes_shape.size() > 1) ? boxes_shape[1] : boxes_shape[0];
-    if (boxes_shape.size() == 1)
+    // 2. Run the model on the persistent bindings (threshold inputs were bound once in the constructor)
+    inference->run();
+
+    // 3. Read the outputs where the context keeps them; their shape depends on the number
+    //    of faces, so ONNX Runtime allocated them during the run
+    const Ort::Value& boxes = inference->output(0);
+    const float* boxes_data = boxes.GetTensorData<float>();
+    const float* scores_data = (inference->outputCount() > 1) ? inference->output(1).GetTensorData<float>() : nullptr;
+
+    // Read into a fixed array rather than GetShape()'s vector
+    const Ort::TensorTypeAndShapeInfo boxes_info = boxes.GetTensorTypeAndShapeInfo();
+    int64_t boxes_shape[4] = {0, 0, 0, 0};
+    const size_t boxes_rank = std::min<size_t>(boxes_info.GetDimensionsCount(), 4);
+    boxes_info.GetDimensions(boxes_shape, boxes_rank);
+    size_t num_boxes = (boxes_rank > 1) ? boxes_shape[1] : boxes_shape[0];
+    if (boxes_rank == 1)
         num_boxes = 1; // If only one detection
+    num_boxes = std::min(num_boxes, static_cast<size_t>(std::max(maxDetections, 0)));
+    results.reserve(num_boxes);
 
     int orig_w = img.width();
     int orig_h = img.height();
@@ -166,15 +121,6 @@ std::vector<FaceDetection> FaceDetector::detect(const QImage& img) {
         fd.right_cheek_x = rea_x * orig_w;
         fd.right_cheek_y = rea_y * orig_h;
 
-        // Log everything
-        qDebug() << "Face" << i << "box:" << fx1 << fy1 << fx2 << fy2 << "conf:" << confidence
-                 << "ley:" << fd.left_eye_x << fd.left_eye_y
-                 << "rey:" << fd.right_eye_x << fd.right_eye_y
-                 << "nose:" << fd.nose_x << fd.nose_y
-                 << "mouth:" << fd.mouth_x << fd.mouth_y
-                 << "lea:" << fd.left_cheek_x << fd.left_cheek_y
-                 << "rea:" << fd.right_cheek_x << fd.right_cheek_y;
-
         results.push_back(fd);
     }
 
@@ -1,6 +1,8 @@
 // FaceEmbedder.cpp
 
 #include "FaceEmbedder.hpp"
+#include "FaceAlignment.hpp"
+#include "ImagePreprocess.hpp"
 #include <algorithm>
 #include <cmath>
 
@@ -16,74 +18,114 @@ FaceEmbedder::FaceEmbedder(const std::string& modelPath)
     sessionOpts.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
     std::wstring wModelPath(modelPath.begin(), modelPath.end());
     session = std::make_unique<Ort::Session>(env, wModelPath.c_str(), sessionOpts);
+
+    // Names, shapes and both tensors are set up once; every call reuses them
+    inference = std::make_unique<InferenceContext>(*session);
+    const std::vector<int64_t>& inShape = inference->inputShape(0);
+    const std::vector<int64_t>& outShape = inference->outputShape(0);
+    if (!outShape.empty() && outShape.back() > 0)
+        embeddingDim = outShape.back();
+
+    // A positive batch dimension is baked into the model; otherwise we pick the batch per call
+    if (!inShape.empty() && inShape[0] > 0) {
+        fixedBatch = true;
+        maxBatch = inShape[0];
+    }
+    bindBatch(fixedBatch ? maxBatch : 1);
 }
 
-// Preprocess image for ArcFace: resize to 112x112, RGB, float32, normalize
-// Output is NHWC: [1, 112, 112, 3] (as your ONNX model expects)
-std::vector<float> FaceEmbedder::preprocess(const QImage& img)
+// (Re)binds input/output tensors for a batch of n faces. Buffers only grow, so
+// switching between batch sizes after warm-up does not allocate tensor memory.
+void FaceEmbedder::bindBatch(int64_t n)
 {
-    // 1. Resize to 112x112 and convert to RGB
-    QImage rgb = img.convertToFormat(QImage::Format_RGB888).scaled(112, 112);
-
-    // 2. Prepare buffer for NHWC: (batch=1, height, width, channel)
-    std::vector<float> data(1 * 112 * 112 * 3);
-
-    // 3. Fill buffer in NHWC order (row, col, channel)
-    // Explanation:
-    // For each pixel, channels are stored together: [R, G, B], [R, G, B], ...
-    for (int y = 0; y < 112; ++y) {
-        for (int x = 0; x < 112; ++x) {
-            QColor c = rgb.pixelColor(x, y);
-            int idx = (y * 112 + x) * 3; // NHWC: [batch=0, y, x, channel]
-            data[idx + 0] = (c.red()   - 127.5f) / 128.0f;   // Red
-            data[idx + 1] = (c.green() - 127.5f) / 128.0f;   // Green
-            data[idx + 2] = (c.blue()  - 127.5f) / 128.0f;   // Blue
+    inputTensor = inference->bindInput<float>(0, {n, 112, 112, 3});
+    outputTensor = inference->bindOutput<float>(0, {n, embeddingDim});
+    boundBatch = n;
+}
+
+namespace {
+// ArcFace input normalization: [0, 255] -> [-1, 1]
+const Normalization arcfaceNorm = {1.0f / 128.0f, -127.5f / 128.0f};
+}
+
+// Runs faces [0..count) through the model in chunks and writes count x embeddingDim
+// unit-length rows to out
+void FaceEmbedder::embedBatch(size_t count, const std::function<void(size_t, float*)>& fill, float* out)
+{
+    std::lock_guard<std::mutex> lock(runMutex);
+    const size_t faceSize = 112 * 112 * 3;
+    size_t done = 0;
+    while (done < count) {
+        const int64_t n = static_cast<int64_t>(std::min<size_t>(count - done, static_cast<size_t>(maxBatch)));
+        if (!fixedBatch && n != boundBatch)
+            bindBatch(n);
+
+        // Each face is written into its slot of the bound NHWC input: [R, G, B], ...
+        for (int64_t i = 0; i < n; ++i)
+            fill(done + static_cast<size_t>(i), inputTensor + i * faceSize);
+        // A fixed-batch model always sees a full batch; pad unused slots with zeros
+        if (n < boundBatch)
+            std::fill(inputTensor + n * faceSize, inputTensor + boundBatch * faceSize, 0.0f);
+
+        // Run inference; outputs land directly in the preallocated output buffer
+        inference->run();
+
+        for (int64_t i = 0; i < n; ++i) {
+            const float* src = outputTensor + i * embeddingDim;
+            float* dst = out + (done + i) * embeddingDim;
+
+            // Normalize to unit length (so dot = cosine)
+            float norm = 0.0f;
+            for (int64_t j = 0; j < embeddingDim; ++j) norm += src[j] * src[j];
+            norm = std::sqrt(norm);
+            const float inv = norm > 0 ? 1.0f / norm : 1.0f;
+            for (int64_t j = 0; j < embeddingDim; ++j) dst[j] = src[j] * inv;
         }
+        done += static_cast<size_t>(n);
     }
-    return data;
 }
 
-
 // Main function: run ONNX inference and return normalized 512-d embedding
 std::vector<float> FaceEmbedder::getEmbedding(const QImage& face)
 {
-    std::vector<float> input = preprocess(face);
-
-    // Prepare tensor: shape (1, 3, 112, 112)
-    std::array<int64_t, 4> inputShape = {1, 112, 112, 3}; // NHWC
-
-    Ort::MemoryInfo memInfo = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
-
-    Ort::Value inputTensor = Ort::Value::CreateTensor<float>(
-        memInfo, input.data(), input.size(), inputShape.data(), inputShape.size()
-    );
-
-    // Get input and output names
-    Ort::AllocatorWithDefaultOptions allocator;
-    auto inputName = session->GetInputNameAllocated(0, allocator);
-    auto outputName = session->GetOutputNameAllocated(0, allocator);
-
-    // Run inference
-    std::array<const char*, 1> inputNames = {inputName.get()};
-    std::array<const char*, 1> outputNames = {outputName.get()};
+    return getEmbeddings(std::vector<QImage>{face});
+}
 
-    auto outputTensors = session->Run(
-        Ort::RunOptions{nullptr},
-        inputNames.data(), &inputTensor, 1,
-        outputNames.data(), 1
-    );
+// Batched variant: one session run per chunk instead of one per face
+std::vector<float> FaceEmbedder::getEmbeddings(const std::vector<QImage>& faces)
+{
+    std::vector<float> embeddings(faces.size() * embeddingDim);
+    if (!faces.empty()) {
+        // Resize to 112x112, normalize to [-1, 1] and fill the input in one pass
+        embedBatch(faces.size(), [&faces](size_t i, float* input) {
+            preprocessInterleaved(faces[i], alignedFaceSize, alignedFaceSize, arcfaceNorm, input);
+        }, embeddings.data());
+    }
+    return embeddings;
+}
 
-    // Get output data (512-d vector)
-    float* outputData = outputTensors[0].GetTensorMutableData<float>();
+std::vector<float> FaceEmbedder::getEmbeddings(const QImage& frame, const std::vector<FaceDetection>& faces)
+{
+    std::vector<float> embeddings(faces.size() * embeddingDim);
+    if (faces.empty())
+        return embeddings;
+
+    ImageView view;
+    QImage converted;
+    if (!imageViewFor(frame, view)) {
+        converted = frame.convertToFormat(QImage::Format_RGBX8888); // once per frame, not per face
+        if (!imageViewFor(converted, view))
+            throw std::runtime_error("Cannot read frame for embedding");
+    }
 
-    std::vector<float> embedding(outputData, outputData + 512);
+    // Warp, resample and normalize each face in a single pass over its pixels
+    embedBatch(faces.size(), [&](size_t i, float* input) {
+        warpNormalizeInterleaved(view, alignmentTransform(faces[i]), alignedFaceSize, alignedFaceSize, arcfaceNorm, input);
+    }, embeddings.data());
+    return embeddings;
+}
 
-    // Normalize to unit length (so dot = cosine)
-    float norm = 0.0f;
-    for (float v : embedding) norm += v * v;
-    norm = std::sqrt(norm);
-    if (norm > 0) {
-        for (float& v : embedding) v /= norm;
-    }
-    return embedding;
+std::vector<float> FaceEmbedder::getEmbedding(const QImage& frame, const FaceDetection& face)
+{
+    return getEmbeddings(frame, std::vector<FaceDetection>{face});
 }
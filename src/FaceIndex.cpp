@@ -1,163 +1,1190 @@
 // FaceIndex.cpp
 
 #include "FaceIndex.hpp"
+#include "FaceIndexInternal.hpp"
+#include "FaceIndexStorage.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <atomic>
 #include <cmath> // for sqrt
-#include <fstream>
-#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <optional>
+#include <unordered_set>
 #include <QDebug> // For qWarning()
 
-// Constructor: create L2Space and hnswlib index
-FaceIndex::FaceIndex(int dim, int max_elements)
-    : dim(dim), max_elements_(max_elements) // Initialize max_elements_
+namespace FaceIndexInternal {
+
+void waitForTasks(std::vector<std::future<void>>& tasks, const std::function<void()>& progress)
+{
+    std::exception_ptr failure;
+    for (std::future<void>& task : tasks) {
+        if (progress) {
+            while (task.wait_for(std::chrono::milliseconds(100)) != std::future_status::ready)
+                progress();
+        }
+        try {
+            task.get();
+        } catch (...) {
+            if (!failure)
+                failure = std::current_exception();
+        }
+    }
+    if (progress)
+        progress();
+    if (failure)
+        std::rethrow_exception(failure);
+}
+
+std::unique_ptr<hnswlib::HierarchicalNSW<float>> makeGraph(hnswlib::SpaceInterface<float>* space, size_t capacity, size_t m)
+{
+    return std::make_unique<hnswlib::HierarchicalNSW<float>>(space, capacity, m, 200, 100, false);
+}
+
+bool copyElementData(const hnswlib::HierarchicalNSW<float>& graph, size_t label, char* out)
+{
+    std::unique_lock<std::mutex> labelLock(graph.getLabelOpMutex(label));
+    std::unique_lock<std::mutex> tableLock(graph.label_lookup_lock);
+    const auto it = graph.label_lookup_.find(label);
+    if (it == graph.label_lookup_.end() || graph.isMarkedDeleted(it->second))
+        return false;
+    const hnswlib::tableint internalId = it->second;
+    tableLock.unlock();
+    std::memcpy(out, graph.getDataByInternalId(internalId), graph.data_size_);
+    return true;
+}
+
+bool copyElementData(const hnswlib::HierarchicalNSW<float>& graph, size_t label, std::vector<char>& out)
+{
+    out.resize(graph.data_size_);
+    return copyElementData(graph, label, out.data());
+}
+
+FaceIndex::GroupList normalizedGroups(FaceIndex::GroupList groups)
+{
+    FaceIndex::GroupList result;
+    for (const std::string& group : groups) {
+        size_t begin = 0, end = group.size();
+        while (begin < end && isBlank(group[begin]))
+            ++begin;
+        while (end > begin && isBlank(group[end - 1]))
+            --end;
+        if (begin < end)
+            result.push_back(group.substr(begin, end - begin));
+    }
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+} // namespace FaceIndexInternal
+
+using namespace FaceIndexInternal;
+
+namespace {
+
+// Smallest step the graph grows by, so a tiny initial capacity doesn't grow every few adds
+constexpr size_t minGrowth = 1024;
+
+// Deleted slots are not counted: searches walk through them without locking, so they
+// are only reclaimed by a rebuild, which swaps in a new graph
+size_t freeSlots(hnswlib::HierarchicalNSW<float>& graph)
+{
+    return graph.getMaxElements() - graph.getCurrentElementCount();
+}
+
+// Copy of source with room for capacity elements. resizeIndex() reallocates in place,
+// so nothing may search meanwhile; this only reads source, so searches can go on while
+// it runs as long as nothing modifies source.
+std::unique_ptr<hnswlib::HierarchicalNSW<float>> cloneWithCapacity(const hnswlib::HierarchicalNSW<float>& source,
+                                                                   hnswlib::SpaceInterface<float>* space, size_t capacity)
+{
+    const size_t count = source.cur_element_count;
+    auto grown = std::make_unique<hnswlib::HierarchicalNSW<float>>(space, capacity, source.M_, source.ef_construction_, 100, false);
+
+    std::memcpy(grown->data_level0_memory_, source.data_level0_memory_, count * source.size_data_per_element_);
+    for (size_t i = 0; i < count; ++i) {
+        const int level = source.element_levels_[i];
+        grown->element_levels_[i] = level;
+        grown->linkLists_[i] = nullptr;
+        if (level > 0) {
+            // searchBaseLayer() prefetches one link past a full list, so leave room for it;
+            // loadIndex allocates no slack at all, so copy only the lists
+            const size_t bytes = source.size_links_per_element_ * static_cast<size_t>(level);
+            grown->linkLists_[i] = static_cast<char*>(std::malloc(bytes + sizeof(hnswlib::tableint)));
+            if (!grown->linkLists_[i]) {
+                grown->cur_element_count = i; // so the destructor frees only what was copied
+                throw std::runtime_error("Not enough memory to grow the face index");
+            }
+            std::memcpy(grown->linkLists_[i], source.linkLists_[i], bytes);
+        }
+    }
+    grown->cur_element_count = count;
+    grown->num_deleted_ = source.num_deleted_.load();
+    grown->maxlevel_ = source.maxlevel_;
+    grown->enterpoint_node_ = source.enterpoint_node_;
+    grown->ef_ = source.ef_;
+    grown->label_lookup_ = source.label_lookup_;
+    grown->level_generator_ = source.level_generator_;
+    grown->update_probability_generator_ = source.update_probability_generator_;
+    return grown;
+}
+
+// Offers a template's score to row, the k best users so far (most similar first, padded
+// with found = false); a user already in it keeps their better template
+void keepBest(SearchMatch* row, size_t k, size_t userId, size_t label, float similarity)
 {
-    space = std::make_unique<hnswlib::L2Space>(dim);
-    index = std::make_unique<hnswlib::HierarchicalNSW<float>>(space.get(), max_elements_); // Use max_elements_
+    size_t slot = 0;
+    while (slot < k && row[slot].found && row[slot].id != userId)
+        ++slot;
+    if (slot < k && row[slot].found) { // the user is in the row already
+        if (similarity <= row[slot].similarity)
+            return;
+    } else if (slot == k) { // full of other users
+        slot = k - 1;
+        if (similarity <= row[slot].similarity)
+            return;
+    }
+    while (slot > 0 && row[slot - 1].similarity < similarity) {
+        row[slot] = row[slot - 1];
+        --slot;
+    }
+    row[slot].id = userId;
+    row[slot].templateId = label;
+    row[slot].similarity = similarity;
+    row[slot].found = true;
+}
+
+} // namespace
+
+// Constructor: create the spaces and hnswlib index
+FaceIndex::FaceIndex(int dim, int initialCapacity, bool readOnly, VectorStorage storage)
+    : dim(dim), initialCapacity(static_cast<size_t>(std::max(initialCapacity, 1))), readOnly(readOnly),
+      storageMode(storage), exactVectors(static_cast<size_t>(dim)), gallery(static_cast<size_t>(dim))
+{
+    space = std::make_unique<CosineSpace>(dim);
+    if (storageMode != VectorStorage::Float32)
+        quantizedSpace = std::make_unique<QuantizedSpace>(dim, storageMode);
+    if (quantizedSpace)
+        templateSpace = std::make_unique<TemplateSpace>(*quantizedSpace);
+    else
+        templateSpace = std::make_unique<TemplateSpace>(*space);
+    index = makeGraph(graphSpace(), this->initialCapacity, graphM);
+    publishedNames = std::make_shared<const NameTable>();
+    publishedGroups = std::make_shared<const GroupTable>();
+    searchBudget = std::make_shared<const SearchBudget>();
+    syncGalleryLocked();
+    if (!readOnly)
+        compactor = std::thread(&FaceIndex::compactorLoop, this);
+}
+
+FaceIndex::~FaceIndex()
+{
+    {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        stopCompactor = true;
+    }
+    compactorWake.notify_all();
+    if (compactor.joinable())
+        compactor.join();
+    // The journal's destructor writes out whatever is still buffered
 }
 
 // Add a name and embedding to the index (embeddings always normalized)
 void FaceIndex::add(const std::string& name, const std::vector<float>& embedding)
 {
-    // Embeddings are assumed to be pre-normalized
-    index->addPoint(embedding.data(), nextId);
-    idToName[nextId] = name;
-    ++nextId;
+    if (readOnly)
+        throw std::runtime_error("The face database is open read-only");
+    size_t id;
+    uint64_t ticket, generation;
+    {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        if (journalFailedLocked())
+            throw std::runtime_error("The face database cannot be saved right now; try again shortly");
+        // Normally the background thread has grown the graph well before this
+        if (freeSlotsLocked() == 0)
+            growLocked();
+        FaceIndexJournal::Record record;
+        record.type = FaceIndexJournal::RecordType::Add;
+        record.id = id = addLocked(name, embedding);
+        record.name = name;
+        record.embedding = embedding;
+        if (rebuilding)
+            rebuildBacklog.push_back(record);
+        try {
+            ticket = journalLocked(record);
+        } catch (...) {
+            eraseUserLocked(id);
+            throw;
+        }
+        generation = storageGeneration;
+        requestGrowthIfLowLocked();
+    }
+    // Other registrations share the fsync while this one waits
+    awaitJournaled(ticket, generation, [&] {
+        if (idToName.contains(id))
+            eraseUserLocked(id);
+    });
 }
 
-// Search for closest face. Returns a SearchResult struct.
-SearchResult FaceIndex::search(const std::vector<float>& embedding, float threshold)
+bool FaceIndex::addTemplate(size_t userId, const std::vector<float>& embedding)
+{
+    if (readOnly)
+        throw std::runtime_error("The face database is open read-only");
+    size_t label;
+    uint64_t ticket, generation;
+    {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        if (!idToName.contains(userId)) {
+            qWarning() << "Attempted to add a template to non-existent user with label:" << userId;
+            return false;
+        }
+        if (journalFailedLocked())
+            throw std::runtime_error("The face database cannot be saved right now; try again shortly");
+        if (freeSlotsLocked() == 0)
+            growLocked();
+        FaceIndexJournal::Record record;
+        record.type = FaceIndexJournal::RecordType::AddTemplate;
+        record.id = label = addTemplateLocked(userId, embedding);
+        record.identity = userId;
+        record.embedding = embedding;
+        if (rebuilding)
+            rebuildBacklog.push_back(record);
+        try {
+            ticket = journalLocked(record);
+        } catch (...) {
+            eraseTemplateLocked(userId, label);
+            throw;
+        }
+        generation = storageGeneration;
+        requestGrowthIfLowLocked();
+    }
+    awaitJournaled(ticket, generation, [&] { eraseTemplateLocked(userId, label); });
+    return true;
+}
+
+size_t FaceIndex::templateCount(size_t userId)
+{
+    std::lock_guard<std::mutex> lock(writeMutex);
+    if (!idToName.contains(userId))
+        return 0;
+    const auto it = extraTemplates.find(userId);
+    return 1 + (it == extraTemplates.end() ? 0 : it->second.size());
+}
+
+size_t FaceIndex::addLocked(const std::string& name, const std::vector<float>& embedding)
 {
     // Embeddings are assumed to be pre-normalized
-    auto result_queue = index->searchKnn(embedding.data(), 1); // top-1 neighbor
-    if (result_queue.empty()) {
-        return {"", 0.0f, 0, false};
+    const size_t id = nextId;
+    // Name (and full-precision copy) first, so a search that finds the new point can use them
+    idToName.set(id, name);
+    publishNamesLocked();
+    if (keepsExactLocked())
+        exactVectors.put(id, embedding.data());
+    try {
+        std::vector<char> code;
+        index->addPoint(graphElement(embedding.data(), id, code), id);
+    } catch (...) {
+        exactVectors.erase(id);
+        idToName.erase(id);
+        publishNamesLocked();
+        throw;
     }
-    auto item = result_queue.top();
-    size_t found_id = item.second;
-    float l2_distance = item.first; // L2 distance on unit vectors (range: 0=identical, 2=opposite)
+    galleryAddLocked(id, id, embedding.data());
+    nextId += labelStride;
+    return id;
+}
 
-    // Convert L2 to cosine similarity: cosine_sim = 1 - (l2^2)/2
-    float cosine_sim = 1.0f - (l2_distance * l2_distance) / 2.0f;
+size_t FaceIndex::addTemplateLocked(size_t userId, const std::vector<float>& embedding)
+{
+    const size_t label = nextId;
+    if (keepsExactLocked())
+        exactVectors.put(label, embedding.data());
+    try {
+        std::vector<char> code;
+        index->addPoint(graphElement(embedding.data(), userId, code), label);
+    } catch (...) {
+        exactVectors.erase(label);
+        throw;
+    }
+    galleryAddLocked(label, userId, embedding.data());
+    extraTemplates[userId].push_back(label);
+    if (groupTemplateLocked(userId, label))
+        publishGroupsLocked();
+    nextId += labelStride;
+    return label;
+}
 
-    if (cosine_sim < threshold) {
-        // Similarity below threshold, but we can still return what was found if needed for context
-        // For attendance logging, we only care about confirmed matches above threshold.
-        return {"", cosine_sim, 0, false}; // Or: {idToName[found_id], cosine_sim, found_id, false} if you want to know who was close but below threshold
-    }
-
-    auto it = idToName.find(found_id);
-    if (it == idToName.end()) {
-        // This case should ideally not happen if HNSW index and idToName are perfectly synced.
-        // Could occur if an ID was deleted from idToName but not perfectly from HNSW.
-        qWarning() << "HNSW index returned ID" << found_id << "but it's not in idToName map.";
-        return {"", cosine_sim, found_id, false}; // Indicate inconsistency
-    }
-
-    return {it->second, cosine_sim, found_id, true};
-}
-
-void FaceIndex::saveToDisk(const std::string& path) {
-    std::ofstream out(path);
-    if (!out) return;
-    for (const auto& pair : idToName) {
-        size_t id = pair.first;
-        const std::string& name = pair.second;
-        // Get internal id from label_lookup_
-        auto search = index->label_lookup_.find(id);
-        if (search == index->label_lookup_.end()) continue;
-        hnswlib::tableint internal_id = search->second;
-        // Get embedding pointer
-        float* emb_ptr = reinterpret_cast<float*>(index->getDataByInternalId(internal_id));
-        std::vector<float> emb(emb_ptr, emb_ptr + dim);
-        out << name;
-        for (float v : emb) out << ',' << v;
-        out << '\n';
-    }
-}
-
-void FaceIndex::loadFromDisk(const std::string& path) {
-    std::ifstream in(path);
-    if (!in) return;
-    // Clear current index
-    space = std::make_unique<hnswlib::L2Space>(dim);
-    index = std::make_unique<hnswlib::HierarchicalNSW<float>>(space.get(), max_elements_); // Use max_elements_
-    idToName.clear();
-    nextId = 0;
-    index = std::make_unique<hnswlib::HierarchicalNSW<float>>(space.get(), max_elements_); // Ensure index is fresh before load attempt
-
-    std::string line;
+std::vector<size_t> FaceIndex::deleteTemplatesLocked(size_t userId)
+{
+    if (userGroups.contains(userId)) {
+        regroupLocked(userId, GroupList());
+        publishGroupsLocked();
+    }
+    std::vector<size_t> labels{userId};
+    const auto extra = extraTemplates.find(userId);
+    if (extra != extraTemplates.end()) {
+        labels.insert(labels.end(), extra->second.begin(), extra->second.end());
+        extraTemplates.erase(extra);
+    }
+    for (size_t label : labels) {
+        try {
+            // HNSWlib uses 'label' as the external label passed to addPoint
+            index->markDelete(label);
+        } catch (const std::runtime_error& e) {
+            // Not in the graph, or already deleted. The user is dropped from idToName
+            // regardless, so they won't be searchable or re-savable with this ID.
+            qWarning() << "Failed to mark label" << label << "as deleted in HNSW index:" << e.what();
+        }
+        exactVectors.erase(label);
+        galleryEraseLocked(label);
+    }
+    return labels;
+}
+
+void FaceIndex::indexTemplatesLocked()
+{
+    extraTemplates.clear();
+    const size_t count = index->getCurrentElementCount();
+    for (size_t i = 0; i < count; ++i) {
+        const auto internalId = static_cast<hnswlib::tableint>(i);
+        if (index->isMarkedDeleted(internalId))
+            continue;
+        const size_t label = index->getExternalLabel(internalId);
+        const auto userId = static_cast<size_t>(templateSpace->get_doc_id(index->getDataByInternalId(internalId)));
+        if (userId != label)
+            extraTemplates[userId].push_back(label);
+    }
+}
+
+hnswlib::SpaceInterface<float>* FaceIndex::graphSpace() const
+{
+    return templateSpace.get();
+}
+
+const void* FaceIndex::graphVector(const float* embedding, std::vector<char>& scratch) const
+{
+    if (!quantizedSpace)
+        return embedding;
+    scratch.resize(quantizedSpace->get_data_size());
+    quantizedSpace->encode(embedding, scratch.data());
+    return scratch.data();
+}
+
+const void* FaceIndex::graphElement(const float* embedding, size_t userId, std::vector<char>& scratch) const
+{
+    scratch.resize(templateSpace->get_data_size());
+    if (quantizedSpace)
+        quantizedSpace->encode(embedding, scratch.data());
+    else
+        std::memcpy(scratch.data(), embedding, templateSpace->codeSize());
+    templateSpace->set_doc_id(scratch.data(), userId);
+    return scratch.data();
+}
+
+bool FaceIndex::keepsExactLocked() const
+{
+    return quantizedSpace && rerankCandidates > 0;
+}
+
+void FaceIndex::galleryAddLocked(size_t label, size_t userId, const float* embedding)
+{
+    if (!galleryActive)
+        return;
+    if (gallery.size() >= 4 * exactSearchLimit) {
+        // Far past the limit: searches have been using the graph for a while
+        gallery.clear();
+        galleryActive = false;
+        return;
+    }
+    gallery.add(label, userId, embedding);
+}
+
+void FaceIndex::galleryEraseLocked(size_t label)
+{
+    if (galleryActive)
+        gallery.erase(label);
+}
+
+void FaceIndex::templateVector(const EmbeddingStore::Snapshot& exact, size_t label, const char* data, float* out) const
+{
+    if (const float* v = exact.find(label))
+        std::memcpy(out, v, static_cast<size_t>(dim) * sizeof(float));
+    else if (quantizedSpace)
+        quantizedSpace->decode(data, out);
+    else
+        std::memcpy(out, data, static_cast<size_t>(dim) * sizeof(float));
+}
+
+void FaceIndex::syncGalleryLocked()
+{
+    const size_t live = index->getCurrentElementCount() - index->getDeletedCount();
+    const size_t limit = exactSearchLimit;
+    if (galleryActive && live <= 4 * limit)
+        return; // kept up to date by every change
+    if (live > 2 * limit) {
+        gallery.clear();
+        galleryActive = false;
+        return;
+    }
+    // Back under the limit (or just loaded): copy the live templates out of the graph,
+    // in full precision where the index keeps it
+    const EmbeddingStore::Snapshot exact = exactVectors.snapshot();
+    std::vector<size_t> labels, users;
+    std::vector<float> rows;
+    labels.reserve(live);
+    users.reserve(live);
+    rows.reserve(live * static_cast<size_t>(dim));
+    const size_t count = index->getCurrentElementCount();
+    for (size_t i = 0; i < count; ++i) {
+        const auto internalId = static_cast<hnswlib::tableint>(i);
+        if (index->isMarkedDeleted(internalId))
+            continue;
+        const char* data = index->getDataByInternalId(internalId);
+        const size_t label = index->getExternalLabel(internalId);
+        labels.push_back(label);
+        users.push_back(static_cast<size_t>(templateSpace->get_doc_id(data)));
+        rows.resize(rows.size() + static_cast<size_t>(dim));
+        templateVector(exact, label, data, rows.data() + rows.size() - static_cast<size_t>(dim));
+    }
+    gallery.assign(labels, users, rows);
+    galleryActive = true;
+}
+
+void FaceIndex::publishIndexLocked(std::shared_ptr<hnswlib::HierarchicalNSW<float>> graph)
+{
+    std::atomic_store(&index, std::move(graph));
+}
+
+void FaceIndex::publishNamesLocked()
+{
+    std::atomic_store(&publishedNames, std::shared_ptr<const NameTable>(std::make_shared<NameTable>(idToName)));
+}
+
+void FaceIndex::publishGroupsLocked()
+{
+    auto table = std::make_shared<GroupTable>();
+    table->userGroups = userGroups;
+    table->members = groupMembers;
+    std::atomic_store(&publishedGroups, std::shared_ptr<const GroupTable>(std::move(table)));
+}
+
+void FaceIndex::regroupLocked(size_t userId, const GroupList& groups)
+{
+    const GroupList* current = userGroups.find(userId);
+    const GroupList previous = current ? *current : GroupList();
+    std::vector<size_t> labels{userId};
+    const auto extra = extraTemplates.find(userId);
+    if (extra != extraTemplates.end())
+        labels.insert(labels.end(), extra->second.begin(), extra->second.end());
+
+    // Published sets are never modified: each group that changes gets a new one
+    for (const std::string& group : previous) {
+        if (std::binary_search(groups.begin(), groups.end(), group))
+            continue;
+        auto members = std::make_shared<LabelSet>(*groupMembers[group]);
+        for (size_t label : labels)
+            members->erase(label);
+        if (members->empty())
+            groupMembers.erase(group);
+        else
+            groupMembers[group] = std::move(members);
+    }
+    for (const std::string& group : groups) {
+        if (std::binary_search(previous.begin(), previous.end(), group))
+            continue;
+        const auto existing = groupMembers.find(group);
+        auto members = existing == groupMembers.end() ? std::make_shared<LabelSet>()
+                                                      : std::make_shared<LabelSet>(*existing->second);
+        for (size_t label : labels)
+            members->insert(label);
+        groupMembers[group] = std::move(members);
+    }
+    if (groups.empty())
+        userGroups.erase(userId);
+    else
+        userGroups.set(userId, groups);
+}
+
+bool FaceIndex::groupTemplateLocked(size_t userId, size_t label)
+{
+    const GroupList* groups = userGroups.find(userId);
+    if (!groups)
+        return false;
+    for (const std::string& group : *groups) {
+        auto members = std::make_shared<LabelSet>(*groupMembers[group]);
+        members->insert(label);
+        groupMembers[group] = std::move(members);
+    }
+    return true;
+}
+
+void FaceIndex::rebuildGroupsLocked()
+{
+    std::unordered_map<std::string, std::shared_ptr<LabelSet>> members;
+    LabelMap<GroupList> kept;
+    userGroups.forEach([&](size_t userId, const GroupList& stored) {
+        if (!idToName.contains(userId)) {
+            qWarning() << "Dropping the groups of unknown user" << userId;
+            return;
+        }
+        GroupList groups = normalizedGroups(stored);
+        if (groups.empty())
+            return;
+        const auto extra = extraTemplates.find(userId);
+        for (const std::string& group : groups) {
+            std::shared_ptr<LabelSet>& set = members[group];
+            if (!set)
+                set = std::make_shared<LabelSet>();
+            set->insert(userId);
+            if (extra != extraTemplates.end()) {
+                for (size_t label : extra->second)
+                    set->insert(label);
+            }
+        }
+        kept.set(userId, std::move(groups));
+    });
+    userGroups = std::move(kept);
+    groupMembers.clear();
+    for (auto& [group, set] : members)
+        groupMembers.emplace(group, std::move(set));
+}
+
+size_t FaceIndex::freeSlotsLocked() const
+{
+    return freeSlots(*index);
+}
+
+size_t FaceIndex::grownCapacityLocked() const
+{
+    const size_t capacity = index->getMaxElements();
+    return std::max({capacity * 2, capacity + minGrowth, initialCapacity});
+}
+
+bool FaceIndex::lowOnSlotsLocked() const
+{
+    return freeSlotsLocked() < index->getMaxElements() / 8 + 1;
+}
+
+void FaceIndex::requestGrowthIfLowLocked()
+{
+    if (lowOnSlotsLocked()) {
+        growthRequested = true;
+        compactorWake.notify_one();
+    }
+}
+
+void FaceIndex::growLocked()
+{
+    const size_t capacity = grownCapacityLocked();
+    // Writers are held off by writeMutex, so the copy sees a stable graph
+    std::shared_ptr<hnswlib::HierarchicalNSW<float>> grown = cloneWithCapacity(*index, graphSpace(), capacity);
+    qInfo() << "Grew face index from" << index->getMaxElements() << "to" << capacity << "slots";
+    publishIndexLocked(std::move(grown));
+    // The old graph is freed once the last search still using it finishes
+}
+
+bool FaceIndex::rebuildDueLocked() const
+{
+    const size_t deleted = index->getDeletedCount();
+    return deleted >= rebuildMinDeleted && deleted >= rebuildThreshold * index->getCurrentElementCount();
+}
+
+void FaceIndex::requestRebuildIfSparseLocked()
+{
+    if (rebuildDueLocked()) {
+        rebuildRequested = true;
+        compactorWake.notify_one();
+    }
+}
+
+void FaceIndex::rebuildLocked(std::unique_lock<std::mutex>& lock)
+{
+    // 1. Copy out the live entries; the old graph may be grown or added to while we build
+    const size_t count = index->getCurrentElementCount();
+    const size_t dropped = index->getDeletedCount();
+    const size_t capacity = index->getMaxElements();
+    const size_t codeSize = graphSpace()->get_data_size(); // vectors are copied as the graph stores them
+    std::vector<size_t> labels;
+    std::vector<char> codes;
+    labels.reserve(count - dropped);
+    codes.reserve((count - dropped) * codeSize);
+    for (size_t i = 0; i < count; ++i) {
+        const auto internalId = static_cast<hnswlib::tableint>(i);
+        if (index->isMarkedDeleted(internalId))
+            continue;
+        labels.push_back(index->getExternalLabel(internalId));
+        const char* v = index->getDataByInternalId(internalId);
+        codes.insert(codes.end(), v, v + codeSize);
+    }
+    const uint64_t epoch = graphEpoch;
+    rebuilding = true;
+    rebuildBacklog.clear();
+    lock.unlock();
+
+    // 2. Build the shadow graph; searches and registrations go on with the old one
+    std::unique_ptr<hnswlib::HierarchicalNSW<float>> shadow;
+    std::exception_ptr failure;
     try {
-        while (std::getline(in, line)) {
-            std::istringstream ss(line);
-            std::string name;
-            if (!std::getline(ss, name, ',')) continue;
-            std::vector<float> emb(dim);
-            bool parse_error = false;
-            for (int i = 0; i < dim; ++i) {
-                std::string val;
-                if (!std::getline(ss, val, ',')) {
-                    parse_error = true;
-                    break;
-                }
-                try {
-                    emb[i] = std::stof(val);
-                } catch (const std::invalid_argument& ia) {
-                    qWarning() << "Invalid number format in database line:" << QString::fromStdString(line) << "value:" << QString::fromStdString(val);
-                    parse_error = true;
-                    break;
-                } catch (const std::out_of_range& oor) {
-                    qWarning() << "Number out of range in database line:" << QString::fromStdString(line) << "value:" << QString::fromStdString(val);
-                    parse_error = true;
-                    break;
+        shadow = makeGraph(graphSpace(), capacity, graphM);
+        ThreadPool pool(std::max(1u, std::thread::hardware_concurrency() / 2)); // leave room for recognition
+        std::atomic<size_t> nextRow{0};
+        std::vector<std::future<void>> tasks;
+        for (size_t w = 0; w < pool.size(); ++w) {
+            tasks.push_back(pool.submit([&] {
+                for (size_t r; !stopCompactor && (r = nextRow.fetch_add(1)) < labels.size();)
+                    shadow->addPoint(codes.data() + r * codeSize, labels[r]);
+            }));
+        }
+        waitForTasks(tasks, std::function<void()>());
+    } catch (...) {
+        failure = std::current_exception();
+    }
+
+    lock.lock();
+    rebuilding = false;
+    std::vector<FaceIndexJournal::Record> backlog;
+    backlog.swap(rebuildBacklog);
+    if (failure)
+        std::rethrow_exception(failure);
+    if (stopCompactor || epoch != graphEpoch)
+        return; // shutting down, or a load replaced the graph meanwhile
+
+    // 3. Catch up with the changes made during the build. The live graph has room for
+    // all of its entries, so the shadow (same entries, fewer tombstones) does too.
+    if (shadow->getMaxElements() < index->getMaxElements())
+        shadow->resizeIndex(index->getMaxElements());
+    std::vector<char> code;
+    for (const FaceIndexJournal::Record& record : backlog) {
+        const size_t label = static_cast<size_t>(record.id);
+        if (record.type == FaceIndexJournal::RecordType::Add) {
+            shadow->addPoint(graphElement(record.embedding.data(), label, code), label);
+        } else if (record.type == FaceIndexJournal::RecordType::AddTemplate) {
+            shadow->addPoint(graphElement(record.embedding.data(), static_cast<size_t>(record.identity), code), label);
+        } else if (record.type == FaceIndexJournal::RecordType::Delete) {
+            try {
+                shadow->markDelete(label);
+            } catch (const std::runtime_error&) {
+                // Not in the graph; nothing to drop
+            }
+        }
+    }
+
+    publishIndexLocked(std::move(shadow));
+    qInfo() << "Rebuilt face index without" << dropped << "deleted entries;"
+            << index->getCurrentElementCount() - index->getDeletedCount() << "live entries";
+}
+
+void FaceIndex::setRebuildThreshold(double deletedFraction)
+{
+    std::lock_guard<std::mutex> lock(writeMutex);
+    rebuildThreshold = deletedFraction;
+    requestRebuildIfSparseLocked();
+}
+
+void FaceIndex::setRerankCandidates(size_t count)
+{
+    std::lock_guard<std::mutex> lock(writeMutex);
+    rerankCandidates = count;
+}
+
+void FaceIndex::setDiskResidentVectors(bool enabled)
+{
+    std::lock_guard<std::mutex> lock(writeMutex);
+    exactVectors.setDiskResident(enabled);
+}
+
+void FaceIndex::setExactSearchLimit(size_t templates)
+{
+    std::lock_guard<std::mutex> lock(writeMutex);
+    exactSearchLimit = templates;
+    gallery.clear();
+    galleryActive = false;
+    syncGalleryLocked();
+}
+
+void FaceIndex::setSearchBudget(const SearchBudget& budget)
+{
+    std::lock_guard<std::mutex> lock(writeMutex);
+    std::atomic_store(&searchBudget, std::shared_ptr<const SearchBudget>(std::make_shared<SearchBudget>(budget)));
+}
+
+SearchStopStats FaceIndex::searchStopStats() const
+{
+    SearchStopStats stats;
+    stats.queries = searchQueries.load(std::memory_order_relaxed);
+    stats.confident = confidentStops.load(std::memory_order_relaxed);
+    stats.budget = budgetStops.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void FaceIndex::setShard(size_t shard, size_t shardCount)
+{
+    std::lock_guard<std::mutex> lock(writeMutex);
+    if (shardCount == 0 || shard >= shardCount)
+        throw std::runtime_error("Invalid face index shard " + std::to_string(shard) + " of " + std::to_string(shardCount));
+    if (!idToName.empty() || nextId != firstLabel)
+        throw std::runtime_error("A face index can only become a shard while it is empty");
+    firstLabel = shard;
+    labelStride = shardCount;
+    nextId = firstLabel;
+    exactVectors.setLabelStride(labelStride);
+}
+
+void FaceIndex::setCompactionThreshold(uint64_t bytes)
+{
+    std::lock_guard<std::mutex> lock(writeMutex);
+    compactionThreshold = bytes;
+    if (journal && journal->sizeBytes() >= compactionThreshold) {
+        compactionRequested = true;
+        compactorWake.notify_one();
+    }
+}
+
+void FaceIndex::compactorLoop()
+{
+    std::unique_lock<std::mutex> lock(writeMutex);
+    while (!stopCompactor) {
+        // Compact when the journal passes the threshold, or when changes have been
+        // waiting for a whole interval (so read-only processes get to see them)
+        compactorWake.wait_for(lock, compactionInterval, [this] {
+            return stopCompactor || compactionRequested || growthRequested || rebuildRequested;
+        });
+        if (stopCompactor)
+            break;
+        // Tombstones take up slots until a rebuild drops them, which may make the room
+        // growth was asked for
+        if (growthRequested && rebuildDueLocked())
+            rebuildRequested = true;
+        if (rebuildRequested) {
+            rebuildRequested = false;
+            try {
+                // Deletes made during the last rebuild may have asked for one already done
+                if (rebuildDueLocked())
+                    rebuildLocked(lock);
+            } catch (const std::exception& e) {
+                qWarning() << "Could not rebuild the face index:" << e.what();
+            }
+            if (stopCompactor)
+                break;
+        }
+        if (growthRequested) {
+            growthRequested = false;
+            try {
+                // Registrations wait for the copy; searches carry on with the old graph
+                if (lowOnSlotsLocked())
+                    growLocked();
+            } catch (const std::exception& e) {
+                qWarning() << "Could not grow the face index:" << e.what();
+            }
+        }
+        compactionRequested = false;
+        if (!journal || (!journal->hasRecords() && !journal->failed()) || databasePath.empty())
+            continue;
+        try {
+            // Only registrations wait for the snapshot; searches never modify the graph
+            saveBinaryLocked(FaceIndexStorage(databasePath));
+        } catch (const std::exception& e) {
+            qWarning() << "Face database compaction failed:" << e.what();
+        }
+    }
+}
+
+// Search for closest face. Returns a SearchResult struct.
+SearchResult FaceIndex::search(const std::vector<float>& embedding, float threshold, const LabelSet* allowed)
+{
+    SearchMatch match;
+    searchBatch(embedding.data(), 1, 1, &match, allowed);
+    return resolve(match, *getIdToNameMap(), threshold);
+}
+
+void FaceIndex::searchBatch(const float* queries, size_t count, size_t k, SearchMatch* out,
+                            const LabelSet* allowed)
+{
+    if (count == 0 || k == 0)
+        return;
+    // Few allowed templates: the filtered graph walk would explore far past ef to find
+    // them, so score them directly
+    if (allowed && allowed->size() <= filteredExactLimit) {
+        searchAllowed(queries, count, k, out, *allowed);
+        return;
+    }
+    // Small galleries: score every template. Batches share the passes over the rows,
+    // which moves their crossover with the graph to about twice the size.
+    const ExactGallery::Snapshot scan = gallery.snapshot();
+    const size_t exactLimit = exactSearchLimit.load() * (count >= 4 ? 2 : 1);
+    if (!allowed && scan.rows() > 0 && scan.rows() <= exactLimit) {
+        const auto searchExact = [&](size_t begin, size_t end) {
+            std::vector<ExactGallery::Match> top((end - begin) * k);
+            scan.search(queries + begin * static_cast<size_t>(dim), end - begin, k, top.data());
+            for (size_t n = 0; n < top.size(); ++n) {
+                SearchMatch& match = out[begin * k + n];
+                match = SearchMatch();
+                if (top[n].found) {
+                    match.id = top[n].user;
+                    match.templateId = top[n].label;
+                    match.similarity = top[n].similarity;
+                    match.found = true;
                 }
             }
-            if (!parse_error && emb.size() == static_cast<size_t>(dim)) { // ensure enough values were read
-                add(name, emb);
-            } else if (parse_error) {
-                 qWarning() << "Skipping corrupted or incomplete line in face database:" << QString::fromStdString(line);
+        };
+        searchQueries.fetch_add(count, std::memory_order_relaxed);
+        if (count < parallelSearchMin)
+            searchExact(0, count);
+        else
+            runSliced(count, searchExact);
+        return;
+    }
+
+    // Holding the snapshot keeps the graph alive even if a writer replaces it meanwhile
+    const std::shared_ptr<hnswlib::HierarchicalNSW<float>> graph = std::atomic_load(&index);
+    const std::shared_ptr<const SearchBudget> budget = std::atomic_load(&searchBudget);
+    const EmbeddingStore::Snapshot exact = exactVectors.snapshot();
+    const size_t ef = searchEf.load();
+    const auto searchRows = [&](size_t begin, size_t end) {
+        SearchScratch scratch;
+        for (size_t q = begin; q < end; ++q) {
+            // Embeddings are assumed to be pre-normalized
+            const float* query = queries + q * static_cast<size_t>(dim);
+            const FaceSearchStopCondition::Stop reason = searchGraph(*graph, query, k, ef, *budget, exact, scratch, out + q * k,
+                                                                     allowed);
+            searchQueries.fetch_add(1, std::memory_order_relaxed);
+            if (reason == FaceSearchStopCondition::Stop::Confident)
+                confidentStops.fetch_add(1, std::memory_order_relaxed);
+            else if (reason == FaceSearchStopCondition::Stop::Budget)
+                budgetStops.fetch_add(1, std::memory_order_relaxed);
+        }
+    };
+    if (count < parallelSearchMin)
+        searchRows(0, count);
+    else
+        runSliced(count, searchRows);
+}
+
+void FaceIndex::searchAllowed(const float* queries, size_t count, size_t k, SearchMatch* out,
+                              const LabelSet& allowed)
+{
+    const std::shared_ptr<hnswlib::HierarchicalNSW<float>> graph = std::atomic_load(&index);
+    const EmbeddingStore::Snapshot exact = exactVectors.snapshot();
+    // The allowed templates that are live, copied out once for the whole batch. Each
+    // copy holds the template's label lock, so it is whole even while that template is
+    // being deleted; pointers into the graph could change under the scoring.
+    struct Candidate {
+        size_t label;
+        size_t userId;
+        const float* vector; // full-precision copy, if kept (the snapshot keeps it)
+    };
+    const size_t codeSize = graph->data_size_;
+    std::vector<Candidate> candidates;
+    std::vector<char> codes(allowed.size() * codeSize); // the candidates' graph elements, in order
+    candidates.reserve(allowed.size());
+    allowed.forEach([&](size_t label) {
+        char* data = codes.data() + candidates.size() * codeSize;
+        if (!copyElementData(*graph, label, data))
+            return;
+        if (quantizedSpace)
+            exact.prefetch(label); // disk-resident copies are read while the lookup goes on
+        candidates.push_back({label, static_cast<size_t>(templateSpace->get_doc_id(data)),
+                              quantizedSpace ? exact.find(label) : nullptr});
+    });
+
+    const hnswlib::DISTFUNC<float> exactDistance = space->get_dist_func();
+    const void* exactParam = space->get_dist_func_param();
+    const hnswlib::DISTFUNC<float> graphDistance = graphSpace()->get_dist_func();
+    const void* graphParam = graphSpace()->get_dist_func_param();
+    const auto searchRows = [&](size_t begin, size_t end) {
+        std::vector<char> code;
+        for (size_t q = begin; q < end; ++q) {
+            // Embeddings are assumed to be pre-normalized
+            const float* query = queries + q * static_cast<size_t>(dim);
+            const void* encoded = graphVector(query, code);
+            SearchMatch* row = out + q * k;
+            std::fill(row, row + k, SearchMatch());
+            for (size_t c = 0; c < candidates.size(); ++c) {
+                const Candidate& candidate = candidates[c];
+                const float distance = candidate.vector ? exactDistance(query, candidate.vector, exactParam)
+                                                        : graphDistance(encoded, codes.data() + c * codeSize, graphParam);
+                keepBest(row, k, candidate.userId, candidate.label, similarityFromDistance(distance));
             }
         }
-    } catch (const std::exception& e) {
-        qWarning() << "Error parsing face database file" << QString::fromStdString(path) << ":" << e.what();
-        // Clear potentially partially loaded data and reset index
-        idToName.clear();
-        index = std::make_unique<hnswlib::HierarchicalNSW<float>>(space.get(), max_elements_);
-        nextId = 0;
+    };
+    searchQueries.fetch_add(count, std::memory_order_relaxed);
+    if (count < parallelSearchMin || candidates.empty())
+        searchRows(0, count);
+    else
+        runSliced(count, searchRows);
+}
+
+void FaceIndex::runSliced(size_t count, const std::function<void(size_t begin, size_t end)>& searchRows)
+{
+    std::call_once(searchPoolStarted, [this] {
+        searchPool = std::make_unique<ThreadPool>(std::min(4u, std::max(1u, std::thread::hardware_concurrency())));
+    });
+    // Slices of at least 4 queries, one per pool thread plus one for this thread
+    const size_t slices = std::min(searchPool->size() + 1, (count + 3) / 4);
+    const size_t perSlice = (count + slices - 1) / slices;
+    std::vector<std::future<void>> tasks;
+    for (size_t begin = perSlice; begin < count; begin += perSlice)
+        tasks.push_back(searchPool->submit([&, begin] { searchRows(begin, std::min(begin + perSlice, count)); }));
+    std::exception_ptr failure;
+    try {
+        searchRows(0, perSlice);
+    } catch (...) {
+        failure = std::current_exception();
+    }
+    waitForTasks(tasks, std::function<void()>()); // also when this slice failed: the tasks use out
+    if (failure)
+        std::rethrow_exception(failure);
+}
+
+FaceSearchStopCondition::Stop FaceIndex::searchGraph(const hnswlib::HierarchicalNSW<float>& graph, const float* query,
+                                                     size_t k, size_t ef, const SearchBudget& budget,
+                                                     const EmbeddingStore::Snapshot& exact, SearchScratch& scratch,
+                                                     SearchMatch* row, const LabelSet* allowed)
+{
+    // Quantized graphs: collect more users and re-score their templates with a full-precision copy
+    const size_t rerank = quantizedSpace ? rerankCandidates.load() : 0;
+    const size_t users = std::max(k, rerank);
+    // Explores until ef distinct users are collected (or the budget ends it) and
+    // returns the templates of the nearest `users` of them, nearest first
+    FaceSearchStopCondition stop(*templateSpace, users, std::max(ef, users), budget);
+    std::optional<LabelSetFilter> filter;
+    if (allowed)
+        filter.emplace(*allowed);
+    const auto templates = graph.searchStopConditionClosest(graphVector(query, scratch.code), stop,
+                                                            filter ? &*filter : nullptr);
+    const bool exhaustive = stop.reason() == FaceSearchStopCondition::Stop::Exhaustive;
+    std::vector<SearchMatch>& candidates = scratch.candidates;
+    candidates.resize(templates.size());
+    for (size_t n = 0; n < templates.size(); ++n) {
+        // This hnswlib version returns internal ids here, not labels
+        const auto internalId = static_cast<hnswlib::tableint>(templates[n].second);
+        candidates[n].id = static_cast<size_t>(templateSpace->get_doc_id(graph.getDataByInternalId(internalId)));
+        candidates[n].templateId = graph.getExternalLabel(internalId);
+        candidates[n].similarity = similarityFromDistance(templates[n].first);
+        candidates[n].found = true;
+        candidates[n].exhaustive = exhaustive;
+    }
+    if (rerank > 0) {
+        const hnswlib::DISTFUNC<float> exactDistance = space->get_dist_func();
+        const void* exactParam = space->get_dist_func_param();
+        // Disk-resident copies: request every row before waiting on the first
+        for (const SearchMatch& candidate : candidates)
+            exact.prefetch(candidate.templateId);
+        for (SearchMatch& candidate : candidates) {
+            if (const float* v = exact.find(candidate.templateId))
+                candidate.similarity = similarityFromDistance(exactDistance(query, v, exactParam));
+        }
+        std::stable_sort(candidates.begin(), candidates.end(), [](const SearchMatch& a, const SearchMatch& b) {
+            return a.similarity > b.similarity;
+        });
+    }
+    // Each user once, scored by their best template
+    scratch.seen.clear();
+    size_t found = 0;
+    for (size_t n = 0; n < candidates.size() && found < k; ++n) {
+        if (scratch.seen.insert(candidates[n].id).second)
+            row[found++] = candidates[n];
+    }
+    SearchMatch padding;
+    padding.exhaustive = exhaustive;
+    std::fill(row + found, row + k, padding);
+    return stop.reason();
+}
+
+float FaceIndex::similarityFromDistance(float distance)
+{
+    // CosineSpace distance is 1 - dot product of unit vectors (0 = identical, 2 = opposite)
+    return 1.0f - distance;
+}
+
+bool FaceIndex::getEmbedding(size_t label, std::vector<float>& out)
+{
+    if (quantizedSpace) {
+        if (const float* v = exactVectors.snapshot().find(label)) {
+            out.assign(v, v + dim);
+            return true;
+        }
+    }
+    const std::shared_ptr<hnswlib::HierarchicalNSW<float>> graph = std::atomic_load(&index);
+    std::vector<char> code;
+    if (!copyElementData(*graph, label, code))
+        return false; // not in the graph, or deleted
+    out.resize(static_cast<size_t>(dim));
+    if (quantizedSpace)
+        quantizedSpace->decode(code.data(), out.data());
+    else
+        std::memcpy(out.data(), code.data(), out.size() * sizeof(float));
+    return true;
+}
+
+SearchResult FaceIndex::resolve(const SearchMatch& match, const NameTable& names, float threshold)
+{
+    if (!match.found) {
+        return {"", 0.0f, 0, false, match.exhaustive};
+    }
+    if (match.similarity < threshold) {
+        // Similarity below threshold, but we can still return what was found if needed for context
+        // For attendance logging, we only care about confirmed matches above threshold.
+        return {"", match.similarity, 0, false, match.exhaustive};
+    }
+    const std::string* name = names.find(match.id);
+    if (!name) {
+        // The user was deleted while the search ran (or a load is replacing the database)
+        return {"", match.similarity, match.id, false, match.exhaustive};
     }
+    return {*name, match.similarity, match.id, true, match.exhaustive};
 }
 
-const std::unordered_map<size_t, std::string>& FaceIndex::getIdToNameMap() const {
-    return idToName;
+std::shared_ptr<const FaceIndex::NameTable> FaceIndex::getIdToNameMap() const {
+    return std::atomic_load(&publishedNames);
 }
 
 bool FaceIndex::deleteUser(size_t label) {
-    if (idToName.find(label) == idToName.end()) {
+    if (readOnly) {
+        qWarning() << "Cannot delete user" << label << ": the face database is open read-only";
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(writeMutex);
+    if (!idToName.contains(label)) {
         qWarning() << "Attempted to delete non-existent user with label:" << label;
         return false; // Label not found in our map
     }
+    if (journalFailedLocked()) {
+        qWarning() << "Cannot delete user" << label << ": the face database cannot be saved right now";
+        return false;
+    }
+
+    eraseUserLocked(label);
+    // One record for the user; replay deletes their templates with it
+    FaceIndexJournal::Record record;
+    record.type = FaceIndexJournal::RecordType::Delete;
+    record.id = label;
+    journalOrWarnLocked(record);
+    // Note: nextId is NOT decremented. New users get fresh IDs (labels); the deleted
+    // user's graph slots stay tombstones until the next rebuild.
+    return true;
+}
 
+void FaceIndex::eraseUserLocked(size_t label)
+{
+    const std::vector<size_t> templates = deleteTemplatesLocked(label);
+    idToName.erase(label);
+    publishNamesLocked();
+    syncGalleryLocked();
+    if (rebuilding) {
+        // The shadow graph has no template table; give it every label
+        FaceIndexJournal::Record record;
+        record.type = FaceIndexJournal::RecordType::Delete;
+        for (size_t templateLabel : templates) {
+            record.id = templateLabel;
+            rebuildBacklog.push_back(record);
+        }
+    }
+    requestRebuildIfSparseLocked();
+}
+
+void FaceIndex::eraseTemplateLocked(size_t userId, size_t label)
+{
+    const auto extra = extraTemplates.find(userId);
+    if (extra == extraTemplates.end())
+        return;
+    const auto it = std::find(extra->second.begin(), extra->second.end(), label);
+    if (it == extra->second.end())
+        return; // went with the user
+    extra->second.erase(it);
+    if (extra->second.empty())
+        extraTemplates.erase(extra);
+    if (const GroupList* groups = userGroups.find(userId)) {
+        for (const std::string& group : *groups) {
+            auto members = std::make_shared<LabelSet>(*groupMembers[group]);
+            members->erase(label);
+            groupMembers[group] = std::move(members);
+        }
+        publishGroupsLocked();
+    }
     try {
-        // HNSWlib uses 'label' as the external label passed to addPoint
         index->markDelete(label);
-    } catch (const std::runtime_error& e) {
-        // This exception can be thrown if the label is not found in the HNSW graph,
-        // or if the element was already deleted, or other HNSW internal issues.
-        qWarning() << "Failed to mark label" << label << "as deleted in HNSW index:" << e.what();
-        // Depending on strictness, could return false. If we proceed, the user is removed
-        // from idToName map, so they won't be searchable or re-savable with this ID.
-        // If HNSW failed but it was in idToName, it's an inconsistency.
-        // For robustness, let's ensure it's removed from our map anyway.
+    } catch (const std::runtime_error&) {
+        // Already gone from the graph
+    }
+    exactVectors.erase(label);
+    galleryEraseLocked(label);
+    syncGalleryLocked();
+    if (rebuilding) {
+        FaceIndexJournal::Record record;
+        record.type = FaceIndexJournal::RecordType::Delete;
+        record.id = label;
+        rebuildBacklog.push_back(record);
     }
+    requestRebuildIfSparseLocked();
+}
 
-    idToName.erase(label);
-    // Note: nextId is NOT decremented. New users will get fresh IDs.
-    // HNSWlib handles reuse of space internally if elements are re-added later,
-    // but we are not re-using labels with current 'nextId++' logic.
+bool FaceIndex::setUserGroups(size_t userId, GroupList groups)
+{
+    if (readOnly) {
+        qWarning() << "Cannot change the groups of user" << userId << ": the face database is open read-only";
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(writeMutex);
+    if (!idToName.contains(userId)) {
+        qWarning() << "Attempted to set groups of non-existent user with label:" << userId;
+        return false;
+    }
+    if (journalFailedLocked()) {
+        qWarning() << "Cannot change the groups of user" << userId << ": the face database cannot be saved right now";
+        return false;
+    }
+    groups = normalizedGroups(std::move(groups));
+    regroupLocked(userId, groups);
+    publishGroupsLocked();
+    FaceIndexJournal::Record record;
+    record.type = FaceIndexJournal::RecordType::SetGroups;
+    record.id = userId;
+    record.groups = std::move(groups);
+    journalOrWarnLocked(record);
     return true;
 }
 
+FaceIndex::GroupList FaceIndex::parseGroupList(const std::string& commaSeparated)
+{
+    GroupList groups;
+    size_t begin = 0;
+    while (begin <= commaSeparated.size()) {
+        size_t end = commaSeparated.find(',', begin);
+        if (end == std::string::npos)
+            end = commaSeparated.size();
+        groups.push_back(commaSeparated.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    return normalizedGroups(std::move(groups));
+}
+
+std::shared_ptr<const FaceIndex::GroupTable> FaceIndex::getGroups() const
+{
+    return std::atomic_load(&publishedGroups);
+}
+
+std::shared_ptr<const LabelSet> FaceIndex::groupLabels(const GroupList& groups) const
+{
+    const std::shared_ptr<const GroupTable> table = getGroups();
+    auto labels = std::make_shared<LabelSet>();
+    for (const std::string& group : groups) {
+        const auto members = table->members.find(group);
+        if (members != table->members.end())
+            labels->unite(*members->second);
+    }
+    return labels;
+}
+
 bool FaceIndex::updateUserName(size_t label, const std::string& newName) {
-    auto it = idToName.find(label);
-    if (it == idToName.end()) {
+    if (readOnly) {
+        qWarning() << "Cannot rename user" << label << ": the face database is open read-only";
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(writeMutex);
+    if (!idToName.contains(label)) {
         qWarning() << "Attempted to update name for non-existent user with label:" << label;
         return false; // Label not found
     }
@@ -165,6 +1192,16 @@ bool FaceIndex::updateUserName(size_t label, const std::string& newName) {
         qWarning() << "Attempted to update user" << label << "with an empty name.";
         return false; // Or handle as an error, prevent empty names
     }
-    it->second = newName;
+    if (journalFailedLocked()) {
+        qWarning() << "Cannot rename user" << label << ": the face database cannot be saved right now";
+        return false;
+    }
+    idToName.set(label, newName);
+    publishNamesLocked();
+    FaceIndexJournal::Record record;
+    record.type = FaceIndexJournal::RecordType::Rename;
+    record.id = label;
+    record.name = newName;
+    journalOrWarnLocked(record);
     return true;
 }
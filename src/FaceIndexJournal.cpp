@@ -0,0 +1,397 @@
+// FaceIndexJournal.cpp
+
+#include "FaceIndexJournal.hpp"
+#include "FaceIndexStorage.hpp" // crc32
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <QDebug>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char journalMagic[4] = {'F', 'P', 'J', 'L'};
+const size_t journalHeaderBytes = 4 + 4 + 8;
+const size_t frameHeaderBytes = 4 + 4;
+
+void putU32(std::string& out, uint32_t v) { for (int i = 0; i < 4; ++i) out.push_back(char((v >> (8 * i)) & 0xff)); }
+void putU64(std::string& out, uint64_t v) { for (int i = 0; i < 8; ++i) out.push_back(char((v >> (8 * i)) & 0xff)); }
+
+uint32_t getU32(const char* p) { uint32_t v = 0; for (int i = 0; i < 4; ++i) v |= uint32_t(uint8_t(p[i])) << (8 * i); return v; }
+uint64_t getU64(const char* p) { uint64_t v = 0; for (int i = 0; i < 8; ++i) v |= uint64_t(uint8_t(p[i])) << (8 * i); return v; }
+
+} // namespace
+
+// Minimal append-only file with a real fsync, which std::ofstream cannot do
+struct FaceIndexJournal::File {
+#ifdef _WIN32
+    HANDLE handle = INVALID_HANDLE_VALUE;
+
+    File(const std::string& path, uint64_t keepBytes) {
+        handle = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+                             FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (handle == INVALID_HANDLE_VALUE)
+            throw std::runtime_error("Cannot open journal " + path);
+        LARGE_INTEGER offset;
+        offset.QuadPart = static_cast<LONGLONG>(keepBytes);
+        if (!SetFilePointerEx(handle, offset, nullptr, FILE_BEGIN) || !SetEndOfFile(handle)) {
+            CloseHandle(handle);
+            throw std::runtime_error("Cannot truncate journal " + path);
+        }
+    }
+    ~File() { CloseHandle(handle); }
+
+    void write(const char* data, size_t size) {
+        while (size > 0) {
+            DWORD written = 0;
+            const DWORD chunk = static_cast<DWORD>(std::min<size_t>(size, 1u << 30));
+            if (!WriteFile(handle, data, chunk, &written, nullptr))
+                throw std::runtime_error("Journal write failed");
+            data += written;
+            size -= written;
+        }
+    }
+    void sync() {
+        if (!FlushFileBuffers(handle))
+            throw std::runtime_error("Journal flush failed");
+    }
+    bool truncate(uint64_t bytes) {
+        LARGE_INTEGER offset;
+        offset.QuadPart = static_cast<LONGLONG>(bytes);
+        return SetFilePointerEx(handle, offset, nullptr, FILE_BEGIN) && SetEndOfFile(handle) && FlushFileBuffers(handle);
+    }
+#else
+    int fd = -1;
+
+    File(const std::string& path, uint64_t keepBytes) {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0)
+            throw std::runtime_error("Cannot open journal " + path);
+        if (::ftruncate(fd, static_cast<off_t>(keepBytes)) != 0 || ::lseek(fd, 0, SEEK_END) < 0) {
+            ::close(fd);
+            throw std::runtime_error("Cannot truncate journal " + path);
+        }
+    }
+    ~File() { ::close(fd); }
+
+    void write(const char* data, size_t size) {
+        while (size > 0) {
+            const ssize_t n = ::write(fd, data, size);
+            if (n < 0)
+                throw std::runtime_error("Journal write failed");
+            data += n;
+            size -= static_cast<size_t>(n);
+        }
+    }
+    void sync() {
+#if defined(__linux__)
+        const int rc = ::fdatasync(fd);
+#else
+        const int rc = ::fsync(fd);
+#endif
+        if (rc != 0)
+            throw std::runtime_error("Journal fsync failed");
+    }
+    bool truncate(uint64_t bytes) {
+        return ::ftruncate(fd, static_cast<off_t>(bytes)) == 0 && ::lseek(fd, 0, SEEK_END) >= 0 && ::fsync(fd) == 0;
+    }
+#endif
+};
+
+FaceIndexJournal::FaceIndexJournal()
+{
+    flusher = std::thread(&FaceIndexJournal::flusherLoop, this);
+}
+
+FaceIndexJournal::~FaceIndexJournal()
+{
+    close();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    pendingReady.notify_all();
+    flusher.join();
+}
+
+std::vector<FaceIndexJournal::Record> FaceIndexJournal::read(const std::string& path, uint64_t generation,
+                                                             size_t dim, uint64_t& validBytes)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("Cannot open journal " + path);
+    const std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    if (bytes.size() < journalHeaderBytes || std::memcmp(bytes.data(), journalMagic, 4) != 0)
+        throw std::runtime_error("Not a face index journal: " + path);
+    if (getU32(bytes.data() + 4) != formatVersion)
+        throw std::runtime_error("Unsupported face index journal version in " + path);
+    if (getU64(bytes.data() + 8) != generation)
+        throw std::runtime_error("Journal " + path + " belongs to another generation");
+
+    std::vector<Record> records;
+    size_t pos = journalHeaderBytes;
+    while (bytes.size() - pos >= frameHeaderBytes) {
+        const uint32_t length = getU32(bytes.data() + pos);
+        const uint32_t checksum = getU32(bytes.data() + pos + 4);
+        if (length < 9 || bytes.size() - pos - frameHeaderBytes < length)
+            break; // torn write at the tail
+        const char* p = bytes.data() + pos + frameHeaderBytes;
+        if (crc32(p, length) != checksum)
+            break;
+
+        Record r;
+        r.type = static_cast<RecordType>(static_cast<uint8_t>(p[0]));
+        r.id = getU64(p + 1);
+        size_t at = 9;
+        bool ok = true;
+        if (r.type == RecordType::Add || r.type == RecordType::Rename) {
+            ok = length - at >= 4;
+            const uint32_t nameLength = ok ? getU32(p + at) : 0;
+            at += 4;
+            ok = ok && length - at >= nameLength;
+            if (ok) {
+                r.name.assign(p + at, nameLength);
+                at += nameLength;
+            }
+        }
+        if (r.type == RecordType::AddTemplate) {
+            ok = length - at >= 8;
+            if (ok) {
+                r.identity = getU64(p + at);
+                at += 8;
+            }
+        }
+        if (ok && r.type == RecordType::SetGroups) {
+            ok = length - at >= 4;
+            const uint32_t count = ok ? getU32(p + at) : 0;
+            at += 4;
+            for (uint32_t g = 0; ok && g < count; ++g) {
+                ok = length - at >= 4;
+                const uint32_t nameLength = ok ? getU32(p + at) : 0;
+                at += 4;
+                ok = ok && length - at >= nameLength;
+                if (ok) {
+                    r.groups.emplace_back(p + at, nameLength);
+                    at += nameLength;
+                }
+            }
+        }
+        if (ok && (r.type == RecordType::Add || r.type == RecordType::AddTemplate)) {
+            ok = length - at == dim * sizeof(float);
+            if (ok) {
+                r.embedding.resize(dim);
+                std::memcpy(r.embedding.data(), p + at, dim * sizeof(float));
+                at += dim * sizeof(float);
+            }
+        }
+        if (!ok || at != length || (r.type != RecordType::Add && r.type != RecordType::Delete && r.type != RecordType::Rename
+                                       && r.type != RecordType::AddTemplate && r.type != RecordType::SetGroups)) {
+            qWarning() << "Ignoring malformed journal record in" << QString::fromStdString(path);
+            break;
+        }
+        records.push_back(std::move(r));
+        pos += frameHeaderBytes + length;
+    }
+    validBytes = pos;
+    return records;
+}
+
+void FaceIndexJournal::open(const std::string& path, uint64_t generation, uint64_t validBytes)
+{
+    close();
+
+    std::unique_ptr<File> opened(new File(path, validBytes));
+    uint64_t size = validBytes;
+    if (validBytes == 0) {
+        std::string header(journalMagic, sizeof(journalMagic));
+        putU32(header, formatVersion);
+        putU64(header, generation);
+        opened->write(header.data(), header.size());
+        opened->sync();
+        size = header.size();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    file = opened.release();
+    generation_ = generation;
+    headerBytes = journalHeaderBytes;
+    appendedBytes = durableBytes = size;
+    // What the old file lost is in the snapshot this journal follows
+    durableRecords = appendedRecords;
+    failure.clear();
+    flushed.notify_all();
+}
+
+void FaceIndexJournal::close()
+{
+    try {
+        flush();
+    } catch (const std::exception& e) {
+        qWarning() << "Closing a failed face index journal:" << e.what();
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    flushed.wait(lock, [this] { return !writing; }); // a failed flush() may return mid-batch
+    delete file;
+    file = nullptr;
+}
+
+bool FaceIndexJournal::isOpen() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return file != nullptr;
+}
+
+std::string FaceIndexJournal::encode(const Record& record)
+{
+    std::string payload;
+    payload.push_back(static_cast<char>(record.type));
+    putU64(payload, record.id);
+    if (record.type == RecordType::Add || record.type == RecordType::Rename) {
+        putU32(payload, static_cast<uint32_t>(record.name.size()));
+        payload += record.name;
+    }
+    if (record.type == RecordType::AddTemplate)
+        putU64(payload, record.identity);
+    if (record.type == RecordType::SetGroups) {
+        putU32(payload, static_cast<uint32_t>(record.groups.size()));
+        for (const std::string& group : record.groups) {
+            putU32(payload, static_cast<uint32_t>(group.size()));
+            payload += group;
+        }
+    }
+    if (record.type == RecordType::Add || record.type == RecordType::AddTemplate)
+        payload.append(reinterpret_cast<const char*>(record.embedding.data()), record.embedding.size() * sizeof(float));
+
+    std::string frame;
+    frame.reserve(frameHeaderBytes + payload.size());
+    putU32(frame, static_cast<uint32_t>(payload.size()));
+    putU32(frame, crc32(payload.data(), payload.size()));
+    frame += payload;
+    return frame;
+}
+
+uint64_t FaceIndexJournal::append(const Record& record)
+{
+    const std::string frame = encode(record);
+    uint64_t ticket;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!file)
+            throw std::runtime_error("Face index journal is not open");
+        if (!failure.empty())
+            throw std::runtime_error("Face index journal failed: " + failure);
+        pending += frame;
+        ++pendingRecords;
+        appendedBytes += frame.size();
+        ticket = ++appendedRecords;
+    }
+    pendingReady.notify_one();
+    return ticket;
+}
+
+void FaceIndexJournal::waitDurable(uint64_t ticket)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    pendingReady.notify_one();
+    flushed.wait(lock, [&] { return durableRecords >= ticket || !failure.empty() || !file; });
+    if (durableRecords < ticket) {
+        if (!failure.empty())
+            throw std::runtime_error("Face index journal failed: " + failure);
+        throw std::runtime_error("Face index journal was closed before the change was written");
+    }
+}
+
+void FaceIndexJournal::flush()
+{
+    uint64_t target;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        target = appendedRecords;
+    }
+    waitDurable(target);
+}
+
+uint64_t FaceIndexJournal::generation() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return generation_;
+}
+
+uint64_t FaceIndexJournal::sizeBytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return appendedBytes;
+}
+
+bool FaceIndexJournal::hasRecords() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return file && appendedBytes > headerBytes;
+}
+
+bool FaceIndexJournal::failed() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return !failure.empty();
+}
+
+void FaceIndexJournal::flusherLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        pendingReady.wait(lock, [this] { return stopping || (!pending.empty() && file); });
+        if (pending.empty() || !file) {
+            if (stopping)
+                return;
+            continue;
+        }
+
+        // Everything appended up to now goes out with one write + one fsync
+        std::string batch;
+        batch.swap(pending);
+        const uint64_t records = pendingRecords;
+        pendingRecords = 0;
+        File* target = file;
+        const uint64_t keepBytes = durableBytes;
+        writing = true;
+        lock.unlock();
+        std::string error;
+        try {
+            target->write(batch.data(), batch.size());
+            target->sync();
+        } catch (const std::exception& e) {
+            error = e.what();
+            // Later records must not follow a torn frame, where replay would never reach them
+            if (!target->truncate(keepBytes))
+                error += "; the torn tail could not be cut off";
+            qWarning() << "Face index journal:" << QString::fromStdString(error);
+        }
+        lock.lock();
+        if (error.empty()) {
+            durableBytes += batch.size();
+            durableRecords += records;
+        } else {
+            // Records appended meanwhile are lost with the batch
+            failure = error;
+            pending.clear();
+            pendingRecords = 0;
+            appendedBytes = durableBytes;
+        }
+        writing = false;
+        flushed.notify_all();
+    }
+}
@@ -0,0 +1,654 @@
+// FaceIndexPersistence.cpp
+//
+// FaceIndex's storage: the journal, saving and loading snapshots, journal replay,
+// storage conversion and the legacy CSV import.
+
+#include "FaceIndex.hpp"
+#include "FaceIndexInternal.hpp"
+#include "FaceIndexStorage.hpp"
+#include "MappedFile.hpp"
+#include "MappedHierarchicalNSW.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <QDebug> // For qWarning()
+
+using namespace FaceIndexInternal;
+
+namespace {
+
+// Rows parsed from one newline-aligned slice of a CSV database
+struct CsvChunk {
+    const char* begin = nullptr;
+    const char* end = nullptr;
+    std::vector<std::string> names;
+    std::vector<float> values; // names.size() x dim
+};
+
+// Parses "name,v1,...,vdim[,ignored...]" into the chunk. Returns false for a malformed line.
+bool parseCsvLine(const char* line, const char* eol, int dim, CsvChunk& out)
+{
+    const char* comma = static_cast<const char*>(std::memchr(line, ',', static_cast<size_t>(eol - line)));
+    if (!comma)
+        return false;
+    const size_t base = out.values.size();
+    out.values.resize(base + static_cast<size_t>(dim));
+    float* values = out.values.data() + base;
+
+    const char* p = comma + 1;
+    for (int i = 0; i < dim; ++i) {
+        while (p < eol && isBlank(*p)) ++p;
+        const auto parsed = std::from_chars(p, eol, values[i]);
+        if (parsed.ec != std::errc()) {
+            out.values.resize(base);
+            return false;
+        }
+        p = parsed.ptr;
+        while (p < eol && isBlank(*p)) ++p;
+        if (i + 1 < dim) {
+            if (p == eol || *p != ',') {
+                out.values.resize(base);
+                return false;
+            }
+            ++p;
+        }
+    }
+    out.names.emplace_back(line, comma);
+    return true;
+}
+
+void parseCsvChunk(int dim, CsvChunk& chunk)
+{
+    const char* line = chunk.begin;
+    while (line < chunk.end) {
+        const char* eol = static_cast<const char*>(std::memchr(line, '\n', static_cast<size_t>(chunk.end - line)));
+        if (!eol)
+            eol = chunk.end;
+        const bool blank = std::all_of(line, eol, isBlank);
+        if (!blank && !parseCsvLine(line, eol, dim, chunk)) {
+            const std::string name(line, std::find(line, eol, ','));
+            qWarning() << "Skipping corrupted or incomplete line in face database for" << QString::fromStdString(name);
+        }
+        line = eol + 1;
+    }
+}
+
+} // namespace
+
+uint64_t FaceIndex::journalLocked(const FaceIndexJournal::Record& record)
+{
+    if (!journal || !journal->isOpen()) {
+        qWarning() << "Face database change for label" << record.id << "is not persisted: no journal is open";
+        return 0;
+    }
+    const uint64_t ticket = journal->append(record);
+    if (journal->sizeBytes() >= compactionThreshold) {
+        compactionRequested = true;
+        compactorWake.notify_one();
+    }
+    return ticket;
+}
+
+void FaceIndex::journalOrWarnLocked(const FaceIndexJournal::Record& record)
+{
+    try {
+        journalLocked(record);
+    } catch (const std::exception& e) {
+        qWarning() << "Failed to journal face database change:" << e.what();
+    }
+}
+
+void FaceIndex::awaitJournaled(uint64_t ticket, uint64_t generation, const std::function<void()>& undoLocked)
+{
+    if (ticket == 0)
+        return;
+    try {
+        journal->waitDurable(ticket); // the journal object lives as long as the index
+    } catch (const std::exception& e) {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        if (storageGeneration != generation)
+            return; // a snapshot saved since holds the change
+        undoLocked();
+        // A new snapshot and journal are the way back to saving changes
+        compactionRequested = true;
+        compactorWake.notify_one();
+        throw std::runtime_error(std::string("The face database change could not be saved: ") + e.what());
+    }
+}
+
+bool FaceIndex::saveToDisk(const std::string& path) {
+    if (readOnly) {
+        qWarning() << "Not saving face database" << QString::fromStdString(path) << ": opened read-only";
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(writeMutex);
+    try {
+        saveBinaryLocked(FaceIndexStorage(path));
+        return true;
+    } catch (const std::exception& e) {
+        qWarning() << "Failed to save face database" << QString::fromStdString(path) << ":" << e.what();
+        return false;
+    }
+}
+
+bool FaceIndex::refreshSnapshot(const std::string& path) {
+    if (!readOnly)
+        return false;
+    FaceIndexStorage storage(path);
+    try {
+        // Cheap check first: the sidecar names the current generation
+        if (!storage.hasMeta() || storage.readMeta().generation == storageGeneration)
+            return false;
+        std::lock_guard<std::mutex> lock(writeMutex);
+        loadBinaryLocked(storage);
+        return true;
+    } catch (const std::exception& e) {
+        // E.g. the writer replaced the snapshot while we were opening it; try again next time
+        qWarning() << "Could not refresh face database snapshot:" << e.what();
+        return false;
+    }
+}
+
+bool FaceIndex::loadFromDisk(const std::string& path, const LoadProgress& progress) {
+    FaceIndexStorage storage(path);
+    std::lock_guard<std::mutex> lock(writeMutex);
+    if (journal)
+        journal->close();
+    databasePath.clear();
+
+    const bool found = storage.hasMeta() || storage.hasLegacyCsv() || !storage.journalGenerations(0).empty();
+    bool migrateCsv = false;
+    bool converted = false;
+    if (storage.hasMeta()) {
+        try {
+            converted = loadBinaryLocked(storage);
+        } catch (const std::exception& e) {
+            qWarning() << "Failed to load face database" << QString::fromStdString(storage.metaPath()) << ":" << e.what();
+            if (!storage.hasLegacyCsv())
+                return false; // Don't journal on top of a database we could not read
+            qWarning() << "Falling back to legacy CSV" << QString::fromStdString(storage.legacyCsvPath());
+            migrateCsv = true;
+        }
+    } else if (storage.hasLegacyCsv()) {
+        migrateCsv = true;
+    } else {
+        // Nothing saved yet, but changes may already be journaled against generation 0
+        resetLocked();
+        storageGeneration = 0;
+    }
+
+    if (migrateCsv) {
+        if (labelStride > 1) {
+            // CSV rows are numbered from 0, which does not fit a shard's label sequence
+            qWarning() << "Face database" << QString::fromStdString(storage.legacyCsvPath())
+                       << "is in the legacy CSV format, which a shard cannot import";
+            return false;
+        }
+        if (readOnly) {
+            // A reader never writes; the migration has to happen in the writer process
+            qWarning() << "Face database" << QString::fromStdString(storage.legacyCsvPath())
+                       << "is still in the legacy CSV format; open it once read-write to migrate it";
+            return false;
+        }
+        // One-shot migration: parse the CSV (and build the graph) this one time, then
+        // write the binary files so later startups only read them back
+        if (!loadLegacyCsvLocked(storage.legacyCsvPath(), progress))
+            return false; // Keep the CSV untouched so nothing is lost
+        storageGeneration = 0; // the CSV plays the part of snapshot 0
+    }
+
+    if (readOnly)
+        return found; // Readers follow the writer's compacted snapshots, not its journal
+
+    try {
+        replayJournalsLocked(storage);
+        databasePath = path;
+    } catch (const std::exception& e) {
+        qWarning() << "Cannot open face database journal; changes will not be saved:" << e.what();
+        return found;
+    }
+
+    if (migrateCsv) {
+        try {
+            saveBinaryLocked(storage);
+            if (!storage.retireLegacyCsv())
+                qWarning() << "Migrated face database but could not rename" << QString::fromStdString(storage.legacyCsvPath());
+            qInfo() << "Migrated face database" << QString::fromStdString(storage.legacyCsvPath())
+                    << "to the binary format:" << idToName.size() << "users";
+        } catch (const std::exception& e) {
+            // The CSV stays in place (changes go to its journal), so the migration is retried on the next start
+            qWarning() << "Failed to migrate face database to the binary format:" << e.what();
+        }
+    }
+    if (converted) {
+        try {
+            saveBinaryLocked(storage);
+            qInfo() << "Converted face database graph to" << vectorStorageName(storageMode) << "vectors with user ids";
+        } catch (const std::exception& e) {
+            // The old files are still valid; the conversion is repeated on the next start
+            qWarning() << "Failed to save the converted face database:" << e.what();
+        }
+    }
+    requestGrowthIfLowLocked();
+    requestRebuildIfSparseLocked();
+    return found;
+}
+
+void FaceIndex::replayJournalsLocked(const FaceIndexStorage& storage) {
+    uint64_t lastGeneration = storageGeneration;
+    uint64_t lastValidBytes = 0;
+    size_t replayed = 0;
+    for (uint64_t generation : storage.journalGenerations(storageGeneration)) {
+        const std::string journalPath = storage.journalPath(generation);
+        uint64_t validBytes = 0;
+        std::vector<FaceIndexJournal::Record> records;
+        try {
+            records = FaceIndexJournal::read(journalPath, generation, static_cast<size_t>(dim), validBytes);
+        } catch (const std::exception& e) {
+            qWarning() << "Skipping face database journal:" << e.what();
+        }
+
+        std::vector<char> code;
+        for (const FaceIndexJournal::Record& record : records) {
+            const size_t label = static_cast<size_t>(record.id);
+            switch (record.type) {
+            case FaceIndexJournal::RecordType::Add:
+                try {
+                    if (freeSlotsLocked() == 0)
+                        growLocked(); // searches may be running, so not resizeIndex()
+                    if (keepsExactLocked())
+                        exactVectors.put(label, record.embedding.data());
+                    index->addPoint(graphElement(record.embedding.data(), label, code), label);
+                } catch (const std::exception& e) {
+                    qWarning() << "Cannot replay registration of label" << label << ":" << e.what();
+                    continue;
+                }
+                galleryAddLocked(label, label, record.embedding.data());
+                idToName.set(label, record.name);
+                nextId = std::max(nextId, label + labelStride);
+                break;
+            case FaceIndexJournal::RecordType::AddTemplate: {
+                const auto userId = static_cast<size_t>(record.identity);
+                if (!idToName.contains(userId)) {
+                    qWarning() << "Skipping journaled template" << label << "of unknown user" << userId;
+                    continue;
+                }
+                try {
+                    if (freeSlotsLocked() == 0)
+                        growLocked();
+                    if (keepsExactLocked())
+                        exactVectors.put(label, record.embedding.data());
+                    index->addPoint(graphElement(record.embedding.data(), userId, code), label);
+                } catch (const std::exception& e) {
+                    qWarning() << "Cannot replay template" << label << "of user" << userId << ":" << e.what();
+                    continue;
+                }
+                galleryAddLocked(label, userId, record.embedding.data());
+                extraTemplates[userId].push_back(label);
+                groupTemplateLocked(userId, label);
+                nextId = std::max(nextId, label + labelStride);
+                break;
+            }
+            case FaceIndexJournal::RecordType::Delete:
+                // The user with all their templates; already gone from the graph is fine,
+                // the name is what matters
+                deleteTemplatesLocked(label);
+                idToName.erase(label);
+                break;
+            case FaceIndexJournal::RecordType::Rename:
+                if (idToName.contains(label))
+                    idToName.set(label, record.name);
+                break;
+            case FaceIndexJournal::RecordType::SetGroups:
+                if (idToName.contains(label))
+                    regroupLocked(label, normalizedGroups(record.groups));
+                break;
+            }
+            ++replayed;
+        }
+        lastGeneration = generation;
+        lastValidBytes = validBytes;
+    }
+    if (replayed > 0) {
+        qInfo() << "Replayed" << replayed << "face database changes from the journal";
+        publishNamesLocked();
+        publishGroupsLocked();
+        syncGalleryLocked(); // deletes may have brought the count under the limit
+    }
+
+    // Keep appending to the newest journal; a torn record at its end is cut off
+    if (!journal)
+        journal = std::make_unique<FaceIndexJournal>();
+    journal->open(storage.journalPath(lastGeneration), lastGeneration, lastValidBytes);
+    if (lastValidBytes == 0)
+        storage.syncDirectory(); // a new journal file; its records are no use if its name is lost
+}
+
+void FaceIndex::resetLocked(size_t capacity) {
+    publishIndexLocked(makeGraph(graphSpace(), std::max(capacity, initialCapacity), graphM));
+    ++graphEpoch;
+    exactVectors.clear();
+    idToName.clear();
+    extraTemplates.clear();
+    publishNamesLocked();
+    userGroups.clear();
+    groupMembers.clear();
+    publishGroupsLocked();
+    gallery.clear();
+    galleryActive = false;
+    syncGalleryLocked();
+    nextId = firstLabel;
+}
+
+void FaceIndex::saveBinaryLocked(const FaceIndexStorage& storage) {
+    // Saving the journaled database folds the journal into the new snapshot
+    FaceIndexJournal* active = nullptr;
+    if (journal && journal->isOpen() && !databasePath.empty()
+        && FaceIndexStorage(databasePath).metaPath() == storage.metaPath())
+        active = journal.get();
+
+    // The graph goes to a new generation file first; the sidecar rename is the commit point.
+    // A failed save may already have started journal <gen>, so never reuse that number.
+    uint64_t generation = storageGeneration + 1;
+    if (active)
+        generation = std::max(generation, active->generation() + 1);
+    const std::string graphFile = storage.graphFileName(generation);
+    const std::string graphPath = storage.pathInDirectory(graphFile);
+    index->saveIndex(graphPath);
+
+    std::error_code ec;
+    const uint64_t graphSize = std::filesystem::file_size(graphPath, ec);
+    if (ec || graphSize != index->indexFileSize())
+        throw std::runtime_error("Incomplete graph file " + graphPath);
+    // The new sidecar may only name files that are on disk; once it does, the journals
+    // they replace are deleted
+    FaceIndexStorage::syncFile(graphPath);
+
+    FaceIndexMeta meta;
+    meta.dim = static_cast<uint32_t>(dim);
+    meta.nextId = nextId;
+    meta.generation = generation;
+    meta.graphFile = graphFile;
+    meta.graphSize = graphSize;
+    meta.vectorStorage = static_cast<uint32_t>(storageMode);
+    meta.searchEf = static_cast<uint32_t>(searchEf.load());
+    meta.graphM = static_cast<uint32_t>(graphM);
+    if (keepsExactLocked()) {
+        const std::string vectorsFile = storage.vectorsFileName(generation);
+        const std::string vectorsPath = storage.pathInDirectory(vectorsFile);
+        meta.vectorsSize = exactVectors.save(vectorsPath, nextId);
+        if (std::filesystem::file_size(vectorsPath, ec) != meta.vectorsSize || ec)
+            throw std::runtime_error("Incomplete embedding file " + vectorsPath);
+        FaceIndexStorage::syncFile(vectorsPath);
+        meta.vectorsFile = vectorsFile;
+    }
+    meta.idToName = idToName;
+    meta.userGroups = userGroups;
+    // Changes from here on belong after the new snapshot. Until the sidecar names it,
+    // a load still starts from the old snapshot and replays both journals.
+    if (active)
+        active->open(storage.journalPath(generation), generation, 0);
+    storage.writeMeta(meta); // also makes the new journal's directory entry durable
+
+    storageGeneration = generation;
+    if (active && !meta.vectorsFile.empty() && exactVectors.isDiskResident()) {
+        // Map the new file, which also holds the rows added since the last one
+        try {
+            exactVectors.load(storage.pathInDirectory(meta.vectorsFile));
+        } catch (const std::exception& e) {
+            qWarning() << "Cannot map the saved embedding file; new faces stay in memory:" << e.what();
+        }
+    }
+    storage.removeStaleGraphs(generation);
+    storage.removeStaleVectors(generation);
+    storage.removeStaleJournals(generation);
+}
+
+bool FaceIndex::loadBinaryLocked(const FaceIndexStorage& storage) {
+    FaceIndexMeta meta = storage.readMeta();
+    if (labelStride > 1 && meta.nextId % labelStride != firstLabel)
+        throw std::runtime_error("Face database " + storage.metaPath() + " belongs to another shard");
+    if (meta.dim != static_cast<uint32_t>(dim))
+        throw std::runtime_error("Face database has dimension " + std::to_string(meta.dim) + ", expected " + std::to_string(dim));
+    if (meta.vectorStorage > static_cast<uint32_t>(VectorStorage::Int8))
+        throw std::runtime_error("Face database uses unknown vector storage " + std::to_string(meta.vectorStorage));
+    const auto fileStorage = static_cast<VectorStorage>(meta.vectorStorage);
+    const bool convert = fileStorage != storageMode || !meta.identityIds;
+    if (fileStorage != storageMode && readOnly)
+        throw std::runtime_error(std::string("Face database stores ") + vectorStorageName(fileStorage) + " vectors, not "
+                                 + vectorStorageName(storageMode) + "; open it read-write with this setting to convert it");
+    if (convert && readOnly)
+        throw std::runtime_error("Face database predates multi-template users; open it read-write once to upgrade it");
+
+    const std::string graphPath = storage.pathInDirectory(meta.graphFile);
+    std::error_code ec;
+    const uint64_t graphSize = std::filesystem::file_size(graphPath, ec);
+    if (ec || graphSize != meta.graphSize)
+        throw std::runtime_error("Graph file " + graphPath + " is missing or has the wrong size");
+
+    // loadIndex reads the graph straight into memory; no points are re-inserted.
+    // Capacity is initialCapacity or the stored element count, whichever is larger.
+    // Read-only indexes map the file instead and share it with other processes.
+    // A graph being converted is read with a space for its own storage (and without
+    // user ids if it predates them).
+    std::unique_ptr<QuantizedSpace> fileCodec;
+    std::unique_ptr<TemplateSpace> fileIds;
+    hnswlib::SpaceInterface<float>* fileSpace = graphSpace();
+    if (convert) {
+        hnswlib::SpaceInterface<float>* fileVectors = space.get();
+        if (fileStorage != VectorStorage::Float32) {
+            fileCodec = std::make_unique<QuantizedSpace>(static_cast<size_t>(dim), fileStorage);
+            fileVectors = fileCodec.get();
+        }
+        fileSpace = fileVectors;
+        if (meta.identityIds) {
+            fileIds = std::make_unique<TemplateSpace>(*fileVectors);
+            fileSpace = fileIds.get();
+        }
+    }
+    std::unique_ptr<hnswlib::HierarchicalNSW<float>> loaded;
+    if (readOnly)
+        loaded = std::make_unique<MappedHierarchicalNSW>(fileSpace, graphPath);
+    else
+        loaded = std::make_unique<hnswlib::HierarchicalNSW<float>>(fileSpace, graphPath, false, initialCapacity, false);
+    // loadIndex trusts the space for the vector size; a mismatch would misread every element
+    if (loaded->label_offset_ - loaded->offsetData_ != fileSpace->get_data_size())
+        throw std::runtime_error("Graph file " + graphPath + " does not match the vector format in its metadata");
+
+    // Full-precision copies, for re-ranking and as the better source for a conversion
+    if (!meta.vectorsFile.empty() && (keepsExactLocked() || convert)) {
+        const std::string vectorsPath = storage.pathInDirectory(meta.vectorsFile);
+        if (std::filesystem::file_size(vectorsPath, ec) != meta.vectorsSize || ec)
+            throw std::runtime_error("Embedding file " + vectorsPath + " is missing or has the wrong size");
+        exactVectors.load(vectorsPath);
+    } else {
+        exactVectors.clear();
+        if (keepsExactLocked() && fileStorage != VectorStorage::Float32)
+            qWarning() << "Face database has no full-precision embeddings; faces registered earlier are not re-ranked";
+    }
+    // Chosen by tuneSearch(); databases never tuned keep the defaults. Set before a
+    // conversion so it builds its graph with the saved M.
+    searchEf = meta.searchEf ? meta.searchEf : defaultSearchEf;
+    graphM = meta.graphM ? meta.graphM : defaultGraphM;
+    if (convert) {
+        loaded = convertGraphLocked(*loaded, fileCodec.get(), fileIds.get());
+        if (!keepsExactLocked())
+            exactVectors.clear();
+    }
+
+    publishIndexLocked(std::move(loaded));
+    ++graphEpoch;
+    indexTemplatesLocked();
+    gallery.clear();
+    galleryActive = false;
+    syncGalleryLocked();
+    idToName = std::move(meta.idToName);
+    publishNamesLocked();
+    userGroups = std::move(meta.userGroups);
+    rebuildGroupsLocked();
+    publishGroupsLocked();
+    nextId = meta.nextId;
+    storageGeneration = meta.generation;
+    return convert;
+}
+
+std::unique_ptr<hnswlib::HierarchicalNSW<float>> FaceIndex::convertGraphLocked(hnswlib::HierarchicalNSW<float>& source,
+                                                                               const QuantizedSpace* sourceCodec,
+                                                                               TemplateSpace* sourceIds)
+{
+    // Each live entry as fp32: its full-precision copy if there is one, else the stored vector
+    const size_t count = source.getCurrentElementCount();
+    const size_t width = static_cast<size_t>(dim);
+    const EmbeddingStore::Snapshot exact = exactVectors.snapshot();
+    std::vector<size_t> labels, users;
+    std::vector<float> vectors;
+    labels.reserve(count - source.getDeletedCount());
+    users.reserve(count - source.getDeletedCount());
+    vectors.reserve((count - source.getDeletedCount()) * width);
+    for (size_t i = 0; i < count; ++i) {
+        const auto internalId = static_cast<hnswlib::tableint>(i);
+        if (source.isMarkedDeleted(internalId))
+            continue;
+        const size_t label = source.getExternalLabel(internalId);
+        const char* data = source.getDataByInternalId(internalId);
+        labels.push_back(label);
+        users.push_back(sourceIds ? static_cast<size_t>(sourceIds->get_doc_id(data)) : label);
+        vectors.resize(vectors.size() + width);
+        float* v = vectors.data() + vectors.size() - width;
+        if (const float* e = exact.find(label)) {
+            std::memcpy(v, e, width * sizeof(float));
+        } else if (sourceCodec) {
+            sourceCodec->decode(data, v);
+        } else {
+            std::memcpy(v, data, width * sizeof(float));
+            if (keepsExactLocked())
+                exactVectors.put(label, v);
+        }
+    }
+
+    auto graph = makeGraph(graphSpace(), std::max(source.getMaxElements(), initialCapacity), graphM);
+    ThreadPool pool;
+    std::atomic<size_t> nextRow{0};
+    std::vector<std::future<void>> tasks;
+    for (size_t w = 0; w < pool.size(); ++w) {
+        tasks.push_back(pool.submit([&] {
+            std::vector<char> code;
+            for (size_t r; (r = nextRow.fetch_add(1)) < labels.size();)
+                graph->addPoint(graphElement(vectors.data() + r * width, users[r], code), labels[r]);
+        }));
+    }
+    waitForTasks(tasks, std::function<void()>());
+    return graph;
+}
+
+bool FaceIndex::loadLegacyCsvLocked(const std::string& path, const LoadProgress& progress) {
+    std::error_code ec;
+    if (std::filesystem::file_size(path, ec) == 0 && !ec) {
+        resetLocked(); // an empty database cannot be mapped, but is valid
+        return true;
+    }
+    std::unique_ptr<MappedFile> file;
+    try {
+        file = std::make_unique<MappedFile>(path);
+    } catch (const std::exception& e) {
+        qWarning() << "Cannot read face database file" << QString::fromStdString(path) << ":" << e.what();
+        return false;
+    }
+    file->prefetch();
+
+    ThreadPool pool;
+    const size_t workers = pool.size();
+
+    // Split into about 8 chunks per worker, each ending just after a newline
+    std::vector<CsvChunk> chunks;
+    const char* const fileEnd = file->data() + file->size();
+    const size_t target = std::max<size_t>(file->size() / (workers * 8), 1 << 16);
+    for (const char* begin = file->data(); begin < fileEnd;) {
+        const char* end = begin + std::min<size_t>(target, static_cast<size_t>(fileEnd - begin));
+        end = std::find(end, fileEnd, '\n');
+        if (end != fileEnd)
+            ++end;
+        CsvChunk chunk;
+        chunk.begin = begin;
+        chunk.end = end;
+        chunks.push_back(std::move(chunk));
+        begin = end;
+    }
+
+    try {
+        // 1. Parse the chunks in parallel
+        std::atomic<size_t> nextChunk{0}, chunksParsed{0};
+        std::vector<std::future<void>> tasks;
+        for (size_t w = 0; w < workers; ++w) {
+            tasks.push_back(pool.submit([&] {
+                for (size_t c; (c = nextChunk.fetch_add(1)) < chunks.size();) {
+                    parseCsvChunk(dim, chunks[c]);
+                    ++chunksParsed;
+                }
+            }));
+        }
+        waitForTasks(tasks, progress ? std::function<void()>([&] {
+            progress(LoadPhase::Parsing, chunksParsed.load(), chunks.size());
+        }) : std::function<void()>());
+
+        // Labels follow file order, as they did when the file was read line by line
+        std::vector<size_t> firstRow(chunks.size() + 1, 0);
+        for (size_t c = 0; c < chunks.size(); ++c)
+            firstRow[c + 1] = firstRow[c] + chunks[c].names.size();
+        const size_t rows = firstRow.back();
+        if (rows > initialCapacity)
+            qInfo() << "Face database has" << rows << "rows; growing the index beyond" << initialCapacity;
+        resetLocked(rows);
+        if (keepsExactLocked()) {
+            for (size_t c = 0; c < chunks.size(); ++c) {
+                for (size_t i = 0; i < chunks[c].names.size(); ++i)
+                    exactVectors.put(firstRow[c] + i, chunks[c].values.data() + i * static_cast<size_t>(dim));
+            }
+        }
+
+        // 2. Insert concurrently; HierarchicalNSW::addPoint is safe for distinct labels
+        std::atomic<size_t> nextRow{0}, rowsAdded{0};
+        std::atomic<bool> failed{false};
+        tasks.clear();
+        for (size_t w = 0; w < workers; ++w) {
+            tasks.push_back(pool.submit([&] {
+                try {
+                    std::vector<char> code;
+                    for (size_t r; !failed && (r = nextRow.fetch_add(1)) < rows;) {
+                        const size_t c = static_cast<size_t>(std::upper_bound(firstRow.begin(), firstRow.end(), r) - firstRow.begin()) - 1;
+                        const float* embedding = chunks[c].values.data() + (r - firstRow[c]) * static_cast<size_t>(dim);
+                        index->addPoint(graphElement(embedding, r, code), r);
+                        ++rowsAdded;
+                    }
+                } catch (...) {
+                    failed = true;
+                    throw;
+                }
+            }));
+        }
+        waitForTasks(tasks, progress ? std::function<void()>([&] {
+            progress(LoadPhase::Indexing, rowsAdded.load(), rows);
+        }) : std::function<void()>());
+
+        for (size_t c = 0; c < chunks.size(); ++c) {
+            for (size_t i = 0; i < chunks[c].names.size(); ++i)
+                idToName.set(firstRow[c] + i, std::move(chunks[c].names[i]));
+        }
+        publishNamesLocked();
+        nextId = rows;
+        // resetLocked() started it for an empty graph; the rows went in behind its back
+        gallery.clear();
+        galleryActive = false;
+        syncGalleryLocked();
+    } catch (const std::exception& e) {
+        qWarning() << "Error loading face database file" << QString::fromStdString(path) << ":" << e.what();
+        // Clear potentially partially loaded data and reset index
+        resetLocked();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,336 @@
+// FaceIndexStorage.cpp
+
+#include "FaceIndexStorage.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const char metaMagic[4] = {'F', 'P', 'I', 'X'};
+
+// Sidecar values are written little-endian byte by byte, so the file is portable
+class ByteWriter {
+public:
+    void u32(uint32_t v) { for (int i = 0; i < 4; ++i) bytes.push_back(char((v >> (8 * i)) & 0xff)); }
+    void u64(uint64_t v) { for (int i = 0; i < 8; ++i) bytes.push_back(char((v >> (8 * i)) & 0xff)); }
+    void str(const std::string& s) { u32(static_cast<uint32_t>(s.size())); bytes += s; }
+    void raw(const char* p, size_t n) { bytes.append(p, n); }
+    std::string bytes;
+};
+
+class ByteReader {
+public:
+    ByteReader(const char* p, size_t n) : data(p), size(n) {}
+    uint32_t u32() { need(4); uint32_t v = 0; for (int i = 0; i < 4; ++i) v |= uint32_t(uint8_t(data[pos + i])) << (8 * i); pos += 4; return v; }
+    uint64_t u64() { need(8); uint64_t v = 0; for (int i = 0; i < 8; ++i) v |= uint64_t(uint8_t(data[pos + i])) << (8 * i); pos += 8; return v; }
+    std::string str() { const uint32_t n = u32(); need(n); std::string s(data + pos, n); pos += n; return s; }
+    void raw(char* out, size_t n) { need(n); std::memcpy(out, data + pos, n); pos += n; }
+    bool atEnd() const { return pos == size; }
+private:
+    void need(size_t n) const {
+        if (size - pos < n)
+            throw std::runtime_error("Face index metadata is truncated");
+    }
+    const char* data;
+    size_t size;
+    size_t pos = 0;
+};
+
+bool endsWith(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+} // namespace
+
+uint32_t crc32(const void* data, size_t size, uint32_t crc)
+{
+    // Standard reflected CRC-32 (polynomial 0xEDB88320), table built on first use
+    static const auto table = [] {
+        std::vector<uint32_t> t(256);
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i)
+        crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+FaceIndexStorage::FaceIndexStorage(const std::string& databasePath)
+{
+    const fs::path path(databasePath);
+    directory_ = path.has_parent_path() ? path.parent_path().string() + "/" : std::string();
+    baseName_ = path.filename().string();
+    if (endsWith(baseName_, ".csv"))
+        baseName_.resize(baseName_.size() - 4);
+    metaPath_ = directory_ + baseName_ + ".meta";
+    legacyCsvPath_ = directory_ + baseName_ + ".csv";
+}
+
+std::string FaceIndexStorage::graphFileName(uint64_t generation) const
+{
+    return baseName_ + ".graph." + std::to_string(generation);
+}
+
+std::string FaceIndexStorage::vectorsFileName(uint64_t generation) const
+{
+    return baseName_ + ".vectors." + std::to_string(generation);
+}
+
+std::string FaceIndexStorage::pathInDirectory(const std::string& fileName) const
+{
+    return directory_ + fileName;
+}
+
+bool FaceIndexStorage::hasMeta() const
+{
+    std::error_code ec;
+    return fs::is_regular_file(metaPath_, ec);
+}
+
+bool FaceIndexStorage::hasLegacyCsv() const
+{
+    std::error_code ec;
+    return fs::is_regular_file(legacyCsvPath_, ec);
+}
+
+FaceIndexMeta FaceIndexStorage::readMeta() const
+{
+    std::ifstream in(metaPath_, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("Cannot open face index metadata " + metaPath_);
+    const std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    if (bytes.size() < sizeof(metaMagic) + 8)
+        throw std::runtime_error("Face index metadata is truncated");
+    ByteReader trailer(bytes.data() + bytes.size() - 4, 4);
+    if (crc32(bytes.data(), bytes.size() - 4) != trailer.u32())
+        throw std::runtime_error("Face index metadata checksum mismatch");
+
+    ByteReader r(bytes.data(), bytes.size() - 4);
+    char magic[4];
+    r.raw(magic, sizeof(magic));
+    if (std::memcmp(magic, metaMagic, sizeof(magic)) != 0)
+        throw std::runtime_error("Not a face index metadata file: " + metaPath_);
+    const uint32_t version = r.u32();
+    if (version < 1 || version > formatVersion)
+        throw std::runtime_error("Unsupported face index metadata version " + std::to_string(version));
+
+    FaceIndexMeta meta;
+    meta.dim = r.u32();
+    meta.nextId = r.u64();
+    meta.generation = r.u64();
+    meta.graphSize = r.u64();
+    meta.graphFile = r.str();
+    const uint64_t count = r.u64();
+    for (uint64_t i = 0; i < count; ++i) {
+        const uint64_t id = r.u64();
+        meta.idToName.set(static_cast<size_t>(id), r.str());
+    }
+    if (version >= 2) {
+        meta.vectorStorage = r.u32();
+        meta.vectorsSize = r.u64();
+        meta.vectorsFile = r.str();
+    }
+    meta.identityIds = version >= 3;
+    if (version >= 4) {
+        meta.searchEf = r.u32();
+        meta.graphM = r.u32();
+    }
+    if (version >= 5) {
+        const uint64_t users = r.u64();
+        for (uint64_t i = 0; i < users; ++i) {
+            const uint64_t id = r.u64();
+            const uint32_t n = r.u32();
+            std::vector<std::string> groups;
+            for (uint32_t g = 0; g < n; ++g)
+                groups.push_back(r.str());
+            meta.userGroups.set(static_cast<size_t>(id), std::move(groups));
+        }
+    }
+    if (!r.atEnd())
+        throw std::runtime_error("Face index metadata has trailing data");
+    return meta;
+}
+
+void FaceIndexStorage::writeMeta(const FaceIndexMeta& meta) const
+{
+    ByteWriter w;
+    w.raw(metaMagic, sizeof(metaMagic));
+    w.u32(formatVersion);
+    w.u32(meta.dim);
+    w.u64(meta.nextId);
+    w.u64(meta.generation);
+    w.u64(meta.graphSize);
+    w.str(meta.graphFile);
+    w.u64(meta.idToName.size());
+    meta.idToName.forEach([&](size_t id, const std::string& name) {
+        w.u64(id);
+        w.str(name);
+    });
+    w.u32(meta.vectorStorage);
+    w.u64(meta.vectorsSize);
+    w.str(meta.vectorsFile);
+    w.u32(meta.searchEf);
+    w.u32(meta.graphM);
+    w.u64(meta.userGroups.size());
+    meta.userGroups.forEach([&](size_t id, const std::vector<std::string>& groups) {
+        w.u64(id);
+        w.u32(static_cast<uint32_t>(groups.size()));
+        for (const std::string& group : groups)
+            w.str(group);
+    });
+    w.u32(crc32(w.bytes.data(), w.bytes.size()));
+
+    const std::string tmpPath = metaPath_ + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out.write(w.bytes.data(), static_cast<std::streamsize>(w.bytes.size())) || !out.flush())
+            throw std::runtime_error("Cannot write face index metadata " + tmpPath);
+    }
+    // On disk before the rename can be, or a power loss could leave an empty sidecar
+    syncFile(tmpPath);
+#ifdef _WIN32
+    if (!MoveFileExA(tmpPath.c_str(), metaPath_.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+        throw std::runtime_error("Cannot replace face index metadata " + metaPath_ + ": error "
+                                 + std::to_string(GetLastError()));
+#else
+    std::error_code ec;
+    fs::rename(tmpPath, metaPath_, ec); // replaces the old sidecar in one step
+    if (ec)
+        throw std::runtime_error("Cannot replace face index metadata " + metaPath_ + ": " + ec.message());
+#endif
+    syncDirectory();
+}
+
+void FaceIndexStorage::syncFile(const std::string& path)
+{
+#ifdef _WIN32
+    // FlushFileBuffers needs a handle with write access
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Cannot open " + path + " to flush it");
+    const bool ok = FlushFileBuffers(handle) != 0;
+    CloseHandle(handle);
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("Cannot open " + path + " to flush it");
+    const bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+#endif
+    if (!ok)
+        throw std::runtime_error("Cannot flush " + path + " to disk");
+}
+
+void FaceIndexStorage::syncDirectory() const
+{
+#ifndef _WIN32
+    const std::string dir = directory_.empty() ? std::string(".") : directory_;
+    const int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("Cannot open directory " + dir + " to flush it");
+    const bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    if (!ok)
+        throw std::runtime_error("Cannot flush directory " + dir + " to disk");
+#endif
+}
+
+std::vector<uint64_t> FaceIndexStorage::generationsOf(const std::string& infix) const
+{
+    const std::string prefix = baseName_ + infix;
+    std::vector<uint64_t> generations;
+    std::error_code ec;
+    const fs::path dir = directory_.empty() ? fs::path(".") : fs::path(directory_);
+    for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        const std::string name = it->path().filename().string();
+        if (name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix) != 0)
+            continue;
+        const std::string suffix = name.substr(prefix.size());
+        if (suffix.find_first_not_of("0123456789") != std::string::npos)
+            continue; // e.g. temporary files
+        try {
+            generations.push_back(std::stoull(suffix));
+        } catch (const std::exception&) {
+        }
+    }
+    std::sort(generations.begin(), generations.end());
+    return generations;
+}
+
+void FaceIndexStorage::removeStaleGraphs(uint64_t keep) const
+{
+    for (uint64_t generation : generationsOf(".graph.")) {
+        if (generation == keep)
+            continue;
+        std::error_code ec;
+        fs::remove(pathInDirectory(graphFileName(generation)), ec); // best effort; a leftover file is only wasted space
+    }
+}
+
+void FaceIndexStorage::removeStaleVectors(uint64_t keep) const
+{
+    for (uint64_t generation : generationsOf(".vectors.")) {
+        if (generation == keep)
+            continue;
+        std::error_code ec;
+        fs::remove(pathInDirectory(vectorsFileName(generation)), ec);
+    }
+}
+
+std::string FaceIndexStorage::journalPath(uint64_t generation) const
+{
+    return directory_ + baseName_ + ".journal." + std::to_string(generation);
+}
+
+std::vector<uint64_t> FaceIndexStorage::journalGenerations(uint64_t from) const
+{
+    std::vector<uint64_t> generations = generationsOf(".journal.");
+    generations.erase(std::remove_if(generations.begin(), generations.end(),
+                                     [from](uint64_t g) { return g < from; }), generations.end());
+    return generations;
+}
+
+void FaceIndexStorage::removeStaleJournals(uint64_t keepFrom) const
+{
+    for (uint64_t generation : generationsOf(".journal.")) {
+        if (generation >= keepFrom)
+            break;
+        std::error_code ec;
+        fs::remove(journalPath(generation), ec);
+    }
+}
+
+bool FaceIndexStorage::retireLegacyCsv() const
+{
+    std::error_code ec;
+    fs::rename(legacyCsvPath_, legacyCsvPath_ + ".migrated", ec);
+    return !ec;
+}
@@ -0,0 +1,165 @@
+// FaceIndexTuning.cpp
+//
+// FaceIndex::tuneSearch(): the recall/latency sweep that picks the search ef and the
+// recommended M.
+
+#include "FaceIndex.hpp"
+#include "FaceIndexInternal.hpp"
+#include "FaceIndexStorage.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <random>
+#include <QDebug> // For qInfo()
+
+using namespace FaceIndexInternal;
+
+SearchTuning FaceIndex::tuneSearch(double targetRecall, size_t samples, const TuneProgress& progress)
+{
+    if (readOnly)
+        throw std::runtime_error("The face database is open read-only");
+    // Measured on a snapshot of the graph, as searches see it, so registrations and
+    // compaction carry on meanwhile; only the result is stored under writeMutex
+    const std::shared_ptr<hnswlib::HierarchicalNSW<float>> graph = std::atomic_load(&index);
+    const EmbeddingStore::Snapshot exact = exactVectors.snapshot();
+    SearchTuning tuning;
+    tuning.targetRecall = targetRecall;
+    tuning.ef = searchEf;
+    tuning.graphM = graph->M_;
+    {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        tuning.recommendedM = graphM;
+    }
+
+    // A template's owner and fp32 vector; false if it was deleted meanwhile (the copy
+    // holds the label's lock, so it is whole)
+    std::vector<char> code;
+    const auto readTemplate = [&](size_t label, size_t& owner, float* out) {
+        if (!copyElementData(*graph, label, code))
+            return false;
+        owner = static_cast<size_t>(templateSpace->get_doc_id(code.data()));
+        templateVector(exact, label, code.data(), out);
+        return true;
+    };
+
+    // 1. Sample queries from the live templates (the same ones each time for the same gallery)
+    std::vector<size_t> live;
+    const size_t elements = graph->getCurrentElementCount();
+    live.reserve(elements);
+    for (size_t i = 0; i < elements; ++i) {
+        if (!graph->isMarkedDeleted(static_cast<hnswlib::tableint>(i)))
+            live.push_back(graph->getExternalLabel(static_cast<hnswlib::tableint>(i)));
+    }
+    if (getIdToNameMap()->size() < 2 || live.empty())
+        return tuning; // no other user to find
+    std::mt19937 rng(static_cast<uint32_t>(live.size()));
+    const size_t d = static_cast<size_t>(dim);
+    std::vector<float> queries(std::min(samples, live.size()) * d);
+    std::vector<size_t> owners(queries.size() / d);
+    size_t sampleCount = 0;
+    for (size_t s = 0; s < live.size() && sampleCount < owners.size(); ++s) {
+        std::swap(live[s], live[s + rng() % (live.size() - s)]);
+        if (readTemplate(live[s], owners[sampleCount], queries.data() + sampleCount * d))
+            ++sampleCount;
+    }
+    if (sampleCount == 0)
+        return tuning;
+
+    static constexpr size_t efSteps[] = {10, 16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512};
+    constexpr size_t chunkRows = 16384;
+    const size_t chunks = (live.size() + chunkRows - 1) / chunkRows;
+    const size_t totalSteps = chunks + std::size(efSteps);
+    size_t stepsDone = 0;
+
+    // 2. The right answers: each query's nearest other user, by scanning the gallery
+    // exactly a chunk at a time. The two nearest users of a chunk include its nearest
+    // other one.
+    std::vector<ExactGallery::Match> truth(sampleCount);
+    {
+        ExactGallery scan(d);
+        std::vector<size_t> labels, users;
+        std::vector<float> rows;
+        std::vector<ExactGallery::Match> top(sampleCount * 2);
+        for (size_t begin = 0; begin < live.size(); begin += chunkRows) {
+            const size_t end = std::min(begin + chunkRows, live.size());
+            labels.clear();
+            users.clear();
+            rows.resize((end - begin) * d);
+            for (size_t i = begin; i < end; ++i) {
+                size_t owner;
+                if (!readTemplate(live[i], owner, rows.data() + labels.size() * d))
+                    continue;
+                labels.push_back(live[i]);
+                users.push_back(owner);
+            }
+            rows.resize(labels.size() * d);
+            if (!labels.empty()) {
+                scan.assign(labels, users, rows);
+                scan.snapshot().search(queries.data(), sampleCount, 2, top.data());
+                for (size_t s = 0; s < sampleCount; ++s) {
+                    const ExactGallery::Match* other = &top[s * 2];
+                    if (other->found && other->user == owners[s])
+                        ++other;
+                    if (other->found && (!truth[s].found || other->similarity > truth[s].similarity))
+                        truth[s] = *other;
+                }
+            }
+            if (progress)
+                progress(++stepsDone, totalSteps);
+        }
+    }
+
+    // 3. Increasing ef until the graph finds that user often enough; no early stops, so
+    // the recall is ef's alone
+    const SearchBudget exhaustive;
+    SearchScratch scratch;
+    SearchMatch found[2];
+    std::vector<double> latencies(sampleCount);
+    for (size_t ef : efSteps) {
+        size_t hits = 0, answerable = 0;
+        for (size_t s = 0; s < sampleCount; ++s) {
+            const auto start = std::chrono::steady_clock::now();
+            searchGraph(*graph, queries.data() + s * d, 2, ef, exhaustive, exact, scratch, found, nullptr);
+            latencies[s] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+            if (!truth[s].found)
+                continue;
+            ++answerable;
+            const SearchMatch& other = found[0].id == owners[s] ? found[1] : found[0];
+            hits += other.found && other.id == truth[s].user;
+        }
+        std::sort(latencies.begin(), latencies.end());
+        SearchTuningPoint point;
+        point.ef = ef;
+        point.recall = answerable ? static_cast<double>(hits) / static_cast<double>(answerable) : 1.0;
+        point.p50Us = latencies[sampleCount / 2];
+        point.p95Us = latencies[sampleCount * 95 / 100];
+        point.p99Us = latencies[sampleCount * 99 / 100];
+        tuning.points.push_back(point);
+        tuning.ef = ef;
+        if (progress)
+            progress(++stepsDone, totalSteps);
+        if (point.recall >= targetRecall) {
+            tuning.targetMet = true;
+            break;
+        }
+    }
+    if (progress && stepsDone < totalSteps)
+        progress(totalSteps, totalSteps); // the target was met early
+
+    // 4. A graph that needs ef far above its M (or can't reach the target at all) has
+    // too few links per element; the usual cure is doubling M
+    tuning.samples = sampleCount;
+    tuning.recommendedM = tuning.graphM;
+    if (!tuning.targetMet || tuning.ef >= 8 * tuning.graphM)
+        tuning.recommendedM = std::min<size_t>(tuning.graphM * 2, 64);
+    const SearchTuningPoint& chosen = tuning.points.back();
+    qInfo() << "Face search tuned on" << sampleCount << "queries: ef" << tuning.ef << "recall@1" << chosen.recall
+            << "p50/p95/p99" << chosen.p50Us << chosen.p95Us << chosen.p99Us << "us; M" << tuning.graphM
+            << "-> recommended" << tuning.recommendedM;
+    std::lock_guard<std::mutex> lock(writeMutex);
+    searchEf = tuning.ef;
+    graphM = tuning.recommendedM;
+    if (!databasePath.empty())
+        saveBinaryLocked(FaceIndexStorage(databasePath));
+    return tuning;
+}
@@ -0,0 +1,43 @@
+// FaceSearchStopCondition.cpp
+
+#include "FaceSearchStopCondition.hpp"
+#include <limits>
+
+FaceSearchStopCondition::FaceSearchStopCondition(TemplateSpace& space, size_t users, size_t ef,
+                                                 const SearchBudget& budget)
+    : Base(space, users, ef),
+      // Distances are 1 - similarity (see FaceIndex::similarityFromDistance)
+      confidentDistance(budget.confidentSimilarity > 0.0f ? 1.0f - budget.confidentSimilarity : -1.0f),
+      maxHops(budget.hops), timed(budget.time.count() > 0),
+      best(std::numeric_limits<float>::infinity())
+{
+    if (timed)
+        deadline = std::chrono::steady_clock::now() + budget.time;
+}
+
+void FaceSearchStopCondition::add_point_to_result(hnswlib::labeltype label, const void* datapoint, float dist)
+{
+    // Points leave the results farthest first, so the nearest one never does
+    if (dist < best)
+        best = dist;
+    Base::add_point_to_result(label, datapoint, dist);
+}
+
+bool FaceSearchStopCondition::should_stop_search(float candidateDist, float lowerBound)
+{
+    if (Base::should_stop_search(candidateDist, lowerBound))
+        return true; // the regular end: no candidate left that could improve the results
+    if (best <= confidentDistance) {
+        stop = Stop::Confident;
+        return true;
+    }
+    if (best == std::numeric_limits<float>::infinity())
+        return false; // nothing to return yet
+    ++hops;
+    if ((maxHops > 0 && hops >= maxHops)
+        || (timed && hops % clockInterval == 0 && std::chrono::steady_clock::now() >= deadline)) {
+        stop = Stop::Budget;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,229 @@
+// FaceTracker.cpp
+
+#include "FaceTracker.hpp"
+#include <algorithm>
+#include <cmath>
+
+void FaceTracker::Axis::init(float value, float posVar, float velVar) {
+    pos = value;
+    vel = 0.0f;
+    p00 = posVar;
+    p01 = 0.0f;
+    p11 = velVar;
+}
+
+void FaceTracker::Axis::predict(float dt, float accelVar) {
+    // x = F x, P = F P F^T + Q with F = [1 dt; 0 1] and white-noise acceleration Q
+    pos += vel * dt;
+    const float dt2 = dt * dt;
+    const float n00 = p00 + 2.0f * dt * p01 + dt2 * p11 + accelVar * dt2 * dt2 / 4.0f;
+    const float n01 = p01 + dt * p11 + accelVar * dt2 * dt / 2.0f;
+    const float n11 = p11 + accelVar * dt2;
+    p00 = n00;
+    p01 = n01;
+    p11 = n11;
+}
+
+void FaceTracker::Axis::correct(float measured, float measVar) {
+    // Only the position is measured (H = [1 0])
+    const float s = p00 + measVar;
+    const float k0 = p00 / s;
+    const float k1 = p01 / s;
+    const float innovation = measured - pos;
+    pos += k0 * innovation;
+    vel += k1 * innovation;
+    const float n00 = (1.0f - k0) * p00;
+    const float n01 = (1.0f - k0) * p01;
+    const float n11 = p11 - k1 * p01;
+    p00 = n00;
+    p01 = n01;
+    p11 = n11;
+}
+
+FaceTracker::FaceTracker(const TrackerOptions& options_)
+    : options(options_)
+{
+}
+
+void FaceTracker::boxOf(const Track& t, float& x1, float& y1, float& x2, float& y2) {
+    const float w = std::max(t.w.pos, 1.0f);
+    const float h = std::max(t.h.pos, 1.0f);
+    x1 = t.cx.pos - w / 2.0f;
+    y1 = t.cy.pos - h / 2.0f;
+    x2 = t.cx.pos + w / 2.0f;
+    y2 = t.cy.pos + h / 2.0f;
+}
+
+float FaceTracker::iou(const Track& t, const FaceDetection& d) {
+    float x1, y1, x2, y2;
+    boxOf(t, x1, y1, x2, y2);
+    const float ix = std::max(0.0f, std::min(x2, d.x2) - std::max(x1, d.x1));
+    const float iy = std::max(0.0f, std::min(y2, d.y2) - std::max(y1, d.y1));
+    const float inter = ix * iy;
+    const float uni = (x2 - x1) * (y2 - y1) + (d.x2 - d.x1) * (d.y2 - d.y1) - inter;
+    return uni > 0.0f ? inter / uni : 0.0f;
+}
+
+void FaceTracker::startTrack(const FaceDetection& d, double timestamp) {
+    Track t;
+    t.id = nextTrackId++;
+    const float h = std::max(d.y2 - d.y1, 1.0f);
+    const float posVar = std::pow(options.measurementNoise * h, 2.0f);
+    const float velVar = std::pow(h, 2.0f); // unknown velocity: about one face height per second
+    t.cx.init((d.x1 + d.x2) / 2.0f, posVar, velVar);
+    t.cy.init((d.y1 + d.y2) / 2.0f, posVar, velVar);
+    t.w.init(d.x2 - d.x1, posVar, velVar);
+    t.h.init(d.y2 - d.y1, posVar, velVar);
+    t.last = d;
+    t.lastSeen = timestamp;
+    t.detectedThisFrame = true;
+    tracks.push_back(t);
+}
+
+std::vector<TrackedFace> FaceTracker::update(const std::vector<FaceDetection>& detections, double timestamp)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // 1. Predict every track forward to this frame
+    const float dt = lastTimestamp < 0.0 ? 0.0f : static_cast<float>(std::max(0.0, timestamp - lastTimestamp));
+    lastTimestamp = timestamp;
+    for (Track& t : tracks) {
+        const float scale = std::max(t.h.pos, 1.0f);
+        const float accelVar = std::pow(options.motionNoise * scale, 2.0f);
+        t.cx.predict(dt, accelVar);
+        t.cy.predict(dt, accelVar);
+        t.w.predict(dt, accelVar);
+        t.h.predict(dt, accelVar);
+        t.detectedThisFrame = false;
+    }
+
+    // 2. Greedy association: best IoU pairs first
+    struct Pair { float iou; size_t track; size_t det; };
+    std::vector<Pair> pairs;
+    for (size_t ti = 0; ti < tracks.size(); ++ti) {
+        for (size_t di = 0; di < detections.size(); ++di) {
+            const float overlap = iou(tracks[ti], detections[di]);
+            if (overlap >= options.minIou)
+                pairs.push_back({overlap, ti, di});
+        }
+    }
+    std::sort(pairs.begin(), pairs.end(), [](const Pair& a, const Pair& b) { return a.iou > b.iou; });
+
+    std::vector<bool> trackUsed(tracks.size(), false);
+    std::vector<bool> detUsed(detections.size(), false);
+    for (const Pair& p : pairs) {
+        if (trackUsed[p.track] || detUsed[p.det])
+            continue;
+        trackUsed[p.track] = detUsed[p.det] = true;
+
+        Track& t = tracks[p.track];
+        const FaceDetection& d = detections[p.det];
+        const float measVar = std::pow(options.measurementNoise * std::max(t.h.pos, 1.0f), 2.0f);
+        t.cx.correct((d.x1 + d.x2) / 2.0f, measVar);
+        t.cy.correct((d.y1 + d.y2) / 2.0f, measVar);
+        t.w.correct(d.x2 - d.x1, measVar);
+        t.h.correct(d.y2 - d.y1, measVar);
+        t.last = d;
+        t.lastSeen = timestamp;
+        t.detectedThisFrame = true;
+
+        // A weak match may be a different person stepping into the box; trust the identity less
+        if (p.iou < 0.5f)
+            t.identityConfidence *= p.iou / 0.5f;
+    }
+
+    // 3. Drop tracks that have coasted too long, start tracks for unmatched detections
+    tracks.erase(std::remove_if(tracks.begin(), tracks.end(), [&](const Track& t) {
+        return timestamp - t.lastSeen > options.maxCoastSecs;
+    }), tracks.end());
+    for (size_t di = 0; di < detections.size(); ++di) {
+        if (!detUsed[di])
+            startTrack(detections[di], timestamp);
+    }
+
+    std::vector<TrackedFace> result;
+    result.reserve(tracks.size());
+    for (Track& t : tracks)
+        result.push_back(snapshot(t, timestamp));
+    return result;
+}
+
+TrackedFace FaceTracker::snapshot(Track& t, double timestamp)
+{
+    TrackedFace out;
+    out.trackId = t.id;
+    out.detectedThisFrame = t.detectedThisFrame;
+    out.measured = t.last;
+
+    // Box from the filter; landmarks from the last detection, moved along with the box
+    FaceDetection d = t.last;
+    boxOf(t, d.x1, d.y1, d.x2, d.y2);
+    const float dx = (d.x1 + d.x2) / 2.0f - (t.last.x1 + t.last.x2) / 2.0f;
+    const float dy = (d.y1 + d.y2) / 2.0f - (t.last.y1 + t.last.y2) / 2.0f;
+    float* points[][2] = {
+        {&d.left_eye_x, &d.left_eye_y}, {&d.right_eye_x, &d.right_eye_y},
+        {&d.nose_x, &d.nose_y}, {&d.mouth_x, &d.mouth_y},
+        {&d.left_cheek_x, &d.left_cheek_y}, {&d.right_cheek_x, &d.right_cheek_y},
+    };
+    for (auto& p : points) {
+        *p[0] += dx;
+        *p[1] += dy;
+    }
+    out.detection = d;
+
+    float confidence = 0.0f;
+    if (t.hasIdentity) {
+        const double halfLife = t.known ? options.identityHalfLifeSecs : options.unknownHalfLifeSecs;
+        confidence = t.identityConfidence * static_cast<float>(std::exp2(-(timestamp - t.identityTime) / halfLife));
+    }
+
+    // Only ask for an identity on frames the face was actually detected (alignment needs real landmarks)
+    if (!t.pending && t.detectedThisFrame && (!t.hasIdentity || confidence < options.reidentifyBelow)) {
+        t.pending = true;
+        out.needsIdentity = true;
+    }
+
+    out.hasIdentity = t.hasIdentity;
+    out.known = t.known;
+    out.userId = t.userId;
+    out.name = t.hasIdentity ? t.name : "Unknown";
+    out.similarity = t.similarity;
+    out.identityConfidence = confidence;
+    return out;
+}
+
+void FaceTracker::setIdentity(int trackId, size_t userId, const std::string& name, float similarity, bool found)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (Track& t : tracks) {
+        if (t.id != trackId)
+            continue;
+        t.pending = false;
+        t.hasIdentity = true;
+        t.known = found;
+        t.userId = found ? userId : 0;
+        t.name = found ? name : "Unknown";
+        t.similarity = similarity;
+        t.identityConfidence = 1.0f;
+        t.identityTime = t.lastSeen;
+        return;
+    }
+}
+
+void FaceTracker::cancelIdentity(int trackId)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (Track& t : tracks) {
+        if (t.id == trackId) {
+            t.pending = false;
+            return;
+        }
+    }
+}
+
+void FaceTracker::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    tracks.clear();
+    lastTimestamp = -1.0;
+}
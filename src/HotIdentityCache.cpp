@@ -0,0 +1,92 @@
+// HotIdentityCache.cpp
+
+#include "HotIdentityCache.hpp"
+#include "FaceIndex.hpp"
+#include <algorithm>
+#include <cstring>
+
+HotIdentityCache::HotIdentityCache(size_t dim_, size_t capacity_)
+    : dim(dim_), maxEntries(capacity_), space(dim_),
+      distance(space.get_dist_func()), distanceParam(space.get_dist_func_param())
+{
+    vectors.reserve(maxEntries * dim);
+    ids.reserve(maxEntries);
+    lastUsed.reserve(maxEntries);
+}
+
+bool HotIdentityCache::best(const float* query, size_t& id, float& similarity) const
+{
+    if (ids.empty())
+        return false;
+    size_t bestRow = 0;
+    float bestDistance = distance(query, vectors.data(), distanceParam);
+    for (size_t row = 1; row < ids.size(); ++row) {
+        const float d = distance(query, vectors.data() + row * dim, distanceParam);
+        if (d < bestDistance) {
+            bestDistance = d;
+            bestRow = row;
+        }
+    }
+    id = ids[bestRow];
+    similarity = FaceIndex::similarityFromDistance(bestDistance);
+    return true;
+}
+
+void HotIdentityCache::touch(size_t id)
+{
+    auto it = rowOf.find(id);
+    if (it != rowOf.end())
+        lastUsed[it->second] = ++tick;
+}
+
+void HotIdentityCache::insert(size_t id, const float* embedding)
+{
+    if (maxEntries == 0)
+        return;
+    auto it = rowOf.find(id);
+    size_t row;
+    if (it != rowOf.end()) {
+        row = it->second;
+    } else if (ids.size() < maxEntries) {
+        row = ids.size();
+        ids.push_back(id);
+        lastUsed.push_back(0);
+        vectors.resize(vectors.size() + dim);
+        rowOf[id] = row;
+    } else {
+        // Evict the least recently matched; a linear scan is cheap next to scoring the rows
+        row = static_cast<size_t>(std::min_element(lastUsed.begin(), lastUsed.end()) - lastUsed.begin());
+        rowOf.erase(ids[row]);
+        ids[row] = id;
+        rowOf[id] = row;
+    }
+    std::memcpy(vectors.data() + row * dim, embedding, dim * sizeof(float));
+    lastUsed[row] = ++tick;
+}
+
+void HotIdentityCache::erase(size_t id)
+{
+    auto it = rowOf.find(id);
+    if (it == rowOf.end())
+        return;
+    const size_t row = it->second;
+    const size_t last = ids.size() - 1;
+    rowOf.erase(it);
+    if (row != last) {
+        std::memcpy(vectors.data() + row * dim, vectors.data() + last * dim, dim * sizeof(float));
+        ids[row] = ids[last];
+        lastUsed[row] = lastUsed[last];
+        rowOf[ids[row]] = row;
+    }
+    ids.pop_back();
+    lastUsed.pop_back();
+    vectors.resize(last * dim);
+}
+
+void HotIdentityCache::clear()
+{
+    vectors.clear();
+    ids.clear();
+    lastUsed.clear();
+    rowOf.clear();
+}
@@ -0,0 +1,375 @@
+// ImagePreprocess.cpp
+
+#include "ImagePreprocess.hpp"
+#include "CpuFeatures.hpp"
+#include <QSysInfo>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#ifdef FACEPUNCH_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Bytes per pixel and the byte position of each colour channel inside a pixel
+struct LayoutInfo {
+    int bpp;
+    int r, g, b;
+};
+
+LayoutInfo layoutInfo(PixelLayout layout) {
+    switch (layout) {
+    case PixelLayout::RGB888:   return {3, 0, 1, 2};
+    case PixelLayout::BGR888:   return {3, 2, 1, 0};
+    case PixelLayout::RGBX8888: return {4, 0, 1, 2};
+    case PixelLayout::BGRX8888: return {4, 2, 1, 0};
+    }
+    return {4, 2, 1, 0};
+}
+
+// Source index sampled for output index dst (pixel centres, like Qt::FastTransformation)
+inline int nearestIndex(int dst, int srcSize, int dstSize) {
+    int s = int((2LL * dst + 1) * srcSize / (2LL * dstSize));
+    return s < srcSize ? s : srcSize - 1;
+}
+
+inline uint32_t load32(const unsigned char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Byte offset of the source pixel for every output column, computed once per image.
+// Lives on the stack for the tensor sizes the models use.
+class ColumnOffsets {
+public:
+    ColumnOffsets(int srcW, int dstW, int bpp) {
+        if (dstW <= kInlineColumns) {
+            offsets_ = inline_;
+        } else {
+            heap_.resize(dstW);
+            offsets_ = heap_.data();
+        }
+        for (int x = 0; x < dstW; ++x)
+            offsets_[x] = nearestIndex(x, srcW, dstW) * bpp;
+
+        // 4-byte loads of the last 3-byte pixels would read past the end of the last row
+        const int rowBytes = srcW * bpp;
+        loadSafe_ = dstW;
+        while (loadSafe_ > 0 && offsets_[loadSafe_ - 1] + 4 > rowBytes)
+            --loadSafe_;
+    }
+
+    const int* data() const { return offsets_; }
+
+    // Leading columns whose pixel can be fetched with a single 32-bit load
+    int loadSafeCount() const { return loadSafe_; }
+
+private:
+    static constexpr int kInlineColumns = 1024;
+    int inline_[kInlineColumns];
+    std::vector<int> heap_;
+    int* offsets_ = nullptr;
+    int loadSafe_ = 0;
+};
+
+void planarRowScalar(const unsigned char* row, const int* offs, int from, int to,
+                     const LayoutInfo& li, Normalization n, float* r, float* g, float* b) {
+    for (int x = from; x < to; ++x) {
+        const unsigned char* p = row + offs[x];
+        r[x] = p[li.r] * n.scale + n.bias;
+        g[x] = p[li.g] * n.scale + n.bias;
+        b[x] = p[li.b] * n.scale + n.bias;
+    }
+}
+
+void interleavedRowScalar(const unsigned char* row, const int* offs, int from, int to,
+                          const LayoutInfo& li, Normalization n, float* out) {
+    for (int x = from; x < to; ++x) {
+        const unsigned char* p = row + offs[x];
+        out[3 * x + 0] = p[li.r] * n.scale + n.bias;
+        out[3 * x + 1] = p[li.g] * n.scale + n.bias;
+        out[3 * x + 2] = p[li.b] * n.scale + n.bias;
+    }
+}
+
+// Bilinear sample at (sx, sy); taps outside the image count as black
+inline void bilinearScalar(const ImageView& src, const LayoutInfo& li, float sx, float sy, float rgb[3]) {
+    rgb[0] = rgb[1] = rgb[2] = 0.0f;
+    if (!(sx > -1.0f && sx < float(src.width) && sy > -1.0f && sy < float(src.height)))
+        return; // no tap inside (also catches NaN)
+    const float fx = std::floor(sx), fy = std::floor(sy);
+    const int x0 = int(fx), y0 = int(fy);
+    const float ax = sx - fx, ay = sy - fy;
+    const float weight[4] = {(1 - ax) * (1 - ay), ax * (1 - ay), (1 - ax) * ay, ax * ay};
+    for (int t = 0; t < 4; ++t) {
+        const int x = x0 + (t & 1), y = y0 + (t >> 1);
+        if (x < 0 || y < 0 || x >= src.width || y >= src.height) continue;
+        const unsigned char* p = src.data + size_t(y) * src.bytesPerLine + size_t(x) * li.bpp;
+        rgb[0] += weight[t] * p[li.r];
+        rgb[1] += weight[t] * p[li.g];
+        rgb[2] += weight[t] * p[li.b];
+    }
+}
+
+void warpRowScalar(const ImageView& src, const LayoutInfo& li, float sx0, float sy0, float dsx, float dsy,
+                   int from, int to, Normalization n, float* out) {
+    for (int x = from; x < to; ++x) {
+        float rgb[3];
+        bilinearScalar(src, li, sx0 + x * dsx, sy0 + x * dsy, rgb);
+        out[3 * x + 0] = rgb[0] * n.scale + n.bias;
+        out[3 * x + 1] = rgb[1] * n.scale + n.bias;
+        out[3 * x + 2] = rgb[2] * n.scale + n.bias;
+    }
+}
+
+#ifdef FACEPUNCH_X86
+
+// 4 pixels per step: scalar gathers, vector unpack + normalize. Returns columns done.
+FACEPUNCH_TARGET("sse2")
+int planarRowSse2(const unsigned char* row, const int* offs, int count,
+                  const LayoutInfo& li, Normalization n, float* r, float* g, float* b) {
+    const __m128 scale = _mm_set1_ps(n.scale);
+    const __m128 bias = _mm_set1_ps(n.bias);
+    const __m128i mask = _mm_set1_epi32(0xFF);
+    const __m128i shR = _mm_cvtsi32_si128(8 * li.r);
+    const __m128i shG = _mm_cvtsi32_si128(8 * li.g);
+    const __m128i shB = _mm_cvtsi32_si128(8 * li.b);
+
+    int x = 0;
+    for (; x + 4 <= count; x += 4) {
+        __m128i px = _mm_setr_epi32(int(load32(row + offs[x + 0])), int(load32(row + offs[x + 1])),
+                                    int(load32(row + offs[x + 2])), int(load32(row + offs[x + 3])));
+        __m128 vr = _mm_cvtepi32_ps(_mm_and_si128(_mm_srl_epi32(px, shR), mask));
+        __m128 vg = _mm_cvtepi32_ps(_mm_and_si128(_mm_srl_epi32(px, shG), mask));
+        __m128 vb = _mm_cvtepi32_ps(_mm_and_si128(_mm_srl_epi32(px, shB), mask));
+        _mm_storeu_ps(r + x, _mm_add_ps(_mm_mul_ps(vr, scale), bias));
+        _mm_storeu_ps(g + x, _mm_add_ps(_mm_mul_ps(vg, scale), bias));
+        _mm_storeu_ps(b + x, _mm_add_ps(_mm_mul_ps(vb, scale), bias));
+    }
+    return x;
+}
+
+// 8 pixels per step with a hardware gather
+FACEPUNCH_TARGET("avx2,fma")
+int planarRowAvx2(const unsigned char* row, const int* offs, int count,
+                  const LayoutInfo& li, Normalization n, float* r, float* g, float* b) {
+    const __m256 scale = _mm256_set1_ps(n.scale);
+    const __m256 bias = _mm256_set1_ps(n.bias);
+    const __m256i mask = _mm256_set1_epi32(0xFF);
+    const __m128i shR = _mm_cvtsi32_si128(8 * li.r);
+    const __m128i shG = _mm_cvtsi32_si128(8 * li.g);
+    const __m128i shB = _mm_cvtsi32_si128(8 * li.b);
+    const int* base = reinterpret_cast<const int*>(row);
+
+    int x = 0;
+    for (; x + 8 <= count; x += 8) {
+        __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offs + x));
+        __m256i px = _mm256_i32gather_epi32(base, idx, 1);
+        __m256 vr = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srl_epi32(px, shR), mask));
+        __m256 vg = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srl_epi32(px, shG), mask));
+        __m256 vb = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srl_epi32(px, shB), mask));
+        _mm256_storeu_ps(r + x, _mm256_fmadd_ps(vr, scale, bias));
+        _mm256_storeu_ps(g + x, _mm256_fmadd_ps(vg, scale, bias));
+        _mm256_storeu_ps(b + x, _mm256_fmadd_ps(vb, scale, bias));
+    }
+    return x;
+}
+
+// One pixel per step: shuffle R,G,B into lanes 0..2, widen, normalize and store 4 floats.
+// The 4th float lands on the next pixel's R and is overwritten by it, so the final
+// column of a row is always left to the scalar tail.
+FACEPUNCH_TARGET("sse4.1")
+int interleavedRowSse41(const unsigned char* row, const int* offs, int count,
+                        const LayoutInfo& li, Normalization n, float* out) {
+    const __m128 scale = _mm_set1_ps(n.scale);
+    const __m128 bias = _mm_set1_ps(n.bias);
+    const __m128i order = _mm_setr_epi8(char(li.r), char(li.g), char(li.b), char(li.b),
+                                        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    int x = 0;
+    for (; x + 1 < count; ++x) {
+        __m128i px = _mm_shuffle_epi8(_mm_cvtsi32_si128(int(load32(row + offs[x]))), order);
+        __m128 v = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(px));
+        _mm_storeu_ps(out + 3 * x, _mm_add_ps(_mm_mul_ps(v, scale), bias));
+    }
+    return x;
+}
+
+// One pixel per step: the four taps are loaded as 32-bit words, shuffled to R,G,B lanes
+// and blended in float. Pixels whose 2x2 neighbourhood is not fully inside the image
+// (and the final column, see interleavedRowSse41) take the scalar path.
+FACEPUNCH_TARGET("sse4.1")
+void warpRowSse41(const ImageView& src, const LayoutInfo& li, float sx0, float sy0, float dsx, float dsy,
+                  int count, Normalization n, float* out) {
+    const __m128 scale = _mm_set1_ps(n.scale);
+    const __m128 bias = _mm_set1_ps(n.bias);
+    const __m128i order = _mm_setr_epi8(char(li.r), char(li.g), char(li.b), char(li.b),
+                                        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    // Largest x0 whose right-hand tap can still be fetched with a 32-bit load
+    const int maxX0 = std::min(src.width - 2, (src.bytesPerLine - 4) / li.bpp - 1);
+    const float maxSx = float(maxX0 + 1);
+    const float maxSy = float(src.height - 1);
+    const size_t bpl = size_t(src.bytesPerLine);
+
+    for (int x = 0; x < count; ++x) {
+        const float sx = sx0 + x * dsx, sy = sy0 + x * dsy;
+        if (x + 1 == count || !(sx >= 0.0f && sx < maxSx && sy >= 0.0f && sy < maxSy)) {
+            warpRowScalar(src, li, sx0, sy0, dsx, dsy, x, x + 1, n, out);
+            continue;
+        }
+        const float fx = std::floor(sx), fy = std::floor(sy);
+        const unsigned char* p00 = src.data + size_t(fy) * bpl + size_t(fx) * li.bpp;
+        const unsigned char* p10 = p00 + bpl;
+        const __m128 c00 = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_shuffle_epi8(_mm_cvtsi32_si128(int(load32(p00))), order)));
+        const __m128 c01 = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_shuffle_epi8(_mm_cvtsi32_si128(int(load32(p00 + li.bpp))), order)));
+        const __m128 c10 = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_shuffle_epi8(_mm_cvtsi32_si128(int(load32(p10))), order)));
+        const __m128 c11 = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_shuffle_epi8(_mm_cvtsi32_si128(int(load32(p10 + li.bpp))), order)));
+        const __m128 ax = _mm_set1_ps(sx - fx);
+        const __m128 ay = _mm_set1_ps(sy - fy);
+        const __m128 top = _mm_add_ps(c00, _mm_mul_ps(ax, _mm_sub_ps(c01, c00)));
+        const __m128 bottom = _mm_add_ps(c10, _mm_mul_ps(ax, _mm_sub_ps(c11, c10)));
+        const __m128 v = _mm_add_ps(top, _mm_mul_ps(ay, _mm_sub_ps(bottom, top)));
+        _mm_storeu_ps(out + 3 * x, _mm_add_ps(_mm_mul_ps(v, scale), bias));
+    }
+}
+
+#endif // FACEPUNCH_X86
+
+bool validArgs(const ImageView& src, int dstW, int dstH, const float* dst) {
+    return src.data && src.width > 0 && src.height > 0 && dstW > 0 && dstH > 0 && dst;
+}
+
+} // namespace
+
+bool imageViewFor(const QImage& img, ImageView& view) {
+    if (img.isNull()) return false;
+
+    switch (img.format()) {
+    case QImage::Format_RGB888:
+        view.layout = PixelLayout::RGB888;
+        break;
+    case QImage::Format_BGR888:
+        view.layout = PixelLayout::BGR888;
+        break;
+    case QImage::Format_RGBX8888:
+    case QImage::Format_RGBA8888:
+    case QImage::Format_RGBA8888_Premultiplied: // camera frames are opaque, so premultiplied == straight
+        view.layout = PixelLayout::RGBX8888;
+        break;
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+        // 0xAARRGGBB words: byte order in memory depends on the host
+        if (QSysInfo::ByteOrder != QSysInfo::LittleEndian) return false;
+        view.layout = PixelLayout::BGRX8888;
+        break;
+    default:
+        return false;
+    }
+
+    view.data = img.constBits();
+    view.width = img.width();
+    view.height = img.height();
+    view.bytesPerLine = int(img.bytesPerLine());
+    return true;
+}
+
+void resizeNormalizePlanar(const ImageView& src, int dstW, int dstH, Normalization norm, float* dst) {
+    if (!validArgs(src, dstW, dstH, dst)) return;
+
+    const LayoutInfo li = layoutInfo(src.layout);
+    const ColumnOffsets cols(src.width, dstW, li.bpp);
+    const size_t plane = size_t(dstW) * dstH;
+#ifdef FACEPUNCH_X86
+    const CpuFeatures& cpu = cpuFeatures();
+#endif
+
+    for (int y = 0; y < dstH; ++y) {
+        const unsigned char* row = src.data + size_t(nearestIndex(y, src.height, dstH)) * src.bytesPerLine;
+        float* r = dst + size_t(y) * dstW;
+        float* g = r + plane;
+        float* b = g + plane;
+
+        int done = 0;
+#ifdef FACEPUNCH_X86
+        if (cpu.avx2 && cpu.fma)
+            done = planarRowAvx2(row, cols.data(), cols.loadSafeCount(), li, norm, r, g, b);
+        else if (cpu.sse2)
+            done = planarRowSse2(row, cols.data(), cols.loadSafeCount(), li, norm, r, g, b);
+#endif
+        planarRowScalar(row, cols.data(), done, dstW, li, norm, r, g, b);
+    }
+}
+
+void resizeNormalizeInterleaved(const ImageView& src, int dstW, int dstH, Normalization norm, float* dst) {
+    if (!validArgs(src, dstW, dstH, dst)) return;
+
+    const LayoutInfo li = layoutInfo(src.layout);
+    const ColumnOffsets cols(src.width, dstW, li.bpp);
+#ifdef FACEPUNCH_X86
+    const bool sse41 = cpuFeatures().sse41;
+#endif
+
+    for (int y = 0; y < dstH; ++y) {
+        const unsigned char* row = src.data + size_t(nearestIndex(y, src.height, dstH)) * src.bytesPerLine;
+        float* out = dst + size_t(y) * dstW * 3;
+
+        int done = 0;
+#ifdef FACEPUNCH_X86
+        if (sse41)
+            done = interleavedRowSse41(row, cols.data(), cols.loadSafeCount(), li, norm, out);
+#endif
+        interleavedRowScalar(row, cols.data(), done, dstW, li, norm, out);
+    }
+}
+
+void warpNormalizeInterleaved(const ImageView& src, const AffineTransform& toSource, int dstW, int dstH,
+                              Normalization norm, float* dst) {
+    if (!validArgs(src, dstW, dstH, dst)) return;
+
+    const LayoutInfo li = layoutInfo(src.layout);
+#ifdef FACEPUNCH_X86
+    // The SIMD path needs room for 2x2 taps
+    const bool sse41 = cpuFeatures().sse41 && src.width >= 2 && src.height >= 2;
+#endif
+
+    for (int y = 0; y < dstH; ++y) {
+        // Source position of the row's first pixel; each column steps by (m00, m10)
+        const float sx0 = toSource.m01 * y + toSource.m02;
+        const float sy0 = toSource.m11 * y + toSource.m12;
+        float* out = dst + size_t(y) * dstW * 3;
+#ifdef FACEPUNCH_X86
+        if (sse41) {
+            warpRowSse41(src, li, sx0, sy0, toSource.m00, toSource.m10, dstW, norm, out);
+            continue;
+        }
+#endif
+        warpRowScalar(src, li, sx0, sy0, toSource.m00, toSource.m10, 0, dstW, norm, out);
+    }
+}
+
+void preprocessPlanar(const QImage& img, int dstW, int dstH, Normalization norm, float* dst) {
+    ImageView view;
+    if (imageViewFor(img, view)) {
+        resizeNormalizePlanar(view, dstW, dstH, norm, dst);
+        return;
+    }
+    QImage converted = img.convertToFormat(QImage::Format_RGBX8888);
+    if (imageViewFor(converted, view))
+        resizeNormalizePlanar(view, dstW, dstH, norm, dst);
+}
+
+void preprocessInterleaved(const QImage& img, int dstW, int dstH, Normalization norm, float* dst) {
+    ImageView view;
+    if (imageViewFor(img, view)) {
+        resizeNormalizeInterleaved(view, dstW, dstH, norm, dst);
+        return;
+    }
+    QImage converted = img.convertToFormat(QImage::Format_RGBX8888);
+    if (imageViewFor(converted, view))
+        resizeNormalizeInterleaved(view, dstW, dstH, norm, dst);
+}
@@ -0,0 +1,111 @@
+// InferenceContext.cpp
+
+#include "InferenceContext.hpp"
+#include <stdexcept>
+
+InferenceContext::InferenceContext(Ort::Session& session_)
+    : session(session_),
+      memoryInfo(Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault)),
+      binding(session_)
+{
+    // Names and declared shapes are looked up once here instead of on every run
+    Ort::AllocatorWithDefaultOptions allocator;
+
+    inputs.resize(session.GetInputCount());
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        inputs[i].name = session.GetInputNameAllocated(i, allocator).get();
+        inputs[i].declaredShape = session.GetInputTypeInfo(i).GetTensorTypeAndShapeInfo().GetShape();
+    }
+
+    outputs.resize(session.GetOutputCount());
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        outputs[i].name = session.GetOutputNameAllocated(i, allocator).get();
+        outputs[i].declaredShape = session.GetOutputTypeInfo(i).GetTensorTypeAndShapeInfo().GetShape();
+    }
+
+    boundOutputs.reserve(outputs.size());
+    fetched.resize(outputs.size());
+    fetchAllocator.version = ORT_API_VERSION;
+    fetchAllocator.Alloc = allocFetched;
+    fetchAllocator.Free = freeFetched;
+    fetchAllocator.Info = fetchedInfo;
+    fetchAllocator.owner = this;
+}
+
+void InferenceContext::bindOutputToCpu(size_t index) {
+    Slot& slot = outputs.at(index);
+    slot.value = Ort::Value{nullptr};
+    slot.allocatedByRun = true;
+    binding.BindOutput(slot.name.c_str(), memoryInfo);
+    markBound(index);
+}
+
+void InferenceContext::run() {
+    bool anyAllocatedByRun = false;
+    for (const Slot& slot : outputs) {
+        if (slot.allocatedByRun) {
+            binding.BindOutput(slot.name.c_str(), memoryInfo);
+            anyAllocatedByRun = true;
+        }
+    }
+    session.Run(Ort::RunOptions{nullptr}, binding);
+    if (anyAllocatedByRun)
+        fetchRunOutputs();
+}
+
+// Moves the tensors ONNX Runtime allocated for bindOutputToCpu() outputs into their
+// slots. GetBoundOutputValues() returns a new handle for every bound output, in the
+// order they were first bound, in an array from the given allocator: here the fixed
+// fetched array, so the fetch allocates no std::vector as GetOutputValues() does.
+void InferenceContext::fetchRunOutputs() {
+    OrtValue** values = nullptr;
+    size_t count = 0;
+    Ort::ThrowOnError(Ort::GetApi().GetBoundOutputValues(binding, &fetchAllocator, &values, &count));
+    for (size_t i = 0; i < count; ++i) {
+        Ort::Value value(values[i]); // owns the handle either way
+        Slot& slot = outputs[boundOutputs[i]];
+        if (slot.allocatedByRun)
+            slot.value = std::move(value); // releases the previous run's tensor
+    }
+}
+
+void* ORT_API_CALL InferenceContext::allocFetched(OrtAllocator* allocator, size_t bytes) {
+    InferenceContext* context = static_cast<FetchAllocator*>(allocator)->owner;
+    // Null makes GetBoundOutputValues() fail rather than write past the array
+    return bytes <= context->fetched.size() * sizeof(OrtValue*) ? context->fetched.data() : nullptr;
+}
+
+void ORT_API_CALL InferenceContext::freeFetched(OrtAllocator*, void*) {
+    // The array belongs to the context
+}
+
+const OrtMemoryInfo* ORT_API_CALL InferenceContext::fetchedInfo(const OrtAllocator* allocator) {
+    return static_cast<const FetchAllocator*>(allocator)->owner->memoryInfo;
+}
+
+void InferenceContext::markBound(size_t outputIndex) {
+    Slot& slot = outputs.at(outputIndex);
+    if (!slot.bound) {
+        slot.bound = true;
+        boundOutputs.push_back(outputIndex);
+    }
+}
+
+void* InferenceContext::reserve(Slot& slot, size_t bytes) {
+    if (bytes > slot.capacityBytes) {
+        // The old tensor still points at the old buffer; it is replaced right after this returns
+        slot.buffer.reset(new unsigned char[bytes]);
+        slot.capacityBytes = bytes;
+    }
+    return slot.buffer.get();
+}
+
+size_t InferenceContext::elementCount(const std::vector<int64_t>& shape) {
+    size_t count = 1;
+    for (int64_t d : shape) {
+        if (d <= 0)
+            throw std::runtime_error("Tensor bindings need concrete (positive) dimensions");
+        count *= static_cast<size_t>(d);
+    }
+    return count;
+}
@@ -0,0 +1,60 @@
+// LabelSet.cpp
+
+#include "LabelSet.hpp"
+#include <atomic>
+#include <bitset>
+
+LabelSet::Chunk& LabelSet::writableChunk(size_t chunk)
+{
+    if (chunk >= chunks.size())
+        chunks.resize(chunk + 1);
+    std::shared_ptr<Chunk>& words = chunks[chunk];
+    if (!words)
+        words = std::make_shared<Chunk>(Chunk{});
+    else if (words.use_count() != 1)
+        words = std::make_shared<Chunk>(*words);
+    else
+        std::atomic_thread_fence(std::memory_order_acquire); // pairs with the release of the last other owner
+    return *words;
+}
+
+void LabelSet::insert(size_t label)
+{
+    if (contains(label))
+        return;
+    const size_t bit = label % chunkLabels;
+    writableChunk(label / chunkLabels)[bit / 64] |= uint64_t(1) << (bit % 64);
+    ++count;
+}
+
+void LabelSet::erase(size_t label)
+{
+    if (!contains(label))
+        return;
+    const size_t bit = label % chunkLabels;
+    writableChunk(label / chunkLabels)[bit / 64] &= ~(uint64_t(1) << (bit % 64));
+    --count;
+}
+
+void LabelSet::unite(const LabelSet& other)
+{
+    if (other.chunks.size() > chunks.size())
+        chunks.resize(other.chunks.size());
+    for (size_t c = 0; c < other.chunks.size(); ++c) {
+        if (!other.chunks[c] || chunks[c] == other.chunks[c])
+            continue;
+        if (!chunks[c]) {
+            chunks[c] = other.chunks[c]; // shared until either set writes to it
+            for (uint64_t word : *other.chunks[c])
+                count += std::bitset<64>(word).count();
+            continue;
+        }
+        Chunk& words = writableChunk(c);
+        const Chunk& add = *other.chunks[c];
+        for (size_t w = 0; w < chunkWords; ++w) {
+            count -= std::bitset<64>(words[w]).count();
+            words[w] |= add[w];
+            count += std::bitset<64>(words[w]).count();
+        }
+    }
+}
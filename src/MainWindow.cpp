@@ -19,9 +19,13 @@
 #include <QVBoxLayout>
 #include <QWidget> // Already included via QMainWindow but good for clarity
 #include <QHeaderView> // For QTableWidget column sizing
+#include <QStatusBar> // For pipeline status
+#include <QProgressDialog> // For loading large face databases
+#include <QCoreApplication>
 
 
 #include <QMediaDevices> // For QMediaDevices
+#include <algorithm> // For std::find_if
 
 MainWindow::MainWindow(const AppConfig &config, QWidget *parent)
     : QMainWindow(parent),
@@ -48,13 +52,13 @@ MainWindow::MainWindow(const AppConfig &config, QWidget *parent)
     userManagementLayout = new QVBoxLayout(userManagementTab);
 
     userTableWidget = new QTableWidget(this);
-    userTableWidget->setColumnCount(2);
-    userTableWidget->setHorizontalHeaderLabels({"User ID", "Name"});
+    userTableWidget->setColumnCount(3);
+    userTableWidget->setHorizontalHeaderLabels({"User ID", "Name", "Groups"});
     userTableWidget->setEditTriggers(QAbstractItemView::NoEditTriggers);
     userTableWidget->setSelectionBehavior(QAbstractItemView::SelectRows);
     userTableWidget->setSelectionMode(QAbstractItemView::SingleSelection);
     userTableWidget->verticalHeader()->setVisible(false); // Hide vertical row numbers
-    userTableWidget->horizontalHeader()->setStretchLastSection(true); // Name column fills space
+    userTableWidget->horizontalHeader()->setStretchLastSection(true); // Groups column fills space
 
     refreshUserListButton = new QPushButton(tr("Refresh List"), this);
     connect(refreshUserListButton, &QPushButton::clicked, this, &MainWindow::populateUserTable);
@@ -69,6 +73,9 @@ MainWindow::MainWindow(const AppConfig &config, QWidget *parent)
     editUserNameButton = new QPushButton(tr("Edit Selected Name"), this);
     connect(editUserNameButton, &QPushButton::clicked, this, &MainWindow::onEditUserNameClicked);
     userMgmtButtonLayout->addWidget(editUserNameButton);
+    editUserGroupsButton = new QPushButton(tr("Edit Selected Groups"), this);
+    connect(editUserGroupsButton, &QPushButton::clicked, this, &MainWindow::onEditUserGroupsClicked);
+    userMgmtButtonLayout->addWidget(editUserGroupsButton);
     userMgmtButtonLayout->addStretch(); // Add spacer to push buttons to one side if desired
 
     userManagementLayout->addLayout(userMgmtButtonLayout); // Add button layout
@@ -118,8 +125,7 @@ MainWindow::MainWindow(const AppConfig &config, QWidget *parent)
         embedder = std::make_unique<FaceEmbedder>(m_appConfig.arcfaceModelPath);
 
         // FaceIndex initialization and loading
-        faceIndex = std::make_unique<FaceIndex>(512, m_appConfig.maxFaceIndexSize);
-        faceIndex->loadFromDisk(m_appConfig.faceDatabasePath);
+        loadFaceIndex();
 
     } catch (const Ort::Exception& ort_err) {
         QMessageBox::critical(this, "Critical Error", QString("ONNX Runtime Error: %1\nApplication will now exit.").arg(ort_err.what()));
@@ -143,6 +149,9 @@ MainWindow::MainWindow(const AppConfig &config, QWidget *parent)
     settingsAction = new QAction(tr("&Settings..."), this);
     connect(settingsAction, &QAction::triggered, this, &MainWindow::openSettingsDialog);
     fileMenu->addAction(settingsAction);
+    tuneSearchAction = new QAction(tr("&Tune Face Search..."), this);
+    connect(tuneSearchAction, &QAction::triggered, this, &MainWindow::onTuneFaceSearch);
+    fileMenu->addAction(tuneSearchAction);
 
     // Camera setup
     camera = new QCamera(this);
@@ -166,11 +175,25 @@ MainWindow::MainWindow(const AppConfig &config, QWidget *parent)
     timer = new QTimer(this);
     timer->start(33);
 
+    // Recognition runs on its own threads; onVideoFrame only submits frames and draws results
+    recognitionPipeline = std::make_unique<RecognitionPipeline>(detector.get(), embedder.get(), faceIndex.get(), m_appConfig);
+
+    pipelineStatusTimer = new QTimer(this);
+    connect(pipelineStatusTimer, &QTimer::timeout, this, &MainWindow::updatePipelineStatus);
+    pipelineStatusTimer->start(1000);
+
+    // Read-only instances pick up the snapshots the writer process publishes
+    snapshotTimer = new QTimer(this);
+    connect(snapshotTimer, &QTimer::timeout, this, &MainWindow::refreshFaceIndexSnapshot);
+    if (m_appConfig.faceIndexReadOnly)
+        snapshotTimer->start(2000);
+
     populateUserTable(); // Initial population
 }
 
 MainWindow::~MainWindow()
 {
+    recognitionPipeline.reset(); // Join the stage threads before the components it uses go away
     delete ui;
     delete camera;
     delete captureSession;
@@ -178,88 +201,13 @@ MainWindow::~MainWindow()
     delete timer;
 }
 
-QImage MainWindow::alignFace(const QImage &sourceImage, const FaceDetection &detectedFace)
-{
-    // Target landmark positions in the 112x112 aligned image
-    const double lx_tgt = 30.0;
-    const double ly_tgt = 48.0;
-    const double rx_tgt = 82.0;
-    const double ry_tgt = 48.0;
-
-    // Source landmark positions
-    double lx_src = detectedFace.left_eye_x;
-    double ly_src = detectedFace.left_eye_y;
-    double rx_src = detectedFace.right_eye_x;
-    double ry_src = detectedFace.right_eye_y;
-
-    // Calculate source eye center and vector
-    double mid_x_src = (lx_src + rx_src) / 2.0;
-    double mid_y_src = (ly_src + ry_src) / 2.0;
-    double dx_src = rx_src - lx_src;
-    double dy_src = ry_src - ly_src;
-
-    // Calculate distance between eyes
-    double dist_src = std::sqrt(dx_src * dx_src + dy_src * dy_src);
-    const double dist_tgt = rx_tgt - lx_tgt; // 52.0
-
-    // Validate eye distance
-    if (dist_src < 1e-6) {
-        qWarning() << "Eye distance too small, falling back to simple crop";
-        return cropFace(sourceImage, detectedFace);
-    }
-
-    // Calculate scale and angle
-    double scale = dist_tgt / dist_src;
-    double angle_src = std::atan2(dy_src, dx_src);
-    double rotation_angle_rad = -angle_src;
-
-    // Create transform
-    QTransform transform;
-    transform.translate(mid_x_src, mid_y_src);
-    transform.rotateRadians(rotation_angle_rad);
-    transform.scale(scale, scale);
-    transform.translate(-mid_x_src, -mid_y_src);
-
-    // Create output image
-    QImage aligned_image(112, 112, sourceImage.format());
-    aligned_image.fill(Qt::black);
-
-    // Draw transformed image
-    QPainter painter(&aligned_image);
-    painter.setRenderHint(QPainter::Antialiasing);
-    painter.setRenderHint(QPainter::SmoothPixmapTransform);
-    painter.setTransform(transform);
-    
-    // Calculate source rectangle to draw
-    double face_width = detectedFace.x2 - detectedFace.x1;
-    double face_height = detectedFace.y2 - detectedFace.y1;
-    double margin = std::max(face_width, face_height) * 0.5; // 50% margin
-    
-    QRectF source_rect(
-        detectedFace.x1 - margin,
-        detectedFace.y1 - margin,
-        face_width + 2 * margin,
-        face_height + 2 * margin
-    );
-    
-    painter.drawImage(QRectF(0, 0, 112, 112), sourceImage, source_rect);
-    painter.end();
-
-    return aligned_image;
-}
-
-// Crops and returns a face image from detected bounding box (with some margin)
-QImage MainWindow::cropFace(const QImage &img, const FaceDetection &fd)
-{
-    int x = std::max(0, int(fd.x1));
-    int y = std::max(0, int(fd.y1));
-    int w = std::min(img.width() - x, int(fd.x2 - fd.x1));
-    int h = std::min(img.height() - y, int(fd.y2 - fd.y1));
-    return img.copy(x, y, w, h).scaled(112, 112); // always scale to ArcFace size
-}
-
 void MainWindow::onRegisterUser()
 {
+    if (faceIndex && faceIndex->isReadOnly()) {
+        QMessageBox::warning(this, "Register User", "This station opens the face database read-only. Register users on the writer station.");
+        return;
+    }
+
     // Take a snapshot of the current frame
     if (lastFrame.isNull()) {
         QMessageBox::critical(this, "Error", "No frame available for registration. Please ensure the camera is working.");
@@ -297,17 +245,51 @@ void MainWindow::onRegisterUser()
         return;
     }
 
-    // Try to align the face
-    QImage aligned_image = alignFace(lastFrame, face_to_register);
-    if (aligned_image.isNull()) {
-        QMessageBox::critical(this, "Error", "Failed to align face for registration. Please try again.");
+    // Align the face and get its embedding in one step, then add to index
+    std::vector<float> emb = embedder->getEmbedding(lastFrame, face_to_register);
+
+    // A name that is already registered usually means another look of the same person:
+    // store the face as one more template of that user rather than a second user
+    const std::string userName = name.trimmed().toStdString();
+    const auto id_map = faceIndex->getIdToNameMap();
+    bool registered = false;
+    size_t existingId = 0; // the first user with that name
+    id_map->forEach([&](size_t id, const std::string& enrolledName) {
+        if (!registered && enrolledName == userName) {
+            registered = true;
+            existingId = id;
+        }
+    });
+    if (registered) {
+        const auto answer = QMessageBox::question(this, "Register User",
+            "'" + name.trimmed() + "' is already registered. Add this face to that user?\n"
+            "Choose No to register a different person with the same name.",
+            QMessageBox::Yes | QMessageBox::No | QMessageBox::Cancel, QMessageBox::Yes);
+        if (answer == QMessageBox::Cancel)
+            return;
+        if (answer == QMessageBox::Yes) {
+            bool added = false;
+            try {
+                added = faceIndex->addTemplate(existingId, emb);
+            } catch (const std::exception& e) {
+                QMessageBox::warning(this, "Register User", QString("The face was not added: %1").arg(e.what()));
+                return;
+            }
+            if (!added) {
+                QMessageBox::warning(this, "Register User", "The user was deleted meanwhile; nothing was added.");
+                return;
+            }
+            QMessageBox::information(this, "Success", "Added another face to user '" + name.trimmed() + "' ("
+                                     + QString::number(faceIndex->templateCount(existingId)) + " faces).");
+            return;
+        }
+    }
+    try {
+        faceIndex->add(userName, emb); // journaled; no full rewrite
+    } catch (const std::exception& e) {
+        QMessageBox::warning(this, "Register User", QString("'%1' was not registered: %2").arg(name.trimmed(), e.what()));
         return;
     }
-
-    // Get embedding and add to index
-    std::vector<float> emb = embedder->getEmbedding(aligned_image);
-    faceIndex->add(name.trimmed().toStdString(), emb);
-    faceIndex->saveToDisk(m_appConfig.faceDatabasePath);
     
     QMessageBox::information(this, "Success", "User '" + name.trimmed() + "' registered successfully!");
 }
@@ -318,108 +300,48 @@ void MainWindow::onVideoFrame(const QVideoFrame &frame)
     if (image.isNull())
         return;
     lastFrame = image;
-    frameCount++;
-
-    // 1. Age/expire cache
-    for (auto it = faceCache.begin(); it != faceCache.end(); ) {
-        if (--(it->ttl) <= 0) it = faceCache.erase(it);
-        else ++it;
-    }
-
-    // 2. Only run ONNX heavy pipeline every frameSkip-th frame or if cache empty
-    bool doDetect = (frameCount % frameSkip == 0) || faceCache.empty();
-
-    if (detector && doDetect) { // Check if detector is initialized
-        faceCache.clear();
-        std::vector<FaceDetection> faces = detector->detect(image); // Use ->
-        for (const auto &f : faces) {
-            QImage aligned_face = alignFace(image, f);
-            if (aligned_face.isNull()) continue; // Skip if alignment failed
-
-            std::vector<float> emb = embedder->getEmbedding(aligned_face);
-            SearchResult search_result = faceIndex->search(emb, m_appConfig.similarityThreshold);
-
-            CachedFace cf;
-            cf.box = QRect(QPoint(int(f.x1), int(f.y1)), QPoint(int(f.x2), int(f.y2)));
-            cf.name = search_result.found ? search_result.name : "Unknown";
-            cf.conf = f.confidence; // Original detection confidence
-            cf.similarity = search_result.similarity;
-            cf.userId = search_result.id; // Store user ID in cache
-
-            // Log attendance if a known user is found
-            if (search_result.found && search_result.id != 0) {
-                QDateTime current_time = QDateTime::currentDateTime();
-                bool should_log = true;
-                if (m_lastLogTimestamps.count(search_result.id)) {
-                    if (m_lastLogTimestamps[search_result.id].secsTo(current_time) < m_attendanceLogDebounceSecs) {
-                        should_log = false;
-                    }
-                }
-
-                if (should_log) {
-                    m_lastLogTimestamps[search_result.id] = current_time; // Update last log time
-
-                    QFile logFile(QString::fromStdString(m_appConfig.attendanceLogPath));
-                    if (logFile.open(QIODevice::Append | QIODevice::Text)) {
-                        QTextStream stream(&logFile);
-                        // Check if file is new/empty to write headers
-                        if (logFile.pos() == 0) {
-                            stream << "Timestamp,UserID,UserName\n";
-                        }
-                        stream << current_time.toString(Qt::ISODate) << ","
-                               << search_result.id << ","
-                               << QString::fromStdString(search_result.name) << "\n";
-                        logFile.close();
-                    } else {
-                        qWarning() << "Could not open attendance log file for writing:" << QString::fromStdString(m_appConfig.attendanceLogPath);
-                    }
-                }
-            }
-            
-            // Cache landmarks if you want landmark overlay every frame
-            cf.left_eye_x = f.left_eye_x; cf.left_eye_y = f.left_eye_y;
-            cf.right_eye_x = f.right_eye_x; cf.right_eye_y = f.right_eye_y;
-            cf.nose_x = f.nose_x; cf.nose_y = f.nose_y;
-            cf.mouth_x = f.mouth_x; cf.mouth_y = f.mouth_y;
-            cf.left_cheek_x = f.left_cheek_x; cf.left_cheek_y = f.left_cheek_y;
-            cf.right_cheek_x = f.right_cheek_x; cf.right_cheek_y = f.right_cheek_y;
-            cf.ttl = cacheTTL;
-            faceCache.push_back(cf);
-        }
-    }
 
-    // 3. Draw overlays from cache on every frame (full speed)
+    // 1. Hand the frame to the recognition pipeline (stale frames are dropped there)
+    if (!recognitionPipeline)
+        return; // Initialization failed; nothing to recognize with
+    recognitionPipeline->submitFrame(image);
+
+    // 2. Draw the most recent published result on every frame (full speed)
+    std::shared_ptr<const RecognitionResult> result = recognitionPipeline->latestResult();
+    const std::vector<OverlayFace> &overlay = result->faces;
+
     QImage display = image;
     QPainter painter(&display);
 
-    for (const auto &cf : faceCache) {
+    for (const auto &of : overlay) {
         // Draw face box
         painter.setPen(QPen(Qt::green, 5));
-        painter.drawRect(cf.box);
+        painter.drawRect(of.box);
 
         // Draw name
         painter.setPen(QPen(Qt::yellow, 2));
         painter.setFont(QFont("Arial", 16, QFont::Bold));
-        painter.drawText(cf.box.topLeft() - QPoint(0, 24), QString::fromStdString(cf.name));
+        painter.drawText(of.box.topLeft() - QPoint(0, 24), QString::fromStdString(of.name));
 
         // Draw confidence or similarity
         painter.setPen(QPen(Qt::green, 2));
         painter.setFont(QFont("Arial", 14, QFont::Bold));
-        if (cf.name != "Unknown") {
-            painter.drawText(cf.box.topLeft() - QPoint(0, 8), QString("Sim: %1").arg(cf.similarity, 0, 'f', 2));
+        if (of.name != "Unknown") {
+            painter.drawText(of.box.topLeft() - QPoint(0, 8), QString("Sim: %1").arg(of.similarity, 0, 'f', 2));
         } else {
-            painter.drawText(cf.box.topLeft() - QPoint(0, 8), QString("Conf: %1").arg(cf.conf, 0, 'f', 2));
+            painter.drawText(of.box.topLeft() - QPoint(0, 8), QString("Conf: %1").arg(of.conf, 0, 'f', 2));
         }
 
         // Draw landmarks
+        const FaceDetection &d = of.detection;
         struct LM { float x, y; QColor color; };
         std::vector<LM> landmarks = {
-            {cf.left_eye_x, cf.left_eye_y, QColor("red")},
-            {cf.right_eye_x, cf.right_eye_y, QColor("red")},
-            {cf.nose_x, cf.nose_y, QColor("blue")},
-            {cf.mouth_x, cf.mouth_y, QColor("magenta")},
-            {cf.left_cheek_x, cf.left_cheek_y, QColor("orange")},
-            {cf.right_cheek_x, cf.right_cheek_y, QColor("orange")},
+            {d.left_eye_x, d.left_eye_y, QColor("red")},
+            {d.right_eye_x, d.right_eye_y, QColor("red")},
+            {d.nose_x, d.nose_y, QColor("blue")},
+            {d.mouth_x, d.mouth_y, QColor("magenta")},
+            {d.left_cheek_x, d.left_cheek_y, QColor("orange")},
+            {d.right_cheek_x, d.right_cheek_y, QColor("orange")},
         };
         for (const auto &lm : landmarks) {
             painter.setBrush(lm.color);
@@ -430,7 +352,7 @@ void MainWindow::onVideoFrame(const QVideoFrame &frame)
         painter.setPen(QPen(Qt::green, 5));
     }
 
-    if (faceCache.empty()) {
+    if (overlay.empty()) {
         painter.setPen(QPen(Qt::red, 2));
         painter.setFont(QFont("Arial", 24, QFont::Bold));
         painter.drawText(display.rect(), Qt::AlignCenter, "No Face Detected");
@@ -439,15 +361,103 @@ void MainWindow::onVideoFrame(const QVideoFrame &frame)
 
     ui->CameraLabel->setPixmap(QPixmap::fromImage(display));
 
-    // Show Register button if any "Unknown" in cache
-    bool showRegister = !faceCache.empty() && std::any_of(faceCache.begin(), faceCache.end(),
-                                [](const CachedFace& cf){ return cf.name == "Unknown"; });
+    // Show Register button if any "Unknown" face is on screen
+    bool showRegister = !overlay.empty() && std::any_of(overlay.begin(), overlay.end(),
+                                [](const OverlayFace& of){ return of.name == "Unknown"; });
     ui->RegisterUserButton->setVisible(showRegister);
 
    
     recentResults.clear();
-    for (const auto &cf : faceCache)
-        recentResults.push_back(cf.name);
+    for (const auto &of : overlay)
+        recentResults.push_back(of.name);
+}
+
+void MainWindow::loadFaceIndex()
+{
+    // Dimension 512 is hardcoded for ArcFace
+    const VectorStorage storage = vectorStorageFromString(m_appConfig.faceIndexVectorStorage, VectorStorage::Float32);
+    faceIndex = std::make_unique<ShardedFaceIndex>(512, m_appConfig.maxFaceIndexSize,
+                                                   static_cast<size_t>(m_appConfig.faceIndexShards),
+                                                   m_appConfig.faceIndexReadOnly, storage);
+    faceIndex->setCompactionThreshold(static_cast<uint64_t>(m_appConfig.faceIndexCompactionMB) << 20);
+    faceIndex->setRebuildThreshold(m_appConfig.faceIndexRebuildDeletedPercent / 100.0);
+    faceIndex->setRerankCandidates(static_cast<size_t>(m_appConfig.faceIndexRerankCandidates));
+    faceIndex->setDiskResidentVectors(m_appConfig.faceIndexDiskVectors);
+    SearchBudget budget;
+    if (m_appConfig.searchConfidenceMargin > 0.0f)
+        budget.confidentSimilarity = m_appConfig.similarityThreshold + m_appConfig.searchConfidenceMargin;
+    budget.time = std::chrono::microseconds(m_appConfig.searchTimeBudgetUs);
+    budget.hops = static_cast<size_t>(m_appConfig.searchHopBudget);
+    faceIndex->setSearchBudget(budget);
+    faceIndex->setExactSearchLimit(static_cast<size_t>(m_appConfig.exactSearchMaxFaces));
+
+    // Only the one-time CSV import reports progress; the dialog appears if it takes a while.
+    // It is modal so nothing can reach the index while the load holds it.
+    QProgressDialog progressDialog(tr("Loading face database..."), QString(), 0, 100, this);
+    progressDialog.setWindowModality(Qt::ApplicationModal);
+    progressDialog.setMinimumDuration(500);
+    progressDialog.setAutoClose(false);
+    progressDialog.setValue(0);
+    faceIndex->loadFromDisk(m_appConfig.faceDatabasePath,
+                            [&progressDialog](FaceIndex::LoadPhase phase, size_t done, size_t total) {
+        // Parsing is the first fifth of the bar, building the graph the rest
+        const double fraction = total ? static_cast<double>(done) / static_cast<double>(total) : 1.0;
+        const bool parsing = phase == FaceIndex::LoadPhase::Parsing;
+        progressDialog.setLabelText(parsing ? tr("Reading face database...") : tr("Indexing %1 faces...").arg(total));
+        progressDialog.setValue(static_cast<int>(parsing ? 20 * fraction : 20 + 80 * fraction));
+        QCoreApplication::processEvents();
+    });
+}
+
+void MainWindow::onTuneFaceSearch()
+{
+    if (!faceIndex)
+        return;
+    if (faceIndex->isReadOnly()) {
+        QMessageBox::warning(this, "Tune Face Search", "This station opens the face database read-only. Tune the search on the writer station.");
+        return;
+    }
+    bool ok;
+    const double target = QInputDialog::getDouble(this, "Tune Face Search", "Target recall@1 (share of searches that find the nearest face):",
+                                                  m_appConfig.searchTargetRecall, 0.5, 1.0, 3, &ok);
+    if (!ok)
+        return;
+
+    // Registrations wait for the tuning; recognition goes on
+    QProgressDialog progressDialog(tr("Measuring face search recall..."), QString(), 0, 100, this);
+    progressDialog.setWindowModality(Qt::ApplicationModal);
+    progressDialog.setMinimumDuration(500);
+    progressDialog.setValue(0);
+    SearchTuning tuning;
+    try {
+        tuning = faceIndex->tuneSearch(target, 200, [&progressDialog](size_t done, size_t total) {
+            progressDialog.setValue(static_cast<int>(100 * done / std::max<size_t>(total, 1)));
+            QCoreApplication::processEvents();
+        });
+    } catch (const std::exception& e) {
+        QMessageBox::warning(this, "Tune Face Search", QString("Tuning failed: %1").arg(e.what()));
+        return;
+    }
+    progressDialog.close();
+    if (tuning.samples == 0) {
+        QMessageBox::information(this, "Tune Face Search", "Register at least two users before tuning the search.");
+        return;
+    }
+    m_appConfig.searchTargetRecall = static_cast<float>(target);
+
+    // e.g. "ef 32: recall 97.5%, p50 / p95 / p99 120 / 180 / 240 us" per ef tried
+    QStringList lines;
+    for (const SearchTuningPoint& p : tuning.points)
+        lines << QString("ef %1: recall %2%, p50 / p95 / p99 %3 / %4 / %5 us").arg(p.ef).arg(100.0 * p.recall, 0, 'f', 1)
+                     .arg(p.p50Us, 0, 'f', 0).arg(p.p95Us, 0, 'f', 0).arg(p.p99Us, 0, 'f', 0);
+    lines << QString();
+    lines << (tuning.targetMet ? QString("Searches now use ef %1.").arg(tuning.ef)
+                               : QString("No ef reached the target; searches now use the largest, %1.").arg(tuning.ef));
+    if (tuning.recommendedM != tuning.graphM)
+        lines << QString("The graph has M = %1; M = %2 is recommended and is used the next time it is rebuilt.")
+                     .arg(tuning.graphM).arg(tuning.recommendedM);
+    QMessageBox::information(this, "Tune Face Search",
+                             QString("Measured on %1 faces held out of the gallery:\n\n%2").arg(tuning.samples).arg(lines.join("\n")));
 }
 
 void MainWindow::openSettingsDialog()
@@ -456,6 +466,8 @@ void MainWindow::openSettingsDialog()
     if (dialog.exec() == QDialog::Accepted) {
         // Apply settings that can be changed at runtime by re-initializing components
         // This is a simplified approach. A more granular update might be preferred in a complex app.
+        // Stop recognition while the components it uses are replaced
+        recognitionPipeline.reset();
         try {
             // Re-initialize FaceDetector
             detector = std::make_unique<FaceDetector>(m_appConfig.modelPath, m_appConfig.maxDetections, m_appConfig.confThresh, m_appConfig.iouThresh);
@@ -463,9 +475,8 @@ void MainWindow::openSettingsDialog()
             // Re-initialize FaceEmbedder
             embedder = std::make_unique<FaceEmbedder>(m_appConfig.arcfaceModelPath);
 
-            // Re-initialize FaceIndex (dimension 512 is hardcoded for ArcFace)
-            faceIndex = std::make_unique<FaceIndex>(512, m_appConfig.maxFaceIndexSize);
-            faceIndex->loadFromDisk(m_appConfig.faceDatabasePath);
+            // Re-initialize FaceIndex
+            loadFaceIndex();
 
             QMessageBox::information(this, "Settings Applied", "Settings have been applied. Critical components were re-initialized.");
 
@@ -476,6 +487,9 @@ void MainWindow::openSettingsDialog()
         } catch (const std::exception& ex) {
             QMessageBox::critical(this, "Error Applying Settings", QString("An unexpected error occurred: %1\nPlease restart.").arg(ex.what()));
         }
+        if (detector && embedder && faceIndex) {
+            recognitionPipeline = std::make_unique<RecognitionPipeline>(detector.get(), embedder.get(), faceIndex.get(), m_appConfig);
+        }
         // Note: The FaceIndex is re-initialized within the try block if settings are accepted.
         // The duplicated lines that were here have been removed.
 
@@ -490,23 +504,32 @@ void MainWindow::populateUserTable()
 
     userTableWidget->setRowCount(0); // Clear existing rows
 
-    const auto& id_map = faceIndex->getIdToNameMap();
+    const auto id_map = faceIndex->getIdToNameMap();
+    const auto groups = faceIndex->getGroups();
     userTableWidget->setSortingEnabled(false); // Disable sorting during population for speed
 
-    for (const auto& pair : id_map) {
+    id_map->forEach([&](size_t id, const std::string& userName) {
         int row = userTableWidget->rowCount();
         userTableWidget->insertRow(row);
 
-        QTableWidgetItem *idItem = new QTableWidgetItem(QString::number(pair.first));
-        QTableWidgetItem *nameItem = new QTableWidgetItem(QString::fromStdString(pair.second));
+        QTableWidgetItem *idItem = new QTableWidgetItem(QString::number(id));
+        QTableWidgetItem *nameItem = new QTableWidgetItem(QString::fromStdString(userName));
+        QStringList groupNames;
+        if (const FaceIndex::GroupList* userGroups = groups->userGroups.find(id)) {
+            for (const std::string& group : *userGroups)
+                groupNames << QString::fromStdString(group);
+        }
+        QTableWidgetItem *groupsItem = new QTableWidgetItem(groupNames.join(", "));
 
         // Items should be non-editable if table is NoEditTriggers, but explicit is fine
         idItem->setFlags(idItem->flags() & ~Qt::ItemIsEditable);
         nameItem->setFlags(nameItem->flags() & ~Qt::ItemIsEditable);
+        groupsItem->setFlags(groupsItem->flags() & ~Qt::ItemIsEditable);
 
         userTableWidget->setItem(row, 0, idItem);
         userTableWidget->setItem(row, 1, nameItem);
-    }
+        userTableWidget->setItem(row, 2, groupsItem);
+    });
     userTableWidget->resizeColumnsToContents(); // Adjust column widths based on content
     userTableWidget->setSortingEnabled(true); // Re-enable sorting
 }
@@ -550,7 +573,6 @@ void MainWindow::onDeleteUserClicked()
     if (reply == QMessageBox::Yes) {
         bool deleted = faceIndex->deleteUser(userId);
         if (deleted) {
-            faceIndex->saveToDisk(m_appConfig.faceDatabasePath); // Persist the change
             populateUserTable(); // Refresh the table
             QMessageBox::information(this, "Delete User", QString("User '%1' (ID: %2) deleted successfully.").arg(userName).arg(userId));
         } else {
@@ -605,7 +627,6 @@ void MainWindow::onEditUserNameClicked()
 
         bool updated = faceIndex->updateUserName(userId, newName.trimmed().toStdString());
         if (updated) {
-            faceIndex->saveToDisk(m_appConfig.faceDatabasePath); // Persist the change
             populateUserTable(); // Refresh the table
             QMessageBox::information(this, "Edit User Name", QString("User name for ID %1 updated from '%2' to '%3'.").arg(userId).arg(currentName).arg(newName.trimmed()));
         } else {
@@ -619,6 +640,53 @@ void MainWindow::onEditUserNameClicked()
     // If !ok_input (user pressed Cancel), do nothing.
 }
 
+void MainWindow::onEditUserGroupsClicked()
+{
+    if (!faceIndex) {
+        QMessageBox::critical(this, "Error", "Face index not available.");
+        return;
+    }
+
+    if (userTableWidget->selectionModel()->selectedRows().isEmpty()) {
+        QMessageBox::information(this, "Edit User Groups", "Please select a user from the list to edit.");
+        return;
+    }
+
+    int selectedRow = userTableWidget->selectionModel()->selectedRows().first().row();
+    QTableWidgetItem *idItem = userTableWidget->item(selectedRow, 0);
+    QTableWidgetItem *nameItem = userTableWidget->item(selectedRow, 1);
+    QTableWidgetItem *groupsItem = userTableWidget->item(selectedRow, 2);
+
+    if (!idItem || !nameItem || !groupsItem) {
+        QMessageBox::warning(this, "Edit User Groups", "Could not retrieve user details from selection.");
+        return;
+    }
+
+    QString userName = nameItem->text();
+    bool ok_id;
+    size_t userId = idItem->text().toULongLong(&ok_id);
+
+    if (!ok_id) {
+        QMessageBox::warning(this, "Edit User Groups", QString("Invalid User ID format for '%1'.").arg(userName));
+        return;
+    }
+
+    // Cameras with cameraAllowedGroups set recognize only the users in those groups
+    bool ok_input;
+    QString newGroups = QInputDialog::getText(this, "Edit User Groups",
+                                              QString("Comma-separated groups of %1 (ID: %2), empty for none:").arg(userName).arg(userId),
+                                              QLineEdit::Normal, groupsItem->text(), &ok_input);
+    if (!ok_input)
+        return;
+
+    if (faceIndex->setUserGroups(userId, FaceIndex::parseGroupList(newGroups.toStdString()))) {
+        populateUserTable(); // Refresh the table
+    } else {
+        QMessageBox::warning(this, "Edit User Groups", QString("Failed to update the groups of user ID %1. User may no longer exist.").arg(userId));
+        populateUserTable(); // Refresh table to ensure consistency
+    }
+}
+
 void MainWindow::populateAttendanceTable()
 {
     attendanceTableWidget->setRowCount(0); // Clear existing rows
@@ -663,3 +731,37 @@ void MainWindow::populateAttendanceTable()
     attendanceTableWidget->resizeColumnsToContents();
     attendanceTableWidget->setSortingEnabled(true); // Re-enable sorting
 }
+
+void MainWindow::updatePipelineStatus()
+{
+    if (!recognitionPipeline) {
+        statusBar()->clearMessage();
+        return;
+    }
+    // e.g. "detect 1/2 (38.2 ms)" per stage: queued/capacity of the stage input and mean time per item
+    QStringList parts;
+    uint64_t dropped = 0;
+    for (const PipelineStageStats &s : recognitionPipeline->stats()) {
+        parts << QString("%1 %2/%3 (%4 ms)").arg(s.name).arg(s.input.size).arg(s.input.capacity)
+                     .arg(s.avgBusyMs, 0, 'f', 1);
+        dropped += s.input.dropped;
+    }
+    parts << QString("dropped %1").arg(dropped);
+    const HotIdentityStats hot = recognitionPipeline->hotIdentityStats();
+    if (hot.lookups > 0)
+        parts << QString("cache hits %1%").arg(hot.hitRate() * 100.0, 0, 'f', 0);
+    if (faceIndex) {
+        // Searches cut short by a confident hit / by their budget
+        const SearchStopStats stops = faceIndex->searchStopStats();
+        if (stops.queries > 0)
+            parts << QString("early stops %1% / %2%").arg(100.0 * stops.confident / stops.queries, 0, 'f', 0)
+                                                     .arg(100.0 * stops.budget / stops.queries, 0, 'f', 0);
+    }
+    statusBar()->showMessage(parts.join("  |  "));
+}
+
+void MainWindow::refreshFaceIndexSnapshot()
+{
+    if (faceIndex && faceIndex->refreshSnapshot(m_appConfig.faceDatabasePath))
+        populateUserTable(); // A new snapshot was mapped
+}
@@ -0,0 +1,138 @@
+// MappedFile.cpp
+
+#include "MappedFile.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path)
+    : path_(path)
+{
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Cannot open " + path + " for mapping");
+    fileHandle_ = file;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(file);
+        throw std::runtime_error("Cannot map empty or unreadable file " + path);
+    }
+    size_ = static_cast<size_t>(fileSize.QuadPart);
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        CloseHandle(file);
+        throw std::runtime_error("CreateFileMapping failed for " + path);
+    }
+    mappingHandle_ = mapping;
+
+    data_ = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!data_) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        throw std::runtime_error("MapViewOfFile failed for " + path);
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if (data_)
+        UnmapViewOfFile(data_);
+    if (mappingHandle_)
+        CloseHandle(static_cast<HANDLE>(mappingHandle_));
+    if (fileHandle_)
+        CloseHandle(static_cast<HANDLE>(fileHandle_));
+}
+
+void MappedFile::prefetch() const
+{
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = const_cast<char*>(data_);
+    range.NumberOfBytes = size_;
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+void MappedFile::prefetch(size_t offset, size_t length) const
+{
+    if (offset >= size_)
+        return;
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = const_cast<char*>(data_ + offset);
+    range.NumberOfBytes = std::min(length, size_ - offset);
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+void MappedFile::adviseRandom() const
+{
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path)
+    : path_(path)
+{
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0)
+        throw std::runtime_error("Cannot open " + path + " for mapping");
+
+    struct stat st;
+    if (::fstat(fd_, &st) != 0 || st.st_size == 0) {
+        ::close(fd_);
+        throw std::runtime_error("Cannot map empty or unreadable file " + path);
+    }
+    size_ = static_cast<size_t>(st.st_size);
+
+    // MAP_SHARED + PROT_READ: pages are the page cache itself, shared by every reader
+    void* p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) {
+        ::close(fd_);
+        throw std::runtime_error("mmap failed for " + path);
+    }
+    data_ = static_cast<const char*>(p);
+}
+
+MappedFile::~MappedFile()
+{
+    if (data_)
+        ::munmap(const_cast<char*>(data_), size_);
+    if (fd_ >= 0)
+        ::close(fd_);
+}
+
+void MappedFile::prefetch() const
+{
+    ::madvise(const_cast<char*>(data_), size_, MADV_WILLNEED);
+}
+
+void MappedFile::prefetch(size_t offset, size_t length) const
+{
+    if (offset >= size_)
+        return;
+    // madvise wants a page-aligned start
+    static const size_t pageSize = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    const size_t end = std::min(offset + length, size_);
+    const size_t start = offset / pageSize * pageSize;
+    ::madvise(const_cast<char*>(data_ + start), end - start, MADV_WILLNEED);
+}
+
+void MappedFile::adviseRandom() const
+{
+    ::madvise(const_cast<char*>(data_), size_, MADV_RANDOM);
+}
+
+#endif
@@ -0,0 +1,132 @@
+// MappedHierarchicalNSW.cpp
+
+#include "MappedHierarchicalNSW.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+// Sequential reader over the mapped saveIndex() image, mirroring loadIndex()
+class ImageReader {
+public:
+    ImageReader(const char* data, size_t size) : data(data), size(size) {}
+
+    template <typename T>
+    void pod(T& value) {
+        need(sizeof(T));
+        std::memcpy(&value, data + pos, sizeof(T));
+        pos += sizeof(T);
+    }
+
+    const char* take(size_t bytes) {
+        need(bytes);
+        const char* p = data + pos;
+        pos += bytes;
+        return p;
+    }
+
+    bool atEnd() const { return pos == size; }
+
+private:
+    void need(size_t bytes) const {
+        if (size - pos < bytes)
+            throw std::runtime_error("Graph file seems to be corrupted or unsupported");
+    }
+
+    const char* data;
+    size_t size;
+    size_t pos = 0;
+};
+
+} // namespace
+
+MappedHierarchicalNSW::MappedHierarchicalNSW(hnswlib::SpaceInterface<float>* space, const std::string& path)
+    : hnswlib::HierarchicalNSW<float>(space),
+      file(std::make_unique<MappedFile>(path))
+{
+    try {
+        mapImage(space, path);
+    } catch (...) {
+        detach(); // only the base destructor runs after a throwing constructor
+        throw;
+    }
+    file->prefetch();
+}
+
+void MappedHierarchicalNSW::mapImage(hnswlib::SpaceInterface<float>* space, const std::string& path)
+{
+    ImageReader in(file->data(), file->size());
+
+    // Header, in saveIndex() order
+    size_t elementCount = 0;
+    in.pod(offsetLevel0_);
+    in.pod(max_elements_);
+    in.pod(elementCount);
+    in.pod(size_data_per_element_);
+    in.pod(label_offset_);
+    in.pod(offsetData_);
+    in.pod(maxlevel_);
+    in.pod(enterpoint_node_);
+    in.pod(maxM_);
+    in.pod(maxM0_);
+    in.pod(M_);
+    in.pod(mult_);
+    in.pod(ef_construction_);
+
+    data_size_ = space->get_data_size();
+    fstdistfunc_ = space->get_dist_func();
+    dist_func_param_ = space->get_dist_func_param();
+    if (size_data_per_element_ != maxM0_ * sizeof(hnswlib::tableint) + sizeof(hnswlib::linklistsizeint) + data_size_ + sizeof(hnswlib::labeltype))
+        throw std::runtime_error("Graph file " + path + " does not match the index dimension");
+
+    // Level 0 is used in place; the capacity is exactly what the file holds
+    max_elements_ = elementCount;
+    data_level0_memory_ = const_cast<char*>(in.take(elementCount * size_data_per_element_));
+
+    size_links_per_element_ = maxM_ * sizeof(hnswlib::tableint) + sizeof(hnswlib::linklistsizeint);
+    size_links_level0_ = maxM0_ * sizeof(hnswlib::tableint) + sizeof(hnswlib::linklistsizeint);
+    revSize_ = 1.0 / mult_;
+    ef_ = 10;
+
+    // Upper-level link lists also point into the mapping. linkLists_ itself is a small
+    // malloc'd pointer table, which the base class frees as usual.
+    linkLists_ = static_cast<char**>(std::malloc(sizeof(void*) * std::max<size_t>(elementCount, 1)));
+    if (linkLists_ == nullptr)
+        throw std::runtime_error("Not enough memory: failed to allocate link list table");
+    element_levels_.assign(elementCount, 0);
+    for (size_t i = 0; i < elementCount; ++i) {
+        unsigned int linkListSize = 0;
+        in.pod(linkListSize);
+        linkLists_[i] = linkListSize ? const_cast<char*>(in.take(linkListSize)) : nullptr;
+        element_levels_[i] = static_cast<int>(linkListSize / size_links_per_element_);
+    }
+    if (!in.atEnd())
+        throw std::runtime_error("Graph file seems to be corrupted or unsupported");
+    cur_element_count = elementCount;
+
+    // Searches need the visited-list pool; label locks keep getDataByLabel() usable
+    visited_list_pool_.reset(new hnswlib::VisitedListPool(1, std::max<size_t>(elementCount, 1)));
+    std::vector<std::mutex>(MAX_LABEL_OPERATION_LOCKS).swap(label_op_locks_);
+
+    label_lookup_.reserve(elementCount);
+    for (size_t i = 0; i < elementCount; ++i) {
+        label_lookup_[getExternalLabel(static_cast<hnswlib::tableint>(i))] = static_cast<hnswlib::tableint>(i);
+        if (isMarkedDeleted(static_cast<hnswlib::tableint>(i)))
+            num_deleted_ += 1;
+    }
+}
+
+MappedHierarchicalNSW::~MappedHierarchicalNSW()
+{
+    detach();
+}
+
+void MappedHierarchicalNSW::detach()
+{
+    // The base destructor frees data_level0_memory_ and every upper link list of an
+    // element with level > 0; those live in the mapping, so hide them from it.
+    data_level0_memory_ = nullptr;
+    std::fill(element_levels_.begin(), element_levels_.end(), 0);
+}
@@ -0,0 +1,362 @@
+// QuantizedSpace.cpp
+
+#include "QuantizedSpace.hpp"
+#include "CpuFeatures.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef FACEPUNCH_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+struct Int8Header {
+    float scale;
+    int32_t sum; // of the codes
+};
+static_assert(sizeof(Int8Header) == 8, "Int8 code layout");
+
+size_t dimOf(const void* param) { return *static_cast<const size_t*>(param); }
+
+Int8Header headerOf(const void* code)
+{
+    Int8Header h;
+    std::memcpy(&h, code, sizeof(h));
+    return h;
+}
+
+const int8_t* codesOf(const void* code)
+{
+    return static_cast<const int8_t*>(code) + sizeof(Int8Header);
+}
+
+// IEEE half <-> float, round to nearest even; only encoding and the scalar kernel use these
+
+float halfToFloat(uint16_t h)
+{
+    const uint32_t sign = uint32_t(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+    uint32_t bits;
+    if (exponent == 0) {
+        if (mantissa == 0) {
+            bits = sign;
+        } else {
+            // Subnormal half: normalize into a float
+            exponent = 127 - 15 + 1;
+            while (!(mantissa & 0x400)) {
+                mantissa <<= 1;
+                --exponent;
+            }
+            bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+        }
+    } else if (exponent == 31) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    } else {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+uint16_t floatToHalf(float f)
+{
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    const uint16_t sign = static_cast<uint16_t>((x >> 16) & 0x8000);
+    x &= 0x7fffffff;
+    if (x >= 0x7f800000) // inf, nan
+        return sign | 0x7c00 | (x > 0x7f800000 ? 0x200 : 0);
+    if (x >= 0x477ff000) // rounds past 65504
+        return sign | 0x7c00;
+    if (x < 0x38800000) { // below the smallest normal half
+        if (x < 0x33000000)
+            return sign;
+        const uint32_t shift = 126 - (x >> 23);
+        const uint32_t mantissa = (x & 0x7fffff) | 0x800000;
+        uint32_t h = mantissa >> shift;
+        const uint32_t rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (h & 1)))
+            ++h;
+        return static_cast<uint16_t>(sign | h);
+    }
+    uint32_t h = (x >> 13) - ((127 - 15) << 10);
+    const uint32_t rest = x & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+        ++h; // a carry into the exponent is still the right encoding
+    return static_cast<uint16_t>(sign | h);
+}
+
+// Scalar kernels
+
+float int8DistanceScalar(const void* a, const void* b, const void* param)
+{
+    const size_t dim = dimOf(param);
+    const int8_t* qa = codesOf(a);
+    const int8_t* qb = codesOf(b);
+    int32_t dot = 0;
+    for (size_t i = 0; i < dim; ++i)
+        dot += int32_t(qa[i]) * qb[i];
+    return 1.0f - headerOf(a).scale * headerOf(b).scale * float(dot);
+}
+
+float halfDistanceScalar(const void* a, const void* b, const void* param)
+{
+    const size_t dim = dimOf(param);
+    const uint16_t* ha = static_cast<const uint16_t*>(a);
+    const uint16_t* hb = static_cast<const uint16_t*>(b);
+    float dot = 0.0f;
+    for (size_t i = 0; i < dim; ++i)
+        dot += halfToFloat(ha[i]) * halfToFloat(hb[i]);
+    return 1.0f - dot;
+}
+
+#ifdef FACEPUNCH_X86
+
+FACEPUNCH_TARGET("avx2")
+int32_t horizontalSum(__m256i v)
+{
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(s);
+}
+
+FACEPUNCH_TARGET("avx2")
+float horizontalSum(__m256 v)
+{
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+
+// Widens 16 codes at a time to 16 bits and multiply-adds pairs into 32-bit lanes
+FACEPUNCH_TARGET("avx2")
+float int8DistanceAvx2(const void* a, const void* b, const void* param)
+{
+    const size_t dim = dimOf(param);
+    const int8_t* qa = codesOf(a);
+    const int8_t* qb = codesOf(b);
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        const __m256i a0 = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(qa + i)));
+        const __m256i b0 = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(qb + i)));
+        const __m256i a1 = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(qa + i + 16)));
+        const __m256i b1 = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(qb + i + 16)));
+        acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(a0, b0));
+        acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(a1, b1));
+    }
+    int32_t dot = horizontalSum(_mm256_add_epi32(acc0, acc1));
+    for (; i < dim; ++i)
+        dot += int32_t(qa[i]) * qb[i];
+    return 1.0f - headerOf(a).scale * headerOf(b).scale * float(dot);
+}
+
+// VNNI multiplies unsigned by signed bytes. Flipping a's sign bit gives a + 128 as
+// unsigned, so the sum is dot(a, b) + 128 * sum(b), and b's stored sum removes the bias.
+FACEPUNCH_TARGET("avx2,avxvnni")
+float int8DistanceAvxVnni(const void* a, const void* b, const void* param)
+{
+    const size_t dim = dimOf(param);
+    const int8_t* qa = codesOf(a);
+    const int8_t* qb = codesOf(b);
+    const __m256i flip = _mm256_set1_epi8(char(0x80));
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 64 <= dim; i += 64) {
+        const __m256i a0 = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(qa + i)), flip);
+        const __m256i a1 = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(qa + i + 32)), flip);
+        acc0 = _mm256_dpbusd_avx_epi32(acc0, a0, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(qb + i)));
+        acc1 = _mm256_dpbusd_avx_epi32(acc1, a1, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(qb + i + 32)));
+    }
+    for (; i < dim; i += 32) {
+        // Zero padding adds (0 + 128) * 0
+        alignas(32) int8_t ta[32] = {}, tb[32] = {};
+        std::memcpy(ta, qa + i, std::min<size_t>(32, dim - i));
+        std::memcpy(tb, qb + i, std::min<size_t>(32, dim - i));
+        acc0 = _mm256_dpbusd_avx_epi32(acc0, _mm256_xor_si256(_mm256_load_si256(reinterpret_cast<const __m256i*>(ta)), flip),
+                                       _mm256_load_si256(reinterpret_cast<const __m256i*>(tb)));
+    }
+    const int32_t biased = horizontalSum(_mm256_add_epi32(acc0, acc1));
+    const Int8Header hb = headerOf(b);
+    return 1.0f - headerOf(a).scale * hb.scale * float(biased - 128 * hb.sum);
+}
+
+FACEPUNCH_TARGET("avx512f,avx512bw,avx512vnni")
+float int8DistanceAvx512Vnni(const void* a, const void* b, const void* param)
+{
+    const size_t dim = dimOf(param);
+    const int8_t* qa = codesOf(a);
+    const int8_t* qb = codesOf(b);
+    const __m512i flip = _mm512_set1_epi8(char(0x80));
+    __m512i acc = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 64 <= dim; i += 64) {
+        const __m512i ua = _mm512_xor_si512(_mm512_loadu_si512(qa + i), flip);
+        acc = _mm512_dpbusd_epi32(acc, ua, _mm512_loadu_si512(qb + i));
+    }
+    if (i < dim) {
+        const __mmask64 tail = ~0ULL >> (64 - (dim - i));
+        const __m512i ua = _mm512_xor_si512(_mm512_maskz_loadu_epi8(tail, qa + i), flip);
+        acc = _mm512_dpbusd_epi32(acc, ua, _mm512_maskz_loadu_epi8(tail, qb + i)); // (0 + 128) * 0 past the end
+    }
+    const int32_t biased = _mm512_reduce_add_epi32(acc);
+    const Int8Header hb = headerOf(b);
+    return 1.0f - headerOf(a).scale * hb.scale * float(biased - 128 * hb.sum);
+}
+
+FACEPUNCH_TARGET("avx2,fma,f16c")
+float halfDistanceF16c(const void* a, const void* b, const void* param)
+{
+    const size_t dim = dimOf(param);
+    const uint16_t* ha = static_cast<const uint16_t*>(a);
+    const uint16_t* hb = static_cast<const uint16_t*>(b);
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ha + i))),
+                               _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(hb + i))), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ha + i + 8))),
+                               _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(hb + i + 8))), acc1);
+    }
+    for (; i < dim; i += 8) {
+        // Zero-padded last step; a scalar loop here would mix in non-VEX code
+        alignas(16) uint16_t ta[8] = {}, tb[8] = {};
+        std::memcpy(ta, ha + i, std::min<size_t>(8, dim - i) * sizeof(uint16_t));
+        std::memcpy(tb, hb + i, std::min<size_t>(8, dim - i) * sizeof(uint16_t));
+        acc0 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_load_si128(reinterpret_cast<const __m128i*>(ta))),
+                               _mm256_cvtph_ps(_mm_load_si128(reinterpret_cast<const __m128i*>(tb))), acc0);
+    }
+    return 1.0f - horizontalSum(_mm256_add_ps(acc0, acc1));
+}
+
+FACEPUNCH_TARGET("avx512f")
+float halfDistanceAvx512(const void* a, const void* b, const void* param)
+{
+    const size_t dim = dimOf(param);
+    const uint16_t* ha = static_cast<const uint16_t*>(a);
+    const uint16_t* hb = static_cast<const uint16_t*>(b);
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ha + i))),
+                               _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(hb + i))), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ha + i + 16))),
+                               _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(hb + i + 16))), acc1);
+    }
+    for (; i < dim; i += 16) {
+        alignas(32) uint16_t ta[16] = {}, tb[16] = {};
+        std::memcpy(ta, ha + i, std::min<size_t>(16, dim - i) * sizeof(uint16_t));
+        std::memcpy(tb, hb + i, std::min<size_t>(16, dim - i) * sizeof(uint16_t));
+        acc0 = _mm512_fmadd_ps(_mm512_cvtph_ps(_mm256_load_si256(reinterpret_cast<const __m256i*>(ta))),
+                               _mm512_cvtph_ps(_mm256_load_si256(reinterpret_cast<const __m256i*>(tb))), acc0);
+    }
+    return 1.0f - _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+#endif // FACEPUNCH_X86
+
+} // namespace
+
+VectorStorage vectorStorageFromString(const std::string& name, VectorStorage fallback)
+{
+    if (name == "fp32" || name == "float32") return VectorStorage::Float32;
+    if (name == "fp16" || name == "float16") return VectorStorage::Float16;
+    if (name == "int8") return VectorStorage::Int8;
+    return fallback;
+}
+
+const char* vectorStorageName(VectorStorage storage)
+{
+    switch (storage) {
+    case VectorStorage::Float32: return "fp32";
+    case VectorStorage::Float16: return "fp16";
+    case VectorStorage::Int8: return "int8";
+    }
+    return "unknown";
+}
+
+QuantizedSpace::QuantizedSpace(size_t dim_, VectorStorage storage)
+    : dim(dim_), mode(storage), codeSize(0), distance(nullptr), kernel("scalar")
+{
+#ifdef FACEPUNCH_X86
+    const CpuFeatures& cpu = cpuFeatures();
+#endif
+    switch (mode) {
+    case VectorStorage::Int8:
+        codeSize = sizeof(Int8Header) + dim;
+        distance = int8DistanceScalar;
+#ifdef FACEPUNCH_X86
+        if (cpu.avx512f && cpu.avx512bw && cpu.avx512vnni) {
+            distance = int8DistanceAvx512Vnni;
+            kernel = "avx512-vnni";
+        } else if (cpu.avx2 && cpu.avxvnni) {
+            distance = int8DistanceAvxVnni;
+            kernel = "avx-vnni";
+        } else if (cpu.avx2) {
+            distance = int8DistanceAvx2;
+            kernel = "avx2";
+        }
+#endif
+        break;
+    case VectorStorage::Float16:
+        codeSize = dim * sizeof(uint16_t);
+        distance = halfDistanceScalar;
+#ifdef FACEPUNCH_X86
+        if (cpu.avx512f) {
+            distance = halfDistanceAvx512;
+            kernel = "avx512";
+        } else if (cpu.avx2 && cpu.fma && cpu.f16c) {
+            distance = halfDistanceF16c;
+            kernel = "f16c";
+        }
+#endif
+        break;
+    default:
+        throw std::runtime_error(std::string("QuantizedSpace cannot store ") + vectorStorageName(mode) + " vectors");
+    }
+}
+
+void QuantizedSpace::encode(const float* v, void* code) const
+{
+    if (mode == VectorStorage::Float16) {
+        uint16_t* h = static_cast<uint16_t*>(code);
+        for (size_t i = 0; i < dim; ++i)
+            h[i] = floatToHalf(v[i]);
+        return;
+    }
+    float maxAbs = 0.0f;
+    for (size_t i = 0; i < dim; ++i)
+        maxAbs = std::max(maxAbs, std::fabs(v[i]));
+    Int8Header header;
+    header.scale = maxAbs / 127.0f;
+    header.sum = 0;
+    const float inverse = maxAbs > 0.0f ? 127.0f / maxAbs : 0.0f;
+    int8_t* q = static_cast<int8_t*>(code) + sizeof(Int8Header);
+    for (size_t i = 0; i < dim; ++i) {
+        const long rounded = std::lrint(v[i] * inverse);
+        q[i] = static_cast<int8_t>(std::clamp(rounded, -127L, 127L));
+        header.sum += q[i];
+    }
+    std::memcpy(code, &header, sizeof(header));
+}
+
+void QuantizedSpace::decode(const void* code, float* v) const
+{
+    if (mode == VectorStorage::Float16) {
+        const uint16_t* h = static_cast<const uint16_t*>(code);
+        for (size_t i = 0; i < dim; ++i)
+            v[i] = halfToFloat(h[i]);
+        return;
+    }
+    const float scale = headerOf(code).scale;
+    const int8_t* q = codesOf(code);
+    for (size_t i = 0; i < dim; ++i)
+        v[i] = scale * q[i];
+}
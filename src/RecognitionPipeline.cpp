@@ -0,0 +1,290 @@
+// RecognitionPipeline.cpp
+
+#include "RecognitionPipeline.hpp"
+#include "FaceEmbedder.hpp"
+#include "ShardedFaceIndex.hpp"
+#include "ImagePreprocess.hpp"
+#include <QFile>
+#include <QTextStream>
+#include <QDebug>
+#include <algorithm>
+#include <chrono>
+
+PipelineOptions PipelineOptions::fromConfig(const AppConfig& config)
+{
+    PipelineOptions options;
+    options.frameQueueDepth = static_cast<size_t>(config.pipelineFrameQueueDepth);
+    options.frameDropPolicy = dropPolicyFromString(config.pipelineFrameDropPolicy, options.frameDropPolicy);
+    options.stageQueueDepth = static_cast<size_t>(config.pipelineStageQueueDepth);
+    options.stageDropPolicy = dropPolicyFromString(config.pipelineStageDropPolicy, options.stageDropPolicy);
+    return options;
+}
+
+RecognitionPipeline::RecognitionPipeline(FaceDetector* detector_, FaceEmbedder* embedder_,
+                                         ShardedFaceIndex* faceIndex_, const AppConfig& config_)
+    : detector(detector_),
+      embedder(embedder_),
+      faceIndex(faceIndex_),
+      config(config_),
+      options(PipelineOptions::fromConfig(config_)),
+      frameQueue(options.frameQueueDepth, options.frameDropPolicy),
+      convertedQueue(options.stageQueueDepth, options.stageDropPolicy),
+      detectedQueue(options.stageQueueDepth, options.stageDropPolicy),
+      embeddedQueue(options.stageQueueDepth, options.stageDropPolicy),
+      hotIdentities(static_cast<size_t>(embedder_->embeddingSize()), static_cast<size_t>(config_.hotIdentityCacheSize)),
+      published(std::make_shared<RecognitionResult>())
+{
+    allowedGroups = FaceIndex::parseGroupList(config.cameraAllowedGroups);
+    threads.emplace_back([this] { runStage(frameQueue, Convert, [this](FrameJob& job) { convert(job); }); });
+    threads.emplace_back([this] { runStage(convertedQueue, Detect, [this](FrameJob& job) { detect(job); }); });
+    threads.emplace_back([this] { runStage(detectedQueue, Embed, [this](DetectedFrame& job) { embed(job); }); });
+    threads.emplace_back([this] { runStage(embeddedQueue, Match, [this](EmbeddedFrame& job) { match(job); }); });
+}
+
+RecognitionPipeline::~RecognitionPipeline()
+{
+    // Closing every queue wakes stages blocked on either side; queued work is abandoned
+    stopping = true;
+    frameQueue.close();
+    convertedQueue.close();
+    detectedQueue.close();
+    embeddedQueue.close();
+    for (std::thread& t : threads) {
+        if (t.joinable())
+            t.join();
+    }
+}
+
+void RecognitionPipeline::submitFrame(const QImage& frame)
+{
+    const double timestamp = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    // Implicitly shared, no pixel copy
+    frameQueue.push(FrameJob{frame, ++submittedFrames, timestamp});
+}
+
+std::shared_ptr<const RecognitionResult> RecognitionPipeline::latestResult() const
+{
+    return std::atomic_load(&published);
+}
+
+std::vector<PipelineStageStats> RecognitionPipeline::stats() const
+{
+    static const char* const names[StageCount] = {"convert", "detect", "embed", "match"};
+    const QueueStats inputs[StageCount] = {
+        frameQueue.stats(), convertedQueue.stats(), detectedQueue.stats(), embeddedQueue.stats()
+    };
+
+    std::vector<PipelineStageStats> result(StageCount);
+    for (int i = 0; i < StageCount; ++i) {
+        result[i].name = names[i];
+        result[i].input = inputs[i];
+        result[i].processed = counters[i].processed.load(std::memory_order_relaxed);
+        const uint64_t busy = counters[i].busyMicros.load(std::memory_order_relaxed);
+        result[i].avgBusyMs = result[i].processed ? busy / 1000.0 / result[i].processed : 0.0;
+    }
+    return result;
+}
+
+HotIdentityStats RecognitionPipeline::hotIdentityStats() const
+{
+    HotIdentityStats result;
+    result.lookups = hotLookups.load(std::memory_order_relaxed);
+    result.hits = hotHits.load(std::memory_order_relaxed);
+    return result;
+}
+
+template <typename In, typename Fn>
+void RecognitionPipeline::runStage(SpscQueue<In>& input, Stage stage, Fn work)
+{
+    In job;
+    while (input.pop(job)) {
+        if (stopping)
+            return;
+        const auto start = std::chrono::steady_clock::now();
+        try {
+            work(job);
+        } catch (const std::exception& e) {
+            // Keep the stage alive; one bad frame should not stop recognition
+            qWarning() << "Recognition failed for frame" << job.frameNumber << ":" << e.what();
+        }
+        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start);
+        counters[stage].processed.fetch_add(1, std::memory_order_relaxed);
+        counters[stage].busyMicros.fetch_add(static_cast<uint64_t>(elapsed.count()), std::memory_order_relaxed);
+        job = In(); // drop references to frame data before waiting for the next item
+    }
+}
+
+void RecognitionPipeline::convert(FrameJob& job)
+{
+    // Camera frames come in whatever format the backend produces (often YUV-derived
+    // ARGB32, sometimes formats the preprocessing kernels cannot read directly).
+    // Normalize them here so the detector never has to convert on its own thread.
+    ImageView view;
+    if (!imageViewFor(job.frame, view))
+        job.frame = job.frame.convertToFormat(QImage::Format_RGBX8888);
+    convertedQueue.push(std::move(job));
+}
+
+void RecognitionPipeline::detect(FrameJob& job)
+{
+    DetectedFrame out;
+    out.faces = detector->detect(job.frame);
+    out.frame = std::move(job.frame);
+    out.frameNumber = job.frameNumber;
+    out.timestamp = job.timestamp;
+    detectedQueue.push(std::move(out));
+}
+
+void RecognitionPipeline::embed(DetectedFrame& job)
+{
+    EmbeddedFrame out;
+    out.frameNumber = job.frameNumber;
+    out.tracks = tracker.update(job.faces, job.timestamp);
+
+    // Embed the faces whose track wants an identity with one batched call; each is
+    // aligned and sampled from the frame straight into the model input
+    std::vector<FaceDetection> faces;
+    for (size_t i = 0; i < out.tracks.size(); ++i) {
+        const TrackedFace &t = out.tracks[i];
+        if (!t.needsIdentity) continue;
+        out.embedded.push_back(i);
+        faces.push_back(t.measured);
+    }
+    try {
+        out.embeddings = embedder->getEmbeddings(job.frame, faces);
+    } catch (...) {
+        cancelIdentities(out);
+        throw;
+    }
+    out.dim = embedder->embeddingSize();
+
+    std::vector<int> requested;
+    for (size_t index : out.embedded)
+        requested.push_back(out.tracks[index].trackId);
+    if (!embeddedQueue.push(std::move(out))) {
+        // Dropped by the stage policy; let those tracks ask again
+        for (int id : requested)
+            tracker.cancelIdentity(id);
+    }
+}
+
+void RecognitionPipeline::match(EmbeddedFrame& job)
+{
+    auto result = std::make_shared<RecognitionResult>();
+    result->frameNumber = job.frameNumber;
+
+    const size_t dim = static_cast<size_t>(job.dim);
+    std::vector<SearchResult> results(job.embedded.size());
+    try {
+        // Templates of the users this camera may recognize, as of now (null = everyone)
+        std::shared_ptr<const LabelSet> allowed;
+        if (!allowedGroups.empty())
+            allowed = faceIndex->groupLabels(allowedGroups);
+
+        // 1. Recently matched identities, scored exactly. A deleted user's entry is
+        // dropped once its name is gone; one taken out of the allowed groups is a miss.
+        std::shared_ptr<const FaceIndex::NameTable> names = faceIndex->getIdToNameMap();
+        std::vector<size_t> missed;
+        for (size_t n = 0; n < results.size(); ++n) {
+            size_t id = 0;
+            float similarity = 0.0f;
+            if (hotIdentities.best(job.embeddings.data() + n * dim, id, similarity)
+                && similarity >= config.similarityThreshold + config.hotIdentityMargin
+                && (!allowed || allowed->contains(id))) {
+                if (const std::string* name = names->find(id)) {
+                    hotIdentities.touch(id);
+                    results[n] = {*name, similarity, id, true};
+                    continue;
+                }
+                hotIdentities.erase(id);
+            }
+            missed.push_back(n);
+        }
+        if (hotIdentities.capacity() > 0) {
+            hotLookups.fetch_add(results.size(), std::memory_order_relaxed);
+            hotHits.fetch_add(results.size() - missed.size(), std::memory_order_relaxed);
+        }
+
+        // 2. One batched graph search for the rest; only the matches get their names copied
+        if (!missed.empty()) {
+            std::vector<float> queries(missed.size() * dim);
+            for (size_t m = 0; m < missed.size(); ++m)
+                std::copy_n(job.embeddings.data() + missed[m] * dim, dim, queries.data() + m * dim);
+            std::vector<SearchMatch> matches(missed.size());
+            faceIndex->searchBatch(queries.data(), missed.size(), 1, matches.data(), allowed.get());
+            names = faceIndex->getIdToNameMap();
+            std::vector<float> enrolled;
+            for (size_t m = 0; m < missed.size(); ++m) {
+                SearchResult& result = results[missed[m]];
+                result = FaceIndex::resolve(matches[m], *names, config.similarityThreshold);
+                // Cache the enrolled template that matched, not this query, so cached scores match the index
+                if (result.found && faceIndex->getEmbedding(matches[m].templateId, enrolled))
+                    hotIdentities.insert(result.id, enrolled.data());
+            }
+        }
+    } catch (...) {
+        cancelIdentities(job);
+        throw;
+    }
+
+    for (size_t n = 0; n < job.embedded.size(); ++n) {
+        TrackedFace &t = job.tracks[job.embedded[n]];
+        const SearchResult& search_result = results[n];
+        tracker.setIdentity(t.trackId, search_result.id, search_result.name, search_result.similarity, search_result.found);
+        t.hasIdentity = true;
+        t.known = search_result.found;
+        t.userId = search_result.found ? search_result.id : 0;
+        t.name = search_result.found ? search_result.name : "Unknown";
+        t.similarity = search_result.similarity;
+
+        // Log attendance if a known user is found
+        if (search_result.found)
+            logAttendance(search_result);
+    }
+
+    for (const TrackedFace &t : job.tracks) {
+        const FaceDetection &f = t.detection;
+        OverlayFace of;
+        of.trackId = t.trackId;
+        of.box = QRect(QPoint(int(f.x1), int(f.y1)), QPoint(int(f.x2), int(f.y2)));
+        of.name = t.name;
+        of.conf = f.confidence; // Confidence of the last associated detection
+        of.similarity = t.similarity;
+        of.userId = t.userId;
+        of.detection = f;
+        result->faces.push_back(of);
+    }
+    std::atomic_store(&published, std::shared_ptr<const RecognitionResult>(std::move(result)));
+}
+
+void RecognitionPipeline::cancelIdentities(const EmbeddedFrame& job)
+{
+    for (size_t index : job.embedded)
+        tracker.cancelIdentity(job.tracks[index].trackId);
+}
+
+void RecognitionPipeline::logAttendance(const SearchResult& match)
+{
+    QDateTime current_time = QDateTime::currentDateTime();
+    auto last = lastLogTimestamps.find(match.id);
+    if (last != lastLogTimestamps.end() && last->second.secsTo(current_time) < attendanceLogDebounceSecs)
+        return;
+
+    lastLogTimestamps[match.id] = current_time; // Update last log time
+
+    QFile logFile(QString::fromStdString(config.attendanceLogPath));
+    if (logFile.open(QIODevice::Append | QIODevice::Text)) {
+        QTextStream stream(&logFile);
+        // Check if file is new/empty to write headers
+        if (logFile.pos() == 0) {
+            stream << "Timestamp,UserID,UserName\n";
+        }
+        stream << current_time.toString(Qt::ISODate) << ","
+               << match.id << ","
+               << QString::fromStdString(match.name) << "\n";
+        logFile.close();
+    } else {
+        qWarning() << "Could not open attendance log file for writing:" << QString::fromStdString(config.attendanceLogPath);
+    }
+}
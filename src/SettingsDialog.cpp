@@ -31,12 +31,33 @@ SettingsDialog::SettingsDialog(AppConfig& config, QWidget *parent)
     similarityThresholdDoubleSpinBox->setRange(0.0, 1.0);
     similarityThresholdDoubleSpinBox->setSingleStep(0.01);
     similarityThresholdDoubleSpinBox->setDecimals(2);
-    formLayout->addRow(tr("Similarity Threshold:"), similarityThresholdDoubleSpinBox);
+    formLayout->addRow(tr("Similarity Threshold (cosine):"), similarityThresholdDoubleSpinBox);
 
     maxFaceIndexSizeSpinBox = new QSpinBox(this);
     maxFaceIndexSizeSpinBox->setRange(100, 1000000); // Consistent with config.cpp validation
     maxFaceIndexSizeSpinBox->setSingleStep(100);
-    formLayout->addRow(tr("Max Face Index Size:"), maxFaceIndexSizeSpinBox);
+    formLayout->addRow(tr("Initial Face Index Capacity:"), maxFaceIndexSizeSpinBox);
+
+    // Early search stops trade a little recall for tail latency; all off by default
+    searchConfidenceMarginDoubleSpinBox = new QDoubleSpinBox(this);
+    searchConfidenceMarginDoubleSpinBox->setRange(0.0, 1.0); // Consistent with config.cpp validation
+    searchConfidenceMarginDoubleSpinBox->setSingleStep(0.01);
+    searchConfidenceMarginDoubleSpinBox->setDecimals(2);
+    searchConfidenceMarginDoubleSpinBox->setSpecialValueText(tr("Off"));
+    formLayout->addRow(tr("Stop Search Above Threshold By:"), searchConfidenceMarginDoubleSpinBox);
+
+    searchTimeBudgetSpinBox = new QSpinBox(this);
+    searchTimeBudgetSpinBox->setRange(0, 1000000);
+    searchTimeBudgetSpinBox->setSingleStep(100);
+    searchTimeBudgetSpinBox->setSuffix(tr(" us"));
+    searchTimeBudgetSpinBox->setSpecialValueText(tr("Unlimited"));
+    formLayout->addRow(tr("Search Time Budget:"), searchTimeBudgetSpinBox);
+
+    searchHopBudgetSpinBox = new QSpinBox(this);
+    searchHopBudgetSpinBox->setRange(0, 1000000);
+    searchHopBudgetSpinBox->setSingleStep(100);
+    searchHopBudgetSpinBox->setSpecialValueText(tr("Unlimited"));
+    formLayout->addRow(tr("Search Hop Budget:"), searchHopBudgetSpinBox);
 
     mainLayout->addLayout(formLayout);
 
@@ -58,6 +79,9 @@ void SettingsDialog::loadSettings() {
     iouThreshDoubleSpinBox->setValue(currentConfig.iouThresh);
     similarityThresholdDoubleSpinBox->setValue(currentConfig.similarityThreshold);
     maxFaceIndexSizeSpinBox->setValue(currentConfig.maxFaceIndexSize);
+    searchConfidenceMarginDoubleSpinBox->setValue(currentConfig.searchConfidenceMargin);
+    searchTimeBudgetSpinBox->setValue(currentConfig.searchTimeBudgetUs);
+    searchHopBudgetSpinBox->setValue(currentConfig.searchHopBudget);
     // Model paths are not typically edited in such a dialog, so they are skipped here.
 }
 
@@ -68,6 +92,9 @@ void SettingsDialog::saveSettings() {
     currentConfig.iouThresh = static_cast<float>(iouThreshDoubleSpinBox->value());
     currentConfig.similarityThreshold = static_cast<float>(similarityThresholdDoubleSpinBox->value());
     currentConfig.maxFaceIndexSize = maxFaceIndexSizeSpinBox->value();
+    currentConfig.searchConfidenceMargin = static_cast<float>(searchConfidenceMarginDoubleSpinBox->value());
+    currentConfig.searchTimeBudgetUs = searchTimeBudgetSpinBox->value();
+    currentConfig.searchHopBudget = searchHopBudgetSpinBox->value();
 
     // Save to QSettings
     QSettings settings("MyCompany", "FacePunchApp"); // Company and App name
@@ -77,9 +104,28 @@ void SettingsDialog::saveSettings() {
     settings.setValue("modelPath", QString::fromStdString(currentConfig.modelPath));
     settings.setValue("arcfaceModelPath", QString::fromStdString(currentConfig.arcfaceModelPath));
     settings.setValue("faceDatabasePath", QString::fromStdString(currentConfig.faceDatabasePath));
-    settings.setValue("similarityThreshold", currentConfig.similarityThreshold);
+    settings.setValue("cosineSimilarityThreshold", currentConfig.similarityThreshold);
     settings.setValue("maxFaceIndexSize", currentConfig.maxFaceIndexSize);
+    settings.setValue("faceIndexShards", currentConfig.faceIndexShards);
+    settings.setValue("faceIndexReadOnly", currentConfig.faceIndexReadOnly);
+    settings.setValue("faceIndexCompactionMB", currentConfig.faceIndexCompactionMB);
+    settings.setValue("faceIndexRebuildDeletedPercent", currentConfig.faceIndexRebuildDeletedPercent);
+    settings.setValue("faceIndexVectorStorage", QString::fromStdString(currentConfig.faceIndexVectorStorage));
+    settings.setValue("faceIndexRerankCandidates", currentConfig.faceIndexRerankCandidates);
+    settings.setValue("faceIndexDiskVectors", currentConfig.faceIndexDiskVectors);
+    settings.setValue("searchConfidenceMargin", currentConfig.searchConfidenceMargin);
+    settings.setValue("searchTimeBudgetUs", currentConfig.searchTimeBudgetUs);
+    settings.setValue("searchHopBudget", currentConfig.searchHopBudget);
+    settings.setValue("exactSearchMaxFaces", currentConfig.exactSearchMaxFaces);
+    settings.setValue("searchTargetRecall", currentConfig.searchTargetRecall);
+    settings.setValue("cameraAllowedGroups", QString::fromStdString(currentConfig.cameraAllowedGroups));
     settings.setValue("attendanceLogPath", QString::fromStdString(currentConfig.attendanceLogPath));
+    settings.setValue("hotIdentityCacheSize", currentConfig.hotIdentityCacheSize);
+    settings.setValue("hotIdentityMargin", currentConfig.hotIdentityMargin);
+    settings.setValue("pipelineFrameQueueDepth", currentConfig.pipelineFrameQueueDepth);
+    settings.setValue("pipelineFrameDropPolicy", QString::fromStdString(currentConfig.pipelineFrameDropPolicy));
+    settings.setValue("pipelineStageQueueDepth", currentConfig.pipelineStageQueueDepth);
+    settings.setValue("pipelineStageDropPolicy", QString::fromStdString(currentConfig.pipelineStageDropPolicy));
 }
 
 void SettingsDialog::accept() {
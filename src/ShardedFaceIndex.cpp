@@ -0,0 +1,405 @@
+// ShardedFaceIndex.cpp
+
+#include "ShardedFaceIndex.hpp"
+#include "FaceIndexStorage.hpp"
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <future>
+#include <stdexcept>
+#include <unordered_set>
+#include <QDebug>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+bool endsWith(const std::string& s, const std::string& suffix)
+{
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Directory (with trailing separator, or empty) and file name without .csv, as FaceIndexStorage splits them
+void splitDatabasePath(const std::string& path, std::string& directory, std::string& baseName)
+{
+    const fs::path p(path);
+    directory = p.has_parent_path() ? p.parent_path().string() + "/" : std::string();
+    baseName = p.filename().string();
+    if (endsWith(baseName, ".csv"))
+        baseName.resize(baseName.size() - 4);
+}
+
+// A sidecar (or legacy CSV) of the database at path saved with another shard count, or empty
+std::string otherLayout(const std::string& path, size_t shardCount)
+{
+    if (shardCount > 1) {
+        const FaceIndexStorage whole(path);
+        if (whole.hasMeta())
+            return whole.metaPath();
+        if (whole.hasLegacyCsv())
+            return whole.legacyCsvPath();
+    }
+    std::string directory, baseName;
+    splitDatabasePath(path, directory, baseName);
+    const std::string prefix = baseName + "-shard";
+    const std::string own = "of" + std::to_string(shardCount) + ".meta";
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(directory.empty() ? fs::path(".") : fs::path(directory), ec)) {
+        const std::string name = entry.path().filename().string();
+        if (name.compare(0, prefix.size(), prefix) == 0 && endsWith(name, ".meta")
+            && (shardCount == 1 || !endsWith(name, own)))
+            return directory + name;
+    }
+    return std::string();
+}
+
+} // namespace
+
+ShardedFaceIndex::ShardedFaceIndex(int dim, int initialCapacity, size_t shardCount, bool readOnly, VectorStorage storage)
+    : dim(static_cast<size_t>(dim))
+{
+    shardCount = std::max<size_t>(shardCount, 1);
+    const int perShard = static_cast<int>((static_cast<size_t>(std::max(initialCapacity, 1)) + shardCount - 1) / shardCount);
+    for (size_t s = 0; s < shardCount; ++s) {
+        shards.push_back(std::make_unique<FaceIndex>(dim, perShard, readOnly, storage));
+        if (shardCount > 1)
+            shards.back()->setShard(s, shardCount);
+    }
+    if (shardCount > 1)
+        pool = std::make_unique<ThreadPool>(shardCount - 1);
+}
+
+ShardedFaceIndex::~ShardedFaceIndex() = default;
+
+std::string ShardedFaceIndex::shardPath(const std::string& path, size_t shard, size_t shardCount)
+{
+    if (shardCount <= 1)
+        return path;
+    std::string directory, baseName;
+    splitDatabasePath(path, directory, baseName);
+    return directory + baseName + "-shard" + std::to_string(shard) + "of" + std::to_string(shardCount);
+}
+
+void ShardedFaceIndex::forEachShard(const std::function<void(size_t shard)>& work)
+{
+    std::vector<std::future<void>> tasks;
+    for (size_t s = 1; s < shards.size(); ++s)
+        tasks.push_back(pool->submit([&work, s] { work(s); }));
+    std::exception_ptr failure;
+    try {
+        work(0);
+    } catch (...) {
+        failure = std::current_exception();
+    }
+    for (std::future<void>& task : tasks) { // all of them, even after a failure: they use the caller's data
+        try {
+            task.get();
+        } catch (...) {
+            if (!failure)
+                failure = std::current_exception();
+        }
+    }
+    if (failure)
+        std::rethrow_exception(failure);
+}
+
+void ShardedFaceIndex::add(const std::string& name, const std::vector<float>& embedding)
+{
+    size_t target = 0, fewest = SIZE_MAX;
+    for (size_t s = 0; s < shards.size(); ++s) {
+        const size_t users = shards[s]->getIdToNameMap()->size();
+        if (users < fewest) {
+            fewest = users;
+            target = s;
+        }
+    }
+    shards[target]->add(name, embedding);
+}
+
+void ShardedFaceIndex::addBatch(const std::vector<std::string>& names, const float* embeddings)
+{
+    if (names.empty())
+        return;
+    const size_t n = shards.size();
+    forEachShard([&](size_t s) {
+        std::vector<float> embedding(dim);
+        for (size_t i = s; i < names.size(); i += n) {
+            std::copy_n(embeddings + i * dim, dim, embedding.begin());
+            shards[s]->add(names[i], embedding);
+        }
+    });
+}
+
+bool ShardedFaceIndex::addTemplate(size_t userId, const std::vector<float>& embedding)
+{
+    return shards[shardOf(userId)]->addTemplate(userId, embedding);
+}
+
+size_t ShardedFaceIndex::templateCount(size_t userId)
+{
+    return shards[shardOf(userId)]->templateCount(userId);
+}
+
+SearchResult ShardedFaceIndex::search(const std::vector<float>& embedding, float threshold, const LabelSet* allowed)
+{
+    SearchMatch match;
+    searchBatch(embedding.data(), 1, 1, &match, allowed);
+    // Only the matched user's shard needs its names looked at
+    return FaceIndex::resolve(match, *shards[shardOf(match.id)]->getIdToNameMap(), threshold);
+}
+
+void ShardedFaceIndex::searchBatch(const float* queries, size_t count, size_t k, SearchMatch* out,
+                                   const LabelSet* allowed)
+{
+    if (shards.size() == 1) {
+        shards.front()->searchBatch(queries, count, k, out, allowed);
+        return;
+    }
+    if (count == 0 || k == 0)
+        return;
+    std::vector<std::vector<SearchMatch>> perShard(shards.size(), std::vector<SearchMatch>(count * k));
+    forEachShard([&](size_t s) { shards[s]->searchBatch(queries, count, k, perShard[s].data(), allowed); });
+
+    // Per query: the best k of the shards' lists. Each list is sorted, so this is a
+    // k-way merge; found matches come before padding.
+    std::vector<size_t> next(shards.size());
+    for (size_t q = 0; q < count; ++q) {
+        bool exhaustive = true;
+        for (size_t s = 0; s < shards.size(); ++s) {
+            exhaustive = exhaustive && perShard[s][q * k].exhaustive;
+            next[s] = 0;
+        }
+        SearchMatch* row = out + q * k;
+        for (size_t n = 0; n < k; ++n) {
+            const SearchMatch* best = nullptr;
+            size_t bestShard = 0;
+            for (size_t s = 0; s < shards.size(); ++s) {
+                if (next[s] == k)
+                    continue;
+                const SearchMatch& candidate = perShard[s][q * k + next[s]];
+                if (candidate.found && (!best || candidate.similarity > best->similarity)) {
+                    best = &candidate;
+                    bestShard = s;
+                }
+            }
+            row[n] = best ? *best : SearchMatch();
+            row[n].exhaustive = exhaustive;
+            if (best)
+                ++next[bestShard];
+        }
+    }
+}
+
+bool ShardedFaceIndex::getEmbedding(size_t label, std::vector<float>& out)
+{
+    return shards[shardOf(label)]->getEmbedding(label, out);
+}
+
+bool ShardedFaceIndex::saveToDisk(const std::string& path)
+{
+    std::vector<char> saved(shards.size(), 0);
+    forEachShard([&](size_t s) { saved[s] = shards[s]->saveToDisk(shardPath(path, s, shards.size())); });
+    return std::all_of(saved.begin(), saved.end(), [](char ok) { return ok != 0; });
+}
+
+bool ShardedFaceIndex::loadFromDisk(const std::string& path, const FaceIndex::LoadProgress& progress)
+{
+    const std::string other = otherLayout(path, shards.size());
+    if (!other.empty()) {
+        // Loading would start an empty gallery beside the saved one
+        qWarning() << "Face database" << QString::fromStdString(other) << "was saved with another shard count than"
+                   << shards.size() << "; set it back to open the database";
+        return false;
+    }
+    if (shards.size() == 1)
+        return shards.front()->loadFromDisk(path, progress);
+    std::vector<char> loaded(shards.size(), 0);
+    forEachShard([&](size_t s) { loaded[s] = shards[s]->loadFromDisk(shardPath(path, s, shards.size())); });
+    return std::all_of(loaded.begin(), loaded.end(), [](char ok) { return ok != 0; });
+}
+
+bool ShardedFaceIndex::refreshSnapshot(const std::string& path)
+{
+    bool changed = false;
+    for (size_t s = 0; s < shards.size(); ++s)
+        changed = shards[s]->refreshSnapshot(shardPath(path, s, shards.size())) || changed;
+    return changed;
+}
+
+void ShardedFaceIndex::setCompactionThreshold(uint64_t bytes)
+{
+    for (auto& shard : shards)
+        shard->setCompactionThreshold(bytes);
+}
+
+void ShardedFaceIndex::setRebuildThreshold(double deletedFraction)
+{
+    for (auto& shard : shards)
+        shard->setRebuildThreshold(deletedFraction);
+}
+
+void ShardedFaceIndex::setRerankCandidates(size_t count)
+{
+    for (auto& shard : shards)
+        shard->setRerankCandidates(count);
+}
+
+void ShardedFaceIndex::setDiskResidentVectors(bool enabled)
+{
+    for (auto& shard : shards)
+        shard->setDiskResidentVectors(enabled);
+}
+
+void ShardedFaceIndex::setSearchBudget(const SearchBudget& budget)
+{
+    for (auto& shard : shards)
+        shard->setSearchBudget(budget);
+}
+
+void ShardedFaceIndex::setExactSearchLimit(size_t templates)
+{
+    for (auto& shard : shards)
+        shard->setExactSearchLimit(templates);
+}
+
+SearchStopStats ShardedFaceIndex::searchStopStats() const
+{
+    SearchStopStats total;
+    for (const auto& shard : shards) {
+        const SearchStopStats stats = shard->searchStopStats();
+        total.queries += stats.queries;
+        total.confident += stats.confident;
+        total.budget += stats.budget;
+    }
+    // Every query reaches every shard; the stops are averaged over them
+    total.queries /= shards.size();
+    total.confident /= shards.size();
+    total.budget /= shards.size();
+    return total;
+}
+
+SearchTuning ShardedFaceIndex::tuneSearch(double targetRecall, size_t samples, const FaceIndex::TuneProgress& progress)
+{
+    SearchTuning worst;
+    for (size_t s = 0; s < shards.size(); ++s) {
+        FaceIndex::TuneProgress shardProgress;
+        if (progress) {
+            shardProgress = [&progress, s, n = shards.size()](size_t done, size_t total) {
+                progress(s * total + done, n * total);
+            };
+        }
+        SearchTuning tuning = shards[s]->tuneSearch(targetRecall, samples, shardProgress);
+        if (tuning.samples > 0 && (worst.samples == 0 || tuning.ef > worst.ef))
+            worst = std::move(tuning);
+    }
+    return worst;
+}
+
+std::shared_ptr<const FaceIndex::NameTable> ShardedFaceIndex::getIdToNameMap() const
+{
+    if (shards.size() == 1)
+        return shards.front()->getIdToNameMap();
+    std::vector<std::shared_ptr<const FaceIndex::NameTable>> current;
+    for (const auto& shard : shards)
+        current.push_back(shard->getIdToNameMap());
+    std::lock_guard<std::mutex> lock(mergeMutex);
+    if (current != namesFrom) {
+        // Apply what changed in each shard since the last merge; a shard's tables share
+        // all but their changes, so this costs about those
+        static const FaceIndex::NameTable none;
+        FaceIndex::NameTable merged = mergedNames ? *mergedNames : none;
+        for (size_t s = 0; s < current.size(); ++s) {
+            const FaceIndex::NameTable& before = s < namesFrom.size() ? *namesFrom[s] : none;
+            if (&before == current[s].get())
+                continue;
+            FaceIndex::NameTable::diff(before, *current[s],
+                                       [&](size_t id, const std::string& name) { merged.set(id, name); },
+                                       [&](size_t id) { merged.erase(id); });
+        }
+        mergedNames = std::make_shared<const FaceIndex::NameTable>(std::move(merged));
+        namesFrom = std::move(current); // also keeps the tables alive, so a new one never reuses an address
+    }
+    return mergedNames;
+}
+
+std::shared_ptr<const FaceIndex::GroupTable> ShardedFaceIndex::getGroups() const
+{
+    if (shards.size() == 1)
+        return shards.front()->getGroups();
+    std::vector<std::shared_ptr<const FaceIndex::GroupTable>> current;
+    for (const auto& shard : shards)
+        current.push_back(shard->getGroups());
+    std::lock_guard<std::mutex> lock(mergeMutex);
+    if (current != groupsFrom) {
+        // As for the names; only the groups whose templates changed in some shard are united again
+        static const FaceIndex::GroupTable none;
+        FaceIndex::GroupTable merged = mergedGroups ? *mergedGroups : none;
+        std::unordered_set<std::string> changed;
+        for (size_t s = 0; s < current.size(); ++s) {
+            const FaceIndex::GroupTable& before = s < groupsFrom.size() ? *groupsFrom[s] : none;
+            if (&before == current[s].get())
+                continue;
+            LabelMap<FaceIndex::GroupList>::diff(before.userGroups, current[s]->userGroups,
+                                                 [&](size_t id, const FaceIndex::GroupList& groups) { merged.userGroups.set(id, groups); },
+                                                 [&](size_t id) { merged.userGroups.erase(id); });
+            for (const auto& [group, members] : current[s]->members) {
+                const auto old = before.members.find(group);
+                if (old == before.members.end() || old->second != members)
+                    changed.insert(group);
+            }
+            for (const auto& [group, members] : before.members) {
+                if (!current[s]->members.count(group))
+                    changed.insert(group);
+            }
+        }
+        for (const std::string& group : changed) {
+            std::shared_ptr<const LabelSet> united;
+            for (const auto& table : current) {
+                const auto members = table->members.find(group);
+                if (members == table->members.end())
+                    continue;
+                if (!united) {
+                    united = members->second;
+                } else {
+                    auto both = std::make_shared<LabelSet>(*united); // shares the chunks until they are written
+                    both->unite(*members->second);
+                    united = std::move(both);
+                }
+            }
+            if (united)
+                merged.members[group] = std::move(united);
+            else
+                merged.members.erase(group);
+        }
+        mergedGroups = std::make_shared<const FaceIndex::GroupTable>(std::move(merged));
+        groupsFrom = std::move(current);
+    }
+    return mergedGroups;
+}
+
+std::shared_ptr<const LabelSet> ShardedFaceIndex::groupLabels(const FaceIndex::GroupList& groups) const
+{
+    if (shards.size() == 1)
+        return shards.front()->groupLabels(groups);
+    auto labels = std::make_shared<LabelSet>();
+    for (const auto& shard : shards)
+        labels->unite(*shard->groupLabels(groups));
+    return labels;
+}
+
+bool ShardedFaceIndex::deleteUser(size_t label)
+{
+    return shards[shardOf(label)]->deleteUser(label);
+}
+
+bool ShardedFaceIndex::updateUserName(size_t label, const std::string& newName)
+{
+    return shards[shardOf(label)]->updateUserName(label, newName);
+}
+
+bool ShardedFaceIndex::setUserGroups(size_t userId, FaceIndex::GroupList groups)
+{
+    return shards[shardOf(userId)]->setUserGroups(userId, std::move(groups));
+}
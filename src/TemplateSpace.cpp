@@ -0,0 +1,23 @@
+// TemplateSpace.cpp
+
+#include "TemplateSpace.hpp"
+#include <cstring>
+
+TemplateSpace::TemplateSpace(hnswlib::SpaceInterface<float>& inner)
+    : innerSize(inner.get_data_size()), dataSize(innerSize + sizeof(uint64_t)),
+      distance(inner.get_dist_func()), param(inner.get_dist_func_param())
+{
+}
+
+uint64_t TemplateSpace::get_doc_id(const void* datapoint)
+{
+    // hnswlib packs elements without alignment, hence the copies
+    uint64_t identity;
+    std::memcpy(&identity, static_cast<const char*>(datapoint) + innerSize, sizeof(identity));
+    return identity;
+}
+
+void TemplateSpace::set_doc_id(void* datapoint, uint64_t identity)
+{
+    std::memcpy(static_cast<char*>(datapoint) + innerSize, &identity, sizeof(identity));
+}
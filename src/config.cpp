@@ -1,5 +1,7 @@
 //src/config.cpp
 #include "config.h"
+#include <algorithm>
+#include <cmath>
 #include <cstdlib>
 #include <stdexcept>
 #include <QSettings>
@@ -33,6 +35,13 @@ static float getFloatSetting(QSettings& settings, const QString& key, float fall
     return fallback;
 }
 
+// Helper to read bool from QSettings or fallback
+static bool getBoolSetting(QSettings& settings, const QString& key, bool fallback) {
+    if (settings.contains(key)) {
+        return settings.value(key).toBool();
+    }
+    return fallback;
+}
 
 static float getFloatEnv(const char* name, float fallback) {
     const char* val = std::getenv(name);
@@ -62,9 +71,35 @@ void AppConfig::loadInitialConfig() {
     modelPath = getStringSetting(settings, "modelPath", modelPath);
     arcfaceModelPath = getStringSetting(settings, "arcfaceModelPath", arcfaceModelPath);
     faceDatabasePath = getStringSetting(settings, "faceDatabasePath", faceDatabasePath);
-    similarityThreshold = getFloatSetting(settings, "similarityThreshold", similarityThreshold);
+    if (settings.contains("cosineSimilarityThreshold")) {
+        similarityThreshold = getFloatSetting(settings, "cosineSimilarityThreshold", similarityThreshold);
+    } else if (settings.contains("similarityThreshold")) {
+        // Older versions saved 1 - d^2/2 of the squared L2 distance d = 2 - 2*cos;
+        // convert so a saved threshold keeps accepting the same matches
+        const float legacy = getFloatSetting(settings, "similarityThreshold", 1.0f);
+        similarityThreshold = 1.0f - std::sqrt(std::max(0.0f, 1.0f - legacy) / 2.0f);
+    }
     maxFaceIndexSize = getIntSetting(settings, "maxFaceIndexSize", maxFaceIndexSize);
+    faceIndexShards = getIntSetting(settings, "faceIndexShards", faceIndexShards);
+    faceIndexReadOnly = getBoolSetting(settings, "faceIndexReadOnly", faceIndexReadOnly);
+    faceIndexCompactionMB = getIntSetting(settings, "faceIndexCompactionMB", faceIndexCompactionMB);
+    faceIndexRebuildDeletedPercent = getIntSetting(settings, "faceIndexRebuildDeletedPercent", faceIndexRebuildDeletedPercent);
+    faceIndexVectorStorage = getStringSetting(settings, "faceIndexVectorStorage", faceIndexVectorStorage);
+    faceIndexRerankCandidates = getIntSetting(settings, "faceIndexRerankCandidates", faceIndexRerankCandidates);
+    faceIndexDiskVectors = getBoolSetting(settings, "faceIndexDiskVectors", faceIndexDiskVectors);
+    searchConfidenceMargin = getFloatSetting(settings, "searchConfidenceMargin", searchConfidenceMargin);
+    searchTimeBudgetUs = getIntSetting(settings, "searchTimeBudgetUs", searchTimeBudgetUs);
+    searchHopBudget = getIntSetting(settings, "searchHopBudget", searchHopBudget);
+    exactSearchMaxFaces = getIntSetting(settings, "exactSearchMaxFaces", exactSearchMaxFaces);
+    searchTargetRecall = getFloatSetting(settings, "searchTargetRecall", searchTargetRecall);
+    cameraAllowedGroups = getStringSetting(settings, "cameraAllowedGroups", cameraAllowedGroups);
     attendanceLogPath = getStringSetting(settings, "attendanceLogPath", attendanceLogPath);
+    hotIdentityCacheSize = getIntSetting(settings, "hotIdentityCacheSize", hotIdentityCacheSize);
+    hotIdentityMargin = getFloatSetting(settings, "hotIdentityMargin", hotIdentityMargin);
+    pipelineFrameQueueDepth = getIntSetting(settings, "pipelineFrameQueueDepth", pipelineFrameQueueDepth);
+    pipelineFrameDropPolicy = getStringSetting(settings, "pipelineFrameDropPolicy", pipelineFrameDropPolicy);
+    pipelineStageQueueDepth = getIntSetting(settings, "pipelineStageQueueDepth", pipelineStageQueueDepth);
+    pipelineStageDropPolicy = getStringSetting(settings, "pipelineStageDropPolicy", pipelineStageDropPolicy);
 
     // 2. Override with Environment Variables if set
     const char* env_val_str; // For string types
@@ -93,15 +128,87 @@ void AppConfig::loadInitialConfig() {
     env_val_str = std::getenv("MAX_FACE_INDEX_SIZE");
     if (env_val_str) maxFaceIndexSize = getIntEnv("MAX_FACE_INDEX_SIZE", maxFaceIndexSize);
 
+    env_val_str = std::getenv("FACE_INDEX_SHARDS");
+    if (env_val_str) faceIndexShards = getIntEnv("FACE_INDEX_SHARDS", faceIndexShards);
+
+    env_val_str = std::getenv("FACE_INDEX_READ_ONLY");
+    if (env_val_str && env_val_str[0]) faceIndexReadOnly = getIntEnv("FACE_INDEX_READ_ONLY", faceIndexReadOnly ? 1 : 0) != 0;
+
+    env_val_str = std::getenv("FACE_INDEX_COMPACTION_MB");
+    if (env_val_str) faceIndexCompactionMB = getIntEnv("FACE_INDEX_COMPACTION_MB", faceIndexCompactionMB);
+
+    env_val_str = std::getenv("FACE_INDEX_REBUILD_DELETED_PERCENT");
+    if (env_val_str) faceIndexRebuildDeletedPercent = getIntEnv("FACE_INDEX_REBUILD_DELETED_PERCENT", faceIndexRebuildDeletedPercent);
+
+    env_val_str = std::getenv("FACE_INDEX_VECTOR_STORAGE");
+    if (env_val_str && env_val_str[0]) faceIndexVectorStorage = env_val_str;
+
+    env_val_str = std::getenv("FACE_INDEX_RERANK_CANDIDATES");
+    if (env_val_str) faceIndexRerankCandidates = getIntEnv("FACE_INDEX_RERANK_CANDIDATES", faceIndexRerankCandidates);
+
+    env_val_str = std::getenv("FACE_INDEX_DISK_VECTORS");
+    if (env_val_str && env_val_str[0]) faceIndexDiskVectors = getIntEnv("FACE_INDEX_DISK_VECTORS", faceIndexDiskVectors ? 1 : 0) != 0;
+
+    env_val_str = std::getenv("SEARCH_CONFIDENCE_MARGIN");
+    if (env_val_str) searchConfidenceMargin = getFloatEnv("SEARCH_CONFIDENCE_MARGIN", searchConfidenceMargin);
+
+    env_val_str = std::getenv("SEARCH_TIME_BUDGET_US");
+    if (env_val_str) searchTimeBudgetUs = getIntEnv("SEARCH_TIME_BUDGET_US", searchTimeBudgetUs);
+
+    env_val_str = std::getenv("SEARCH_HOP_BUDGET");
+    if (env_val_str) searchHopBudget = getIntEnv("SEARCH_HOP_BUDGET", searchHopBudget);
+
+    env_val_str = std::getenv("EXACT_SEARCH_MAX_FACES");
+    if (env_val_str) exactSearchMaxFaces = getIntEnv("EXACT_SEARCH_MAX_FACES", exactSearchMaxFaces);
+
+    env_val_str = std::getenv("SEARCH_TARGET_RECALL");
+    if (env_val_str) searchTargetRecall = getFloatEnv("SEARCH_TARGET_RECALL", searchTargetRecall);
+
+    env_val_str = std::getenv("CAMERA_ALLOWED_GROUPS");
+    if (env_val_str) cameraAllowedGroups = env_val_str; // empty lifts the restriction
+
     env_val_str = std::getenv("ATTENDANCE_LOG_PATH");
     if (env_val_str && env_val_str[0]) attendanceLogPath = env_val_str;
 
+    env_val_str = std::getenv("HOT_IDENTITY_CACHE_SIZE");
+    if (env_val_str) hotIdentityCacheSize = getIntEnv("HOT_IDENTITY_CACHE_SIZE", hotIdentityCacheSize);
+
+    env_val_str = std::getenv("HOT_IDENTITY_MARGIN");
+    if (env_val_str) hotIdentityMargin = getFloatEnv("HOT_IDENTITY_MARGIN", hotIdentityMargin);
+
+    env_val_str = std::getenv("PIPELINE_FRAME_QUEUE_DEPTH");
+    if (env_val_str) pipelineFrameQueueDepth = getIntEnv("PIPELINE_FRAME_QUEUE_DEPTH", pipelineFrameQueueDepth);
+
+    env_val_str = std::getenv("PIPELINE_FRAME_DROP_POLICY");
+    if (env_val_str && env_val_str[0]) pipelineFrameDropPolicy = env_val_str;
+
+    env_val_str = std::getenv("PIPELINE_STAGE_QUEUE_DEPTH");
+    if (env_val_str) pipelineStageQueueDepth = getIntEnv("PIPELINE_STAGE_QUEUE_DEPTH", pipelineStageQueueDepth);
+
+    env_val_str = std::getenv("PIPELINE_STAGE_DROP_POLICY");
+    if (env_val_str && env_val_str[0]) pipelineStageDropPolicy = env_val_str;
+
     // 3. Validate (and apply hardcoded defaults if validation fails)
     // This validation logic is similar to what was at the end of the old loadFromEnv
     if (maxDetections <= 0 || maxDetections > 1000) maxDetections = 25; // Default from original struct
     if (confThresh <= 0.0f || confThresh > 1.0f) confThresh = 0.5f; // Default from original struct
     if (iouThresh < 0.0f || iouThresh > 1.0f) iouThresh = 0.3f; // Default from original struct
     // No specific validation for paths here, assuming they are correct or empty
-    if (similarityThreshold < 0.0f || similarityThreshold > 1.0f) similarityThreshold = 0.85f; // Default
+    if (similarityThreshold < 0.0f || similarityThreshold > 1.0f) similarityThreshold = 0.73f; // Default
     if (maxFaceIndexSize < 100 || maxFaceIndexSize > 1000000) maxFaceIndexSize = 10000; // Default
+    if (faceIndexShards < 1 || faceIndexShards > 64) faceIndexShards = 1; // Default
+    if (faceIndexCompactionMB < 1 || faceIndexCompactionMB > 1024) faceIndexCompactionMB = 4; // Default
+    if (faceIndexRebuildDeletedPercent < 1 || faceIndexRebuildDeletedPercent > 90) faceIndexRebuildDeletedPercent = 20; // Default
+    if (faceIndexRerankCandidates < 0 || faceIndexRerankCandidates > 1024) faceIndexRerankCandidates = 32; // Default
+    if (searchConfidenceMargin < 0.0f || searchConfidenceMargin > 1.0f) searchConfidenceMargin = 0.0f; // Default
+    if (searchTimeBudgetUs < 0 || searchTimeBudgetUs > 1000000) searchTimeBudgetUs = 0; // Default
+    if (searchHopBudget < 0 || searchHopBudget > 1000000) searchHopBudget = 0; // Default
+    if (exactSearchMaxFaces < 0 || exactSearchMaxFaces > 100000) exactSearchMaxFaces = 512; // Default
+    if (searchTargetRecall < 0.5f || searchTargetRecall > 1.0f) searchTargetRecall = 0.95f; // Default
+    // Unknown vector storage names fall back to fp32 (see MainWindow::loadFaceIndex)
+    if (hotIdentityCacheSize < 0 || hotIdentityCacheSize > 4096) hotIdentityCacheSize = 256; // Default
+    if (hotIdentityMargin < 0.0f || hotIdentityMargin > 1.0f) hotIdentityMargin = 0.05f; // Default
+    if (pipelineFrameQueueDepth < 1 || pipelineFrameQueueDepth > 64) pipelineFrameQueueDepth = 1; // Default
+    if (pipelineStageQueueDepth < 1 || pipelineStageQueueDepth > 64) pipelineStageQueueDepth = 2; // Default
+    // Unknown drop policy names fall back to the defaults in PipelineOptions
 }
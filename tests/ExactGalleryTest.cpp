@@ -0,0 +1,151 @@
+// ExactGalleryTest.cpp
+//
+// ExactGallery stays exact through erases: erasing a row moves the last row into the
+// hole (compaction), across block boundaries, while snapshots taken before keep
+// answering from the rows they saw.
+
+#include "ExactGallery.hpp"
+#include "TestSupport.hpp"
+#include <algorithm>
+#include <map>
+
+namespace {
+
+constexpr size_t dim = 24; // not a multiple of 16: exercises the row padding
+
+struct Row {
+    size_t user;
+    std::vector<float> embedding;
+};
+
+// The top-k users by brute force, each with their best template, as ExactGallery defines them
+std::vector<ExactGallery::Match> expectedTopK(const std::map<size_t, Row>& rows, const std::vector<float>& query, size_t k)
+{
+    std::map<size_t, ExactGallery::Match> best; // per user
+    for (const auto& [label, row] : rows) {
+        const float similarity = dot(query, row.embedding);
+        ExactGallery::Match& match = best[row.user];
+        if (!match.found || similarity > match.similarity)
+            match = {row.user, label, similarity, true};
+    }
+    std::vector<ExactGallery::Match> sorted;
+    for (const auto& [user, match] : best)
+        sorted.push_back(match);
+    std::sort(sorted.begin(), sorted.end(),
+              [](const ExactGallery::Match& a, const ExactGallery::Match& b) { return a.similarity > b.similarity; });
+    sorted.resize(k);
+    return sorted;
+}
+
+void checkSearch(const ExactGallery::Snapshot& snapshot, const std::map<size_t, Row>& rows,
+                 const std::vector<std::vector<float>>& queries, size_t k)
+{
+    CHECK(snapshot.rows() == rows.size());
+    std::vector<float> batch;
+    for (const std::vector<float>& query : queries)
+        batch.insert(batch.end(), query.begin(), query.end());
+    std::vector<ExactGallery::Match> out(queries.size() * k);
+    snapshot.search(batch.data(), queries.size(), k, out.data());
+    for (size_t q = 0; q < queries.size(); ++q) {
+        const std::vector<ExactGallery::Match> expected = expectedTopK(rows, queries[q], k);
+        for (size_t n = 0; n < k; ++n) {
+            const ExactGallery::Match& got = out[q * k + n];
+            CHECK(got.found == expected[n].found);
+            if (!got.found || !expected[n].found)
+                continue;
+            CHECK(got.user == expected[n].user);
+            CHECK(got.label == expected[n].label);
+            CHECK(std::fabs(got.similarity - expected[n].similarity) < 1e-4f);
+        }
+    }
+}
+
+} // namespace
+
+int main()
+{
+    std::mt19937 rng(21);
+    ExactGallery gallery(dim);
+    std::map<size_t, Row> rows;
+
+    // Three and a half blocks; users 0..59 with one to three templates each
+    const size_t count = ExactGallery::blockRows * 3 + ExactGallery::blockRows / 2;
+    for (size_t label = 0; label < count; ++label) {
+        Row row{label % 60, randomEmbedding(rng, dim)};
+        gallery.add(label, row.user, row.embedding.data());
+        rows[label] = row;
+    }
+    CHECK(gallery.size() == count);
+
+    std::vector<std::vector<float>> queries;
+    for (int q = 0; q < 9; ++q) // two groups of four and one left over
+        queries.push_back(randomEmbedding(rng, dim));
+    // Queries equal to stored rows must find them first
+    queries.push_back(rows[5].embedding);
+    queries.push_back(rows[count - 1].embedding);
+    checkSearch(gallery.snapshot(), rows, queries, 5);
+
+    const ExactGallery::Snapshot before = gallery.snapshot();
+    const std::map<size_t, Row> rowsBefore = rows;
+
+    // Erase the last row, rows from the first and middle blocks, and a whole user
+    const std::vector<size_t> erased = {count - 1, 0, 5, ExactGallery::blockRows, ExactGallery::blockRows * 2 + 3, 77};
+    for (size_t label : erased) {
+        CHECK(gallery.erase(label));
+        rows.erase(label);
+    }
+    CHECK(!gallery.erase(5)); // already gone
+    for (auto it = rows.begin(); it != rows.end();) {
+        if (it->second.user == 17) {
+            CHECK(gallery.erase(it->first));
+            it = rows.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    CHECK(gallery.size() == rows.size());
+    checkSearch(gallery.snapshot(), rows, queries, 5);
+    // Published blocks are never modified: the old snapshot still sees every row
+    checkSearch(before, rowsBefore, queries, 5);
+
+    // Erased labels can come back, and replacing a row keeps one copy
+    Row back{3, randomEmbedding(rng, dim)};
+    gallery.add(5, back.user, back.embedding.data());
+    rows[5] = back;
+    Row replaced{rows[10].user, randomEmbedding(rng, dim)};
+    gallery.add(10, replaced.user, replaced.embedding.data());
+    rows[10] = replaced;
+    CHECK(gallery.size() == rows.size());
+    queries.push_back(back.embedding);
+    checkSearch(gallery.snapshot(), rows, queries, 5);
+
+    // Erase down to fewer users than k: the rest of each row is padding
+    while (rows.size() > 2) {
+        CHECK(gallery.erase(rows.begin()->first));
+        rows.erase(rows.begin());
+    }
+    checkSearch(gallery.snapshot(), rows, queries, 5);
+
+    // assign() replaces everything in one pass
+    std::vector<size_t> labels, users;
+    std::vector<float> flat;
+    rows.clear();
+    for (size_t label = 1000; label < 1100; ++label) {
+        Row row{label, randomEmbedding(rng, dim)};
+        labels.push_back(label);
+        users.push_back(row.user);
+        flat.insert(flat.end(), row.embedding.begin(), row.embedding.end());
+        rows[label] = row;
+    }
+    gallery.assign(labels, users, flat);
+    checkSearch(gallery.snapshot(), rows, queries, 3);
+    CHECK(gallery.erase(1050));
+    rows.erase(1050);
+    checkSearch(gallery.snapshot(), rows, queries, 3);
+
+    gallery.clear();
+    CHECK(gallery.size() == 0);
+    CHECK(gallery.snapshot().rows() == 0);
+
+    return testResult("ExactGalleryTest");
+}
@@ -0,0 +1,135 @@
+// FaceIndexJournalTest.cpp
+//
+// Journal replay stops at a torn tail: a crash mid-append leaves a partial record at
+// the end of the file, which read() must leave out and open() must cut off before
+// appending, both for the journal alone and for FaceIndex::loadFromDisk().
+
+#include "FaceIndex.hpp"
+#include "FaceIndexJournal.hpp"
+#include "FaceIndexStorage.hpp"
+#include "TestSupport.hpp"
+#include <filesystem>
+#include <fstream>
+
+namespace {
+
+constexpr size_t dim = 8;
+
+FaceIndexJournal::Record addRecord(uint64_t id, const std::string& name, std::mt19937& rng)
+{
+    FaceIndexJournal::Record record;
+    record.type = FaceIndexJournal::RecordType::Add;
+    record.id = id;
+    record.name = name;
+    record.embedding = randomEmbedding(rng, dim);
+    return record;
+}
+
+void appendGarbage(const std::string& path, size_t bytes)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::app);
+    for (size_t i = 0; i < bytes; ++i)
+        out.put(static_cast<char>(0x5a));
+}
+
+void testJournalTornTail(const TempDir& dir, std::mt19937& rng)
+{
+    const std::string path = dir.file("torn.journal.3");
+    uint64_t validBytes = 0;
+    {
+        FaceIndexJournal journal;
+        journal.open(path, 3, 0);
+        for (uint64_t id = 0; id < 3; ++id)
+            journal.append(addRecord(id, "user" + std::to_string(id), rng));
+        journal.flush();
+    }
+    std::vector<FaceIndexJournal::Record> records = FaceIndexJournal::read(path, 3, dim, validBytes);
+    CHECK(records.size() == 3);
+    CHECK(validBytes == std::filesystem::file_size(path));
+
+    // Cut into the last record, as a crash between its writes would
+    const uint64_t intact = validBytes;
+    std::filesystem::resize_file(path, intact - 5);
+    records = FaceIndexJournal::read(path, 3, dim, validBytes);
+    CHECK(records.size() == 2);
+    CHECK(validBytes < intact - 5);
+    CHECK(records.size() == 2 && records[1].name == "user1" && records[1].embedding.size() == dim);
+
+    // A tail of junk after intact records is not a record either
+    const uint64_t twoRecords = validBytes;
+    appendGarbage(path, 64);
+    records = FaceIndexJournal::read(path, 3, dim, validBytes);
+    CHECK(records.size() == 2);
+    CHECK(validBytes == twoRecords);
+
+    // Reopening cuts the tail, so a new record follows the intact ones
+    {
+        FaceIndexJournal journal;
+        journal.open(path, 3, validBytes);
+        journal.append(addRecord(7, "after", rng));
+        journal.flush();
+    }
+    records = FaceIndexJournal::read(path, 3, dim, validBytes);
+    CHECK(records.size() == 3);
+    CHECK(records.size() == 3 && records[2].id == 7 && records[2].name == "after");
+    CHECK(validBytes == std::filesystem::file_size(path));
+
+    // The header names the generation; another one is refused
+    bool refused = false;
+    try {
+        FaceIndexJournal::read(path, 4, dim, validBytes);
+    } catch (const std::runtime_error&) {
+        refused = true;
+    }
+    CHECK(refused);
+}
+
+void testIndexReplaysTornJournal(const TempDir& dir, std::mt19937& rng)
+{
+    const std::string db = dir.file("face_db");
+    std::vector<std::vector<float>> faces;
+    {
+        FaceIndex index(static_cast<int>(dim), 16);
+        index.loadFromDisk(db); // nothing saved yet: changes go to journal 0
+        for (int i = 0; i < 3; ++i) {
+            faces.push_back(randomEmbedding(rng, dim));
+            index.add("user" + std::to_string(i), faces.back());
+        }
+    }
+    const std::string journalPath = FaceIndexStorage(db).journalPath(0);
+    std::filesystem::resize_file(journalPath, std::filesystem::file_size(journalPath) - 3);
+
+    {
+        FaceIndex index(static_cast<int>(dim), 16);
+        CHECK(index.loadFromDisk(db));
+        const auto names = index.getIdToNameMap();
+        CHECK(names->size() == 2);
+        CHECK(names->find(0) && *names->find(0) == "user0");
+        CHECK(names->find(1) && *names->find(1) == "user1");
+        CHECK(!names->find(2));
+        CHECK(index.search(faces[1], 0.9f).id == 1);
+        // Lands after user1's record, not after the torn bytes
+        faces.push_back(randomEmbedding(rng, dim));
+        index.add("user3", faces.back());
+    }
+    {
+        FaceIndex index(static_cast<int>(dim), 16);
+        CHECK(index.loadFromDisk(db));
+        const auto names = index.getIdToNameMap();
+        CHECK(names->size() == 3);
+        CHECK(names->find(2) && *names->find(2) == "user3"); // label 2 again: the torn add never happened
+        const SearchResult found = index.search(faces.back(), 0.9f);
+        CHECK(found.found && found.name == "user3");
+    }
+}
+
+} // namespace
+
+int main()
+{
+    TempDir dir("facepunch-journal-test");
+    std::mt19937 rng(7);
+    testJournalTornTail(dir, rng);
+    testIndexReplaysTornJournal(dir, rng);
+    return testResult("FaceIndexJournalTest");
+}
@@ -0,0 +1,116 @@
+// FaceIndexStressTest.cpp
+//
+// N search threads against one enrolling thread on one FaceIndex, through growth,
+// deletes and background rebuilds. Searches must keep finding the users that are never
+// deleted and must only ever resolve names that belong to the matched user; the test
+// prints the search and enrollment throughput it saw.
+//
+// Usage: FaceIndexStressTest [search threads] [seconds]
+
+#include "FaceIndex.hpp"
+#include "TestSupport.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+namespace {
+
+constexpr size_t dim = 64;
+
+// Each user's embedding follows from their name, so a reader can check any match
+std::vector<float> embeddingOf(size_t seed)
+{
+    std::mt19937 rng(static_cast<uint32_t>(seed));
+    return randomEmbedding(rng, dim);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const size_t readers = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4;
+    const double seconds = argc > 2 ? std::atof(argv[2]) : 2.0;
+
+    FaceIndex index(static_cast<int>(dim), 64); // small, so it grows while searched
+    index.setExactSearchLimit(0);               // always walk the graph
+    index.setRebuildThreshold(0.2);
+    index.setSearchBudget(SearchBudget());
+
+    // Stable users are never deleted; their names are "s<seed>"
+    const size_t stable = 500;
+    for (size_t i = 0; i < stable; ++i)
+        index.add("s" + std::to_string(i), embeddingOf(i));
+
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> queries{0}, hits{0}, enrolled{0}, deleted{0};
+    std::vector<std::thread> threads;
+    for (size_t r = 0; r < readers; ++r) {
+        threads.emplace_back([&, r] {
+            std::mt19937 rng(static_cast<uint32_t>(100 + r));
+            std::vector<float> batch;
+            std::vector<SearchMatch> out;
+            std::vector<size_t> seeds;
+            while (!stop) {
+                const size_t count = 1 + rng() % 12; // single queries and pooled batches
+                batch.clear();
+                seeds.clear();
+                for (size_t q = 0; q < count; ++q) {
+                    seeds.push_back(rng() % stable);
+                    const std::vector<float> query = embeddingOf(seeds.back());
+                    batch.insert(batch.end(), query.begin(), query.end());
+                }
+                out.assign(count * 2, SearchMatch());
+                index.searchBatch(batch.data(), count, 2, out.data());
+                const auto names = index.getIdToNameMap();
+                for (size_t q = 0; q < count; ++q) {
+                    const SearchMatch& best = out[q * 2];
+                    CHECK(best.found);
+                    CHECK(best.similarity <= 1.001f && best.similarity >= -1.001f);
+                    const std::string* name = names->find(best.id);
+                    // A user deleted after the search is gone from the table, never renamed to someone else
+                    if (name && (*name)[0] == 's' && std::stoul(name->substr(1)) == seeds[q])
+                        ++hits;
+                }
+                queries += count;
+            }
+        });
+    }
+
+    // The writer: churn users in and out, so slots fill up, tombstones pile up and the
+    // background thread grows and rebuilds the graph under the readers
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<size_t> churn;
+    size_t nextSeed = 1000000;
+    std::mt19937 rng(1);
+    while (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() < seconds) {
+        index.add("c" + std::to_string(nextSeed), embeddingOf(nextSeed));
+        ++nextSeed;
+        ++enrolled;
+        if (enrolled % 4 == 0) {
+            const auto names = index.getIdToNameMap();
+            names->forEach([&](size_t id, const std::string& name) {
+                if (name[0] == 'c' && rng() % 3 == 0)
+                    churn.push_back(id);
+            });
+            for (size_t id : churn) {
+                if (index.deleteUser(id))
+                    ++deleted;
+            }
+            churn.clear();
+        }
+    }
+    stop = true;
+    for (std::thread& t : threads)
+        t.join();
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::printf("%zu search threads, %.1f s: %.0f queries/s, %.0f enrollments/s, %llu deletes, self-hit rate %.3f\n",
+                readers, elapsed, queries / elapsed, enrolled / elapsed, static_cast<unsigned long long>(deleted.load()),
+                queries ? double(hits) / double(queries) : 0.0);
+    CHECK(queries > 0);
+    CHECK(enrolled > 0);
+    // ef 10 on random 64-d vectors finds a query's own template nearly always; a
+    // reader working on freed or half-written memory would not
+    CHECK(queries == 0 || double(hits) / double(queries) > 0.9);
+    return testResult("FaceIndexStressTest");
+}
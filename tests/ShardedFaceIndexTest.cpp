@@ -0,0 +1,157 @@
+// ShardedFaceIndexTest.cpp
+//
+// ShardedFaceIndex::searchBatch() merges the shards' per-query top-k lists into the
+// global top k: the same users, in the same order, as one exact scan over everyone.
+// Also checks that the merged name and group tables follow the shards' changes.
+
+#include "ShardedFaceIndex.hpp"
+#include "TestSupport.hpp"
+#include <algorithm>
+#include <map>
+
+namespace {
+
+constexpr size_t dim = 32;
+
+struct User {
+    std::string name;
+    std::vector<std::vector<float>> templates;
+};
+
+// Exact top-k user ids for query, each user scored by their best template
+std::vector<std::pair<size_t, float>> expectedTopK(const std::map<size_t, User>& users, const std::vector<float>& query, size_t k)
+{
+    std::vector<std::pair<size_t, float>> scored;
+    for (const auto& [id, user] : users) {
+        float best = -2.0f;
+        for (const std::vector<float>& t : user.templates)
+            best = std::max(best, dot(query, t));
+        scored.emplace_back(id, best);
+    }
+    std::sort(scored.begin(), scored.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+    scored.resize(std::min(k, scored.size()));
+    return scored;
+}
+
+void checkMerge(ShardedFaceIndex& index, const std::map<size_t, User>& users,
+                const std::vector<float>& queries, size_t count, size_t k)
+{
+    std::vector<SearchMatch> out(count * k);
+    index.searchBatch(queries.data(), count, k, out.data());
+    for (size_t q = 0; q < count; ++q) {
+        const std::vector<float> query(queries.begin() + q * dim, queries.begin() + (q + 1) * dim);
+        const auto expected = expectedTopK(users, query, k);
+        for (size_t n = 0; n < k; ++n) {
+            const SearchMatch& got = out[q * k + n];
+            CHECK(got.exhaustive);
+            if (n >= expected.size()) {
+                CHECK(!got.found);
+                continue;
+            }
+            CHECK(got.found);
+            CHECK(got.id == expected[n].first);
+            CHECK(std::fabs(got.similarity - expected[n].second) < 1e-4f);
+            if (n > 0)
+                CHECK(out[q * k + n - 1].similarity >= got.similarity);
+        }
+    }
+}
+
+size_t idOf(ShardedFaceIndex& index, const std::string& name)
+{
+    size_t found = SIZE_MAX;
+    index.getIdToNameMap()->forEach([&](size_t id, const std::string& userName) {
+        if (userName == name)
+            found = id;
+    });
+    return found;
+}
+
+} // namespace
+
+int main()
+{
+    std::mt19937 rng(24);
+    ShardedFaceIndex index(static_cast<int>(dim), 64, 3);
+    std::map<size_t, User> users;
+
+    for (int i = 0; i < 90; ++i) {
+        User user{"user" + std::to_string(i), {randomEmbedding(rng, dim)}};
+        index.add(user.name, user.templates.front());
+        const size_t id = idOf(index, user.name);
+        CHECK(id != SIZE_MAX);
+        users[id] = user;
+    }
+    // Users go to the emptiest shard, so each shard holds a third of them
+    for (size_t s = 0; s < index.shardCount(); ++s)
+        CHECK(index.shard(s).getIdToNameMap()->size() == 30);
+
+    // Extra templates: a user must still appear once, with their best template
+    for (auto& [id, user] : users) {
+        if (id % 4 != 0)
+            continue;
+        user.templates.push_back(randomEmbedding(rng, dim));
+        CHECK(index.addTemplate(id, user.templates.back()));
+    }
+
+    const size_t count = 12;
+    std::vector<float> queries;
+    for (size_t q = 0; q < count; ++q) {
+        const std::vector<float> query = q % 3 == 0 ? users.begin()->second.templates.front() : randomEmbedding(rng, dim);
+        queries.insert(queries.end(), query.begin(), query.end());
+    }
+    checkMerge(index, users, queries, count, 1);
+    checkMerge(index, users, queries, count, 5);
+    checkMerge(index, users, queries, 1, 10);
+
+    // More k than users: the merged rows end in padding
+    ShardedFaceIndex small(static_cast<int>(dim), 16, 4);
+    std::map<size_t, User> few;
+    for (int i = 0; i < 3; ++i) {
+        User user{"few" + std::to_string(i), {randomEmbedding(rng, dim)}};
+        small.add(user.name, user.templates.front());
+        few[idOf(small, user.name)] = user;
+    }
+    checkMerge(small, few, queries, count, 6);
+
+    // The merged tables follow deletes, renames and group changes in any shard
+    const size_t gone = users.begin()->first;
+    CHECK(index.deleteUser(gone));
+    users.erase(gone);
+    checkMerge(index, users, queries, count, 5);
+    const size_t renamed = std::next(users.begin())->first;
+    CHECK(index.updateUserName(renamed, "renamed"));
+    const auto names = index.getIdToNameMap();
+    CHECK(names->size() == users.size());
+    CHECK(!names->find(gone));
+    CHECK(names->find(renamed) && *names->find(renamed) == "renamed");
+
+    std::vector<size_t> staff;
+    for (const auto& [id, user] : users) {
+        if (id % 5 == 0) {
+            CHECK(index.setUserGroups(id, {"staff"}));
+            staff.push_back(id);
+        }
+    }
+    const auto groups = index.getGroups();
+    for (const auto& [id, user] : users) {
+        const FaceIndex::GroupList* userGroups = groups->userGroups.find(id);
+        CHECK((userGroups != nullptr) == (id % 5 == 0));
+    }
+    const std::shared_ptr<const LabelSet> allowed = index.groupLabels({"staff"});
+    for (size_t id : staff)
+        CHECK(allowed->contains(id));
+    std::map<size_t, User> staffUsers;
+    for (size_t id : staff)
+        staffUsers[id] = users[id];
+    std::vector<SearchMatch> out(count * 3);
+    index.searchBatch(queries.data(), count, 3, out.data(), allowed.get());
+    for (size_t q = 0; q < count; ++q) {
+        const std::vector<float> query(queries.begin() + q * dim, queries.begin() + (q + 1) * dim);
+        const auto expected = expectedTopK(staffUsers, query, 3);
+        for (size_t n = 0; n < expected.size(); ++n)
+            CHECK(out[q * 3 + n].found && out[q * 3 + n].id == expected[n].first);
+    }
+
+    return testResult("ShardedFaceIndexTest");
+}
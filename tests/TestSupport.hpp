@@ -0,0 +1,82 @@
+// TestSupport.hpp
+#pragma once
+
+// Minimal checks for the tests in this directory: each test is a plain executable
+// that prints its failures and exits non-zero if there were any (see CMakeLists.txt).
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+inline std::atomic<int>& testFailures()
+{
+    static std::atomic<int> failures{0};
+    return failures;
+}
+
+// Unlike assert(), also checks in release builds and carries on after a failure
+#define CHECK(condition)                                                               \
+    do {                                                                               \
+        if (!(condition)) {                                                            \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            ++testFailures();                                                          \
+        }                                                                              \
+    } while (0)
+
+inline int testResult(const char* name)
+{
+    const int failures = testFailures();
+    if (failures == 0)
+        std::printf("%s: passed\n", name);
+    else
+        std::printf("%s: %d check(s) failed\n", name, failures);
+    return failures == 0 ? 0 : 1;
+}
+
+// Random unit vector; the index assumes normalized embeddings
+inline std::vector<float> randomEmbedding(std::mt19937& rng, size_t dim)
+{
+    std::normal_distribution<float> normal;
+    std::vector<float> v(dim);
+    float norm = 0.0f;
+    for (float& x : v) {
+        x = normal(rng);
+        norm += x * x;
+    }
+    norm = std::sqrt(norm);
+    for (float& x : v)
+        x /= norm;
+    return v;
+}
+
+inline float dot(const std::vector<float>& a, const std::vector<float>& b)
+{
+    float sum = 0.0f;
+    for (size_t i = 0; i < a.size(); ++i)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+// Empty directory under the system temp directory, removed again on destruction
+class TempDir {
+public:
+    explicit TempDir(const std::string& name)
+        : path(std::filesystem::temp_directory_path() / (name + "-" + std::to_string(std::random_device()())))
+    {
+        std::filesystem::remove_all(path);
+        std::filesystem::create_directories(path);
+    }
+    ~TempDir()
+    {
+        std::error_code ec;
+        std::filesystem::remove_all(path, ec);
+    }
+    std::string file(const std::string& name) const { return (path / name).string(); }
+
+private:
+    std::filesystem::path path;
+};